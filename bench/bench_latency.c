@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "bench_latency.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int bench_latencies_reserve(struct bench_latencies *latencies, size_t count)
+{
+	if(count <= latencies->capacity)
+	{
+		return 0;
+	}
+	
+	size_t capacity = latencies->capacity ? latencies->capacity : 4096;
+	while(capacity < count) capacity *= 2;
+	
+	uint32_t *values = realloc(latencies->values, capacity * sizeof(uint32_t));
+	if(!values) return -1;
+	
+	latencies->values = values;
+	latencies->capacity = capacity;
+	return 0;
+}
+
+void bench_latencies_add(struct bench_latencies *latencies, uint64_t us)
+{
+	if(bench_latencies_reserve(latencies, latencies->count + 1) < 0)
+	{
+		return;
+	}
+	
+	latencies->values[latencies->count++] = us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+int bench_latencies_merge(struct bench_latencies *latencies, const struct bench_latencies *other)
+{
+	if(bench_latencies_reserve(latencies, latencies->count + other->count) < 0)
+	{
+		return -1;
+	}
+	
+	memcpy(latencies->values + latencies->count, other->values, other->count * sizeof(uint32_t));
+	latencies->count += other->count;
+	return 0;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+void bench_latencies_sort(struct bench_latencies *latencies)
+{
+	qsort(latencies->values, latencies->count, sizeof(uint32_t), compare_latency);
+}
+
+// nearest rank
+uint32_t bench_latencies_percentile(const struct bench_latencies *latencies, double p)
+{
+	if(latencies->count == 0)
+	{
+		return 0;
+	}
+	
+	size_t rank = (size_t)(p * latencies->count + 0.999999);
+	if(rank > 0) rank--;
+	if(rank >= latencies->count) rank = latencies->count - 1;
+	return latencies->values[rank];
+}
+
+void bench_latencies_free(struct bench_latencies *latencies)
+{
+	free(latencies->values);
+	memset(latencies, 0, sizeof(*latencies));
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BENCH_LATENCY_H
+#define BENCH_LATENCY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// every latency of a run is kept, so the percentiles are exact
+struct bench_latencies
+{
+	uint32_t *values; // in microseconds
+	size_t count;
+	size_t capacity;
+};
+
+void bench_latencies_add(struct bench_latencies *latencies, uint64_t us);
+int bench_latencies_merge(struct bench_latencies *latencies, const struct bench_latencies *other);
+// sorts the values, which percentile expects
+void bench_latencies_sort(struct bench_latencies *latencies);
+uint32_t bench_latencies_percentile(const struct bench_latencies *latencies, double p);
+void bench_latencies_free(struct bench_latencies *latencies);
+
+#endif
@@ -0,0 +1,1084 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <strings.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+#include "compat/base64.h"
+#include "os/io.h"
+#include "os/socket.h"
+#include "os/signal.h"
+#include "os/threads.h"
+#include "os/clock.h"
+#include "bench_latency.h"
+
+// Load generator for a running git-lfs-fcgi. It talks HTTP to the
+// standalone server or FastCGI to the socket a webserver would use, so
+// both front ends are measured with the same requests. The objects are
+// generated from a seed and uploaded before the run, so two runs with the
+// same options send byte for byte the same traffic.
+
+enum bench_workload
+{
+	BENCH_BATCH,
+	BENCH_DOWNLOAD,
+	BENCH_UPLOAD,
+	BENCH_NUM_WORKLOADS
+};
+
+static const char * const bench_workload_names[BENCH_NUM_WORKLOADS] =
+{
+	[BENCH_BATCH] = "batch",
+	[BENCH_DOWNLOAD] = "download",
+	[BENCH_UPLOAD] = "upload"
+};
+
+enum fcgi_record_type
+{
+	FCGI_BEGIN_REQUEST = 1,
+	FCGI_END_REQUEST = 3,
+	FCGI_PARAMS = 4,
+	FCGI_STDIN = 5,
+	FCGI_STDOUT = 6
+};
+
+#define BENCH_BUFFER_SIZE (64 * 1024)
+#define BENCH_HEADER_MAX (16 * 1024)
+#define FCGI_CHUNK_SIZE 32768
+
+struct bench_options
+{
+	const char *host;
+	int port;
+	const char *fastcgi; // socket path, or host:port
+	const char *repo_uri;
+	char authorization[512];
+	int workloads; // bit per enum bench_workload
+	int concurrency;
+	int duration; // seconds per workload
+	int warmup; // seconds of each workload that aren't measured
+	int num_objects;
+	long object_size;
+	int batch_size;
+	uint64_t seed;
+	const char *label;
+	const char *mode;
+	const char *output;
+};
+
+struct bench_object
+{
+	char oid[65];
+	const char *data;
+};
+
+struct bench_conn
+{
+	const struct bench_options *options;
+	int fd;
+	size_t start;
+	size_t end;
+	char buffer[BENCH_BUFFER_SIZE];
+};
+
+struct bench_response
+{
+	int status;
+	uint64_t body_bytes;
+	int keep_alive;
+};
+
+struct bench_thread
+{
+	const struct bench_options *options;
+	const struct bench_object *objects;
+	int index;
+	enum bench_workload workload;
+	uint64_t measure_start;
+	uint64_t deadline;
+	
+	struct bench_conn conn;
+	char *batch_body;
+	size_t batch_body_size;
+	
+	struct bench_latencies latencies;
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t bytes;
+};
+
+static int conn_open(struct bench_conn *conn)
+{
+	const struct bench_options *options = conn->options;
+	
+	conn->start = conn->end = 0;
+	
+	if(!options->fastcgi)
+	{
+		conn->fd = os_socket_connect_tcp(options->host, options->port);
+		return conn->fd;
+	}
+	
+	char host[256];
+	const char *colon = strrchr(options->fastcgi, ':');
+	if(colon && options->fastcgi[0] != '/' && colon - options->fastcgi < sizeof(host))
+	{
+		memcpy(host, options->fastcgi, colon - options->fastcgi);
+		host[colon - options->fastcgi] = 0;
+		conn->fd = os_socket_connect_tcp(host[0] ? host : "127.0.0.1", atoi(colon + 1));
+	}
+	else
+	{
+		conn->fd = os_socket_connect_unix(options->fastcgi);
+	}
+	
+	return conn->fd;
+}
+
+static void conn_close(struct bench_conn *conn)
+{
+	if(conn->fd >= 0)
+	{
+		os_close(conn->fd);
+		conn->fd = -1;
+	}
+}
+
+static int conn_write(struct bench_conn *conn, const void *data, size_t size)
+{
+	const char *p = (const char *)data;
+	while(size > 0)
+	{
+		int n = os_write(conn->fd, p, size > 1 << 20 ? 1 << 20 : size);
+		if(n <= 0) return -1;
+		p += n;
+		size -= n;
+	}
+	
+	return 0;
+}
+
+// makes at least one more byte available, returns 0 at the end of the stream
+static int conn_fill(struct bench_conn *conn)
+{
+	if(conn->start > 0)
+	{
+		memmove(conn->buffer, conn->buffer + conn->start, conn->end - conn->start);
+		conn->end -= conn->start;
+		conn->start = 0;
+	}
+	
+	if(conn->end == sizeof(conn->buffer))
+	{
+		return -1;
+	}
+	
+	int n = os_read(conn->fd, conn->buffer + conn->end, sizeof(conn->buffer) - conn->end);
+	if(n < 0) return -1;
+	conn->end += n;
+	return n;
+}
+
+static int conn_read(struct bench_conn *conn, void *data, size_t size)
+{
+	char *p = (char *)data;
+	while(size > 0)
+	{
+		if(conn->start == conn->end && conn_fill(conn) <= 0)
+		{
+			return -1;
+		}
+		
+		size_t n = conn->end - conn->start;
+		if(n > size) n = size;
+		if(p)
+		{
+			memcpy(p, conn->buffer + conn->start, n);
+			p += n;
+		}
+		conn->start += n;
+		size -= n;
+	}
+	
+	return 0;
+}
+
+// returns the line without its line break, or NULL on error
+static char *conn_read_line(struct bench_conn *conn)
+{
+	for(;;)
+	{
+		char *line = conn->buffer + conn->start;
+		char *eol = memchr(line, '\n', conn->end - conn->start);
+		if(eol)
+		{
+			conn->start = eol + 1 - conn->buffer;
+			if(eol > line && eol[-1] == '\r') eol--;
+			*eol = 0;
+			return line;
+		}
+		
+		if(conn_fill(conn) <= 0)
+		{
+			return NULL;
+		}
+	}
+}
+
+static int http_read_response(struct bench_conn *conn, struct bench_response *response)
+{
+	char *line = conn_read_line(conn);
+	if(!line || strncmp(line, "HTTP/1.", 7) != 0)
+	{
+		return -1;
+	}
+	
+	const char *status = strchr(line, ' ');
+	if(!status) return -1;
+	response->status = atoi(status + 1);
+	response->keep_alive = line[7] == '1';
+	response->body_bytes = 0;
+	
+	long long content_length = -1;
+	int chunked = 0;
+	
+	while((line = conn_read_line(conn)) && *line)
+	{
+		char *value = strchr(line, ':');
+		if(!value) continue;
+		*value++ = 0;
+		while(*value == ' ') value++;
+		
+		if(0 == strcasecmp(line, "Content-Length"))
+		{
+			content_length = atoll(value);
+		}
+		else if(0 == strcasecmp(line, "Transfer-Encoding") && 0 == strcasecmp(value, "chunked"))
+		{
+			chunked = 1;
+		}
+		else if(0 == strcasecmp(line, "Connection"))
+		{
+			response->keep_alive = 0 == strcasecmp(value, "keep-alive");
+		}
+	}
+	
+	if(!line) return -1;
+	
+	if(chunked)
+	{
+		for(;;)
+		{
+			line = conn_read_line(conn);
+			if(!line) return -1;
+			
+			long long size = strtoll(line, NULL, 16);
+			if(size == 0) break;
+			
+			if(conn_read(conn, NULL, size) < 0 || !conn_read_line(conn)) return -1;
+			response->body_bytes += size;
+		}
+		
+		// trailers
+		while((line = conn_read_line(conn)) && *line)
+		{
+		}
+		return line ? 0 : -1;
+	}
+	
+	if(content_length >= 0)
+	{
+		if(conn_read(conn, NULL, content_length) < 0) return -1;
+		response->body_bytes = content_length;
+		return 0;
+	}
+	
+	// no length, the body ends with the connection
+	response->keep_alive = 0;
+	response->body_bytes = conn->end - conn->start;
+	conn->start = conn->end = 0;
+	int n;
+	while((n = os_read(conn->fd, conn->buffer, sizeof(conn->buffer))) > 0)
+	{
+		response->body_bytes += n;
+	}
+	
+	return n < 0 ? -1 : 0;
+}
+
+static int http_request(struct bench_conn *conn,
+						const char *method,
+						const char *path,
+						const void *body,
+						size_t body_size,
+						struct bench_response *response)
+{
+	const struct bench_options *options = conn->options;
+	char header[2048];
+	int n = snprintf(header, sizeof(header),
+					 "%s %s%s HTTP/1.1\r\n"
+					 "Host: %s:%d\r\n"
+					 "Content-Type: application/vnd.git-lfs+json\r\n"
+					 "Content-Length: %zu\r\n"
+					 "%s%s%s"
+					 "\r\n",
+					 method, options->repo_uri, path,
+					 options->host, options->port,
+					 body_size,
+					 options->authorization[0] ? "Authorization: " : "",
+					 options->authorization,
+					 options->authorization[0] ? "\r\n" : "");
+	if(n < 0 || n >= sizeof(header)) return -1;
+	
+	if(conn_write(conn, header, n) < 0 ||
+	   conn_write(conn, body, body_size) < 0)
+	{
+		return -1;
+	}
+	
+	return http_read_response(conn, response);
+}
+
+static size_t fcgi_record(char *out, int type, const void *content, size_t size)
+{
+	out[0] = 1;
+	out[1] = type;
+	out[2] = 0;
+	out[3] = 1; // request id
+	out[4] = size >> 8;
+	out[5] = size & 0xff;
+	out[6] = 0;
+	out[7] = 0;
+	if(size) memcpy(out + 8, content, size);
+	return 8 + size;
+}
+
+static size_t fcgi_param(char *out, const char *name, const char *value)
+{
+	size_t name_len = strlen(name);
+	size_t value_len = strlen(value);
+	char *p = out;
+	
+	if(name_len < 128)
+	{
+		*p++ = name_len;
+	}
+	else
+	{
+		*p++ = 0x80 | (name_len >> 24);
+		*p++ = name_len >> 16;
+		*p++ = name_len >> 8;
+		*p++ = name_len;
+	}
+	
+	if(value_len < 128)
+	{
+		*p++ = value_len;
+	}
+	else
+	{
+		*p++ = 0x80 | (value_len >> 24);
+		*p++ = value_len >> 16;
+		*p++ = value_len >> 8;
+		*p++ = value_len;
+	}
+	
+	memcpy(p, name, name_len);
+	memcpy(p + name_len, value, value_len);
+	return p + name_len + value_len - out;
+}
+
+// the stdout of the request is a CGI response, a Status header then the body
+static int fcgi_read_response(struct bench_conn *conn, struct bench_response *response)
+{
+	char header[BENCH_HEADER_MAX];
+	size_t header_size = 0;
+	int in_body = 0;
+	
+	response->status = 200;
+	response->body_bytes = 0;
+	response->keep_alive = 0;
+	
+	for(;;)
+	{
+		unsigned char record[8];
+		if(conn_read(conn, record, sizeof(record)) < 0)
+		{
+			return -1;
+		}
+		
+		size_t content_size = (record[4] << 8) | record[5];
+		size_t padding = record[6];
+		
+		if(record[1] == FCGI_END_REQUEST)
+		{
+			return conn_read(conn, NULL, content_size + padding) < 0 || !in_body ? -1 : 0;
+		}
+		
+		if(record[1] != FCGI_STDOUT || in_body)
+		{
+			if(record[1] == FCGI_STDOUT) response->body_bytes += content_size;
+			if(conn_read(conn, NULL, content_size + padding) < 0) return -1;
+			continue;
+		}
+		
+		if(header_size + content_size > sizeof(header) - 1 ||
+		   conn_read(conn, header + header_size, content_size) < 0 ||
+		   conn_read(conn, NULL, padding) < 0)
+		{
+			return -1;
+		}
+		header_size += content_size;
+		header[header_size] = 0;
+		
+		char *end = strstr(header, "\r\n\r\n");
+		if(!end) continue;
+		
+		in_body = 1;
+		response->body_bytes = header + header_size - (end + 4);
+		*end = 0;
+		
+		for(char *line = header; line; )
+		{
+			char *next = strstr(line, "\r\n");
+			if(next)
+			{
+				*next = 0;
+				next += 2;
+			}
+			
+			if(0 == strncasecmp(line, "Status:", 7))
+			{
+				response->status = atoi(line + 7);
+			}
+			
+			line = next;
+		}
+	}
+}
+
+static int fcgi_request(struct bench_conn *conn,
+						const char *method,
+						const char *path,
+						const void *body,
+						size_t body_size,
+						struct bench_response *response)
+{
+	const struct bench_options *options = conn->options;
+	char uri[1024];
+	char content_length[32];
+	if(snprintf(uri, sizeof(uri), "%s%s", options->repo_uri, path) >= sizeof(uri))
+	{
+		return -1;
+	}
+	snprintf(content_length, sizeof(content_length), "%zu", body_size);
+	
+	// role responder. the connection isn't kept, like webservers do by
+	// default, which the server's FastCGI library doesn't handle anyway
+	static const unsigned char begin_request[8] = { 0, 1, 0 };
+	
+	char params[4096];
+	size_t params_size = 0;
+	params_size += fcgi_param(params + params_size, "REQUEST_METHOD", method);
+	params_size += fcgi_param(params + params_size, "SCRIPT_NAME", uri);
+	params_size += fcgi_param(params + params_size, "REQUEST_URI", uri);
+	params_size += fcgi_param(params + params_size, "QUERY_STRING", "");
+	params_size += fcgi_param(params + params_size, "CONTENT_LENGTH", content_length);
+	params_size += fcgi_param(params + params_size, "CONTENT_TYPE", "application/vnd.git-lfs+json");
+	params_size += fcgi_param(params + params_size, "SERVER_PROTOCOL", "HTTP/1.1");
+	if(options->authorization[0])
+	{
+		params_size += fcgi_param(params + params_size, "HTTP_AUTHORIZATION", options->authorization);
+	}
+	
+	char out[8 + FCGI_CHUNK_SIZE];
+	size_t n = fcgi_record(out, FCGI_BEGIN_REQUEST, begin_request, sizeof(begin_request));
+	n += fcgi_record(out + n, FCGI_PARAMS, params, params_size);
+	n += fcgi_record(out + n, FCGI_PARAMS, NULL, 0);
+	if(conn_write(conn, out, n) < 0)
+	{
+		return -1;
+	}
+	
+	const char *p = (const char *)body;
+	while(body_size > 0)
+	{
+		size_t chunk = body_size > FCGI_CHUNK_SIZE ? FCGI_CHUNK_SIZE : body_size;
+		n = fcgi_record(out, FCGI_STDIN, p, chunk);
+		if(conn_write(conn, out, n) < 0) return -1;
+		p += chunk;
+		body_size -= chunk;
+	}
+	
+	n = fcgi_record(out, FCGI_STDIN, NULL, 0);
+	if(conn_write(conn, out, n) < 0)
+	{
+		return -1;
+	}
+	
+	return fcgi_read_response(conn, response);
+}
+
+// sends one request, reconnecting first if the last one closed the connection
+static int bench_request(struct bench_conn *conn,
+						 const char *method,
+						 const char *path,
+						 const void *body,
+						 size_t body_size,
+						 struct bench_response *response)
+{
+	// a kept alive connection may have been closed by the server in the
+	// meantime, that request is tried again on a new connection
+	int ret = -1;
+	for(int attempt = 0; ret < 0 && attempt < 2; attempt++)
+	{
+		int reused = conn->fd >= 0;
+		if(!reused && conn_open(conn) < 0)
+		{
+			return -1;
+		}
+		
+		if(conn->options->fastcgi)
+		{
+			ret = fcgi_request(conn, method, path, body, body_size, response);
+		}
+		else
+		{
+			ret = http_request(conn, method, path, body, body_size, response);
+		}
+		
+		if(ret < 0)
+		{
+			conn_close(conn);
+			if(!reused) break;
+		}
+	}
+	
+	if(ret < 0 || !response->keep_alive)
+	{
+		conn_close(conn);
+	}
+	
+	return ret;
+}
+
+// xorshift, so the objects only depend on the seed
+static void generate_object(char *data, size_t size, uint64_t seed)
+{
+	uint64_t x = seed * 0x9e3779b97f4a7c15ULL + 1;
+	for(size_t i = 0; i < size; i++)
+	{
+		if((i & 7) == 0)
+		{
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+		}
+		data[i] = x >> ((i & 7) * 8);
+	}
+}
+
+static struct bench_object *create_objects(const struct bench_options *options, char **data)
+{
+	struct bench_object *objects = calloc(options->num_objects, sizeof(struct bench_object));
+	*data = malloc(options->object_size * options->num_objects + 1);
+	if(!objects || !*data)
+	{
+		free(objects);
+		free(*data);
+		return NULL;
+	}
+	
+	static const char hex[] = "0123456789abcdef";
+	for(int i = 0; i < options->num_objects; i++)
+	{
+		char *object_data = *data + options->object_size * i;
+		generate_object(object_data, options->object_size, options->seed * 1000003 + i);
+		
+		unsigned char sha256[SHA256_DIGEST_LENGTH];
+		SHA256((const unsigned char *)object_data, options->object_size, sha256);
+		for(int j = 0; j < SHA256_DIGEST_LENGTH; j++)
+		{
+			objects[i].oid[j * 2] = hex[sha256[j] >> 4];
+			objects[i].oid[j * 2 + 1] = hex[sha256[j] & 15];
+		}
+		objects[i].data = object_data;
+	}
+	
+	return objects;
+}
+
+static int upload_objects(const struct bench_options *options, const struct bench_object *objects)
+{
+	struct bench_conn *conn = malloc(sizeof(struct bench_conn));
+	if(!conn) return -1;
+	conn->options = options;
+	conn->fd = -1;
+	
+	// the server may still be starting up
+	for(int i = 0; i < 100 && conn_open(conn) < 0; i++)
+	{
+		usleep(100000);
+	}
+	
+	if(conn->fd < 0)
+	{
+		fprintf(stderr, "Failed to connect to the server.\n");
+		free(conn);
+		return -1;
+	}
+	
+	int ret = 0;
+	for(int i = 0; i < options->num_objects; i++)
+	{
+		char path[128];
+		snprintf(path, sizeof(path), "/upload/%s", objects[i].oid);
+		
+		struct bench_response response = { 0 };
+		if(bench_request(conn, "PUT", path, objects[i].data, options->object_size, &response) < 0 ||
+		   response.status != 200)
+		{
+			fprintf(stderr, "Uploading object %s failed (status %d).\n", objects[i].oid, response.status);
+			ret = -1;
+			break;
+		}
+	}
+	
+	conn_close(conn);
+	free(conn);
+	return ret;
+}
+
+static int build_batch_body(struct bench_thread *thread, int first)
+{
+	const struct bench_options *options = thread->options;
+	size_t size = 64 + options->batch_size * 128;
+	if(size > thread->batch_body_size)
+	{
+		char *body = realloc(thread->batch_body, size);
+		if(!body) return -1;
+		thread->batch_body = body;
+		thread->batch_body_size = size;
+	}
+	
+	char *p = thread->batch_body;
+	p += sprintf(p, "{\"operation\":\"download\",\"objects\":[");
+	for(int i = 0; i < options->batch_size; i++)
+	{
+		const struct bench_object *object = &thread->objects[(first + i) % options->num_objects];
+		p += sprintf(p, "%s{\"oid\":\"%s\",\"size\":%ld}", i ? "," : "", object->oid, options->object_size);
+	}
+	p += sprintf(p, "]}");
+	
+	return p - thread->batch_body;
+}
+
+static void *bench_thread_main(void *data)
+{
+	struct bench_thread *thread = (struct bench_thread *)data;
+	const struct bench_options *options = thread->options;
+	
+	// each thread walks the objects from a different place
+	unsigned int next = thread->index * options->num_objects / options->concurrency;
+	
+	for(;;)
+	{
+		uint64_t start = os_clock_us();
+		if(start >= thread->deadline) break;
+		
+		const struct bench_object *object = &thread->objects[next % options->num_objects];
+		char path[128];
+		const char *method;
+		const void *body = NULL;
+		size_t body_size = 0;
+		
+		switch(thread->workload)
+		{
+			case BENCH_BATCH:
+				method = "POST";
+				strcpy(path, "/objects/batch");
+				int n = build_batch_body(thread, next);
+				if(n < 0) return NULL;
+				body = thread->batch_body;
+				body_size = n;
+				next += options->batch_size;
+				break;
+			case BENCH_DOWNLOAD:
+				method = "GET";
+				snprintf(path, sizeof(path), "/download/%s", object->oid);
+				next++;
+				break;
+			default:
+				method = "PUT";
+				snprintf(path, sizeof(path), "/upload/%s", object->oid);
+				body = object->data;
+				body_size = options->object_size;
+				next++;
+				break;
+		}
+		
+		struct bench_response response;
+		int ret = bench_request(&thread->conn, method, path, body, body_size, &response);
+		uint64_t end = os_clock_us();
+		
+		if(start < thread->measure_start)
+		{
+			continue;
+		}
+		
+		thread->requests++;
+		if(ret < 0 || response.status != 200)
+		{
+			thread->errors++;
+			continue;
+		}
+		
+		thread->bytes += thread->workload == BENCH_UPLOAD ? body_size : response.body_bytes;
+		bench_latencies_add(&thread->latencies, end - start);
+	}
+	
+	conn_close(&thread->conn);
+	return NULL;
+}
+
+static int run_workload(const struct bench_options *options, const struct bench_object *objects, enum bench_workload workload, FILE *output)
+{
+	struct bench_thread *threads = calloc(options->concurrency, sizeof(struct bench_thread));
+	os_thread_t *handles = calloc(options->concurrency, sizeof(os_thread_t));
+	if(!threads || !handles)
+	{
+		free(threads);
+		free(handles);
+		return -1;
+	}
+	
+	uint64_t now = os_clock_us();
+	uint64_t measure_start = now + options->warmup * 1000000ULL;
+	uint64_t deadline = measure_start + options->duration * 1000000ULL;
+	
+	int started = 0;
+	for(int i = 0; i < options->concurrency; i++)
+	{
+		struct bench_thread *thread = &threads[i];
+		thread->options = options;
+		thread->objects = objects;
+		thread->index = i;
+		thread->workload = workload;
+		thread->measure_start = measure_start;
+		thread->deadline = deadline;
+		thread->conn.options = options;
+		thread->conn.fd = -1;
+		
+		handles[i] = os_thread_create(bench_thread_main, thread);
+		if(!handles[i]) break;
+		started++;
+	}
+	
+	uint64_t requests = 0, errors = 0, bytes = 0;
+	struct bench_latencies latencies = { 0 };
+	for(int i = 0; i < started; i++)
+	{
+		os_thread_join(handles[i], NULL);
+		requests += threads[i].requests;
+		errors += threads[i].errors;
+		bytes += threads[i].bytes;
+		bench_latencies_merge(&latencies, &threads[i].latencies);
+	}
+	
+	for(int i = 0; i < options->concurrency; i++)
+	{
+		bench_latencies_free(&threads[i].latencies);
+		free(threads[i].batch_body);
+	}
+	
+	bench_latencies_sort(&latencies);
+	
+	double seconds = options->duration;
+	const char *mode = options->mode ? options->mode : options->fastcgi ? "fastcgi" : "http";
+	uint32_t p50 = bench_latencies_percentile(&latencies, 0.50);
+	uint32_t p99 = bench_latencies_percentile(&latencies, 0.99);
+	uint32_t p999 = bench_latencies_percentile(&latencies, 0.999);
+	
+	printf("%-9s %-8s %5d %10ld %6d %9llu %7llu %10.1f %9.2f %9u %9u %9u\n",
+		   bench_workload_names[workload],
+		   mode,
+		   options->concurrency,
+		   options->object_size,
+		   workload == BENCH_BATCH ? options->batch_size : 1,
+		   (unsigned long long)requests,
+		   (unsigned long long)errors,
+		   (requests - errors) / seconds,
+		   bytes / seconds / (1024 * 1024),
+		   p50, p99, p999);
+	fflush(stdout);
+	
+	if(output)
+	{
+		fprintf(output, "%s\t%s\t%s\t%d\t%ld\t%d\t%d\t%llu\t%llu\t%.1f\t%.2f\t%u\t%u\t%u\n",
+				options->label ? options->label : "-",
+				bench_workload_names[workload],
+				mode,
+				options->concurrency,
+				options->object_size,
+				workload == BENCH_BATCH ? options->batch_size : 1,
+				options->duration,
+				(unsigned long long)requests,
+				(unsigned long long)errors,
+				(requests - errors) / seconds,
+				bytes / seconds / (1024 * 1024),
+				p50, p99, p999);
+	}
+	
+	bench_latencies_free(&latencies);
+	free(handles);
+	free(threads);
+	
+	return started == options->concurrency ? 0 : -1;
+}
+
+static long parse_size(const char *str)
+{
+	char *end;
+	long size = strtol(str, &end, 10);
+	switch(*end)
+	{
+		case 'k': case 'K': size *= 1024; end++; break;
+		case 'm': case 'M': size *= 1024 * 1024; end++; break;
+	}
+	
+	return *end || size < 0 ? -1 : size;
+}
+
+static int parse_workloads(const char *str)
+{
+	int workloads = 0;
+	char list[256];
+	if(strlen(str) >= sizeof(list)) return -1;
+	strcpy(list, str);
+	
+	for(char *name = strtok(list, ","); name; name = strtok(NULL, ","))
+	{
+		int i;
+		for(i = 0; i < BENCH_NUM_WORKLOADS; i++)
+		{
+			if(0 == strcmp(name, bench_workload_names[i])) break;
+		}
+		
+		if(i == BENCH_NUM_WORKLOADS) return -1;
+		workloads |= 1 << i;
+	}
+	
+	return workloads;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+			"usage: git-lfs-bench [options]\n"
+			"  -H, --http HOST:PORT      standalone server to load (default 127.0.0.1:8080)\n"
+			"  -F, --fastcgi SOCKET      FastCGI socket path or HOST:PORT to load instead\n"
+			"  -r, --repo URI            uri of the repo (default /repo)\n"
+			"  -u, --user USER:PASSWORD  basic authentication\n"
+			"  -w, --workloads LIST      any of batch,download,upload (default all)\n"
+			"  -c, --concurrency N       connections sending requests (default 8)\n"
+			"  -d, --duration SECONDS    measured time of each workload (default 10)\n"
+			"  -W, --warmup SECONDS      time before measuring (default 1)\n"
+			"  -n, --objects N           number of synthetic objects (default 64)\n"
+			"  -s, --object-size SIZE    size of each object, k and m suffixes (default 64k)\n"
+			"  -b, --batch-size N        objects per batch request (default 100)\n"
+			"  -S, --seed N              seed the objects are generated from (default 1)\n"
+			"  -l, --label LABEL         first column of the output file, eg. a commit\n"
+			"  -m, --mode NAME           mode column of the results (default http or fastcgi)\n"
+			"  -o, --output FILE         append tab separated results to FILE\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_options options;
+	memset(&options, 0, sizeof(options));
+	options.host = "127.0.0.1";
+	options.port = 8080;
+	options.repo_uri = "/repo";
+	options.workloads = (1 << BENCH_NUM_WORKLOADS) - 1;
+	options.concurrency = 8;
+	options.duration = 10;
+	options.warmup = 1;
+	options.num_objects = 64;
+	options.object_size = 64 * 1024;
+	options.batch_size = 100;
+	options.seed = 1;
+	
+	// a closed connection shows up as a failed write instead
+	os_signal(SIGPIPE, SIG_IGN);
+	
+	static struct option long_options[] =
+	{
+		{ "help", no_argument, 0, 'h' },
+		{ "http", required_argument, 0, 'H' },
+		{ "fastcgi", required_argument, 0, 'F' },
+		{ "repo", required_argument, 0, 'r' },
+		{ "user", required_argument, 0, 'u' },
+		{ "workloads", required_argument, 0, 'w' },
+		{ "concurrency", required_argument, 0, 'c' },
+		{ "duration", required_argument, 0, 'd' },
+		{ "warmup", required_argument, 0, 'W' },
+		{ "objects", required_argument, 0, 'n' },
+		{ "object-size", required_argument, 0, 's' },
+		{ "batch-size", required_argument, 0, 'b' },
+		{ "seed", required_argument, 0, 'S' },
+		{ "label", required_argument, 0, 'l' },
+		{ "mode", required_argument, 0, 'm' },
+		{ "output", required_argument, 0, 'o' },
+		{ 0, 0, 0, 0 }
+	};
+	
+	char host[256];
+	int opt_index;
+	int c;
+	while((c = getopt_long(argc, argv, "hH:F:r:u:w:c:d:W:n:s:b:S:l:m:o:", long_options, &opt_index)) >= 0)
+	{
+		switch(c) {
+			case 'H': {
+				const char *colon = strrchr(optarg, ':');
+				if(!colon || colon - optarg >= sizeof(host))
+				{
+					fprintf(stderr, "Invalid address '%s'. Expected HOST:PORT.\n", optarg);
+					return 1;
+				}
+				memcpy(host, optarg, colon - optarg);
+				host[colon - optarg] = 0;
+				options.host = host;
+				options.port = atoi(colon + 1);
+				break;
+			}
+			case 'F':
+				options.fastcgi = optarg;
+				break;
+			case 'r':
+				options.repo_uri = optarg;
+				break;
+			case 'u': {
+				strcpy(options.authorization, "Basic ");
+				if(b64_ntop((const unsigned char *)optarg, strlen(optarg), options.authorization + 6, sizeof(options.authorization) - 6) < 0)
+				{
+					fprintf(stderr, "User and password are too long.\n");
+					return 1;
+				}
+				break;
+			}
+			case 'w':
+				options.workloads = parse_workloads(optarg);
+				if(options.workloads <= 0)
+				{
+					fprintf(stderr, "Invalid workloads '%s'.\n", optarg);
+					return 1;
+				}
+				break;
+			case 'c':
+				options.concurrency = atoi(optarg);
+				break;
+			case 'd':
+				options.duration = atoi(optarg);
+				break;
+			case 'W':
+				options.warmup = atoi(optarg);
+				break;
+			case 'n':
+				options.num_objects = atoi(optarg);
+				break;
+			case 's':
+				options.object_size = parse_size(optarg);
+				break;
+			case 'b':
+				options.batch_size = atoi(optarg);
+				break;
+			case 'S':
+				options.seed = strtoull(optarg, NULL, 10);
+				break;
+			case 'l':
+				options.label = optarg;
+				break;
+			case 'm':
+				options.mode = optarg;
+				break;
+			case 'o':
+				options.output = optarg;
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+	
+	if(options.concurrency < 1 || options.duration < 1 || options.warmup < 0 ||
+	   options.num_objects < 1 || options.object_size < 0 || options.batch_size < 1)
+	{
+		usage();
+		return 1;
+	}
+	
+	FILE *output = NULL;
+	if(options.output)
+	{
+		output = fopen(options.output, "a");
+		if(!output)
+		{
+			fprintf(stderr, "Failed to open '%s'.\n", options.output);
+			return 1;
+		}
+	}
+	
+	char *data;
+	struct bench_object *objects = create_objects(&options, &data);
+	if(!objects)
+	{
+		fprintf(stderr, "Out of memory for %d objects of %ld bytes.\n", options.num_objects, options.object_size);
+		goto error0;
+	}
+	
+	if(upload_objects(&options, objects) < 0)
+	{
+		goto error1;
+	}
+	
+	printf("%-9s %-8s %5s %10s %6s %9s %7s %10s %9s %9s %9s %9s\n",
+		   "workload", "mode", "conc", "size", "batch", "requests", "errors", "req/s", "MB/s", "p50_us", "p99_us", "p999_us");
+	
+	for(int i = 0; i < BENCH_NUM_WORKLOADS; i++)
+	{
+		if((options.workloads & (1 << i)) && run_workload(&options, objects, i, output) < 0)
+		{
+			fprintf(stderr, "Failed to start the %s workload.\n", bench_workload_names[i]);
+			goto error1;
+		}
+	}
+	
+	free(data);
+	free(objects);
+	if(output) fclose(output);
+	return 0;
+	
+error1:
+	free(data);
+	free(objects);
+error0:
+	if(output) fclose(output);
+	return 1;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "os/clock.h"
+#include "oid_utils.h"
+
+// Checks every hex implementation the cpu supports against the scalar one,
+// then times them. The checks put every byte value at every position, so a
+// lane that is off in a SIMD version can't go unnoticed.
+
+enum oid_bench_config
+{
+	OID_BENCH_ITERATIONS = 10240000, // a multiple of OID_BENCH_SET
+	OID_BENCH_ROUND_TRIPS = 1000000
+};
+
+static uint64_t oid_bench_state = 0x2545f4914f6cdd1dULL;
+
+static uint64_t oid_bench_random(void)
+{
+	oid_bench_state ^= oid_bench_state << 13;
+	oid_bench_state ^= oid_bench_state >> 7;
+	oid_bench_state ^= oid_bench_state << 17;
+	return oid_bench_state;
+}
+
+static void random_oid(unsigned char oid[32])
+{
+	for(int i = 0; i < 32; i += 8) {
+		uint64_t r = oid_bench_random();
+		memcpy(oid + i, &r, 8);
+	}
+}
+
+static int is_hex_digit(int c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+}
+
+static int check_impl(const struct oid_hex_impl *impl, const struct oid_hex_impl *scalar)
+{
+	unsigned char oid[32], expected_oid[32], decoded[32];
+	char hex[64], expected_hex[64];
+	
+	for(int pos = 0; pos < 32; pos++) {
+		for(int value = 0; value < 256; value++) {
+			random_oid(oid);
+			oid[pos] = value;
+			impl->encode(oid, hex);
+			scalar->encode(oid, expected_hex);
+			if(memcmp(hex, expected_hex, sizeof(hex)) != 0) {
+				fprintf(stderr, "%s: encoding byte %d as 0x%02x is wrong.\n", impl->name, pos, value);
+				return -1;
+			}
+		}
+	}
+	
+	for(int pos = 0; pos < 64; pos++) {
+		for(int c = 0; c < 256; c++) {
+			random_oid(oid);
+			scalar->encode(oid, hex);
+			hex[pos] = c;
+			
+			int ret = impl->decode(hex, decoded);
+			int expected_ret = scalar->decode(hex, expected_oid);
+			if(ret != expected_ret || ret != (is_hex_digit(c) ? 0 : -1)) {
+				fprintf(stderr, "%s: validating 0x%02x at %d is wrong.\n", impl->name, c, pos);
+				return -1;
+			}
+			
+			if(ret == 0 && memcmp(decoded, expected_oid, sizeof(decoded)) != 0) {
+				fprintf(stderr, "%s: decoding '%c' at %d is wrong.\n", impl->name, c, pos);
+				return -1;
+			}
+		}
+	}
+	
+	for(int i = 0; i < OID_BENCH_ROUND_TRIPS; i++) {
+		random_oid(oid);
+		impl->encode(oid, hex);
+		if(impl->decode(hex, decoded) < 0 || memcmp(oid, decoded, sizeof(oid)) != 0) {
+			fprintf(stderr, "%s: round trip failed.\n", impl->name);
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+// a working set that stays in the L1 cache, so the conversion is timed
+// rather than memory
+enum oid_bench_set
+{
+	OID_BENCH_SET = 256
+};
+
+static void bench_impl(const struct oid_hex_impl *impl)
+{
+	static unsigned char oids[OID_BENCH_SET][32];
+	static char hexes[OID_BENCH_SET][64];
+	for(int i = 0; i < OID_BENCH_SET; i++) {
+		random_oid(oids[i]);
+	}
+	
+	uint64_t start = os_clock_us();
+	for(int i = 0; i < OID_BENCH_ITERATIONS; i += OID_BENCH_SET) {
+		for(int j = 0; j < OID_BENCH_SET; j++) {
+			impl->encode(oids[j], hexes[j]);
+		}
+	}
+	uint64_t encode_us = os_clock_us() - start;
+	
+	int failed = 0;
+	start = os_clock_us();
+	for(int i = 0; i < OID_BENCH_ITERATIONS; i += OID_BENCH_SET) {
+		for(int j = 0; j < OID_BENCH_SET; j++) {
+			failed |= impl->decode(hexes[j], oids[j]);
+		}
+	}
+	uint64_t decode_us = os_clock_us() - start;
+	
+	printf("%-8s %10.2f %10.2f%s\n",
+		   impl->name,
+		   encode_us * 1000.0 / OID_BENCH_ITERATIONS,
+		   decode_us * 1000.0 / OID_BENCH_ITERATIONS,
+		   failed ? " (decode failed)" : "");
+}
+
+int main(int argc, char *argv[])
+{
+	int count;
+	const struct oid_hex_impl *impls = oid_hex_get_impls(&count);
+	const struct oid_hex_impl *scalar = &impls[count - 1];
+	
+	for(int i = 0; i < count; i++) {
+		if(!impls[i].supported()) {
+			printf("%s: not supported by this cpu\n", impls[i].name);
+			continue;
+		}
+		
+		if(check_impl(&impls[i], scalar) < 0) {
+			return 1;
+		}
+	}
+	
+	printf("%-8s %10s %10s\n", "impl", "encode_ns", "decode_ns");
+	for(int i = 0; i < count; i++) {
+		if(impls[i].supported()) {
+			bench_impl(&impls[i]);
+		}
+	}
+	
+	return 0;
+}
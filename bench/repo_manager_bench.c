@@ -0,0 +1,587 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#define _XOPEN_SOURCE 700 // nftw
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <ftw.h>
+#include <openssl/sha.h>
+#include "os/io.h"
+#include "os/filesystem.h"
+#include "os/socket.h"
+#include "os/process.h"
+#include "os/threads.h"
+#include "os/clock.h"
+#include "configuration.h"
+#include "repo_manager.h"
+#include "bench_latency.h"
+
+// Measures round trips to the repo manager processes without any http in
+// front. The managers are forked over socketpairs like main does, but are
+// not chrooted or sandboxed, and serve a scratch repo. Each command is
+// sent from 1, 2, 4, ... client threads, each with a session of its own.
+// Authentication is left out since bcrypt would be all it measures, and
+// so are the multipart commands, which mostly move part data around.
+
+enum ipc_bench_op
+{
+	IPC_BENCH_GET_ACCESS_TOKEN,
+	IPC_BENCH_CHECK_OID_EXIST,
+	IPC_BENCH_CHECK_OIDS_EXIST,
+	IPC_BENCH_GET_OID,
+	IPC_BENCH_PUT_OID,
+	IPC_BENCH_COMMIT,
+	IPC_BENCH_CREATE_LOCK,
+	IPC_BENCH_LIST_LOCKS,
+	IPC_BENCH_DELETE_LOCK,
+	IPC_BENCH_GET_PARTS_STATUS,
+	IPC_BENCH_NUM_OPS
+};
+
+// some ops can only be measured as part of a sequence, eg. a commit needs
+// the ticket of a put. those are run by the first op of the group and
+// timed individually.
+static const struct
+{
+	const char *name;
+	enum ipc_bench_op group;
+} ipc_bench_ops[IPC_BENCH_NUM_OPS] =
+{
+	[IPC_BENCH_GET_ACCESS_TOKEN] = { "get_access_token", IPC_BENCH_GET_ACCESS_TOKEN },
+	[IPC_BENCH_CHECK_OID_EXIST] = { "check_oid_exist", IPC_BENCH_CHECK_OID_EXIST },
+	[IPC_BENCH_CHECK_OIDS_EXIST] = { "check_oids_exist", IPC_BENCH_CHECK_OIDS_EXIST },
+	[IPC_BENCH_GET_OID] = { "get_oid", IPC_BENCH_GET_OID },
+	[IPC_BENCH_PUT_OID] = { "put_oid", IPC_BENCH_PUT_OID },
+	[IPC_BENCH_COMMIT] = { "commit", IPC_BENCH_PUT_OID },
+	[IPC_BENCH_CREATE_LOCK] = { "create_lock", IPC_BENCH_CREATE_LOCK },
+	[IPC_BENCH_LIST_LOCKS] = { "list_locks", IPC_BENCH_CREATE_LOCK },
+	[IPC_BENCH_DELETE_LOCK] = { "delete_lock", IPC_BENCH_CREATE_LOCK },
+	[IPC_BENCH_GET_PARTS_STATUS] = { "get_parts_status", IPC_BENCH_GET_PARTS_STATUS }
+};
+
+struct ipc_bench_options
+{
+	int max_threads;
+	int num_managers;
+	int duration; // seconds per op and thread count
+	int batch_size; // oids per check_oids_exist
+	int object_size;
+};
+
+struct ipc_bench_thread
+{
+	const struct ipc_bench_options *options;
+	struct repo_manager *client;
+	const struct git_lfs_repo *repo;
+	const uint8_t (*oids)[32]; // objects in the repo
+	const char *object_data;
+	int index;
+	enum ipc_bench_op group;
+	uint64_t deadline;
+	
+	struct bench_latencies latencies[IPC_BENCH_NUM_OPS];
+	uint64_t errors;
+};
+
+static int ipc_bench_write_config(const char *dir, char *path, size_t path_size)
+{
+	if(snprintf(path, path_size, "%s/bench.conf", dir) >= path_size)
+	{
+		return -1;
+	}
+	
+	FILE *fp = fopen(path, "w");
+	if(!fp) return -1;
+	
+	fprintf(fp,
+			"repo \"bench\"\n"
+			"{\n"
+			"\turi \"/bench\"\n"
+			"\troot \"%s/repo\"\n"
+			"\tverify_uploads yes\n"
+			"}\n",
+			dir);
+	
+	return fclose(fp);
+}
+
+static int ipc_bench_remove_file(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static void ipc_bench_error(struct ipc_bench_thread *thread, const char *op, const char *error_msg)
+{
+	// only the first one, a broken op fails on every iteration
+	if(thread->errors++ == 0)
+	{
+		fprintf(stderr, "%s failed: %s\n", op, error_msg);
+	}
+}
+
+static void ipc_bench_timed(struct ipc_bench_thread *thread, enum ipc_bench_op op, uint64_t start)
+{
+	bench_latencies_add(&thread->latencies[op], os_clock_us() - start);
+}
+
+static void ipc_bench_put_commit(struct ipc_bench_thread *thread, struct repo_manager *session, uint8_t *oid, const uint8_t *sha256)
+{
+	char error_msg[128];
+	int fd;
+	uint32_t ticket;
+	
+	uint64_t start = os_clock_us();
+	if(git_lfs_repo_get_write_oid_fd(session, NULL, thread->repo, oid, &fd, &ticket, error_msg, sizeof(error_msg)) < 0)
+	{
+		ipc_bench_error(thread, "put_oid", error_msg);
+		return;
+	}
+	ipc_bench_timed(thread, IPC_BENCH_PUT_OID, start);
+	
+	os_write(fd, thread->object_data, thread->options->object_size);
+	os_close(fd);
+	
+	start = os_clock_us();
+	if(git_lfs_repo_commit(session, ticket, thread->options->object_size, sha256, error_msg, sizeof(error_msg)) < 0)
+	{
+		ipc_bench_error(thread, "commit", error_msg);
+		return;
+	}
+	ipc_bench_timed(thread, IPC_BENCH_COMMIT, start);
+}
+
+static void ipc_bench_locks(struct ipc_bench_thread *thread, struct repo_manager *session, unsigned int n)
+{
+	char error_msg[128];
+	char path[64];
+	snprintf(path, sizeof(path), "bench/%d/%u", thread->index, n);
+	
+	struct repo_cmd_create_lock_response create_response;
+	uint64_t start = os_clock_us();
+	if(git_lfs_repo_create_lock(session, thread->repo, "bench", path, &create_response, error_msg, sizeof(error_msg)) < 0 ||
+	   !create_response.successful)
+	{
+		ipc_bench_error(thread, "create_lock", error_msg);
+		return;
+	}
+	ipc_bench_timed(thread, IPC_BENCH_CREATE_LOCK, start);
+	
+	struct repo_lock_list *list;
+	start = os_clock_us();
+	if(git_lfs_repo_list_locks(session, thread->repo, 0, LIST_LOCKS_LIMIT, path, NULL, &list, error_msg, sizeof(error_msg)) < 0)
+	{
+		ipc_bench_error(thread, "list_locks", error_msg);
+	}
+	else
+	{
+		ipc_bench_timed(thread, IPC_BENCH_LIST_LOCKS, start);
+		repo_lock_list_free(list);
+	}
+	
+	struct repo_cmd_delete_lock_response delete_response;
+	start = os_clock_us();
+	if(git_lfs_repo_delete_lock(session, thread->repo, "bench", create_response.lock.id, 0, &delete_response, error_msg, sizeof(error_msg)) < 0)
+	{
+		ipc_bench_error(thread, "delete_lock", error_msg);
+		return;
+	}
+	ipc_bench_timed(thread, IPC_BENCH_DELETE_LOCK, start);
+}
+
+static void *ipc_bench_thread_main(void *data)
+{
+	struct ipc_bench_thread *thread = (struct ipc_bench_thread *)data;
+	const struct ipc_bench_options *options = thread->options;
+	
+	struct repo_manager session;
+	repo_manager_init_session(&session, thread->client);
+	
+	char error_msg[128];
+	if(git_lfs_repo_get_access_token(&session, thread->repo, session.access_token, sizeof(session.access_token), &session.access_token_expire, error_msg, sizeof(error_msg)) < 0)
+	{
+		ipc_bench_error(thread, "get_access_token", error_msg);
+		return NULL;
+	}
+	
+	// the uploaded object has the same content every time
+	uint8_t sha256[32];
+	SHA256((const unsigned char *)thread->object_data, options->object_size, sha256);
+	
+	int64_t *sizes = malloc(options->batch_size * sizeof(int64_t));
+	uint8_t *received = malloc(MULTIPART_MAX_PARTS / 8);
+	if(!sizes || !received)
+	{
+		goto error;
+	}
+	
+	for(unsigned int n = 0; os_clock_us() < thread->deadline; n++)
+	{
+		uint8_t oid[32];
+		memcpy(oid, thread->oids[n % options->batch_size], sizeof(oid));
+		
+		uint64_t start = os_clock_us();
+		int ret = 0;
+		switch(thread->group)
+		{
+			case IPC_BENCH_GET_ACCESS_TOKEN:
+				ret = git_lfs_repo_get_access_token(&session, thread->repo, session.access_token, sizeof(session.access_token), &session.access_token_expire, error_msg, sizeof(error_msg));
+				break;
+			case IPC_BENCH_CHECK_OID_EXIST:
+				ret = git_lfs_repo_check_oid_exist(&session, NULL, thread->repo, oid, error_msg, sizeof(error_msg));
+				break;
+			case IPC_BENCH_CHECK_OIDS_EXIST:
+				ret = git_lfs_repo_check_oids_exist(&session, thread->repo, thread->oids, options->batch_size, sizes, error_msg, sizeof(error_msg)) > 0 ? -1 : 0;
+				break;
+			case IPC_BENCH_GET_OID: {
+				int fd;
+				long size;
+				ret = git_lfs_repo_get_read_oid_fd(&session, NULL, thread->repo, oid, &fd, &size, error_msg, sizeof(error_msg));
+				if(ret >= 0) os_close(fd);
+				break;
+			}
+			case IPC_BENCH_GET_PARTS_STATUS: {
+				int64_t size, part_size;
+				uint32_t num_parts;
+				ret = git_lfs_repo_get_parts_status(&session, thread->repo, oid, &size, &part_size, &num_parts, received, error_msg, sizeof(error_msg));
+				break;
+			}
+			case IPC_BENCH_PUT_OID:
+				memcpy(oid, sha256, sizeof(oid));
+				ipc_bench_put_commit(thread, &session, oid, sha256);
+				continue;
+			case IPC_BENCH_CREATE_LOCK:
+				ipc_bench_locks(thread, &session, n);
+				continue;
+			default:
+				continue;
+		}
+		
+		if(ret < 0)
+		{
+			ipc_bench_error(thread, ipc_bench_ops[thread->group].name, error_msg);
+			continue;
+		}
+		
+		ipc_bench_timed(thread, thread->group, start);
+	}
+	
+error:
+	free(sizes);
+	free(received);
+	return NULL;
+}
+
+static int ipc_bench_run(const struct ipc_bench_options *options,
+						 struct repo_manager *client,
+						 const struct git_lfs_repo *repo,
+						 const uint8_t (*oids)[32],
+						 const char *object_data,
+						 enum ipc_bench_op group,
+						 int num_threads)
+{
+	struct ipc_bench_thread *threads = calloc(num_threads, sizeof(struct ipc_bench_thread));
+	os_thread_t *handles = calloc(num_threads, sizeof(os_thread_t));
+	if(!threads || !handles)
+	{
+		free(threads);
+		free(handles);
+		return -1;
+	}
+	
+	uint64_t deadline = os_clock_us() + options->duration * 1000000ULL;
+	
+	int started = 0;
+	for(int i = 0; i < num_threads; i++)
+	{
+		threads[i].options = options;
+		threads[i].client = client;
+		threads[i].repo = repo;
+		threads[i].oids = oids;
+		threads[i].object_data = object_data;
+		threads[i].index = i;
+		threads[i].group = group;
+		threads[i].deadline = deadline;
+		
+		handles[i] = os_thread_create(ipc_bench_thread_main, &threads[i]);
+		if(!handles[i]) break;
+		started++;
+	}
+	
+	struct bench_latencies latencies[IPC_BENCH_NUM_OPS];
+	memset(latencies, 0, sizeof(latencies));
+	uint64_t errors = 0;
+	
+	for(int i = 0; i < started; i++)
+	{
+		os_thread_join(handles[i], NULL);
+		errors += threads[i].errors;
+		for(int op = 0; op < IPC_BENCH_NUM_OPS; op++)
+		{
+			bench_latencies_merge(&latencies[op], &threads[i].latencies[op]);
+			bench_latencies_free(&threads[i].latencies[op]);
+		}
+	}
+	
+	for(int op = 0; op < IPC_BENCH_NUM_OPS; op++)
+	{
+		if(ipc_bench_ops[op].group != group)
+		{
+			continue;
+		}
+		
+		bench_latencies_sort(&latencies[op]);
+		printf("%-18s %7d %9zu %7llu %10.1f %8u %8u %8u\n",
+			   ipc_bench_ops[op].name,
+			   num_threads,
+			   latencies[op].count,
+			   (unsigned long long)errors,
+			   latencies[op].count / (double)options->duration,
+			   bench_latencies_percentile(&latencies[op], 0.50),
+			   bench_latencies_percentile(&latencies[op], 0.99),
+			   bench_latencies_percentile(&latencies[op], 0.999));
+		bench_latencies_free(&latencies[op]);
+	}
+	fflush(stdout);
+	
+	free(handles);
+	free(threads);
+	return started == num_threads ? 0 : -1;
+}
+
+// objects for the lookups, so they take the path of existing objects
+static int ipc_bench_fill_repo(const struct ipc_bench_options *options,
+							   struct repo_manager *client,
+							   const struct git_lfs_repo *repo,
+							   uint8_t (*oids)[32])
+{
+	struct repo_manager session;
+	repo_manager_init_session(&session, client);
+	
+	char error_msg[128];
+	if(git_lfs_repo_get_access_token(&session, repo, session.access_token, sizeof(session.access_token), &session.access_token_expire, error_msg, sizeof(error_msg)) < 0)
+	{
+		fprintf(stderr, "get_access_token failed: %s\n", error_msg);
+		return -1;
+	}
+	
+	for(int i = 0; i < options->batch_size; i++)
+	{
+		char data[32];
+		int size = snprintf(data, sizeof(data), "ipc bench object %d", i);
+		SHA256((const unsigned char *)data, size, oids[i]);
+		
+		int fd;
+		uint32_t ticket;
+		if(git_lfs_repo_get_write_oid_fd(&session, NULL, repo, oids[i], &fd, &ticket, error_msg, sizeof(error_msg)) < 0)
+		{
+			fprintf(stderr, "put_oid failed: %s\n", error_msg);
+			return -1;
+		}
+		
+		os_write(fd, data, size);
+		os_close(fd);
+		
+		if(git_lfs_repo_commit(&session, ticket, size, oids[i], error_msg, sizeof(error_msg)) < 0)
+		{
+			fprintf(stderr, "commit failed: %s\n", error_msg);
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+			"usage: repo-manager-bench [options]\n"
+			"  -t, --threads N       highest number of client threads (default 8)\n"
+			"  -m, --managers N      repo manager processes (default 1)\n"
+			"  -d, --duration SECS   time for each command and thread count (default 2)\n"
+			"  -b, --batch-size N    oids per check_oids_exist (default 100)\n"
+			"  -s, --object-size N   bytes written per put_oid (default 1024)\n"
+			"  -D, --dir DIR         where to create the scratch repo (default /tmp)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct ipc_bench_options options;
+	options.max_threads = 8;
+	options.num_managers = 1;
+	options.duration = 2;
+	options.batch_size = 100;
+	options.object_size = 1024;
+	const char *base_dir = "/tmp";
+	
+	static struct option long_options[] =
+	{
+		{ "help", no_argument, 0, 'h' },
+		{ "threads", required_argument, 0, 't' },
+		{ "managers", required_argument, 0, 'm' },
+		{ "duration", required_argument, 0, 'd' },
+		{ "batch-size", required_argument, 0, 'b' },
+		{ "object-size", required_argument, 0, 's' },
+		{ "dir", required_argument, 0, 'D' },
+		{ 0, 0, 0, 0 }
+	};
+	
+	int opt_index;
+	int c;
+	while((c = getopt_long(argc, argv, "ht:m:d:b:s:D:", long_options, &opt_index)) >= 0)
+	{
+		switch(c) {
+			case 't': options.max_threads = atoi(optarg); break;
+			case 'm': options.num_managers = atoi(optarg); break;
+			case 'd': options.duration = atoi(optarg); break;
+			case 'b': options.batch_size = atoi(optarg); break;
+			case 's': options.object_size = atoi(optarg); break;
+			case 'D': base_dir = optarg; break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+	
+	if(options.max_threads < 1 || options.num_managers < 1 || options.num_managers > 64 ||
+	   options.duration < 1 || options.batch_size < 1 || options.batch_size > CHECK_OIDS_LIMIT ||
+	   options.object_size < 0)
+	{
+		usage();
+		return 1;
+	}
+	
+	char dir[1024];
+	char path[1100];
+	if(snprintf(dir, sizeof(dir), "%s/repo-manager-bench.XXXXXX", base_dir) >= sizeof(dir) || !mkdtemp(dir))
+	{
+		fprintf(stderr, "Failed to create a directory in %s.\n", base_dir);
+		return 1;
+	}
+	
+	int ret = 1;
+	struct git_lfs_config *config = NULL;
+	
+	snprintf(path, sizeof(path), "%s/repo", dir);
+	if(os_mkdir(path, 0755) < 0 ||
+	   ipc_bench_write_config(dir, path, sizeof(path)) < 0 ||
+	   !(config = git_lfs_load_config(path)))
+	{
+		fprintf(stderr, "Failed to set up the config.\n");
+		goto error0;
+	}
+	
+	const struct git_lfs_repo *repo = SLIST_FIRST(&config->repos);
+	
+	int sockets[64];
+	int pids[64];
+	int num_managers = 0;
+	for(int i = 0; i < options.num_managers; i++)
+	{
+		int fd[2];
+		if(os_socketpair(fd) < 0)
+		{
+			goto error1;
+		}
+		
+		int pid = os_fork();
+		if(pid < 0)
+		{
+			os_close(fd[0]);
+			os_close(fd[1]);
+			goto error1;
+		}
+		
+		if(pid == 0)
+		{
+			for(int j = 0; j < num_managers; j++)
+			{
+				os_close(sockets[j]);
+			}
+			os_close(fd[0]);
+			
+			struct repo_manager *mgr = repo_manager_create(fd[1]);
+			git_lfs_repo_manager_service(mgr, config);
+			repo_manager_free(mgr);
+			exit(0);
+		}
+		
+		os_close(fd[1]);
+		sockets[num_managers] = fd[0];
+		pids[num_managers++] = pid;
+	}
+	
+	struct repo_manager *client = repo_manager_create_client(sockets, num_managers);
+	if(!client)
+	{
+		fprintf(stderr, "Failed to start repo manager client.\n");
+		goto error1;
+	}
+	
+	uint8_t (*oids)[32] = malloc(options.batch_size * sizeof(*oids));
+	char *object_data = calloc(1, options.object_size + 1);
+	if(!oids || !object_data || ipc_bench_fill_repo(&options, client, repo, oids) < 0)
+	{
+		goto error2;
+	}
+	
+	printf("%-18s %7s %9s %7s %10s %8s %8s %8s\n",
+		   "command", "threads", "ops", "errors", "ops/s", "p50_us", "p99_us", "p999_us");
+	
+	ret = 0;
+	for(enum ipc_bench_op group = 0; group < IPC_BENCH_NUM_OPS && ret == 0; group++)
+	{
+		if(ipc_bench_ops[group].group != group)
+		{
+			continue;
+		}
+		
+		for(int num_threads = 1; ; num_threads *= 2)
+		{
+			if(num_threads > options.max_threads) num_threads = options.max_threads;
+			
+			if(ipc_bench_run(&options, client, repo, (const uint8_t (*)[32])oids, object_data, group, num_threads) < 0)
+			{
+				fprintf(stderr, "Failed to start %d threads.\n", num_threads);
+				ret = 1;
+				break;
+			}
+			
+			if(num_threads == options.max_threads) break;
+		}
+	}
+	
+error2:
+	free(oids);
+	free(object_data);
+	repo_manager_free(client);
+error1:
+	// the managers exit once their socket is shut down
+	for(int i = 0; i < num_managers; i++)
+	{
+		os_close(sockets[i]);
+		int status;
+		os_waitpid(pids[i], &status);
+	}
+	git_lfs_free_config(config);
+error0:
+	if(nftw(dir, ipc_bench_remove_file, 16, FTW_DEPTH | FTW_PHYS) < 0)
+	{
+		fprintf(stderr, "Failed to remove %s.\n", dir);
+	}
+	return ret;
+}
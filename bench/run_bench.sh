@@ -0,0 +1,110 @@
+#!/bin/sh
+#
+# Runs git-lfs-bench against a scratch git-lfs-fcgi, first as a standalone
+# mongoose server, then as the standalone event server where the system
+# has it and last behind its FastCGI socket. Has to run as root because
+# the server chroots and drops to BENCH_USER.
+#
+# usage: run_bench.sh path/to/git-lfs-fcgi path/to/git-lfs-bench [bench options]
+#
+# Results are appended to $BENCH_OUTPUT (default bench-results.tsv) with
+# the git commit as the label, so runs of different commits line up. The
+# columns are label, workload, mode (mongoose, event or fastcgi), concurrency, object size, batch size,
+# duration, requests, errors, requests/s, MB/s, p50, p99 and p999 in us.
+
+set -e
+
+SERVER=$1
+BENCH=$2
+shift 2
+
+BENCH_USER=${BENCH_USER:-nobody}
+BENCH_GROUP=${BENCH_GROUP:-$(id -gn "$BENCH_USER")}
+BENCH_PORT=${BENCH_PORT:-18080}
+BENCH_OUTPUT=${BENCH_OUTPUT:-$(pwd)/bench-results.tsv}
+SOURCE_DIR=$(cd "$(dirname "$0")/.." && pwd)
+LABEL=$(git -C "$SOURCE_DIR" describe --always --dirty 2>/dev/null || echo unknown)
+
+if [ "$(id -u)" != 0 ]; then
+	echo "run_bench.sh must run as root, the server chroots to its run directory." >&2
+	exit 1
+fi
+
+DIR=$(mktemp -d /tmp/git-lfs-bench.XXXXXX)
+SERVER_PID=
+stop_server() {
+	kill "$SERVER_PID" 2>/dev/null || true
+	# the FastCGI threads can stay blocked in accept after the signal
+	TRIES=0
+	while kill -0 "$SERVER_PID" 2>/dev/null && [ $TRIES -lt 50 ]; do
+		sleep 0.1
+		TRIES=$((TRIES + 1))
+	done
+	kill -9 "$SERVER_PID" 2>/dev/null || true
+	wait "$SERVER_PID" 2>/dev/null || true
+	SERVER_PID=
+}
+
+cleanup() {
+	if [ -n "$SERVER_PID" ]; then
+		stop_server
+	fi
+	rm -rf "$DIR"
+}
+trap cleanup EXIT INT TERM
+
+chmod 755 "$DIR"
+mkdir -p "$DIR/run" "$DIR/repo"
+chown "$BENCH_USER:$BENCH_GROUP" "$DIR/run" "$DIR/repo"
+
+write_config() {
+	cat > "$DIR/bench.conf" <<CONF
+base_url "http://127.0.0.1:$BENCH_PORT"
+port $BENCH_PORT
+fastcgi_server $1
+event_server $2
+fastcgi_socket "$DIR/run/bench.sock"
+num_threads 16
+num_repo_managers 4
+user "$BENCH_USER"
+group "$BENCH_GROUP"
+process_chroot "$DIR/run"
+repo "bench"
+{
+	uri "/repo"
+	root "$DIR/repo"
+	verify_uploads yes
+}
+CONF
+}
+
+run_mode() {
+	MODE=$1
+	shift
+	
+	case "$MODE" in
+		mongoose) write_config no no ;;
+		event) write_config no yes ;;
+		fastcgi) write_config yes no ;;
+	esac
+	"$SERVER" -f "$DIR/bench.conf" &
+	SERVER_PID=$!
+	
+	# git-lfs-bench waits for the server to start listening
+	if [ "$MODE" = fastcgi ]; then
+		"$BENCH" -F "$DIR/run/bench.sock" -m "$MODE" -l "$LABEL" -o "$BENCH_OUTPUT" "$@"
+	else
+		"$BENCH" -H "127.0.0.1:$BENCH_PORT" -m "$MODE" -l "$LABEL" -o "$BENCH_OUTPUT" "$@"
+	fi
+	
+	stop_server
+	rm -rf "$DIR/repo/"*
+}
+
+echo "git-lfs-fcgi $LABEL"
+run_mode mongoose "$@"
+# the event server is only built on Linux
+if [ "$(uname -s)" = Linux ]; then
+	run_mode event "$@"
+fi
+run_mode fastcgi "$@"
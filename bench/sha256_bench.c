@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <openssl/sha.h>
+#include "os/clock.h"
+#include "sha256.h"
+
+// Checks the plain C sha256 engine against the ssl library and every other
+// engine the cpu supports against it, then times them. Multi-buffer engines are timed with all their lanes busy, the
+// rate is the total of all lanes.
+
+enum sha256_bench_config
+{
+	SHA256_BENCH_BUFFER = 1024 * 1024,
+	SHA256_BENCH_ROUNDS = 64,
+	SHA256_BENCH_MAX_LENGTH = 1024
+};
+
+static uint64_t sha256_bench_state = 0x2545f4914f6cdd1dULL;
+
+static uint64_t sha256_bench_random(void)
+{
+	sha256_bench_state ^= sha256_bench_state << 13;
+	sha256_bench_state ^= sha256_bench_state >> 7;
+	sha256_bench_state ^= sha256_bench_state << 17;
+	return sha256_bench_state;
+}
+
+static void random_bytes(void *buffer, size_t size)
+{
+	uint8_t *p = buffer;
+	for(size_t i = 0; i < size; i++) {
+		p[i] = sha256_bench_random();
+	}
+}
+
+// pads every length up to a few blocks by hand and compresses it with the
+// reference engine alone
+static int check_reference(const struct sha256_engine *reference)
+{
+	static uint8_t data[SHA256_BENCH_MAX_LENGTH + 2 * SHA256_BLOCK_SIZE];
+	uint8_t expected[SHA256_HASH_SIZE];
+	
+	for(size_t length = 0; length <= SHA256_BENCH_MAX_LENGTH; length++) {
+		random_bytes(data, length);
+		SHA256(data, length, expected);
+		
+		size_t padded = (length + 8) / SHA256_BLOCK_SIZE * SHA256_BLOCK_SIZE + SHA256_BLOCK_SIZE;
+		memset(data + length, 0, padded - length);
+		data[length] = 0x80;
+		for(int i = 0; i < 8; i++) {
+			data[padded - 1 - i] = (uint8_t)((uint64_t)length * 8 >> (i * 8));
+		}
+		
+		uint32_t state[8] = {
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+			0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+		};
+		uint32_t *states[1] = { state };
+		const uint8_t *blocks[1] = { data };
+		reference->compress(states, blocks, padded / SHA256_BLOCK_SIZE);
+		
+		for(int i = 0; i < SHA256_HASH_SIZE; i++) {
+			if((uint8_t)(state[i / 4] >> (24 - i % 4 * 8)) != expected[i]) {
+				fprintf(stderr, "%s: %zu bytes is wrong.\n", reference->name, length);
+				return -1;
+			}
+		}
+	}
+	
+	return 0;
+}
+
+static int check_engine(const struct sha256_engine *engine, const struct sha256_engine *reference)
+{
+	uint8_t data[SHA256_MAX_LANES][4 * SHA256_BLOCK_SIZE];
+	uint32_t state[SHA256_MAX_LANES][8], expected[SHA256_MAX_LANES][8];
+	uint32_t *states[SHA256_MAX_LANES];
+	const uint8_t *blocks[SHA256_MAX_LANES];
+	
+	for(int round = 0; round < 10000; round++) {
+		size_t num_blocks = 1 + round % 4;
+		random_bytes(data, sizeof(data));
+		random_bytes(state, sizeof(state));
+		memcpy(expected, state, sizeof(state));
+		
+		for(int lane = 0; lane < engine->lanes; lane++) {
+			states[lane] = state[lane];
+			blocks[lane] = data[lane];
+		}
+		engine->compress(states, blocks, num_blocks);
+		
+		for(int lane = 0; lane < engine->lanes; lane++) {
+			states[0] = expected[lane];
+			blocks[0] = data[lane];
+			reference->compress(states, blocks, num_blocks);
+			if(memcmp(state[lane], expected[lane], sizeof(expected[lane])) != 0) {
+				fprintf(stderr, "%s: lane %d is wrong after %zu blocks.\n", engine->name, lane, num_blocks);
+				return -1;
+			}
+		}
+	}
+	
+	return 0;
+}
+
+// every length up to a few blocks, fed in two random pieces, and random
+// pieces of up to SHA256_MAX_LANES streams at once
+static int check_api(void)
+{
+	static uint8_t data[SHA256_MAX_LANES][SHA256_BENCH_MAX_LENGTH];
+	uint8_t hash[SHA256_HASH_SIZE], expected[SHA256_HASH_SIZE];
+	struct sha256_ctx ctx;
+	
+	random_bytes(data, sizeof(data));
+	for(size_t length = 0; length <= SHA256_BENCH_MAX_LENGTH; length++) {
+		size_t split = length > 0 ? sha256_bench_random() % (length + 1) : 0;
+		sha256_init(&ctx);
+		sha256_update(&ctx, data[0], split);
+		sha256_update(&ctx, data[0] + split, length - split);
+		sha256_final(&ctx, hash);
+		
+		SHA256(data[0], length, expected);
+		if(memcmp(hash, expected, sizeof(hash)) != 0) {
+			fprintf(stderr, "sha256_update: %zu bytes split at %zu is wrong.\n", length, split);
+			return -1;
+		}
+	}
+	
+	for(int round = 0; round < 10000; round++) {
+		int count = 1 + round % SHA256_MAX_LANES;
+		struct sha256_ctx ctxs[SHA256_MAX_LANES];
+		struct sha256_ctx *ctx_ptrs[SHA256_MAX_LANES];
+		size_t lengths[SHA256_MAX_LANES] = { 0 };
+		
+		for(int i = 0; i < count; i++) {
+			sha256_init(&ctxs[i]);
+			ctx_ptrs[i] = &ctxs[i];
+		}
+		
+		for(int piece = 0; piece < 3; piece++) {
+			const void *pieces[SHA256_MAX_LANES];
+			size_t sizes[SHA256_MAX_LANES];
+			for(int i = 0; i < count; i++) {
+				sizes[i] = sha256_bench_random() % (SHA256_BENCH_MAX_LENGTH / 3);
+				pieces[i] = data[i] + lengths[i];
+				lengths[i] += sizes[i];
+			}
+			sha256_update_multi(ctx_ptrs, pieces, sizes, count);
+		}
+		
+		for(int i = 0; i < count; i++) {
+			sha256_final(&ctxs[i], hash);
+			SHA256(data[i], lengths[i], expected);
+			if(memcmp(hash, expected, sizeof(hash)) != 0) {
+				fprintf(stderr, "sha256_update_multi: stream %d of %d is wrong.\n", i, count);
+				return -1;
+			}
+		}
+	}
+	
+	return 0;
+}
+
+static void bench_engine(const struct sha256_engine *engine, uint8_t *buffer)
+{
+	uint32_t state[SHA256_MAX_LANES][8];
+	uint32_t *states[SHA256_MAX_LANES];
+	const uint8_t *blocks[SHA256_MAX_LANES];
+	size_t lane_size = SHA256_BENCH_BUFFER / engine->lanes;
+	
+	for(int lane = 0; lane < engine->lanes; lane++) {
+		states[lane] = state[lane];
+		blocks[lane] = buffer + lane * lane_size;
+	}
+	
+	uint64_t start = os_clock_us();
+	for(int i = 0; i < SHA256_BENCH_ROUNDS; i++) {
+		engine->compress(states, blocks, lane_size / SHA256_BLOCK_SIZE);
+	}
+	uint64_t elapsed_us = os_clock_us() - start;
+	
+	printf("%-8s %6d %10.1f\n", engine->name, engine->lanes,
+		   (double)SHA256_BENCH_BUFFER * SHA256_BENCH_ROUNDS / elapsed_us);
+}
+
+int main(int argc, char *argv[])
+{
+	int count;
+	const struct sha256_engine *engines = sha256_get_engines(&count);
+	const struct sha256_engine *reference = &engines[count - 1];
+	
+	if(check_reference(reference) < 0) {
+		return 1;
+	}
+	
+	for(int i = 0; i < count; i++) {
+		if(!engines[i].supported()) {
+			printf("%s: not supported by this cpu\n", engines[i].name);
+			continue;
+		}
+		
+		if(check_engine(&engines[i], reference) < 0) {
+			return 1;
+		}
+	}
+	
+	if(check_api() < 0) {
+		return 1;
+	}
+	
+	printf("single stream engine: %s\n", sha256_get_engine()->name);
+	printf("multi stream engine: %s\n", sha256_get_multi_engine()->name);
+	
+	uint8_t *buffer = malloc(SHA256_BENCH_BUFFER);
+	if(!buffer) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	random_bytes(buffer, SHA256_BENCH_BUFFER);
+	
+	printf("%-8s %6s %10s\n", "engine", "lanes", "MB/s");
+	for(int i = 0; i < count; i++) {
+		if(engines[i].supported()) {
+			bench_engine(&engines[i], buffer);
+		}
+	}
+	
+	free(buffer);
+	return 0;
+}
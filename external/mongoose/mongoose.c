@@ -673,6 +673,11 @@ struct mg_request_info *mg_get_request_info(struct mg_connection *conn) {
   return &conn->request_info;
 }
 
+int mg_get_socket(const struct mg_connection *conn) {
+  // SSL connections must go through mg_write()
+  return conn->ssl != NULL ? -1 : (int) conn->client.sock;
+}
+
 static void mg_strlcpy(register char *dst, register const char *src, size_t n) {
   for (; *src != '\0' && n > 1; n--) {
     *dst++ = *src++;
@@ -202,6 +202,12 @@ int mg_modify_passwords_file(const char *passwords_file_name,
 struct mg_request_info *mg_get_request_info(struct mg_connection *);
 
 
+// Return the client socket, so that data can be sent without going
+// through mg_write(), e.g. with sendfile().
+// Return: socket, or -1 if the connection cannot be written to directly.
+int mg_get_socket(const struct mg_connection *);
+
+
 // Send data to the client.
 // Return:
 //  0   when the connection has been closed
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef OS_EVENT_H
+#define OS_EVENT_H
+
+// readiness notification for many sockets. registrations are one-shot,
+// after an event is delivered the socket must be re-armed with
+// os_event_modify before it reports again
+
+enum os_event_flags
+{
+	OS_EVENT_READ = 1,
+	OS_EVENT_WRITE = 2,
+	OS_EVENT_HANGUP = 4
+};
+
+struct os_event
+{
+	void *data;
+	int events;
+};
+
+int os_event_queue_create();
+int os_event_add(int queue, int fd, int events, void *data);
+int os_event_modify(int queue, int fd, int events, void *data);
+int os_event_remove(int queue, int fd);
+int os_event_wait(int queue, struct os_event *events, int max_events, int timeout_ms);
+
+#endif
@@ -19,9 +19,12 @@
 int os_is_directory(const char *path);
 int os_file_exists(const char *path);
 long os_file_size(const char *path);
+int os_file_get_size(const char *path, long *size);
 int os_mkdir(const char *path, int mode);
 int os_rename(const char *src_path, const char *dest_path);
+int os_link(const char *src_path, const char *dest_path);
 int os_unlink(const char *path);
+int os_truncate(const char *path, long size);
 int os_chroot(const char *path);
 int os_mkstemp(char *template_path);
 int os_umask(int mode);
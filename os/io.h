@@ -19,8 +19,15 @@
 
 int os_open_read(const char *filename);
 int os_open_create(const char *filename, int mode);
+int os_open_read_write(const char *filename);
+int os_open_append(const char *filename, int mode);
 int os_read(int fd, void *buffer, int size);
 int os_write(int fd, const void *buffer, int size);
+int os_pread(int fd, void *buffer, int size, long offset);
+int os_pwrite(int fd, const void *buffer, int size, long offset);
 int os_close(int fd);
+int os_dup(int fd);
+long os_seek(int fd, long offset);
+long os_sendfile(int socket, int fd, long offset, long size);
 
 #endif
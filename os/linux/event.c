@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "os/event.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+int os_event_queue_create()
+{
+	return epoll_create1(EPOLL_CLOEXEC);
+}
+
+static uint32_t os_event_to_epoll(int events)
+{
+	uint32_t epoll_events = EPOLLONESHOT | EPOLLRDHUP;
+	if(events & OS_EVENT_READ) epoll_events |= EPOLLIN;
+	if(events & OS_EVENT_WRITE) epoll_events |= EPOLLOUT;
+	return epoll_events;
+}
+
+static int os_event_ctl(int queue, int op, int fd, int events, void *data)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = os_event_to_epoll(events);
+	ev.data.ptr = data;
+	
+	return epoll_ctl(queue, op, fd, &ev);
+}
+
+int os_event_add(int queue, int fd, int events, void *data)
+{
+	return os_event_ctl(queue, EPOLL_CTL_ADD, fd, events, data);
+}
+
+int os_event_modify(int queue, int fd, int events, void *data)
+{
+	return os_event_ctl(queue, EPOLL_CTL_MOD, fd, events, data);
+}
+
+int os_event_remove(int queue, int fd)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	return epoll_ctl(queue, EPOLL_CTL_DEL, fd, &ev);
+}
+
+int os_event_wait(int queue, struct os_event *events, int max_events, int timeout_ms)
+{
+	struct epoll_event epoll_events[64];
+	if(max_events > sizeof(epoll_events) / sizeof(epoll_events[0]))
+	{
+		max_events = sizeof(epoll_events) / sizeof(epoll_events[0]);
+	}
+	
+	int n = epoll_wait(queue, epoll_events, max_events, timeout_ms);
+	if(n < 0)
+	{
+		return 0; // interrupted, nothing to report
+	}
+	
+	for(int i = 0; i < n; i++)
+	{
+		events[i].data = epoll_events[i].data.ptr;
+		events[i].events = 0;
+		if(epoll_events[i].events & EPOLLIN) events[i].events |= OS_EVENT_READ;
+		if(epoll_events[i].events & EPOLLOUT) events[i].events |= OS_EVENT_WRITE;
+		if(epoll_events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) events[i].events |= OS_EVENT_HANGUP;
+	}
+	
+	return n;
+}
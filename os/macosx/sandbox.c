@@ -34,6 +34,7 @@ int os_sandbox(enum sandbox_profile profile)
 			break;
 		case SANDBOX_INET_SOCKET:
 		case SANDBOX_UNIX_SOCKET:
+		case SANDBOX_READ_ONLY:
 			osx_sandbox_profile = kSBXProfileNoWrite;
 			break;
 		case SANDBOX_COMPUTE:
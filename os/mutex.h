@@ -17,10 +17,19 @@
 #define OS_MUTEX_H
 
 typedef void * os_mutex_t;
+typedef void * os_cond_t;
 
 os_mutex_t os_mutex_create();
 void os_mutex_destroy(os_mutex_t mutex);
 int os_mutex_lock(os_mutex_t mutex);
 int os_mutex_unlock(os_mutex_t mutex);
 
+os_cond_t os_cond_create();
+void os_cond_destroy(os_cond_t cond);
+int os_cond_wait(os_cond_t cond, os_mutex_t mutex);
+// returns 0 when signaled, 1 when the timeout ran out first
+int os_cond_timedwait(os_cond_t cond, os_mutex_t mutex, int timeout_ms);
+int os_cond_signal(os_cond_t cond);
+int os_cond_broadcast(os_cond_t cond);
+
 #endif
@@ -26,6 +26,8 @@ int os_sandbox(enum sandbox_profile profile)
 			return pledge("stdio inet sendfd recvfd", NULL);
 		case SANDBOX_UNIX_SOCKET:
 			return pledge("stdio unix sendfd recvfd", NULL);
+		case SANDBOX_READ_ONLY:
+			return pledge("stdio rpath proc", NULL);
 		case SANDBOX_COMPUTE:
 			return pledge("stdio", NULL);
 	}
@@ -19,5 +19,7 @@
 
 int os_fork();
 int os_kill(int pid, int sig);
+int os_waitpid(int pid, int *exit_status);
+int os_getpid(void);
 
 #endif
@@ -22,7 +22,8 @@ enum sandbox_profile
 	SANDBOX_COMPUTE, // no file-io or networking allowed
 	SANDBOX_FILEIO, // allow file-io, but no network
 	SANDBOX_UNIX_SOCKET, // allow unix-socket only
-	SANDBOX_INET_SOCKET // allow inet-sockets only
+	SANDBOX_INET_SOCKET, // allow inet-sockets only
+	SANDBOX_READ_ONLY // allow reading files and forking, but no writes or network
 };
 
 int os_sandbox(enum sandbox_profile profile);
@@ -19,5 +19,9 @@
 #include <signal.h>
 
 int os_signal(int signo, void (*action)(int));
+// blocks a signal in the calling thread and the threads it starts afterwards
+int os_signal_block(int signo);
+// waits for a blocked signal to be sent to the process
+int os_signal_wait(int signo);
 
 #endif
@@ -17,8 +17,17 @@
 #define OS_SOCKET_H
 
 int os_socketpair(int pair[2]);
+int os_shutdown(int socket);
 
 int os_send_with_file_descriptor(int socket, const void *buffer, int size, int fd);
 int os_recv_with_file_descriptor(int socket, void *buffer, int size, int *fd);
 
+int os_socket_listen_tcp(const char *host, int port, int backlog, int reuse_port);
+int os_socket_accept(int listen_socket);
+int os_socket_connect_tcp(const char *host, int port);
+int os_socket_connect_unix(const char *path);
+int os_socket_set_nonblocking(int socket);
+int os_socket_wait(int socket, int for_write, int timeout_ms);
+int os_socket_would_block();
+
 #endif
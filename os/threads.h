@@ -22,4 +22,9 @@ typedef void * os_thread_t;
 os_thread_t os_thread_create(void *(*start_routine) (void *), void *arg);
 int os_thread_join(os_thread_t thread, void **value_ptr);
 
+// lowers the cpu and io priority of the calling thread so that it only gets
+// what nothing else wants. returns -1 where only whole processes can be
+// lowered.
+int os_thread_set_idle_priority(void);
+
 #endif
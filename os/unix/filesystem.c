@@ -45,6 +45,15 @@ long os_file_size(const char *path)
 	return st.st_size;
 }
 
+int os_file_get_size(const char *path, long *size)
+{
+	struct stat st;
+	if(stat(path, &st) != 0) return -1;
+	
+	*size = st.st_size;
+	return 0;
+}
+
 int os_mkdir(const char *path, int mode)
 {
 	return mkdir(path, mode);
@@ -55,11 +64,21 @@ int os_rename(const char *src_path, const char *dest_path)
 	return rename(src_path, dest_path);
 }
 
+int os_link(const char *src_path, const char *dest_path)
+{
+	return link(src_path, dest_path);
+}
+
 int os_unlink(const char *path)
 {
 	return unlink(path);
 }
 
+int os_truncate(const char *path, long size)
+{
+	return truncate(path, size);
+}
+
 int os_chroot(const char *path)
 {
 	if(chdir(path) < 0)
@@ -16,6 +16,10 @@
 #include "os/io.h"
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
 int os_open_read(const char *filename)
 {
@@ -27,6 +31,16 @@ int os_open_create(const char *filename, int mode)
 	return open(filename, O_CREAT | O_WRONLY, mode);
 }
 
+int os_open_read_write(const char *filename)
+{
+	return open(filename, O_RDWR);
+}
+
+int os_open_append(const char *filename, int mode)
+{
+	return open(filename, O_CREAT | O_WRONLY | O_APPEND, mode);
+}
+
 int os_read(int fd, void *buffer, int size)
 {
 	return read(fd, buffer, size);
@@ -37,8 +51,64 @@ int os_write(int fd, const void *buffer, int size)
 	return write(fd, buffer, size);
 }
 
+int os_pread(int fd, void *buffer, int size, long offset)
+{
+	return pread(fd, buffer, size, offset);
+}
+
+int os_pwrite(int fd, const void *buffer, int size, long offset)
+{
+	return pwrite(fd, buffer, size, offset);
+}
+
 int os_close(int fd)
 {
 	return close(fd);
 }
 
+int os_dup(int fd)
+{
+	return dup(fd);
+}
+
+long os_seek(int fd, long offset)
+{
+	return lseek(fd, offset, SEEK_SET);
+}
+
+long os_sendfile(int socket, int fd, long offset, long size)
+{
+	long total = 0;
+	
+#if defined(__linux__)
+	off_t off = offset;
+	while(total < size)
+	{
+		ssize_t n = sendfile(socket, fd, &off, size - total);
+		if(n == 0) errno = EIO; // the file is shorter than expected
+		if(n <= 0) break;
+		total += n;
+	}
+#else
+	char buffer[65536];
+	while(total < size)
+	{
+		size_t chunk = size - total < sizeof(buffer) ? size - total : sizeof(buffer);
+		ssize_t n = pread(fd, buffer, chunk, offset + total);
+		if(n == 0) errno = EIO; // the file is shorter than expected
+		if(n <= 0) break;
+		
+		ssize_t written = 0;
+		while(written < n)
+		{
+			ssize_t w = write(socket, buffer + written, n - written);
+			if(w <= 0) return total > 0 ? total + written : -1;
+			written += w;
+		}
+		total += n;
+	}
+#endif
+
+	if(total == 0 && size > 0) return -1;
+	return total;
+}
@@ -15,6 +15,8 @@
  */
 #include <stdlib.h>
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
 #include "os/mutex.h"
 
 struct mutex_data
@@ -52,3 +54,70 @@ int os_mutex_unlock(os_mutex_t mutex)
 	struct mutex_data *data = (struct mutex_data *)mutex;
 	return pthread_mutex_unlock(&data->mutex);
 }
+
+struct cond_data
+{
+	pthread_cond_t cond;
+};
+
+os_cond_t os_cond_create()
+{
+	struct cond_data *data = (struct cond_data *)malloc(sizeof(struct cond_data));
+	if(!data) return NULL;
+	
+	if(pthread_cond_init(&data->cond, NULL) != 0)
+	{
+		free(data);
+		return NULL;
+	}
+	
+	return data;
+}
+
+void os_cond_destroy(os_cond_t cond)
+{
+	struct cond_data *data = (struct cond_data *)cond;
+	
+	pthread_cond_destroy(&data->cond);
+	
+	free(data);
+}
+
+int os_cond_wait(os_cond_t cond, os_mutex_t mutex)
+{
+	struct cond_data *data = (struct cond_data *)cond;
+	struct mutex_data *mutex_data = (struct mutex_data *)mutex;
+	return pthread_cond_wait(&data->cond, &mutex_data->mutex);
+}
+
+int os_cond_timedwait(os_cond_t cond, os_mutex_t mutex, int timeout_ms)
+{
+	struct cond_data *data = (struct cond_data *)cond;
+	struct mutex_data *mutex_data = (struct mutex_data *)mutex;
+	
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if(deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	
+	int ret = pthread_cond_timedwait(&data->cond, &mutex_data->mutex, &deadline);
+	if(ret == ETIMEDOUT) return 1;
+	return ret;
+}
+
+int os_cond_signal(os_cond_t cond)
+{
+	struct cond_data *data = (struct cond_data *)cond;
+	return pthread_cond_signal(&data->cond);
+}
+
+int os_cond_broadcast(os_cond_t cond)
+{
+	struct cond_data *data = (struct cond_data *)cond;
+	return pthread_cond_broadcast(&data->cond);
+}
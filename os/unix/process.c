@@ -16,6 +16,8 @@
 #include "os/process.h"
 #include <unistd.h>
 #include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 int os_fork()
 {
@@ -26,3 +28,21 @@ int os_kill(int pid, int sig)
 {
 	return kill(pid, sig);
 }
+
+int os_waitpid(int pid, int *exit_status)
+{
+	int status;
+	
+	if(waitpid(pid, &status, 0) < 0)
+	{
+		return -1;
+	}
+	
+	*exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	return 0;
+}
+
+int os_getpid(void)
+{
+	return getpid();
+}
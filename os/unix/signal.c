@@ -15,6 +15,7 @@
  */
 #include "os/signal.h"
 #include <signal.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <string.h>
 
@@ -33,3 +34,24 @@ int os_signal(int signo, void (*action)(int))
 	
 	return -1;
 }
+
+int os_signal_block(int signo)
+{
+	sigset_t set;
+	
+	sigemptyset(&set);
+	sigaddset(&set, signo);
+	
+	return pthread_sigmask(SIG_BLOCK, &set, NULL) == 0 ? 0 : -1;
+}
+
+int os_signal_wait(int signo)
+{
+	sigset_t set;
+	int sig;
+	
+	sigemptyset(&set);
+	sigaddset(&set, signo);
+	
+	return sigwait(&set, &sig) == 0 ? 0 : -1;
+}
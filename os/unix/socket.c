@@ -16,13 +16,26 @@
 #include "os/socket.h"
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <sys/un.h>
 
 int os_socketpair(int pair[2])
 {
 	return socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
 }
 
+int os_shutdown(int socket)
+{
+	return shutdown(socket, SHUT_RDWR);
+}
+
 int os_send_with_file_descriptor(int socket, const void *buffer, int size, int fd)
 {
 	struct msghdr msg;
@@ -80,3 +93,208 @@ int os_recv_with_file_descriptor(int socket, void *buffer, int size, int *fd)
 	return ret;
 }
 
+
+static int socket_listen(int family, const struct sockaddr *addr, socklen_t addr_len, int backlog, int reuse_port)
+{
+	int s = socket(family, SOCK_STREAM, 0);
+	if(s < 0) return -1;
+	
+	int on = 1;
+	if(family == AF_INET6)
+	{
+		// accept IPv4 on the same socket where the system allows it
+		int off = 0;
+		setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+	}
+	
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	
+	// lets several sockets bind the same port, the kernel spreads the
+	// incoming connections between them
+	if(reuse_port)
+	{
+#if defined(SO_REUSEPORT)
+		if(setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+		{
+			close(s);
+			return -1;
+		}
+#else
+		fprintf(stderr, "SO_REUSEPORT is not supported on this system, cannot share a port between listeners.\n");
+		close(s);
+		errno = ENOTSUP;
+		return -1;
+#endif
+	}
+	
+	if(bind(s, addr, addr_len) < 0 ||
+	   listen(s, backlog) < 0)
+	{
+		int saved_errno = errno;
+		close(s);
+		errno = saved_errno;
+		return -1;
+	}
+	
+	return s;
+}
+
+int os_socket_listen_tcp(const char *host, int port, int backlog, int reuse_port)
+{
+	if(host && host[0])
+	{
+		char service[16];
+		snprintf(service, sizeof(service), "%d", port);
+		
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		
+		struct addrinfo *result;
+		if(getaddrinfo(host, service, &hints, &result) != 0)
+		{
+			return -1;
+		}
+		
+		int s = -1;
+		for(struct addrinfo *ai = result; ai && s < 0; ai = ai->ai_next)
+		{
+			s = socket_listen(ai->ai_family, ai->ai_addr, ai->ai_addrlen, backlog, reuse_port);
+		}
+		
+		freeaddrinfo(result);
+		return s;
+	}
+	
+	struct sockaddr_in6 addr6;
+	memset(&addr6, 0, sizeof(addr6));
+	addr6.sin6_family = AF_INET6;
+	addr6.sin6_port = htons(port);
+	addr6.sin6_addr = in6addr_any;
+	
+	int s = socket_listen(AF_INET6, (struct sockaddr *)&addr6, sizeof(addr6), backlog, reuse_port);
+	if(s >= 0 || errno != EAFNOSUPPORT)
+	{
+		return s;
+	}
+	
+	// no IPv6 on this system
+	struct sockaddr_in addr4;
+	memset(&addr4, 0, sizeof(addr4));
+	addr4.sin_family = AF_INET;
+	addr4.sin_port = htons(port);
+	addr4.sin_addr.s_addr = htonl(INADDR_ANY);
+	
+	return socket_listen(AF_INET, (struct sockaddr *)&addr4, sizeof(addr4), backlog, reuse_port);
+}
+
+int os_socket_accept(int listen_socket)
+{
+	int s = accept(listen_socket, NULL, NULL);
+	if(s < 0) return -1;
+	
+	int on = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	
+	if(os_socket_set_nonblocking(s) < 0 ||
+	   fcntl(s, F_SETFD, FD_CLOEXEC) < 0)
+	{
+		close(s);
+		return -1;
+	}
+	
+	return s;
+}
+
+int os_socket_connect_tcp(const char *host, int port)
+{
+	char service[16];
+	snprintf(service, sizeof(service), "%d", port);
+	
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	
+	struct addrinfo *result;
+	if(getaddrinfo(host, service, &hints, &result) != 0)
+	{
+		return -1;
+	}
+	
+	int s = -1;
+	for(struct addrinfo *ai = result; ai; ai = ai->ai_next)
+	{
+		s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(s < 0) continue;
+		
+		if(connect(s, ai->ai_addr, ai->ai_addrlen) == 0) break;
+		
+		close(s);
+		s = -1;
+	}
+	
+	freeaddrinfo(result);
+	
+	if(s >= 0)
+	{
+		int on = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	}
+	
+	return s;
+}
+
+int os_socket_connect_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(s < 0) return -1;
+	
+	if(connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		close(s);
+		return -1;
+	}
+	
+	return s;
+}
+
+int os_socket_set_nonblocking(int socket)
+{
+	int flags = fcntl(socket, F_GETFL, 0);
+	if(flags < 0) return -1;
+	
+	return fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+}
+
+int os_socket_wait(int socket, int for_write, int timeout_ms)
+{
+	struct pollfd pfd;
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = socket;
+	pfd.events = for_write ? POLLOUT : POLLIN;
+	
+	int ret;
+	do
+	{
+		ret = poll(&pfd, 1, timeout_ms);
+	} while(ret < 0 && errno == EINTR);
+	
+	return ret;
+}
+
+int os_socket_would_block()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
@@ -13,9 +13,17 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
 #include "os/threads.h"
 #include <stddef.h>
 #include <pthread.h>
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 
 os_thread_t os_thread_create(void *(*start_routine) (void *), void *arg)
 {
@@ -32,3 +40,21 @@ int os_thread_join(os_thread_t thread, void **value_ptr)
 {
 	return pthread_join((pthread_t)thread, value_ptr);
 }
+
+int os_thread_set_idle_priority(void)
+{
+#if defined(__linux__)
+	// ioprio_set has no libc wrapper. IOPRIO_WHO_PROCESS with a thread id
+	// only changes that thread, the value is IOPRIO_CLASS_IDLE << 13.
+	struct sched_param param = { 0 };
+	if(sched_setscheduler(0, SCHED_IDLE, &param) < 0 ||
+	   syscall(SYS_ioprio_set, 1, (int)syscall(SYS_gettid), 3 << 13) < 0)
+	{
+		return -1;
+	}
+	
+	return 0;
+#else
+	return -1;
+#endif
+}
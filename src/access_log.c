@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "access_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include "os/io.h"
+#include "os/mutex.h"
+#include "os/threads.h"
+
+enum access_log_config
+{
+	ACCESS_LOG_RING_SIZE = 256 * 1024, // per thread, power of two
+	ACCESS_LOG_FLUSH_MS = 200, // how long entries may wait in a ring
+	ACCESS_LOG_BUFFER_SIZE = 64 * 1024, // formatted output written at once
+	ACCESS_LOG_LINE_MAX = 8 * ACCESS_LOG_BODY_MAX // longest escaped line
+};
+
+enum access_log_field
+{
+	ACCESS_LOG_METHOD,
+	ACCESS_LOG_REPO,
+	ACCESS_LOG_END_POINT,
+	ACCESS_LOG_USER,
+	ACCESS_LOG_REQUEST_BODY,
+	ACCESS_LOG_RESPONSE_BODY,
+	ACCESS_LOG_NUM_FIELDS
+};
+
+static const uint16_t access_log_field_max[ACCESS_LOG_NUM_FIELDS] =
+{
+	[ACCESS_LOG_METHOD] = 16,
+	[ACCESS_LOG_REPO] = 256,
+	[ACCESS_LOG_END_POINT] = 1024,
+	[ACCESS_LOG_USER] = 256,
+	[ACCESS_LOG_REQUEST_BODY] = ACCESS_LOG_BODY_MAX,
+	[ACCESS_LOG_RESPONSE_BODY] = ACCESS_LOG_BODY_MAX
+};
+
+// an entry in a ring, followed by the strings of its fields
+struct access_log_record
+{
+	uint32_t size; // including the strings, rounded up to 8 bytes
+	int32_t status;
+	int64_t time;
+	uint64_t duration_us;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint16_t lengths[ACCESS_LOG_NUM_FIELDS];
+	uint16_t has_user;
+};
+
+// head only moves on the owning thread and tail only on the flush thread,
+// so the two sides never need more than acquire and release ordering
+struct access_log_ring
+{
+	struct access_log_ring *next;
+	uint64_t head;
+	uint64_t tail;
+	uint64_t dropped; // written by the owning thread
+	uint64_t reported; // drops already noted in the log
+	unsigned int sample_count;
+	char data[ACCESS_LOG_RING_SIZE];
+};
+
+static struct
+{
+	int fd;
+	struct access_log_ring *rings; // rings are never freed
+	os_mutex_t lock; // only used to sleep on wakeup
+	os_cond_t wakeup;
+	os_thread_t thread;
+	volatile int stopping;
+	
+	// the timestamp only has to be formatted again when the second changes
+	int64_t cached_time;
+	char cached_timestamp[64];
+	
+	char *buffer;
+	size_t buffer_used;
+} access_log = { -1 };
+
+static __thread struct access_log_ring *access_log_thread_ring;
+
+int access_log_open(const char *path)
+{
+	if(!path)
+	{
+		return 0;
+	}
+	
+	access_log.fd = os_open_append(path, 0640);
+	if(access_log.fd < 0)
+	{
+		fprintf(stderr, "Failed to open access log '%s'.\n", path);
+		return -1;
+	}
+	
+	return 0;
+}
+
+int access_log_enabled(void)
+{
+	return access_log.thread != NULL;
+}
+
+static struct access_log_ring *access_log_get_ring(void)
+{
+	struct access_log_ring *ring = access_log_thread_ring;
+	if(ring) return ring;
+	
+	ring = calloc(1, sizeof(*ring));
+	if(!ring) return NULL;
+	
+	ring->next = __atomic_load_n(&access_log.rings, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&access_log.rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	{
+	}
+	
+	access_log_thread_ring = ring;
+	return ring;
+}
+
+static void ring_copy_in(struct access_log_ring *ring, uint64_t pos, const void *src, size_t len)
+{
+	size_t offset = pos & (ACCESS_LOG_RING_SIZE - 1);
+	size_t first = ACCESS_LOG_RING_SIZE - offset;
+	if(first > len) first = len;
+	
+	memcpy(ring->data + offset, src, first);
+	memcpy(ring->data, (const char *)src + first, len - first);
+}
+
+static void ring_copy_out(const struct access_log_ring *ring, uint64_t pos, void *dst, size_t len)
+{
+	size_t offset = pos & (ACCESS_LOG_RING_SIZE - 1);
+	size_t first = ACCESS_LOG_RING_SIZE - offset;
+	if(first > len) first = len;
+	
+	memcpy(dst, ring->data + offset, first);
+	memcpy((char *)dst + first, ring->data, len - first);
+}
+
+void access_log_write(const struct access_log_entry *entry)
+{
+	if(!access_log_enabled())
+	{
+		return;
+	}
+	
+	struct access_log_ring *ring = access_log_get_ring();
+	if(!ring) return;
+	
+	const char *fields[ACCESS_LOG_NUM_FIELDS] =
+	{
+		[ACCESS_LOG_METHOD] = entry->method,
+		[ACCESS_LOG_REPO] = entry->repo,
+		[ACCESS_LOG_END_POINT] = entry->end_point,
+		[ACCESS_LOG_USER] = entry->user,
+		[ACCESS_LOG_REQUEST_BODY] = entry->request_body,
+		[ACCESS_LOG_RESPONSE_BODY] = entry->response_body
+	};
+	
+	struct access_log_record record;
+	memset(&record, 0, sizeof(record));
+	record.status = entry->status;
+	record.time = time(NULL);
+	record.duration_us = entry->duration_us;
+	record.bytes_in = entry->bytes_in;
+	record.bytes_out = entry->bytes_out;
+	record.has_user = entry->user != NULL;
+	
+	size_t size = sizeof(record);
+	for(int i = 0; i < ACCESS_LOG_NUM_FIELDS; i++)
+	{
+		size_t len = 0;
+		if(i == ACCESS_LOG_REQUEST_BODY) len = entry->request_body_len;
+		else if(i == ACCESS_LOG_RESPONSE_BODY) len = entry->response_body_len;
+		else if(fields[i]) len = strlen(fields[i]);
+		
+		if(!fields[i]) len = 0;
+		if(len > access_log_field_max[i]) len = access_log_field_max[i];
+		
+		record.lengths[i] = len;
+		size += len;
+	}
+	
+	size = (size + 7) & ~(size_t)7;
+	record.size = size;
+	
+	uint64_t head = ring->head;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if(ACCESS_LOG_RING_SIZE - (head - tail) < size)
+	{
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		os_cond_signal(access_log.wakeup);
+		return;
+	}
+	
+	uint64_t pos = head;
+	ring_copy_in(ring, pos, &record, sizeof(record));
+	pos += sizeof(record);
+	
+	for(int i = 0; i < ACCESS_LOG_NUM_FIELDS; i++)
+	{
+		ring_copy_in(ring, pos, fields[i], record.lengths[i]);
+		pos += record.lengths[i];
+	}
+	
+	__atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);
+	
+	// past half full the flush thread is woken early. without the lock the
+	// signal can be missed, which only delays the flush until the timeout
+	if(head + size - tail > ACCESS_LOG_RING_SIZE / 2)
+	{
+		os_cond_signal(access_log.wakeup);
+	}
+}
+
+int access_log_sample(int every)
+{
+	if(every <= 0 || !access_log_enabled())
+	{
+		return 0;
+	}
+	
+	struct access_log_ring *ring = access_log_get_ring();
+	if(!ring) return 0;
+	
+	if(++ring->sample_count < every)
+	{
+		return 0;
+	}
+	
+	ring->sample_count = 0;
+	return 1;
+}
+
+static void access_log_capture(char *body, size_t *len, const void *data, int n)
+{
+	if(n <= 0 || *len >= ACCESS_LOG_BODY_MAX) return;
+	
+	size_t copy = ACCESS_LOG_BODY_MAX - *len;
+	if(copy > n) copy = n;
+	
+	memcpy(body + *len, data, copy);
+	*len += copy;
+}
+
+static int access_log_io_read(void *context, void *buffer, int n)
+{
+	struct access_log_io *lio = (struct access_log_io *)context;
+	const struct socket_io *inner = lio->wrapper.inner;
+	int ret = inner->read(inner->context, buffer, n);
+	access_log_capture(lio->request_body, &lio->request_len, buffer, ret);
+	return ret;
+}
+
+static int access_log_io_write(void *context, const void *buffer, int n)
+{
+	struct access_log_io *lio = (struct access_log_io *)context;
+	const struct socket_io *inner = lio->wrapper.inner;
+	int ret = inner->write(inner->context, buffer, n);
+	access_log_capture(lio->response_body, &lio->response_len, buffer, ret);
+	return ret;
+}
+
+void access_log_io_init(struct access_log_io *lio, const struct socket_io *inner)
+{
+	// files sent straight from disk go past without being captured
+	socket_io_wrapper_init(&lio->wrapper, inner);
+	lio->wrapper.io.read = access_log_io_read;
+	lio->wrapper.io.write = access_log_io_write;
+	lio->request_len = 0;
+	lio->response_len = 0;
+}
+
+static void access_log_flush_buffer(void)
+{
+	size_t written = 0;
+	while(written < access_log.buffer_used)
+	{
+		int n = os_write(access_log.fd, access_log.buffer + written, access_log.buffer_used - written);
+		if(n <= 0) break;
+		written += n;
+	}
+	
+	access_log.buffer_used = 0;
+}
+
+static char *access_log_reserve(size_t len)
+{
+	if(ACCESS_LOG_BUFFER_SIZE - access_log.buffer_used < len)
+	{
+		access_log_flush_buffer();
+	}
+	
+	return access_log.buffer + access_log.buffer_used;
+}
+
+static void access_log_append(const char *format, ...)
+{
+	char *p = access_log_reserve(ACCESS_LOG_LINE_MAX);
+	
+	va_list va;
+	va_start(va, format);
+	int n = vsnprintf(p, ACCESS_LOG_LINE_MAX, format, va);
+	va_end(va);
+	
+	if(n < 0) return;
+	if(n >= ACCESS_LOG_LINE_MAX) n = ACCESS_LOG_LINE_MAX - 1;
+	access_log.buffer_used += n;
+}
+
+// strings come from the client, so everything unprintable is escaped and
+// a line can't be broken up or faked
+static void access_log_append_string(const char *str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	char *start = access_log_reserve(4 * len + 2);
+	char *p = start;
+	
+	*p++ = '"';
+	for(size_t i = 0; i < len; i++)
+	{
+		unsigned char c = str[i];
+		if(c == '"' || c == '\\')
+		{
+			*p++ = '\\';
+			*p++ = c;
+		}
+		else if(c < 0x20 || c >= 0x7f)
+		{
+			*p++ = '\\';
+			*p++ = 'x';
+			*p++ = hex[c >> 4];
+			*p++ = hex[c & 15];
+		}
+		else
+		{
+			*p++ = c;
+		}
+	}
+	*p++ = '"';
+	
+	access_log.buffer_used += p - start;
+}
+
+static const char *access_log_timestamp(int64_t t)
+{
+	if(t != access_log.cached_time)
+	{
+		time_t now = t;
+		struct tm tm;
+		if(!localtime_r(&now, &tm) ||
+		   !strftime(access_log.cached_timestamp, sizeof(access_log.cached_timestamp), "%d/%b/%Y:%H:%M:%S %z", &tm))
+		{
+			access_log.cached_timestamp[0] = 0;
+		}
+		access_log.cached_time = t;
+	}
+	
+	return access_log.cached_timestamp;
+}
+
+static void access_log_format(const struct access_log_record *record, const char *strings)
+{
+	const char *fields[ACCESS_LOG_NUM_FIELDS];
+	for(int i = 0; i < ACCESS_LOG_NUM_FIELDS; i++)
+	{
+		fields[i] = strings;
+		strings += record->lengths[i];
+	}
+	
+	access_log_append("[%s] method=", access_log_timestamp(record->time));
+	access_log_append_string(fields[ACCESS_LOG_METHOD], record->lengths[ACCESS_LOG_METHOD]);
+	access_log_append(" repo=");
+	access_log_append_string(fields[ACCESS_LOG_REPO], record->lengths[ACCESS_LOG_REPO]);
+	access_log_append(" endpoint=");
+	access_log_append_string(fields[ACCESS_LOG_END_POINT], record->lengths[ACCESS_LOG_END_POINT]);
+	access_log_append(" status=%d bytes_in=%llu bytes_out=%llu duration_us=%llu user=",
+					  record->status,
+					  (unsigned long long)record->bytes_in,
+					  (unsigned long long)record->bytes_out,
+					  (unsigned long long)record->duration_us);
+	
+	if(record->has_user)
+	{
+		access_log_append_string(fields[ACCESS_LOG_USER], record->lengths[ACCESS_LOG_USER]);
+	}
+	else
+	{
+		access_log_append("-");
+	}
+	
+	if(record->lengths[ACCESS_LOG_REQUEST_BODY] > 0)
+	{
+		access_log_append(" request_body=");
+		access_log_append_string(fields[ACCESS_LOG_REQUEST_BODY], record->lengths[ACCESS_LOG_REQUEST_BODY]);
+	}
+	
+	if(record->lengths[ACCESS_LOG_RESPONSE_BODY] > 0)
+	{
+		access_log_append(" response_body=");
+		access_log_append_string(fields[ACCESS_LOG_RESPONSE_BODY], record->lengths[ACCESS_LOG_RESPONSE_BODY]);
+	}
+	
+	access_log_append("\n");
+}
+
+static void access_log_drain(void)
+{
+	static char strings[ACCESS_LOG_RING_SIZE];
+	
+	struct access_log_ring *ring = __atomic_load_n(&access_log.rings, __ATOMIC_ACQUIRE);
+	for(; ring; ring = ring->next)
+	{
+		uint64_t tail = ring->tail;
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		
+		while(tail < head)
+		{
+			struct access_log_record record;
+			ring_copy_out(ring, tail, &record, sizeof(record));
+			ring_copy_out(ring, tail + sizeof(record), strings, record.size - sizeof(record));
+			tail += record.size;
+			
+			access_log_format(&record, strings);
+		}
+		
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		
+		uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if(dropped != ring->reported)
+		{
+			access_log_append("[%s] dropped=%llu\n",
+							  access_log_timestamp(time(NULL)),
+							  (unsigned long long)(dropped - ring->reported));
+			ring->reported = dropped;
+		}
+	}
+	
+	access_log_flush_buffer();
+}
+
+static void *access_log_thread(void *data)
+{
+	os_mutex_lock(access_log.lock);
+	while(!access_log.stopping)
+	{
+		os_cond_timedwait(access_log.wakeup, access_log.lock, ACCESS_LOG_FLUSH_MS);
+		
+		os_mutex_unlock(access_log.lock);
+		access_log_drain();
+		os_mutex_lock(access_log.lock);
+	}
+	os_mutex_unlock(access_log.lock);
+	
+	return NULL;
+}
+
+int access_log_start(void)
+{
+	if(access_log.fd < 0)
+	{
+		return 0;
+	}
+	
+	access_log.buffer = malloc(ACCESS_LOG_BUFFER_SIZE);
+	if(!access_log.buffer)
+	{
+		goto error0;
+	}
+	
+	access_log.lock = os_mutex_create();
+	if(!access_log.lock)
+	{
+		goto error1;
+	}
+	
+	access_log.wakeup = os_cond_create();
+	if(!access_log.wakeup)
+	{
+		goto error2;
+	}
+	
+	access_log.cached_time = -1;
+	access_log.stopping = 0;
+	access_log.thread = os_thread_create(access_log_thread, NULL);
+	if(!access_log.thread)
+	{
+		goto error3;
+	}
+	
+	return 0;
+	
+error3:
+	os_cond_destroy(access_log.wakeup);
+	access_log.wakeup = NULL;
+error2:
+	os_mutex_destroy(access_log.lock);
+	access_log.lock = NULL;
+error1:
+	free(access_log.buffer);
+	access_log.buffer = NULL;
+error0:
+	return -1;
+}
+
+void access_log_stop(void)
+{
+	if(access_log.thread)
+	{
+		os_mutex_lock(access_log.lock);
+		access_log.stopping = 1;
+		os_cond_signal(access_log.wakeup);
+		os_mutex_unlock(access_log.lock);
+		
+		os_thread_join(access_log.thread, NULL);
+		access_log.thread = NULL;
+		
+		// entries logged while the thread was finishing up
+		access_log_drain();
+		
+		os_cond_destroy(access_log.wakeup);
+		access_log.wakeup = NULL;
+		os_mutex_destroy(access_log.lock);
+		access_log.lock = NULL;
+		free(access_log.buffer);
+		access_log.buffer = NULL;
+	}
+	
+	if(access_log.fd >= 0)
+	{
+		os_close(access_log.fd);
+		access_log.fd = -1;
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "socket_io.h"
+
+// Request threads append their entries to rings of their own without
+// taking a lock, and a background thread formats and writes them out in
+// batches. When a ring is full the entry is dropped and counted instead of
+// making the request wait.
+
+#define ACCESS_LOG_BODY_MAX 2048
+
+struct access_log_entry
+{
+	const char *method;
+	const char *repo;
+	const char *end_point;
+	const char *user; // NULL if the request wasn't authenticated
+	int status; // 0 if no status was sent
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t duration_us;
+	const char *request_body; // only set for sampled requests
+	size_t request_body_len;
+	const char *response_body;
+	size_t response_body_len;
+};
+
+// keeps the start of the bodies going through, up to ACCESS_LOG_BODY_MAX each
+struct access_log_io
+{
+	struct socket_io_wrapper wrapper;
+	size_t request_len;
+	size_t response_len;
+	char request_body[ACCESS_LOG_BODY_MAX];
+	char response_body[ACCESS_LOG_BODY_MAX];
+};
+
+// the file is opened before the process drops root and gets chrooted
+int access_log_open(const char *path);
+int access_log_start(void);
+// writes out everything logged so far and closes the file
+void access_log_stop(void);
+
+int access_log_enabled(void);
+void access_log_write(const struct access_log_entry *entry);
+
+// true for every nth request of the calling thread
+int access_log_sample(int every);
+void access_log_io_init(struct access_log_io *lio, const struct socket_io *inner);
+
+#endif
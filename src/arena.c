@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct arena_block
+{
+	struct arena_block *next;
+	size_t size;
+	char data[];
+};
+
+void arena_init(struct arena *arena, void *buffer, size_t size)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->initial = buffer;
+	arena->initial_size = size;
+	arena->base = buffer;
+	arena->size = size;
+}
+
+void arena_reset(struct arena *arena)
+{
+	while(arena->blocks)
+	{
+		struct arena_block *block = arena->blocks;
+		arena->blocks = block->next;
+		free(block);
+	}
+	
+	arena->base = arena->initial;
+	arena->size = arena->initial_size;
+	arena->used = 0;
+	arena->last = NULL;
+}
+
+// returns the offset in the current block the next allocation starts at
+static size_t arena_aligned_used(const struct arena *arena)
+{
+	uintptr_t next = (uintptr_t)(arena->base + arena->used);
+	return arena->used + (-next & (ARENA_ALIGN - 1));
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	size_t start = arena_aligned_used(arena);
+	if(start > arena->size || size > arena->size - start)
+	{
+		// the rest of the current block is given up
+		size_t block_size = ARENA_BLOCK_SIZE;
+		if(size + ARENA_ALIGN > block_size - sizeof(struct arena_block))
+		{
+			block_size = sizeof(struct arena_block) + size + ARENA_ALIGN;
+		}
+		
+		struct arena_block *block = malloc(block_size);
+		if(!block)
+		{
+			return NULL;
+		}
+		
+		block->next = arena->blocks;
+		block->size = block_size - sizeof(struct arena_block);
+		arena->blocks = block;
+		
+		arena->base = block->data;
+		arena->size = block->size;
+		arena->used = 0;
+		start = arena_aligned_used(arena);
+	}
+	
+	arena->used = start + size;
+	arena->last = arena->base + start;
+	return arena->last;
+}
+
+void *arena_calloc(struct arena *arena, size_t count, size_t size)
+{
+	if(size && count > SIZE_MAX / size)
+	{
+		return NULL;
+	}
+	
+	void *ptr = arena_alloc(arena, count * size);
+	if(ptr)
+	{
+		memset(ptr, 0, count * size);
+	}
+	
+	return ptr;
+}
+
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+	if(!ptr)
+	{
+		return arena_alloc(arena, new_size);
+	}
+	
+	// the last allocation grows or shrinks where it is if the block allows
+	if(ptr == arena->last)
+	{
+		size_t start = (char *)ptr - arena->base;
+		if(new_size <= arena->size - start)
+		{
+			arena->used = start + new_size;
+			return ptr;
+		}
+	}
+	
+	if(new_size <= old_size)
+	{
+		return ptr;
+	}
+	
+	void *new_ptr = arena_alloc(arena, new_size);
+	if(new_ptr)
+	{
+		memcpy(new_ptr, ptr, old_size);
+	}
+	
+	return new_ptr;
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t max_len)
+{
+	size_t len = strnlen(str, max_len);
+	char *copy = arena_alloc(arena, len + 1);
+	if(copy)
+	{
+		memcpy(copy, str, len);
+		copy[len] = 0;
+	}
+	
+	return copy;
+}
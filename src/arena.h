@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A bump allocator for the scratch memory of a single request. The first
+// block is supplied by the caller, normally on the handling thread's stack,
+// so small requests never reach malloc. Larger ones spill into heap blocks.
+// Nothing is freed individually, arena_reset releases everything at once.
+
+#define ARENA_ALIGN 16
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arena_block;
+
+struct arena
+{
+	char *base;
+	size_t size;
+	size_t used;
+	void *last; // most recent allocation, which can grow in place
+	char *initial;
+	size_t initial_size;
+	struct arena_block *blocks;
+};
+
+void arena_init(struct arena *arena, void *buffer, size_t size);
+void arena_reset(struct arena *arena);
+
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_calloc(struct arena *arena, size_t count, size_t size);
+// the new memory is not cleared
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size, size_t new_size);
+char *arena_strndup(struct arena *arena, const char *str, size_t max_len);
+
+#endif
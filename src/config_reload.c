@@ -0,0 +1,515 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config_reload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "compat/string.h"
+#include "compat/queue.h"
+#include "os/mutex.h"
+#include "os/threads.h"
+#include "os/io.h"
+#include "os/socket.h"
+#include "os/process.h"
+#include "os/signal.h"
+#include "configuration.h"
+#include "htpasswd.h"
+#include "metrics.h"
+#include "repo_manager.h"
+#include "socket_utils.h"
+
+struct config_load_response
+{
+	int32_t status; // 0 if the config was loaded
+	uint32_t size; // size of the serialized config following the response
+};
+
+static struct
+{
+	os_mutex_t lock; // protects current and the reference counts
+	struct git_lfs_config *current;
+	struct git_lfs_config *initial; // belongs to the caller
+	uint32_t next_repo_id; // ids are never reused, so tokens can't move to another repo
+	int loader_socket;
+	struct repo_manager *mgr;
+	os_thread_t thread;
+	volatile int stopping;
+} config_reload;
+
+// the parser keeps global state and exits on some errors, so each load
+// happens in a child of its own that writes the serialized config back
+static void *config_loader_load(const char *config_path, size_t *size)
+{
+	int fd[2];
+	if(os_socketpair(fd) < 0)
+	{
+		return NULL;
+	}
+	
+	int pid = os_fork();
+	if(pid < 0)
+	{
+		os_close(fd[0]);
+		os_close(fd[1]);
+		return NULL;
+	}
+	
+	if(pid == 0)
+	{
+		os_close(fd[0]);
+		
+		int status = 1;
+		struct git_lfs_config *config = git_lfs_load_config(config_path);
+		if(config)
+		{
+			size_t config_size;
+			void *config_data = git_lfs_config_serialize(config, &config_size);
+			if(config_data && socket_write_fully(fd[1], config_data, config_size) == config_size)
+			{
+				status = 0;
+			}
+			
+			free(config_data);
+			git_lfs_free_config(config);
+		}
+		
+		os_close(fd[1]);
+		exit(status);
+	}
+	
+	os_close(fd[1]);
+	
+	char *data = NULL;
+	size_t used = 0;
+	size_t capacity = 0;
+	int failed = 0;
+	for(;;)
+	{
+		if(used == capacity)
+		{
+			size_t new_capacity = capacity ? capacity * 2 : 64 * 1024;
+			char *new_data = new_capacity <= RELOAD_CONFIG_MAX_SIZE ? realloc(data, new_capacity) : NULL;
+			if(!new_data)
+			{
+				failed = 1;
+				break;
+			}
+			
+			data = new_data;
+			capacity = new_capacity;
+		}
+		
+		int n = os_read(fd[0], data + used, capacity - used);
+		if(n < 0) failed = 1;
+		if(n <= 0) break;
+		used += n;
+	}
+	
+	// closed first, so the child can't be stuck writing
+	os_close(fd[0]);
+	
+	int exit_status;
+	if(os_waitpid(pid, &exit_status) < 0 || exit_status != 0)
+	{
+		failed = 1;
+	}
+	
+	if(failed || used == 0)
+	{
+		if(data) explicit_bzero(data, used);
+		free(data);
+		return NULL;
+	}
+	
+	*size = used;
+	return data;
+}
+
+int config_loader_service(int socket, const char *config_path)
+{
+	char request;
+	while(socket_read_fully(socket, &request, sizeof(request)) == sizeof(request))
+	{
+		struct config_load_response response;
+		memset(&response, 0, sizeof(response));
+		response.status = -1;
+		
+		size_t size = 0;
+		void *data = config_loader_load(config_path, &size);
+		if(data)
+		{
+			response.status = 0;
+			response.size = size;
+		}
+		
+		int ret = socket_write_fully(socket, &response, sizeof(response)) == sizeof(response) &&
+				  (!data || socket_write_fully(socket, data, size) == size) ? 0 : -1;
+		
+		if(data)
+		{
+			explicit_bzero(data, size);
+			free(data);
+		}
+		
+		if(ret < 0)
+		{
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+static int config_reload_request(void **data, size_t *size)
+{
+	char request = 'r';
+	struct config_load_response response;
+	
+	if(socket_write_fully(config_reload.loader_socket, &request, sizeof(request)) != sizeof(request) ||
+	   socket_read_fully(config_reload.loader_socket, &response, sizeof(response)) != sizeof(response))
+	{
+		return -1;
+	}
+	
+	if(response.status != 0)
+	{
+		return -1;
+	}
+	
+	*data = malloc(response.size);
+	if(!*data)
+	{
+		// keeps the socket in step with the loader
+		char buffer[256];
+		for(uint32_t left = response.size; left > 0;)
+		{
+			int n = left < sizeof(buffer) ? left : sizeof(buffer);
+			if(socket_read_fully(config_reload.loader_socket, buffer, n) != n) break;
+			left -= n;
+		}
+		
+		return -1;
+	}
+	
+	if(socket_read_fully(config_reload.loader_socket, *data, response.size) != response.size)
+	{
+		free(*data);
+		*data = NULL;
+		return -1;
+	}
+	
+	*size = response.size;
+	return 0;
+}
+
+// the processes keep running with what they were started with
+static void config_reload_keep_int(const char *name, int *value, int current)
+{
+	if(*value != current)
+	{
+		fprintf(stderr, "warning: Changing %s requires a restart.\n", name);
+		*value = current;
+	}
+}
+
+static int config_reload_keep_string(const char *name, char **value, const char *current)
+{
+	if(*value == current || (*value && current && 0 == strcmp(*value, current)))
+	{
+		return 0;
+	}
+	
+	fprintf(stderr, "warning: Changing %s requires a restart.\n", name);
+	
+	char *copy = NULL;
+	if(current)
+	{
+		copy = strdup(current);
+		if(!copy) return -1;
+	}
+	
+	free(*value);
+	*value = copy;
+	
+	return 0;
+}
+
+static const struct git_lfs_repo *find_repo_by_name(const struct git_lfs_config *config, const char *name)
+{
+	const struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		if(repo->name && name && 0 == strcmp(repo->name, name))
+		{
+			return repo;
+		}
+	}
+	
+	return NULL;
+}
+
+static int config_reload_merge(struct git_lfs_config *config, const struct git_lfs_config *current)
+{
+	// the repo roots are relative to it
+	if((config->chroot_path == NULL) != (current->chroot_path == NULL) ||
+	   (config->chroot_path && 0 != strcmp(config->chroot_path, current->chroot_path)))
+	{
+		fprintf(stderr, "Config reload failed. Changing chroot_path requires a restart.\n");
+		return -1;
+	}
+	
+	config->verbose = current->verbose;
+	config_reload_keep_int("port", &config->port, current->port);
+	config_reload_keep_int("fastcgi_server", &config->fastcgi_server, current->fastcgi_server);
+	config_reload_keep_int("event_server", &config->event_server, current->event_server);
+	config_reload_keep_int("fastcgi_listeners", &config->fastcgi_listeners, current->fastcgi_listeners);
+	config_reload_keep_int("num_threads", &config->num_threads, current->num_threads);
+	config_reload_keep_int("num_repo_managers", &config->num_repo_managers, current->num_repo_managers);
+	config_reload_keep_int("scrub_rate", &config->scrub_rate, current->scrub_rate);
+	config_reload_keep_int("scrub_interval", &config->scrub_interval, current->scrub_interval);
+	
+	if(config_reload_keep_string("fastcgi_socket", &config->fastcgi_socket, current->fastcgi_socket) < 0 ||
+	   config_reload_keep_string("user", &config->user, current->user) < 0 ||
+	   config_reload_keep_string("group", &config->group, current->group) < 0 ||
+	   config_reload_keep_string("process_chroot", &config->process_chroot, current->process_chroot) < 0 ||
+	   config_reload_keep_string("access_log", &config->access_log, current->access_log) < 0)
+	{
+		fprintf(stderr, "Config reload failed. Out of memory.\n");
+		return -1;
+	}
+	
+	// a repo keeps its id as long as its name stays the same, which keeps
+	// its access tokens and upload tickets working across the reload
+	struct git_lfs_repo *repo, *prev;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		const struct git_lfs_repo *current_repo = find_repo_by_name(current, repo->name);
+		
+		if(current_repo)
+		{
+			SLIST_FOREACH(prev, &config->repos, entries)
+			{
+				if(prev == repo || prev->id == current_repo->id) break;
+			}
+			
+			// a second repo of the same name gets an id of its own
+			if(prev == repo)
+			{
+				repo->id = current_repo->id;
+				continue;
+			}
+		}
+		
+		repo->id = config_reload.next_repo_id++;
+	}
+	
+	return 0;
+}
+
+// a config of the http process, which may have metrics attached
+static void config_reload_free(struct git_lfs_config *config)
+{
+	metrics_detach_repos(config);
+	git_lfs_free_config(config);
+}
+
+static void config_reload_swap(struct git_lfs_config *config)
+{
+	os_mutex_lock(config_reload.lock);
+	struct git_lfs_config *old_config = config_reload.current;
+	config->refs = 1;
+	config_reload.current = config;
+	int refs = --old_config->refs;
+	os_mutex_unlock(config_reload.lock);
+	
+	if(refs == 0 && old_config != config_reload.initial)
+	{
+		config_reload_free(old_config);
+	}
+}
+
+static void config_reload_now(void)
+{
+	void *data = NULL;
+	size_t size = 0;
+	struct git_lfs_config *config = NULL;
+	char error_msg[128] = "";
+	
+	if(config_reload_request(&data, &size) < 0)
+	{
+		fprintf(stderr, "Config reload failed. The config could not be loaded.\n");
+		goto error;
+	}
+	
+	config = git_lfs_config_deserialize(data, size);
+	explicit_bzero(data, size);
+	free(data);
+	data = NULL;
+	
+	if(!config)
+	{
+		fprintf(stderr, "Config reload failed. Unable to read the config.\n");
+		goto error;
+	}
+	
+	if(config_reload_merge(config, config_reload.current) < 0)
+	{
+		goto error;
+	}
+	
+	// repos that stay keep counting where they were
+	if(metrics_attach_repos(config, config_reload.current) < 0)
+	{
+		fprintf(stderr, "Config reload failed. Out of memory.\n");
+		goto error;
+	}
+	
+	data = git_lfs_config_serialize(config, &size);
+	if(!data)
+	{
+		fprintf(stderr, "Config reload failed. Out of memory.\n");
+		goto error;
+	}
+	
+	if(git_lfs_repo_reload_config(config_reload.mgr, data, size, error_msg, sizeof(error_msg)) < 0)
+	{
+		fprintf(stderr, "Config reload failed. %s\n", error_msg);
+		goto error;
+	}
+	
+	// only the repo managers check passwords
+	struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		free_htpasswd(repo->auth);
+		repo->auth = NULL;
+	}
+	
+	if(config->verbose)
+	{
+		printf("Config reloaded.\n");
+		SLIST_FOREACH(repo, &config->repos, entries)
+		{
+			printf("\tRepo \"%s\" (%d) at %s\n", repo->name, repo->id, repo->uri);
+		}
+	}
+	
+	config_reload_swap(config);
+	config = NULL;
+	
+error:
+	if(data)
+	{
+		explicit_bzero(data, size);
+		free(data);
+	}
+	
+	if(config)
+	{
+		config_reload_free(config);
+	}
+}
+
+static void *config_reload_thread(void *data)
+{
+	while(os_signal_wait(SIGHUP) == 0 && !config_reload.stopping)
+	{
+		config_reload_now();
+	}
+	
+	return NULL;
+}
+
+int config_reload_start(struct git_lfs_config *config, int loader_socket, struct repo_manager *mgr)
+{
+	memset(&config_reload, 0, sizeof(config_reload));
+	
+	config_reload.lock = os_mutex_create();
+	if(!config_reload.lock)
+	{
+		return -1;
+	}
+	
+	config->refs = 1;
+	config_reload.current = config;
+	config_reload.initial = config;
+	config_reload.loader_socket = loader_socket;
+	config_reload.mgr = mgr;
+	
+	struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		if(repo->id >= config_reload.next_repo_id)
+		{
+			config_reload.next_repo_id = repo->id + 1;
+		}
+	}
+	
+	config_reload.thread = os_thread_create(config_reload_thread, NULL);
+	if(!config_reload.thread)
+	{
+		os_mutex_destroy(config_reload.lock);
+		config_reload.lock = NULL;
+		return -1;
+	}
+	
+	return 0;
+}
+
+void config_reload_stop(void)
+{
+	if(!config_reload.thread)
+	{
+		return;
+	}
+	
+	config_reload.stopping = 1;
+	os_kill(os_getpid(), SIGHUP);
+	os_thread_join(config_reload.thread, NULL);
+	config_reload.thread = NULL;
+	
+	if(config_reload.current != config_reload.initial)
+	{
+		config_reload_free(config_reload.current);
+	}
+	config_reload.current = NULL;
+	
+	os_mutex_destroy(config_reload.lock);
+	config_reload.lock = NULL;
+}
+
+struct git_lfs_config *config_reload_acquire(void)
+{
+	os_mutex_lock(config_reload.lock);
+	struct git_lfs_config *config = config_reload.current;
+	config->refs++;
+	os_mutex_unlock(config_reload.lock);
+	
+	return config;
+}
+
+void config_reload_release(struct git_lfs_config *config)
+{
+	os_mutex_lock(config_reload.lock);
+	int refs = --config->refs;
+	os_mutex_unlock(config_reload.lock);
+	
+	if(refs == 0 && config != config_reload.initial)
+	{
+		config_reload_free(config);
+	}
+}
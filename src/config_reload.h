@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CONFIG_RELOAD_H
+#define CONFIG_RELOAD_H
+
+struct git_lfs_config;
+struct repo_manager;
+
+// The http process and the repo managers are chrooted away from the config
+// files, so on SIGHUP a loader process that was forked before dropping root
+// parses them again. The repo managers switch over to the new config right
+// away, the http process once the requests using the old one are done.
+
+// serves reload requests of the http process until it goes away
+int config_loader_service(int socket, const char *config_path);
+
+// starts waiting for SIGHUP, which must be blocked in every thread. config
+// stays owned by the caller and is only freed after config_reload_stop.
+int config_reload_start(struct git_lfs_config *config, int loader_socket, struct repo_manager *mgr);
+void config_reload_stop(void);
+
+// the config to serve a request with, which stays valid until released
+struct git_lfs_config *config_reload_acquire(void);
+void config_reload_release(struct git_lfs_config *config);
+
+#endif
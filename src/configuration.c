@@ -19,6 +19,9 @@
 #include <string.h>
 #include "compat/string.h"
 #include "compat/queue.h"
+#include "htpasswd.h"
+#include "object_index.h"
+#include "repo_router.h"
 
 extern int yyparse (void);
 
@@ -28,8 +31,12 @@ struct git_lfs_config *git_lfs_load_config(const char *path)
 	if(!config) return NULL;
 
 	config->fastcgi_server = 1;
+	config->event_server = 1;
 	config->port = 80;
 	config->num_threads = 10;
+	config->fastcgi_listeners = 1;
+	config->num_repo_managers = 1;
+	config->scrub_interval = 7 * 24 * 3600;
 
 	SLIST_INIT(&config->repos);
 
@@ -44,6 +51,18 @@ struct git_lfs_config *git_lfs_load_config(const char *path)
 		goto error;
 	}
 	
+	if(config->num_repo_managers < 1 || config->num_repo_managers > 64)
+	{
+		fprintf(stderr, "error: Invalid number of repo managers (%d). Must be >= 1 and <= 64.\n", config->num_repo_managers);
+		goto error;
+	}
+	
+	if(config->scrub_rate < 0 || config->scrub_interval < 0)
+	{
+		fprintf(stderr, "error: scrub_rate and scrub_interval must be >= 0.\n");
+		goto error;
+	}
+	
 	if(!config->user)
 	{
 		config->user = strdup("git-lfs");
@@ -68,6 +87,12 @@ struct git_lfs_config *git_lfs_load_config(const char *path)
 	struct git_lfs_repo *repo;
 	SLIST_FOREACH(repo, &config->repos, entries)
 	{
+		if(repo->object_index_size < 0)
+		{
+			fprintf(stderr, "error: The repo '%s' object_index (%d) must be >= 0.\n", repo->name, repo->object_index_size);
+			goto error;
+		}
+		
 		if(chroot_path_len)
 		{
 			if(0 != strncmp(config->chroot_path, repo->full_root_dir, chroot_path_len) ||
@@ -90,7 +115,7 @@ struct git_lfs_config *git_lfs_load_config(const char *path)
 		config->fastcgi_socket = strdup("/var/lib/git-lfs-fcgi/run/git-lfs-fcgi.sock");
 	}
 	
-	if(config->fastcgi_server && config->fastcgi_socket[0] != ':')
+	if(config->fastcgi_server && !strchr(config->fastcgi_socket, ':'))
 	{
 		size_t process_chroot_path_len = strlen(config->process_chroot);
 		if(0 != strncmp(config->fastcgi_socket, config->process_chroot, process_chroot_path_len) ||
@@ -104,6 +129,12 @@ struct git_lfs_config *git_lfs_load_config(const char *path)
 		free(config->fastcgi_socket);
 		config->fastcgi_socket = chroot_fastcgi_socket;
 	}
+	
+	config->router = repo_router_create(config);
+	if(!config->router)
+	{
+		goto error;
+	}
 
 	return config;
 error:
@@ -115,10 +146,12 @@ void git_lfs_free_config(struct git_lfs_config *config)
 {
 	free(config->base_url);
 	free(config->fastcgi_socket);
+	free(config->access_log);
 	free(config->chroot_path);
 	free(config->user);
 	free(config->group);
 	free(config->process_chroot);
+	repo_router_free(config->router);
 
 	while (!SLIST_EMPTY(&config->repos))
 	{
@@ -126,15 +159,309 @@ void git_lfs_free_config(struct git_lfs_config *config)
 		SLIST_REMOVE_HEAD(&config->repos, entries);
 
 		free(repo->auth_realm);
-		free(repo->auth);
+		free_htpasswd(repo->auth);
 		free(repo->name);
 		free(repo->uri);
 		free(repo->root_dir);
 		free(repo->full_root_dir);
 		free(repo->base_url);
+		object_index_free(repo->object_index);
 		
 		free(repo);
 	}
 
 	free(config);
 }
+
+// A reload hands the parsed config from the process that can read the
+// config files to the chrooted ones as native ints and length prefixed
+// strings. Both ends are the same binary on the same machine.
+
+struct config_writer
+{
+	char *data;
+	size_t size;
+	size_t capacity;
+	int failed;
+};
+
+struct config_reader
+{
+	const char *data;
+	size_t size;
+	size_t pos;
+	int failed;
+};
+
+static void config_write(struct config_writer *writer, const void *data, size_t size)
+{
+	if(writer->failed) return;
+	
+	if(writer->size + size > writer->capacity)
+	{
+		size_t capacity = writer->capacity ? writer->capacity : 4096;
+		while(capacity < writer->size + size)
+		{
+			capacity *= 2;
+		}
+		
+		char *new_data = realloc(writer->data, capacity);
+		if(!new_data)
+		{
+			writer->failed = 1;
+			return;
+		}
+		
+		writer->data = new_data;
+		writer->capacity = capacity;
+	}
+	
+	memcpy(writer->data + writer->size, data, size);
+	writer->size += size;
+}
+
+static void config_write_int(struct config_writer *writer, int32_t value)
+{
+	config_write(writer, &value, sizeof(value));
+}
+
+// NULL is written as a length of -1
+static void config_write_string(struct config_writer *writer, const char *str)
+{
+	if(!str)
+	{
+		config_write_int(writer, -1);
+		return;
+	}
+	
+	size_t len = strlen(str);
+	config_write_int(writer, (int32_t)len);
+	config_write(writer, str, len);
+}
+
+static int32_t config_read_int(struct config_reader *reader)
+{
+	int32_t value = 0;
+	
+	if(reader->failed || reader->size - reader->pos < sizeof(value))
+	{
+		reader->failed = 1;
+		return 0;
+	}
+	
+	memcpy(&value, reader->data + reader->pos, sizeof(value));
+	reader->pos += sizeof(value);
+	
+	return value;
+}
+
+static char *config_read_string(struct config_reader *reader)
+{
+	int32_t len = config_read_int(reader);
+	if(reader->failed || len == -1)
+	{
+		return NULL;
+	}
+	
+	if(len < 0 || reader->size - reader->pos < (size_t)len)
+	{
+		reader->failed = 1;
+		return NULL;
+	}
+	
+	char *str = strndup(reader->data + reader->pos, len);
+	if(!str)
+	{
+		reader->failed = 1;
+		return NULL;
+	}
+	
+	reader->pos += len;
+	
+	return str;
+}
+
+void *git_lfs_config_serialize(const struct git_lfs_config *config, size_t *size)
+{
+	struct config_writer writer;
+	memset(&writer, 0, sizeof(writer));
+	
+	config_write_int(&writer, config->verbose);
+	config_write_int(&writer, config->port);
+	config_write_string(&writer, config->base_url);
+	config_write_int(&writer, config->fastcgi_server);
+	config_write_int(&writer, config->event_server);
+	config_write_string(&writer, config->fastcgi_socket);
+	config_write_int(&writer, config->fastcgi_listeners);
+	config_write_int(&writer, config->metrics);
+	config_write_string(&writer, config->access_log);
+	config_write_int(&writer, config->access_log_sample);
+	config_write_int(&writer, config->scrub_rate);
+	config_write_int(&writer, config->scrub_interval);
+	config_write_int(&writer, config->num_threads);
+	config_write_int(&writer, config->num_repo_managers);
+	config_write_string(&writer, config->chroot_path);
+	config_write_string(&writer, config->user);
+	config_write_string(&writer, config->group);
+	config_write_string(&writer, config->process_chroot);
+	
+	int32_t num_repos = 0;
+	const struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		num_repos++;
+	}
+	config_write_int(&writer, num_repos);
+	
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		config_write_int(&writer, (int32_t)repo->id);
+		config_write_string(&writer, repo->base_url);
+		config_write_string(&writer, repo->name);
+		config_write_string(&writer, repo->uri);
+		config_write_string(&writer, repo->full_root_dir);
+		config_write_string(&writer, repo->root_dir);
+		config_write_int(&writer, repo->verify_uploads);
+		config_write_int(&writer, repo->object_index_size);
+		config_write_int(&writer, repo->enable_authentication);
+		config_write_string(&writer, repo->auth_realm);
+		
+		// -1 if the repo has no htpasswd file
+		if(!repo->auth)
+		{
+			config_write_int(&writer, -1);
+			continue;
+		}
+		
+		int32_t num_users = 0;
+		const struct password_entry *user;
+		SLIST_FOREACH(user, &repo->auth->users, entries)
+		{
+			num_users++;
+		}
+		config_write_int(&writer, num_users);
+		
+		SLIST_FOREACH(user, &repo->auth->users, entries)
+		{
+			config_write_string(&writer, user->username);
+			config_write_string(&writer, user->bcrypt_hash);
+		}
+	}
+	
+	if(writer.failed)
+	{
+		free(writer.data);
+		return NULL;
+	}
+	
+	*size = writer.size;
+	return writer.data;
+}
+
+struct git_lfs_config *git_lfs_config_deserialize(const void *data, size_t size)
+{
+	struct config_reader reader;
+	memset(&reader, 0, sizeof(reader));
+	reader.data = data;
+	reader.size = size;
+	
+	struct git_lfs_config *config = (struct git_lfs_config *)calloc(1, sizeof(struct git_lfs_config));
+	if(!config) return NULL;
+	
+	SLIST_INIT(&config->repos);
+	
+	config->verbose = config_read_int(&reader);
+	config->port = config_read_int(&reader);
+	config->base_url = config_read_string(&reader);
+	config->fastcgi_server = config_read_int(&reader);
+	config->event_server = config_read_int(&reader);
+	config->fastcgi_socket = config_read_string(&reader);
+	config->fastcgi_listeners = config_read_int(&reader);
+	config->metrics = config_read_int(&reader);
+	config->access_log = config_read_string(&reader);
+	config->access_log_sample = config_read_int(&reader);
+	config->scrub_rate = config_read_int(&reader);
+	config->scrub_interval = config_read_int(&reader);
+	config->num_threads = config_read_int(&reader);
+	config->num_repo_managers = config_read_int(&reader);
+	config->chroot_path = config_read_string(&reader);
+	config->user = config_read_string(&reader);
+	config->group = config_read_string(&reader);
+	config->process_chroot = config_read_string(&reader);
+	
+	int32_t num_repos = config_read_int(&reader);
+	struct git_lfs_repo *last = NULL;
+	for(int32_t i = 0; i < num_repos && !reader.failed; i++)
+	{
+		struct git_lfs_repo *repo = (struct git_lfs_repo *)calloc(1, sizeof(struct git_lfs_repo));
+		if(!repo)
+		{
+			goto error;
+		}
+		
+		// keeps the order of the config file
+		if(last)
+		{
+			SLIST_INSERT_AFTER(last, repo, entries);
+		}
+		else
+		{
+			SLIST_INSERT_HEAD(&config->repos, repo, entries);
+		}
+		last = repo;
+		
+		repo->id = (uint32_t)config_read_int(&reader);
+		repo->base_url = config_read_string(&reader);
+		repo->name = config_read_string(&reader);
+		repo->uri = config_read_string(&reader);
+		repo->full_root_dir = config_read_string(&reader);
+		repo->root_dir = config_read_string(&reader);
+		repo->verify_uploads = config_read_int(&reader);
+		repo->object_index_size = config_read_int(&reader);
+		repo->enable_authentication = config_read_int(&reader);
+		repo->auth_realm = config_read_string(&reader);
+		
+		int32_t num_users = config_read_int(&reader);
+		if(reader.failed || num_users < 0)
+		{
+			continue;
+		}
+		
+		repo->auth = create_htpasswd();
+		if(!repo->auth)
+		{
+			goto error;
+		}
+		
+		for(int32_t j = 0; j < num_users && !reader.failed; j++)
+		{
+			char *username = config_read_string(&reader);
+			char *bcrypt_hash = config_read_string(&reader);
+			
+			if(username && bcrypt_hash && htpasswd_add_user(repo->auth, username, bcrypt_hash) < 0)
+			{
+				reader.failed = 1;
+			}
+			
+			free(username);
+			if(bcrypt_hash) explicit_bzero(bcrypt_hash, strlen(bcrypt_hash));
+			free(bcrypt_hash);
+		}
+	}
+	
+	if(reader.failed || reader.pos != size)
+	{
+		goto error;
+	}
+	
+	config->router = repo_router_create(config);
+	if(!config->router)
+	{
+		goto error;
+	}
+	
+	return config;
+error:
+	git_lfs_free_config(config);
+	return NULL;
+}
@@ -18,6 +18,7 @@
 #define CONFIGURATION_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include "compat/queue.h"
 
 #ifndef PATH_MAX
@@ -25,6 +26,9 @@
 #endif
 
 struct htpasswd;
+struct metrics_repo;
+struct object_index;
+struct repo_router;
 struct git_lfs_repo
 {
 	SLIST_ENTRY(git_lfs_repo) entries;
@@ -36,9 +40,12 @@ struct git_lfs_repo
 	char *full_root_dir; // full path to the root_dir
 	char *root_dir; // root directory for files, relative to chroot_path
 	int verify_uploads; // upload verification
+	int object_index_size; // number of objects the index is sized for, 0 to disable it
+	struct object_index *object_index; // shared by the repo managers
 	int enable_authentication;
 	char *auth_realm;
 	struct htpasswd *auth;
+	struct metrics_repo *metrics; // request counters of the http process
 };
 
 SLIST_HEAD(git_lfs_repo_list, git_lfs_repo);
@@ -52,9 +59,17 @@ struct git_lfs_config
 	char *base_url; // eg. http://example.com
 	
 	int fastcgi_server; // enable fastcgi server
+	int event_server; // standalone server uses the event driven engine instead of mongoose
 	char *fastcgi_socket; // socket path or :port for fastcgi
+	int fastcgi_listeners; // number of fastcgi sockets, each with its own share of the threads
+	int metrics; // serve counters and latency histograms at /metrics
+	char *access_log; // path of the access log, NULL to disable it
+	int access_log_sample; // log the bodies of every nth request, 0 for none
+	int scrub_rate; // bytes per second the object scrubber reads, 0 to disable it
+	int scrub_interval; // seconds from the start of one scrub of a repo to the next
 
 	int num_threads;
+	int num_repo_managers; // number of privileged repo manager processes
 	
 	char *chroot_path;
 	char *user;
@@ -63,11 +78,18 @@ struct git_lfs_config
 	char *process_chroot;
 
 	struct git_lfs_repo_list repos;
+	struct repo_router *router; // finds the repo of a request uri
+	
+	int refs; // requests using it, plus one while it is the current config
 };
 
 struct git_lfs_config *git_lfs_load_config(const char *path);
 void git_lfs_free_config(struct git_lfs_config *config);
 
+// flattens a config so it can be passed to another process on reload
+void *git_lfs_config_serialize(const struct git_lfs_config *config, size_t *size);
+struct git_lfs_config *git_lfs_config_deserialize(const void *data, size_t size);
+
 extern int config_scan_init(const char *filename);
 int config_parse_init(struct git_lfs_config *config);
 
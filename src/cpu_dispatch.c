@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "cpu_dispatch.h"
+
+const void *cpu_dispatch_pick(const void **cache,
+							  const void *impls,
+							  int count,
+							  size_t impl_size,
+							  int (*usable)(const void *impl, int arg),
+							  int arg)
+{
+	const void *impl = __atomic_load_n(cache, __ATOMIC_RELAXED);
+	if(impl) return impl;
+	
+	const char *table = impls;
+	impl = table + (count - 1) * impl_size;
+	for(int i = 0; i < count; i++) {
+		if(usable(table + i * impl_size, arg)) {
+			impl = table + i * impl_size;
+			break;
+		}
+	}
+	
+	__atomic_store_n(cache, impl, __ATOMIC_RELAXED);
+	return impl;
+}
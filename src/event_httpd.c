@@ -0,0 +1,1127 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "event_httpd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <time.h>
+#include "compat/queue.h"
+#include "os/event.h"
+#include "os/io.h"
+#include "os/mutex.h"
+#include "os/signal.h"
+#include "os/socket.h"
+#include "os/threads.h"
+#include "socket_io.h"
+
+// A small HTTP/1.1 server. One event thread owns every connection that is
+// waiting on the network: idle keep-alive connections, clients that are
+// still sending their headers and responses that are being written out.
+// Once a request's headers are in, the connection is handed to a worker
+// thread that runs the handler with blocking semantics, then handed back
+// to the event thread to finish writing. Files passed to send_file are
+// not sent by the worker at all, the event thread streams them with
+// sendfile so a slow download does not hold a worker.
+
+enum event_httpd_config
+{
+	EVENT_HTTPD_HEADER_SIZE = 16384,
+	EVENT_HTTPD_MAX_HEADERS = 64,
+	EVENT_HTTPD_OUTPUT_SIZE = 65536,
+	EVENT_HTTPD_TIMEOUT = 60, // seconds a connection may go without progress
+	EVENT_HTTPD_SEND_BUDGET = 4 * 1024 * 1024, // file bytes per event, so one download cannot starve the others
+	EVENT_HTTPD_BACKLOG = 1024,
+	EVENT_HTTPD_MAX_EVENTS = 64
+};
+
+enum event_conn_state
+{
+	EVENT_CONN_READ_HEADER,
+	EVENT_CONN_HANDLING,
+	EVENT_CONN_WRITE
+};
+
+struct event_header
+{
+	const char *name;
+	const char *value;
+};
+
+struct event_conn
+{
+	TAILQ_ENTRY(event_conn) timer_entries;
+	SIMPLEQ_ENTRY(event_conn) queue_entries;
+	
+	struct event_httpd *httpd;
+	int socket;
+	enum event_conn_state state;
+	time_t deadline;
+	int in_timer_list;
+	
+	// request, the header is parsed in place
+	char *in;
+	size_t in_len;
+	size_t in_pos; // first byte after the header that has not been consumed
+	const char *request_method;
+	const char *uri;
+	const char *query_string;
+	struct event_header headers[EVENT_HTTPD_MAX_HEADERS];
+	int num_headers;
+	long long body_remaining;
+	int keep_alive;
+	int expect_continue;
+	int failed;
+	
+	// response
+	char *out;
+	size_t out_len;
+	size_t out_sent;
+	int file_fd;
+	long file_offset;
+	long file_remaining;
+	int status_written;
+};
+
+TAILQ_HEAD(event_conn_timer_list, event_conn);
+SIMPLEQ_HEAD(event_conn_queue, event_conn);
+
+struct event_httpd
+{
+	event_httpd_handler handler;
+	void *user_data;
+	
+	int listen_socket;
+	int accept_paused;
+	int queue;
+	int wake[2];
+	volatile int stopping;
+	
+	os_thread_t event_thread;
+	os_thread_t *workers;
+	int num_workers;
+	
+	// owned by the event thread, ordered by deadline
+	struct event_conn_timer_list timers;
+	
+	// requests waiting for a worker
+	os_mutex_t work_mutex;
+	os_cond_t work_cond;
+	struct event_conn_queue work;
+	
+	// requests the workers are done with
+	os_mutex_t done_mutex;
+	struct event_conn_queue done;
+};
+
+static void conn_touch(struct event_conn *conn)
+{
+	struct event_httpd *httpd = conn->httpd;
+	
+	if(conn->in_timer_list)
+	{
+		TAILQ_REMOVE(&httpd->timers, conn, timer_entries);
+	}
+	
+	conn->deadline = time(NULL) + EVENT_HTTPD_TIMEOUT;
+	TAILQ_INSERT_TAIL(&httpd->timers, conn, timer_entries);
+	conn->in_timer_list = 1;
+}
+
+static void conn_untouch(struct event_conn *conn)
+{
+	if(conn->in_timer_list)
+	{
+		TAILQ_REMOVE(&conn->httpd->timers, conn, timer_entries);
+		conn->in_timer_list = 0;
+	}
+}
+
+static void conn_reset_response(struct event_conn *conn)
+{
+	if(conn->file_fd >= 0)
+	{
+		os_close(conn->file_fd);
+		conn->file_fd = -1;
+	}
+	
+	conn->file_remaining = 0;
+	free(conn->out);
+	conn->out = NULL;
+	conn->out_len = 0;
+	conn->out_sent = 0;
+	conn->status_written = 0;
+}
+
+static void conn_close(struct event_conn *conn)
+{
+	conn_untouch(conn);
+	conn_reset_response(conn);
+	os_close(conn->socket);
+	free(conn->in);
+	free(conn);
+}
+
+static void conn_wait(struct event_conn *conn, int events)
+{
+	conn_touch(conn);
+	
+	if(os_event_modify(conn->httpd->queue, conn->socket, events, conn) < 0)
+	{
+		conn_close(conn);
+	}
+}
+
+static void conn_dispatch(struct event_conn *conn)
+{
+	struct event_httpd *httpd = conn->httpd;
+	
+	conn_untouch(conn);
+	conn->state = EVENT_CONN_HANDLING;
+	
+	os_mutex_lock(httpd->work_mutex);
+	SIMPLEQ_INSERT_TAIL(&httpd->work, conn, queue_entries);
+	os_cond_signal(httpd->work_cond);
+	os_mutex_unlock(httpd->work_mutex);
+}
+
+static int conn_buffer_output(struct event_conn *conn, const void *data, size_t len);
+static void conn_write(struct event_conn *conn);
+
+// answers a request that never reaches a handler and drops the connection
+static void conn_reject(struct event_conn *conn, int code, const char *message)
+{
+	char response[256];
+	int len = snprintf(response, sizeof(response),
+					   "HTTP/1.1 %d %s\r\n"
+					   "Content-Length: 0\r\n"
+					   "Connection: close\r\n"
+					   "\r\n", code, message);
+	
+	conn->keep_alive = 0;
+	conn->state = EVENT_CONN_WRITE;
+	if(conn_buffer_output(conn, response, len) < 0)
+	{
+		conn_close(conn);
+		return;
+	}
+	
+	conn_write(conn);
+}
+
+static char *find_header_end(char *data, size_t len)
+{
+	for(size_t i = 3; i < len; i++)
+	{
+		if(data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r')
+		{
+			return data + i + 1;
+		}
+	}
+	
+	return NULL;
+}
+
+static char *trim(char *str)
+{
+	while(*str == ' ' || *str == '\t') str++;
+	
+	char *end = str + strlen(str);
+	while(end > str && (end[-1] == ' ' || end[-1] == '\t')) *--end = 0;
+	
+	return str;
+}
+
+// parses the request line and headers in place. returns 0, or the status
+// code to reject the request with
+static int conn_parse_request(struct event_conn *conn, char *header_end)
+{
+	header_end[-2] = 0; // cuts the blank line
+	
+	char *iter = conn->in;
+	char *line = strsep(&iter, "\n");
+	size_t line_len = strlen(line);
+	if(line_len == 0 || line[line_len - 1] != '\r') return 400;
+	line[line_len - 1] = 0;
+	
+	char *method = strsep(&line, " ");
+	char *target = strsep(&line, " ");
+	char *version = line;
+	if(!method || !*method || !target || *target != '/' || !version)
+	{
+		return 400;
+	}
+	
+	if(0 == strcmp(version, "HTTP/1.1")) conn->keep_alive = 1;
+	else if(0 == strcmp(version, "HTTP/1.0")) conn->keep_alive = 0;
+	else return 505;
+	
+	conn->request_method = method;
+	conn->uri = strsep(&target, "?");
+	conn->query_string = target ? target : "";
+	conn->num_headers = 0;
+	conn->body_remaining = 0;
+	conn->expect_continue = 0;
+	
+	while((line = strsep(&iter, "\n")) != NULL)
+	{
+		line_len = strlen(line);
+		if(line_len > 0 && line[line_len - 1] == '\r') line[--line_len] = 0;
+		if(line_len == 0) continue;
+		
+		char *value = line;
+		char *name = strsep(&value, ":");
+		if(!value || !*name || strpbrk(name, " \t")) return 400;
+		value = trim(value);
+		
+		if(conn->num_headers == EVENT_HTTPD_MAX_HEADERS) return 431;
+		conn->headers[conn->num_headers].name = name;
+		conn->headers[conn->num_headers].value = value;
+		conn->num_headers++;
+		
+		if(0 == strcasecmp(name, "Content-Length"))
+		{
+			char *end_ptr;
+			conn->body_remaining = strtoll(value, &end_ptr, 10);
+			if(!*value || *end_ptr || conn->body_remaining < 0) return 400;
+		}
+		else if(0 == strcasecmp(name, "Transfer-Encoding"))
+		{
+			if(0 != strcasecmp(value, "identity")) return 501;
+		}
+		else if(0 == strcasecmp(name, "Connection"))
+		{
+			if(0 == strcasecmp(value, "close")) conn->keep_alive = 0;
+			else if(0 == strcasecmp(value, "keep-alive")) conn->keep_alive = 1;
+		}
+		else if(0 == strcasecmp(name, "Expect"))
+		{
+			if(0 != strcasecmp(value, "100-continue")) return 417;
+			conn->expect_continue = 1;
+		}
+	}
+	
+	return 0;
+}
+
+static const char *status_message(int code)
+{
+	switch(code)
+	{
+		case 400: return "Bad Request";
+		case 417: return "Expectation Failed";
+		case 431: return "Request Header Fields Too Large";
+		case 501: return "Not Implemented";
+		case 505: return "HTTP Version Not Supported";
+		default: return "Error";
+	}
+}
+
+// starts the next request if its header is complete. returns 1 if the
+// connection was passed on, 0 if it needs more data
+static int conn_try_dispatch(struct event_conn *conn)
+{
+	if(!conn->in || conn->in_len == 0)
+	{
+		return 0;
+	}
+	
+	char *header_end = find_header_end(conn->in, conn->in_len);
+	if(!header_end)
+	{
+		if(conn->in_len == EVENT_HTTPD_HEADER_SIZE)
+		{
+			conn_reject(conn, 431, status_message(431));
+			return 1;
+		}
+		
+		return 0;
+	}
+	
+	conn->in_pos = header_end - conn->in;
+	
+	int code = conn_parse_request(conn, header_end);
+	if(code != 0)
+	{
+		conn_reject(conn, code, status_message(code));
+		return 1;
+	}
+	
+	conn_dispatch(conn);
+	return 1;
+}
+
+static void conn_read_header(struct event_conn *conn)
+{
+	if(!conn->in)
+	{
+		conn->in = malloc(EVENT_HTTPD_HEADER_SIZE);
+		if(!conn->in)
+		{
+			conn_close(conn);
+			return;
+		}
+	}
+	
+	for(;;)
+	{
+		int n = os_read(conn->socket, conn->in + conn->in_len, EVENT_HTTPD_HEADER_SIZE - conn->in_len);
+		if(n > 0)
+		{
+			conn->in_len += n;
+			if(conn_try_dispatch(conn)) return;
+			continue;
+		}
+		
+		if(n < 0 && os_socket_would_block())
+		{
+			conn_wait(conn, OS_EVENT_READ);
+			return;
+		}
+		
+		conn_close(conn);
+		return;
+	}
+}
+
+// the response is complete, go back to waiting for the next request
+static void conn_finish_response(struct event_conn *conn)
+{
+	conn_reset_response(conn);
+	
+	if(!conn->keep_alive)
+	{
+		conn_close(conn);
+		return;
+	}
+	
+	// keep whatever the client already sent of its next request
+	size_t leftover = conn->in_len - conn->in_pos;
+	if(leftover > 0)
+	{
+		memmove(conn->in, conn->in + conn->in_pos, leftover);
+	}
+	conn->in_len = leftover;
+	conn->in_pos = 0;
+	conn->state = EVENT_CONN_READ_HEADER;
+	
+	if(conn_try_dispatch(conn))
+	{
+		return;
+	}
+	
+	// idle connections only keep the connection itself
+	if(conn->in_len == 0)
+	{
+		free(conn->in);
+		conn->in = NULL;
+	}
+	
+	conn_wait(conn, OS_EVENT_READ);
+}
+
+// event thread side, writes without blocking whatever is left of the
+// response and waits for the socket when it cannot take more
+static void conn_write(struct event_conn *conn)
+{
+	while(conn->out_sent < conn->out_len)
+	{
+		int n = os_write(conn->socket, conn->out + conn->out_sent, conn->out_len - conn->out_sent);
+		if(n > 0)
+		{
+			conn->out_sent += n;
+			continue;
+		}
+		
+		if(n < 0 && os_socket_would_block())
+		{
+			conn_wait(conn, OS_EVENT_WRITE);
+			return;
+		}
+		
+		conn_close(conn);
+		return;
+	}
+	
+	long budget = EVENT_HTTPD_SEND_BUDGET;
+	while(conn->file_remaining > 0)
+	{
+		if(budget <= 0)
+		{
+			conn_wait(conn, OS_EVENT_WRITE);
+			return;
+		}
+		
+		long chunk = conn->file_remaining < budget ? conn->file_remaining : budget;
+		long n = os_sendfile(conn->socket, conn->file_fd, conn->file_offset, chunk);
+		if(n > 0)
+		{
+			conn->file_offset += n;
+			conn->file_remaining -= n;
+			budget -= n;
+			continue;
+		}
+		
+		if(os_socket_would_block())
+		{
+			conn_wait(conn, OS_EVENT_WRITE);
+			return;
+		}
+		
+		conn_close(conn);
+		return;
+	}
+	
+	conn_finish_response(conn);
+}
+
+// worker side, writes everything queued so far and waits for the socket
+// when it is full
+static int conn_send_blocking(struct event_conn *conn, const char *data, size_t len)
+{
+	while(len > 0)
+	{
+		int n = os_write(conn->socket, data, len);
+		if(n > 0)
+		{
+			data += n;
+			len -= n;
+			continue;
+		}
+		
+		if(n < 0 && os_socket_would_block() &&
+		   os_socket_wait(conn->socket, 1, EVENT_HTTPD_TIMEOUT * 1000) > 0)
+		{
+			continue;
+		}
+		
+		conn->failed = 1;
+		return -1;
+	}
+	
+	return 0;
+}
+
+static int conn_flush_blocking(struct event_conn *conn)
+{
+	if(conn->failed)
+	{
+		return -1;
+	}
+	
+	if(conn_send_blocking(conn, conn->out + conn->out_sent, conn->out_len - conn->out_sent) < 0)
+	{
+		return -1;
+	}
+	conn->out_len = 0;
+	conn->out_sent = 0;
+	
+	while(conn->file_remaining > 0)
+	{
+		long n = os_sendfile(conn->socket, conn->file_fd, conn->file_offset, conn->file_remaining);
+		if(n > 0)
+		{
+			conn->file_offset += n;
+			conn->file_remaining -= n;
+			continue;
+		}
+		
+		if(os_socket_would_block() &&
+		   os_socket_wait(conn->socket, 1, EVENT_HTTPD_TIMEOUT * 1000) > 0)
+		{
+			continue;
+		}
+		
+		conn->failed = 1;
+		return -1;
+	}
+	
+	if(conn->file_fd >= 0)
+	{
+		os_close(conn->file_fd);
+		conn->file_fd = -1;
+	}
+	
+	return 0;
+}
+
+static int conn_buffer_output(struct event_conn *conn, const void *data, size_t len)
+{
+	if(!conn->out)
+	{
+		conn->out = malloc(EVENT_HTTPD_OUTPUT_SIZE);
+		if(!conn->out)
+		{
+			conn->failed = 1;
+			return -1;
+		}
+	}
+	
+	if(conn->out_len + len > EVENT_HTTPD_OUTPUT_SIZE)
+	{
+		if(conn_flush_blocking(conn) < 0)
+		{
+			return -1;
+		}
+		
+		if(len > EVENT_HTTPD_OUTPUT_SIZE)
+		{
+			return conn_send_blocking(conn, data, len);
+		}
+	}
+	
+	memcpy(conn->out + conn->out_len, data, len);
+	conn->out_len += len;
+	
+	return 0;
+}
+
+static int io_event_read(void *context, void *buffer, int size)
+{
+	struct event_conn *conn = (struct event_conn *)context;
+	
+	if(conn->failed) return -1;
+	if(size <= 0 || conn->body_remaining == 0) return 0;
+	if(size > conn->body_remaining) size = conn->body_remaining;
+	
+	// body bytes that came in with the header
+	size_t buffered = conn->in_len - conn->in_pos;
+	if(buffered > 0)
+	{
+		if(size > buffered) size = buffered;
+		memcpy(buffer, conn->in + conn->in_pos, size);
+		conn->in_pos += size;
+		conn->body_remaining -= size;
+		return size;
+	}
+	
+	if(conn->expect_continue)
+	{
+		static const char continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+		conn->expect_continue = 0;
+		if(conn_send_blocking(conn, continue_response, sizeof(continue_response) - 1) < 0)
+		{
+			return -1;
+		}
+	}
+	
+	for(;;)
+	{
+		int n = os_read(conn->socket, buffer, size);
+		if(n > 0)
+		{
+			conn->body_remaining -= n;
+			return n;
+		}
+		
+		if(n < 0 && os_socket_would_block() &&
+		   os_socket_wait(conn->socket, 0, EVENT_HTTPD_TIMEOUT * 1000) > 0)
+		{
+			continue;
+		}
+		
+		conn->failed = 1;
+		return -1;
+	}
+}
+
+static int io_event_write(void *context, const void *buffer, int size)
+{
+	struct event_conn *conn = (struct event_conn *)context;
+	
+	if(conn->failed) return -1;
+	
+	// anything written after a file has to go out after it
+	if(conn->file_remaining > 0 && conn_flush_blocking(conn) < 0)
+	{
+		return -1;
+	}
+	
+	if(conn_buffer_output(conn, buffer, size) < 0)
+	{
+		return -1;
+	}
+	
+	return size;
+}
+
+static int io_event_vprintf(struct event_conn *conn, const char *format, va_list va)
+{
+	char buffer[1024];
+	va_list copy;
+	
+	va_copy(copy, va);
+	int len = vsnprintf(buffer, sizeof(buffer), format, copy);
+	va_end(copy);
+	
+	if(len < 0) return -1;
+	
+	if(len < sizeof(buffer))
+	{
+		return io_event_write(conn, buffer, len);
+	}
+	
+	char *large = malloc(len + 1);
+	if(!large) return -1;
+	
+	vsnprintf(large, len + 1, format, va);
+	int ret = io_event_write(conn, large, len);
+	free(large);
+	
+	return ret;
+}
+
+static int io_event_printf(void *context, const char *format, ...)
+{
+	va_list va;
+	
+	va_start(va, format);
+	int len = io_event_vprintf((struct event_conn *)context, format, va);
+	va_end(va);
+	
+	return len;
+}
+
+static void io_event_write_http_status(void *context, int code, const char *message)
+{
+	struct event_conn *conn = (struct event_conn *)context;
+	
+	conn->status_written = 1;
+	io_event_printf(context, "HTTP/1.1 %d %s\r\n", code, message);
+}
+
+static void io_event_write_headers(void *context, const char * const *headers, int num_headers)
+{
+	struct event_conn *conn = (struct event_conn *)context;
+	int has_length = 0;
+	
+	for(int i = 0; i < num_headers; i++)
+	{
+		// the connection header is ours to decide
+		if(0 == strncasecmp(headers[i], "Connection:", 11))
+		{
+			continue;
+		}
+		
+		if(0 == strncasecmp(headers[i], "Content-Length:", 15))
+		{
+			has_length = 1;
+		}
+		
+		io_event_printf(context, "%s\r\n", headers[i]);
+	}
+	
+	// without a length the end of the body is the end of the connection
+	if(!has_length)
+	{
+		conn->keep_alive = 0;
+	}
+	
+	io_event_printf(context, "Connection: %s\r\n\r\n", conn->keep_alive ? "keep-alive" : "close");
+}
+
+static void io_event_flush(void *context)
+{
+	// the event thread sends whatever is left once the handler returns
+}
+
+static const char *io_event_get_header(void *context, const char *name)
+{
+	struct event_conn *conn = (struct event_conn *)context;
+	
+	for(int i = 0; i < conn->num_headers; i++)
+	{
+		if(0 == strcasecmp(conn->headers[i].name, name))
+		{
+			return conn->headers[i].value;
+		}
+	}
+	
+	return NULL;
+}
+
+static long io_event_send_file(void *context, int fd, long offset, long size)
+{
+	struct event_conn *conn = (struct event_conn *)context;
+	
+	if(conn->failed) return -1;
+	
+	if(conn->file_remaining > 0 && conn_flush_blocking(conn) < 0)
+	{
+		return -1;
+	}
+	
+	if(size == 0) return 0;
+	
+	// the handler closes its descriptor when it returns, keep our own
+	// for the event thread to send from
+	int file_fd = os_dup(fd);
+	if(file_fd < 0) return -1;
+	
+	if(conn->file_fd >= 0)
+	{
+		os_close(conn->file_fd);
+	}
+	
+	conn->file_fd = file_fd;
+	conn->file_offset = offset;
+	conn->file_remaining = size;
+	
+	return size;
+}
+
+static void conn_handle_request(struct event_conn *conn)
+{
+	struct event_httpd *httpd = conn->httpd;
+	struct socket_io io;
+	
+	memset(&io, 0, sizeof(io));
+	io.context = conn;
+	io.read = io_event_read;
+	io.write = io_event_write;
+	io.write_http_status = io_event_write_http_status;
+	io.write_headers = io_event_write_headers;
+	io.printf = io_event_printf;
+	io.flush = io_event_flush;
+	io.get_header = io_event_get_header;
+	io.send_file = io_event_send_file;
+	
+	httpd->handler(httpd->user_data, &io, conn->request_method, conn->uri, conn->query_string);
+	
+	// an unread body would be taken for the next request
+	if(conn->body_remaining > 0 || !conn->status_written)
+	{
+		conn->keep_alive = 0;
+	}
+	
+	if(!conn->status_written)
+	{
+		conn->failed = 1;
+	}
+	
+	conn->state = EVENT_CONN_WRITE;
+}
+
+static void *event_httpd_worker(void *data)
+{
+	struct event_httpd *httpd = (struct event_httpd *)data;
+	
+	for(;;)
+	{
+		os_mutex_lock(httpd->work_mutex);
+		while(SIMPLEQ_EMPTY(&httpd->work) && !httpd->stopping)
+		{
+			os_cond_wait(httpd->work_cond, httpd->work_mutex);
+		}
+		
+		struct event_conn *conn = SIMPLEQ_FIRST(&httpd->work);
+		if(conn)
+		{
+			SIMPLEQ_REMOVE_HEAD(&httpd->work, queue_entries);
+		}
+		os_mutex_unlock(httpd->work_mutex);
+		
+		if(!conn)
+		{
+			break;
+		}
+		
+		conn_handle_request(conn);
+		
+		os_mutex_lock(httpd->done_mutex);
+		SIMPLEQ_INSERT_TAIL(&httpd->done, conn, queue_entries);
+		os_mutex_unlock(httpd->done_mutex);
+		
+		// if the pipe is full the event thread is already awake
+		char wake = 1;
+		os_write(httpd->wake[1], &wake, 1);
+	}
+	
+	return NULL;
+}
+
+static void event_httpd_accept(struct event_httpd *httpd)
+{
+	for(;;)
+	{
+		int socket = os_socket_accept(httpd->listen_socket);
+		if(socket < 0)
+		{
+			if(!os_socket_would_block())
+			{
+				// likely out of descriptors, try again on the next tick
+				httpd->accept_paused = 1;
+				return;
+			}
+			break;
+		}
+		
+		struct event_conn *conn = calloc(1, sizeof *conn);
+		if(!conn)
+		{
+			os_close(socket);
+			continue;
+		}
+		
+		conn->httpd = httpd;
+		conn->socket = socket;
+		conn->file_fd = -1;
+		conn->state = EVENT_CONN_READ_HEADER;
+		
+		if(os_event_add(httpd->queue, socket, OS_EVENT_READ, conn) < 0)
+		{
+			os_close(socket);
+			free(conn);
+			continue;
+		}
+		
+		conn_touch(conn);
+	}
+	
+	os_event_modify(httpd->queue, httpd->listen_socket, OS_EVENT_READ, &httpd->listen_socket);
+}
+
+static void event_httpd_process_done(struct event_httpd *httpd)
+{
+	char drain[64];
+	while(os_read(httpd->wake[0], drain, sizeof(drain)) > 0);
+	os_event_modify(httpd->queue, httpd->wake[0], OS_EVENT_READ, httpd->wake);
+	
+	struct event_conn_queue done;
+	os_mutex_lock(httpd->done_mutex);
+	done = httpd->done;
+	SIMPLEQ_INIT(&httpd->done);
+	os_mutex_unlock(httpd->done_mutex);
+	
+	// only the links are followed from here, the copied head's tail
+	// pointer is not used
+	struct event_conn *conn = SIMPLEQ_FIRST(&done);
+	while(conn)
+	{
+		struct event_conn *next = SIMPLEQ_NEXT(conn, queue_entries);
+		
+		if(conn->failed)
+		{
+			conn_close(conn);
+		}
+		else
+		{
+			conn_write(conn);
+		}
+		
+		conn = next;
+	}
+}
+
+static void *event_httpd_loop(void *data)
+{
+	struct event_httpd *httpd = (struct event_httpd *)data;
+	struct os_event events[EVENT_HTTPD_MAX_EVENTS];
+	
+	while(!httpd->stopping)
+	{
+		int n = os_event_wait(httpd->queue, events, EVENT_HTTPD_MAX_EVENTS, 1000);
+		for(int i = 0; i < n; i++)
+		{
+			if(events[i].data == &httpd->listen_socket)
+			{
+				event_httpd_accept(httpd);
+				continue;
+			}
+			
+			if(events[i].data == httpd->wake)
+			{
+				event_httpd_process_done(httpd);
+				continue;
+			}
+			
+			struct event_conn *conn = (struct event_conn *)events[i].data;
+			if(conn->state == EVENT_CONN_READ_HEADER)
+			{
+				conn_read_header(conn);
+			}
+			else if(conn->state == EVENT_CONN_WRITE)
+			{
+				conn_write(conn);
+			}
+		}
+		
+		time_t now = time(NULL);
+		struct event_conn *conn;
+		while((conn = TAILQ_FIRST(&httpd->timers)) != NULL && conn->deadline <= now)
+		{
+			conn_close(conn);
+		}
+		
+		if(httpd->accept_paused)
+		{
+			httpd->accept_paused = 0;
+			os_event_modify(httpd->queue, httpd->listen_socket, OS_EVENT_READ, &httpd->listen_socket);
+		}
+	}
+	
+	return NULL;
+}
+
+struct event_httpd *event_httpd_start(int port, int num_threads, event_httpd_handler handler, void *user_data)
+{
+	if(num_threads < 1 || num_threads > 256)
+	{
+		fprintf(stderr, "Invalid number of threads (%d) specified. Must be >= 1 and < 256.\n", num_threads);
+		return NULL;
+	}
+	
+	struct event_httpd *httpd = calloc(1, sizeof *httpd);
+	if(!httpd)
+	{
+		return NULL;
+	}
+	
+	httpd->handler = handler;
+	httpd->user_data = user_data;
+	httpd->queue = -1;
+	httpd->wake[0] = httpd->wake[1] = -1;
+	TAILQ_INIT(&httpd->timers);
+	SIMPLEQ_INIT(&httpd->work);
+	SIMPLEQ_INIT(&httpd->done);
+	
+	// writes to a closed connection are reported as errors instead
+	os_signal(SIGPIPE, SIG_IGN);
+	
+	httpd->listen_socket = os_socket_listen_tcp(NULL, port, EVENT_HTTPD_BACKLOG, 0);
+	if(httpd->listen_socket < 0)
+	{
+		fprintf(stderr, "Unable to listen on port %d.\n", port);
+		goto error0;
+	}
+	
+	if(os_socket_set_nonblocking(httpd->listen_socket) < 0)
+	{
+		goto error1;
+	}
+	
+	httpd->queue = os_event_queue_create();
+	if(httpd->queue < 0)
+	{
+		goto error1;
+	}
+	
+	if(os_socketpair(httpd->wake) < 0)
+	{
+		goto error2;
+	}
+	
+	if(os_socket_set_nonblocking(httpd->wake[0]) < 0 ||
+	   os_socket_set_nonblocking(httpd->wake[1]) < 0 ||
+	   os_event_add(httpd->queue, httpd->listen_socket, OS_EVENT_READ, &httpd->listen_socket) < 0 ||
+	   os_event_add(httpd->queue, httpd->wake[0], OS_EVENT_READ, httpd->wake) < 0)
+	{
+		goto error3;
+	}
+	
+	httpd->work_mutex = os_mutex_create();
+	httpd->work_cond = os_cond_create();
+	httpd->done_mutex = os_mutex_create();
+	
+	httpd->workers = calloc(num_threads, sizeof(httpd->workers[0]));
+	if(!httpd->workers)
+	{
+		goto error4;
+	}
+	
+	for(int i = 0; i < num_threads; i++)
+	{
+		httpd->workers[i] = os_thread_create(event_httpd_worker, httpd);
+		if(!httpd->workers[i])
+		{
+			goto error5;
+		}
+		httpd->num_workers++;
+	}
+	
+	httpd->event_thread = os_thread_create(event_httpd_loop, httpd);
+	if(!httpd->event_thread)
+	{
+		goto error5;
+	}
+	
+	return httpd;
+	
+error5:
+	os_mutex_lock(httpd->work_mutex);
+	httpd->stopping = 1;
+	os_cond_broadcast(httpd->work_cond);
+	os_mutex_unlock(httpd->work_mutex);
+	for(int i = 0; i < httpd->num_workers; i++)
+	{
+		os_thread_join(httpd->workers[i], NULL);
+	}
+	free(httpd->workers);
+error4:
+	os_mutex_destroy(httpd->done_mutex);
+	os_cond_destroy(httpd->work_cond);
+	os_mutex_destroy(httpd->work_mutex);
+error3:
+	os_close(httpd->wake[0]);
+	os_close(httpd->wake[1]);
+error2:
+	os_close(httpd->queue);
+error1:
+	os_close(httpd->listen_socket);
+error0:
+	free(httpd);
+	return NULL;
+}
+
+void event_httpd_stop(struct event_httpd *httpd)
+{
+	// stop taking connections, then let the workers finish what they have
+	httpd->stopping = 1;
+	char wake = 1;
+	os_write(httpd->wake[1], &wake, 1);
+	os_thread_join(httpd->event_thread, NULL);
+	
+	os_mutex_lock(httpd->work_mutex);
+	os_cond_broadcast(httpd->work_cond);
+	os_mutex_unlock(httpd->work_mutex);
+	for(int i = 0; i < httpd->num_workers; i++)
+	{
+		os_thread_join(httpd->workers[i], NULL);
+	}
+	
+	struct event_conn *conn;
+	while((conn = SIMPLEQ_FIRST(&httpd->done)) != NULL)
+	{
+		SIMPLEQ_REMOVE_HEAD(&httpd->done, queue_entries);
+		conn_close(conn);
+	}
+	
+	while((conn = TAILQ_FIRST(&httpd->timers)) != NULL)
+	{
+		conn_close(conn);
+	}
+	
+	free(httpd->workers);
+	os_mutex_destroy(httpd->done_mutex);
+	os_cond_destroy(httpd->work_cond);
+	os_mutex_destroy(httpd->work_mutex);
+	os_close(httpd->wake[0]);
+	os_close(httpd->wake[1]);
+	os_close(httpd->queue);
+	os_close(httpd->listen_socket);
+	free(httpd);
+}
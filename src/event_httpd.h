@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef EVENT_HTTPD_H
+#define EVENT_HTTPD_H
+
+struct socket_io;
+struct event_httpd;
+
+// called on a worker thread once the headers of a request are in. the
+// uri is the raw request path, query_string is "" when there is none
+typedef void (*event_httpd_handler)(void *user_data,
+									struct socket_io *io,
+									const char *request_method,
+									const char *uri,
+									const char *query_string);
+
+struct event_httpd *event_httpd_start(int port, int num_threads, event_httpd_handler handler, void *user_data);
+void event_httpd_stop(struct event_httpd *httpd);
+
+#endif
@@ -15,11 +15,13 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <inttypes.h>
 #include <stdarg.h>
 #include <time.h>
 #include <errno.h>
+#include <ctype.h>
 #include <openssl/sha.h>
 #include <json-c/json.h>
 #include "compat/string.h"
@@ -28,6 +30,7 @@
 #include "os/filesystem.h"
 #include "os/mutex.h"
 #include "os/io.h"
+#include "os/clock.h"
 #include "configuration.h"
 #include "httpd.h"
 #include "socket_io.h"
@@ -35,6 +38,14 @@
 #include "repo_manager.h"
 #include "mkdir_recusive.h"
 #include "git_lfs_server.h"
+#include "json_reader.h"
+#include "arena.h"
+#include "metrics.h"
+#include "access_log.h"
+#include "sha256.h"
+
+// uploads are read and hashed this much at a time
+#define UPLOAD_CHUNK_SIZE (1024 * 1024)
 
 #define JSON_OBJECT_CHECK(x, label) \
 do {\
@@ -54,82 +65,6 @@ typedef enum git_lfs_operation_type
 	git_lfs_operation_download
 } git_lfs_operation;
 
-void git_lfs_write_error(const struct socket_io *io, int error_code, const char *format, ...)
-{
-	char message[4096];
-	va_list va;
-	va_start(va, format);
-	vsnprintf(message, sizeof(message), format, va);
-	va_end(va);
-
-	const char *error_reason = "Unknown error";
-	switch(error_code) {
-		case 400: error_reason = "Bad Request"; break;
-		case 403: error_reason = "Forbidden"; break;
-		case 404: error_reason = "Not Found"; break;
-		case 422: error_reason = "Unprocessable Entity"; break;
-		case 500: error_reason = "Internal Server Error"; break;
-		case 501: error_reason = "Not Implemented"; break;
-	}
-
-	const char *body = "{\"message\":\"Unable to write error.\"}";
-	
-	json_object *error = json_object_new_object();
-	if(error)
-	{
-		struct json_object *msg_obj = json_object_new_string(message);
-		if(msg_obj)
-		{
-			json_object_object_add(error, "message", msg_obj);
-			body = json_object_get_string(error);
-		}
-	}
-
-	io->write_http_status(io->context, error_code, error_reason);
-	char content_length[64];
-	int length = strlen(body);
-	
-	snprintf(content_length, sizeof(content_length), "Content-Length: %d", length);
-	const char *headers[] = {
-		"Content-Type: application/vnd.git-lfs+json",
-		content_length
-	};
-
-	io->write_headers(io->context, headers, sizeof(headers) / sizeof(headers[0]));
-	io->write(io->context, body, length);
-	io->flush(io->context);
-
-	json_object_put(error);
-}
-
-static struct json_object *create_json_error(int error_code, const char *format, ...)
-{
-	char message[4096];
-	va_list va;
-	va_start(va, format);
-	vsnprintf(message, sizeof(message), format, va);
-	va_end(va);
-
-	struct json_object *error = json_object_new_object();
-	if(!error) return NULL;
-	
-	struct json_object *error_code_obj = json_object_new_int(error_code);
-	if(!error_code_obj) goto error0;
-	
-	struct json_object *message_obj = json_object_new_string(message);
-	if(!message_obj) goto error1;
-
-	json_object_object_add(error, "code", error_code_obj);
-	json_object_object_add(error, "message", message_obj);
-	
-	return error;
-error1:
-	json_object_put(error_code_obj);
-error0:
-	json_object_put(error);
-	return NULL;
-}
-
 static struct json_object *parse_json_request(const struct socket_io *io)
 {
 	char buffer[4096];
@@ -176,263 +111,1068 @@ static void write_response_json(const struct git_lfs_config *config, struct sock
 	}
 }
 
-static void git_lfs_server_handle_batch(struct repo_manager *mgr,
-										const struct git_lfs_config *config,
-										const struct git_lfs_repo *repo,
-										struct socket_io *io)
+// lock lists and batch responses are written straight to the connection
+// rather than built as json-c trees. the body is generated twice, once to
+// measure it for the Content-Length header and once to send it
+struct json_stream
 {
-	struct json_object *request = parse_json_request(io);
-	if(!request)
+	const struct socket_io *io;
+	size_t length;
+	int write;
+	int echo;
+	size_t buffered;
+	char buffer[4096];
+};
+
+typedef void (*json_stream_body_func)(struct json_stream *stream, void *context);
+
+static void json_stream_send(struct json_stream *stream, const char *data, size_t len)
+{
+	stream->io->write(stream->io->context, data, len);
+	
+	if(stream->echo)
 	{
-		git_lfs_write_error(io, 400, "Error while parsing request.");
-		return;
+		fwrite(data, 1, len, stdout);
 	}
+}
+
+static void json_stream_flush(struct json_stream *stream)
+{
+	json_stream_send(stream, stream->buffer, stream->buffered);
+	stream->buffered = 0;
+}
+
+static void json_stream_raw(struct json_stream *stream, const char *data, size_t len)
+{
+	stream->length += len;
 	
-	struct json_object *operation;
-	if(!json_object_object_get_ex(request, "operation", &operation) ||
-	   !json_object_is_type(operation, json_type_string))
+	if(!stream->write)
 	{
-		git_lfs_write_error(io, 400, "API error. Missing operation.");
-		goto error0;
+		return;
 	}
 	
-	struct json_object *transfers;
-	if(json_object_object_get_ex(request, "transfers", &transfers)) {
-		int has_basic_transfer = 0;
+	// the pieces are mostly a few bytes, so they are gathered before being
+	// handed to the connection
+	if(stream->buffered + len > sizeof(stream->buffer))
+	{
+		json_stream_flush(stream);
 		
-		// transfers was specified
-		struct array_list * transfers_array = json_object_get_array(transfers);
-		if(!transfers_array) {
-			git_lfs_write_error(io, 400, "API error. Transfers must be an array.");
-			goto error0;
+		if(len > sizeof(stream->buffer))
+		{
+			json_stream_send(stream, data, len);
+			return;
 		}
-		
-		int n = array_list_length(transfers_array);
-		for(int i = 0; i < n; ++i) {
-			struct json_object *transfer_obj_type = array_list_get_idx(transfers_array, i);
-			if(!json_object_is_type(transfer_obj_type, json_type_string)) {
-				git_lfs_write_error(io, 400, "API error. Unable to parse transfer list.");
-				goto error0;
-			}
-			const char *transfer_type = json_object_get_string(transfer_obj_type);
-			if(0 == strcmp("basic", transfer_type)) {
-				has_basic_transfer = 1;
-				break;
-			}
+	}
+	
+	memcpy(stream->buffer + stream->buffered, data, len);
+	stream->buffered += len;
+}
+
+static void json_stream_literal(struct json_stream *stream, const char *str)
+{
+	json_stream_raw(stream, str, strlen(str));
+}
+
+static void json_stream_string(struct json_stream *stream, const char *str)
+{
+	static const char hex[] = "0123456789abcdef";
+	
+	json_stream_raw(stream, "\"", 1);
+	
+	const char *run = str;
+	for(const char *p = str; *p; p++)
+	{
+		unsigned char c = *p;
+		if(c >= 0x20 && c != '"' && c != '\\')
+		{
+			continue;
 		}
 		
-		if(!has_basic_transfer) {
-			git_lfs_write_error(io, 400, "Unable to handle any of the transfer types.");
-			goto error0;
+		json_stream_raw(stream, run, p - run);
+		run = p + 1;
+		
+		if(c == '"' || c == '\\')
+		{
+			char escaped[2] = { '\\', c };
+			json_stream_raw(stream, escaped, sizeof(escaped));
+		}
+		else
+		{
+			char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+			json_stream_raw(stream, escaped, sizeof(escaped));
 		}
 	}
+	
+	json_stream_raw(stream, run, strlen(run));
+	json_stream_raw(stream, "\"", 1);
+}
 
-	git_lfs_operation op = git_lfs_operation_unknown;
-	const char *operation_string = json_object_get_string(operation);
-	if(strcmp(operation_string, "upload") == 0)
+static void json_stream_int64(struct json_stream *stream, int64_t value)
+{
+	char value_str[32];
+	int len = snprintf(value_str, sizeof(value_str), "%lld", (long long)value);
+	json_stream_raw(stream, value_str, len);
+}
+
+static void write_json_stream(const struct socket_io *io, int code, const char *reason, json_stream_body_func body, void *context, int echo)
+{
+	struct json_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	stream.io = io;
+	body(&stream, context);
+	
+	char content_length[64];
+	snprintf(content_length, sizeof(content_length), "Content-Length: %zu", stream.length);
+	const char *headers[] =
 	{
-		op = git_lfs_operation_upload;
+		"Content-Type: application/vnd.git-lfs+json",
+		content_length
+	};
+	
+	io->write_http_status(io->context, code, reason);
+	io->write_headers(io->context, headers, sizeof(headers) / sizeof(headers[0]));
+	
+	if(echo)
+	{
+		printf("< ");
+		stream.echo = 1;
 	}
-	else if(strcmp(operation_string, "download") == 0)
+	
+	stream.length = 0;
+	stream.write = 1;
+	body(&stream, context);
+	json_stream_flush(&stream);
+	io->flush(io->context);
+	
+	if(stream.echo)
 	{
-		op = git_lfs_operation_download;
+		printf("\n");
 	}
-	else
+}
+
+static void write_response_json_stream(const struct git_lfs_config *config, struct socket_io *io, int code, const char *reason, json_stream_body_func body, void *context)
+{
+	write_json_stream(io, code, reason, body, context, config->verbose >= 2);
+}
+
+static void write_error_body(struct json_stream *stream, void *context)
+{
+	json_stream_literal(stream, "{\"message\":");
+	json_stream_string(stream, context);
+	json_stream_raw(stream, "}", 1);
+}
+
+void git_lfs_write_error(const struct socket_io *io, int error_code, const char *format, ...)
+{
+	char message[4096];
+	va_list va;
+	va_start(va, format);
+	vsnprintf(message, sizeof(message), format, va);
+	va_end(va);
+
+	const char *error_reason = "Unknown error";
+	switch(error_code) {
+		case 400: error_reason = "Bad Request"; break;
+		case 403: error_reason = "Forbidden"; break;
+		case 404: error_reason = "Not Found"; break;
+		case 422: error_reason = "Unprocessable Entity"; break;
+		case 500: error_reason = "Internal Server Error"; break;
+		case 501: error_reason = "Not Implemented"; break;
+	}
+
+	write_json_stream(io, error_code, error_reason, write_error_body, message, 0);
+}
+
+// The objects of a batch request are read into fixed size records rather
+// than a json-c tree, and the oids go straight into the array sent to the
+// repo manager. Oids that don't parse are kept as strings to echo back.
+struct batch_object
+{
+	int64_t size;
+	int oid_index; // into oid_hashes, or -1 if the oid is invalid
+	size_t invalid_oid; // offset into invalid_oids if oid_index is -1
+};
+
+struct batch_request
+{
+	struct arena *arena;
+	git_lfs_operation op;
+	int multipart;
+	int num_objects;
+	int max_objects;
+	struct batch_object *objects;
+	uint8_t (*oid_hashes)[SHA256_DIGEST_LENGTH];
+	int num_oids;
+	char *invalid_oids;
+	size_t invalid_oids_size;
+};
+
+static int batch_request_add_object(struct batch_request *request, const char *oid_str, size_t oid_len, int64_t size)
+{
+	if(request->num_objects == request->max_objects)
 	{
-		git_lfs_write_error(io, 400, "Unknown operation.");
-		goto error0;
+		int max_objects = request->max_objects ? request->max_objects * 2 : 64;
+		if(max_objects > INT_MAX / 64) return -1;
+		
+		struct batch_object *objects = arena_realloc(request->arena, request->objects, request->max_objects * sizeof(*objects), max_objects * sizeof(*objects));
+		if(!objects) return -1;
+		request->objects = objects;
+		
+		uint8_t (*oid_hashes)[SHA256_DIGEST_LENGTH] = arena_realloc(request->arena, request->oid_hashes, request->max_objects * sizeof(*oid_hashes), max_objects * sizeof(*oid_hashes));
+		if(!oid_hashes) return -1;
+		request->oid_hashes = oid_hashes;
+		
+		request->max_objects = max_objects;
 	}
 	
-	struct json_object *objects;
-	if(!json_object_object_get_ex(request, "objects", &objects)
-	   || !json_object_is_type(objects, json_type_array))
+	struct batch_object *object = &request->objects[request->num_objects];
+	object->size = size;
+	
+	if(oid_from_string(oid_str, request->oid_hashes[request->num_oids]) == 0)
 	{
-		git_lfs_write_error(io, 400, "API error. Missing objects.");
-		goto error0;
+		object->oid_index = request->num_oids++;
 	}
-
-	struct json_object *response = json_object_new_object();
-	if(!response)
+	else
 	{
-		git_lfs_write_error(io, 400, "Failed to create response object.");
-		goto error0;
+		char *invalid_oids = arena_realloc(request->arena, request->invalid_oids, request->invalid_oids_size, request->invalid_oids_size + oid_len + 1);
+		if(!invalid_oids) return -1;
+		
+		memcpy(invalid_oids + request->invalid_oids_size, oid_str, oid_len + 1);
+		request->invalid_oids = invalid_oids;
+		
+		object->oid_index = -1;
+		object->invalid_oid = request->invalid_oids_size;
+		request->invalid_oids_size += oid_len + 1;
 	}
 	
-	struct json_object *output_objects = json_object_new_array();
-	if(!output_objects)
+	request->num_objects++;
+	return 0;
+}
+
+// returns 0 once the object is added, 1 and the error for an object that
+// does not have the expected members, -1 on a syntax error or -2 if out of
+// memory
+static int parse_batch_object(struct json_reader *reader, struct batch_request *request, const char **error)
+{
+	if(json_reader_peek(reader) != JSON_READER_OBJECT)
 	{
-		git_lfs_write_error(io, 400, "Failed to create output object.");
-		goto error1;
+		if(json_reader_skip(reader) < 0) return -1;
+		*error = "API error. Invalid object in stream.";
+		return 1;
 	}
 	
-	json_object_object_add(response, "objects", output_objects);
+	char oid_str[1024];
+	int oid_len = -1;
+	int64_t size;
+	int has_size = 0;
 	
-	struct array_list *obj_list = json_object_get_array(objects);
-	int obj_count = array_list_length(obj_list);
-	for(int i = 0; i < obj_count; i++)
+	char key[32];
+	int ret;
+	if(json_reader_begin_object(reader) < 0) return -1;
+	while((ret = json_reader_next_key(reader, key, sizeof(key))) > 0)
 	{
-		struct json_object * obj = array_list_get_idx(obj_list, i);
-		if(!json_object_is_type(obj, json_type_object))
+		if(0 == strcmp(key, "oid") && json_reader_peek(reader) == JSON_READER_STRING)
 		{
-			git_lfs_write_error(io, 400, "API error. Invalid object in stream.");
-			goto error1;
+			oid_len = json_reader_string(reader, oid_str, sizeof(oid_str));
+			if(oid_len < 0) return -1;
 		}
-		
-		struct json_object *oid, *size;
-		if(!json_object_object_get_ex(obj, "oid", &oid) ||
-		   !json_object_is_type(oid, json_type_string) ||
-		   !json_object_object_get_ex(obj, "size", &size) ||
-		   !json_object_is_type(size, json_type_int))
+		else if(0 == strcmp(key, "size") && json_reader_peek(reader) == JSON_READER_NUMBER)
 		{
-			git_lfs_write_error(io, 400, "API error. Missing oid and size.");
-			goto error1;
+			// a number that is not an integer can't be skipped past
+			// after a failed read, so it ends the request
+			if(json_reader_int64(reader, &size) < 0)
+			{
+				*error = "API error. Missing oid and size.";
+				return -1;
+			}
+			has_size = 1;
 		}
-		
-		struct json_object *obj_info = json_object_new_object();
-		JSON_OBJECT_CHECK(obj_info, error1);
-
-		json_object_array_add(output_objects, obj_info);
-
-		json_object_object_add(obj_info, "oid", json_object_get(oid));
-		json_object_object_add(obj_info, "size", json_object_get(size));
-
-		const char *oid_str = json_object_get_string(oid);
-		if(!oid_str) {
-			struct json_object *error = create_json_error(400, "OID is not a string.");
-			JSON_OBJECT_CHECK(error, error1);
-			json_object_object_add(obj_info, "error", error);
-			continue;
+		else if(json_reader_skip(reader) < 0)
+		{
+			return -1;
 		}
-
-		uint8_t oid_hash[SHA256_DIGEST_LENGTH];
-		if(oid_from_string(oid_str, oid_hash) < 0) {
-			struct json_object *error = create_json_error(400, "OID (%s) is invalid.", oid_str);
-			JSON_OBJECT_CHECK(error, error1);
-			json_object_object_add(obj_info, "error", error);
-			continue;
+	}
+	
+	if(ret < 0) return -1;
+	
+	if(oid_len < 0 || !has_size)
+	{
+		*error = "API error. Missing oid and size.";
+		return 1;
+	}
+	
+	// an oid this long can't be valid, it is echoed back truncated along
+	// with the invalid oid error of its object. a utf-8 sequence that was
+	// cut in half is dropped so the response stays valid json
+	if(oid_len >= sizeof(oid_str))
+	{
+		oid_len = sizeof(oid_str) - 1;
+		int start = oid_len;
+		while(start > 0 && ((unsigned char)oid_str[start - 1] & 0xC0) == 0x80)
+		{
+			start--;
 		}
-		
-		char expire_time[32];
-		if(!strftime(expire_time, sizeof(expire_time), "%FT%TZ", gmtime(&mgr->access_token_expire)))
+		if(start > 0 && (unsigned char)oid_str[start - 1] >= 0xC0)
 		{
-			struct json_object *error = create_json_error(400, "Unable to format time string for timestamp %ld.", mgr->access_token_expire);
-			JSON_OBJECT_CHECK(error, error1);
-			json_object_object_add(obj_info, "error", error);
-			continue;
+			unsigned char lead = oid_str[start - 1];
+			int sequence_len = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : 2;
+			if(start - 1 + sequence_len > oid_len)
+			{
+				oid_len = start - 1;
+			}
 		}
+		oid_str[oid_len] = 0;
+	}
+	
+	if(batch_request_add_object(request, oid_str, oid_len, size) < 0)
+	{
+		return -2;
+	}
+	
+	return 0;
+}
 
-		char error_msg[128];
-		switch(op) {
-			case git_lfs_operation_upload:
+// reads the request as it arrives. the members may come in any order, so
+// errors are collected and reported in the order the API checks them.
+// returns 0, or the http status and message of the error
+static int parse_batch_request(const struct socket_io *io, struct batch_request *request, const char **error)
+{
+	struct json_reader reader;
+	json_reader_init(&reader, io);
+	
+	int has_operation = 0;
+	int has_objects = 0;
+	const char *transfers_error = NULL;
+	const char *objects_error = NULL;
+	const char *fatal_error = NULL;
+	
+	// the first transfer type the client lists that we support
+	int multipart = 0;
+	
+	char key[32];
+	int ret;
+	if(json_reader_begin_object(&reader) < 0) goto syntax_error;
+	while((ret = json_reader_next_key(&reader, key, sizeof(key))) > 0)
+	{
+		if(0 == strcmp(key, "operation") && json_reader_peek(&reader) == JSON_READER_STRING)
+		{
+			char operation[16];
+			int len = json_reader_string(&reader, operation, sizeof(operation));
+			if(len < 0) goto syntax_error;
+			
+			has_operation = 1;
+			request->op = git_lfs_operation_unknown;
+			if(len < sizeof(operation) && 0 == strcmp(operation, "upload"))
+			{
+				request->op = git_lfs_operation_upload;
+			}
+			else if(len < sizeof(operation) && 0 == strcmp(operation, "download"))
+			{
+				request->op = git_lfs_operation_download;
+			}
+		}
+		else if(0 == strcmp(key, "transfers"))
+		{
+			if(json_reader_peek(&reader) != JSON_READER_ARRAY)
+			{
+				transfers_error = "API error. Transfers must be an array.";
+				if(json_reader_skip(&reader) < 0) goto syntax_error;
+				continue;
+			}
+			
+			int has_transfer = 0;
+			if(json_reader_begin_array(&reader) < 0) goto syntax_error;
+			while((ret = json_reader_next_element(&reader)) > 0)
 			{
-				int result = git_lfs_repo_check_oid_exist(mgr, config, repo, oid_hash, error_msg, sizeof(error_msg));
-				if(result < 0)
+				if(json_reader_peek(&reader) != JSON_READER_STRING)
 				{
-					struct json_object *error = create_json_error(400, "%s", error_msg);
-					JSON_OBJECT_CHECK(error, error1);
-					json_object_object_add(obj_info, "error", error);
+					if(!has_transfer && !transfers_error)
+					{
+						transfers_error = "API error. Unable to parse transfer list.";
+					}
+					if(json_reader_skip(&reader) < 0) goto syntax_error;
 					continue;
 				}
 				
-				if(!result) // only add upload entry if file doesn't exist
+				char transfer[32];
+				int len = json_reader_string(&reader, transfer, sizeof(transfer));
+				if(len < 0) goto syntax_error;
+				
+				if(!has_transfer && len < sizeof(transfer) &&
+				   (0 == strcmp("basic", transfer) || 0 == strcmp("multipart", transfer)))
 				{
-					char url[1024];
-
-					// add upload url
-					if(snprintf(url, sizeof(url), "%s/%s/upload/%s", repo->base_url ? repo->base_url : config->base_url, repo->uri, oid_str) >= (long)sizeof(url))
-					{
-						struct json_object *error = create_json_error(400, "Upload URL is too long.");
-						JSON_OBJECT_CHECK(error, error1);
-						json_object_object_add(obj_info, "error", error);
-						continue;
-					}
-
-					struct json_object *actions = json_object_new_object();
-					JSON_OBJECT_CHECK(actions, error1);
-					json_object_object_add(obj_info, "actions", actions);
-
-					struct json_object *upload = json_object_new_object();
-					JSON_OBJECT_CHECK(upload, error1);
-
-					json_object_object_add(actions, "upload", upload);
-
-					struct json_object *href_obj = json_object_new_string(url);
-					JSON_OBJECT_CHECK(href_obj, error1);
-					json_object_object_add(upload, "href", href_obj);
-
-					struct json_object *expire_obj = json_object_new_string(expire_time);
-					JSON_OBJECT_CHECK(expire_obj, error1);
-					json_object_object_add(upload, "expires_at", expire_obj);
+					multipart = 0 == strcmp("multipart", transfer);
+					has_transfer = 1;
 				}
-
-				break;
 			}
+			if(ret < 0) goto syntax_error;
 			
-			case git_lfs_operation_download:
+			if(!has_transfer && !transfers_error)
+			{
+				transfers_error = "Unable to handle any of the transfer types.";
+			}
+		}
+		else if(0 == strcmp(key, "objects") && json_reader_peek(&reader) == JSON_READER_ARRAY)
+		{
+			has_objects = 1;
+			if(json_reader_begin_array(&reader) < 0) goto syntax_error;
+			while((ret = json_reader_next_element(&reader)) > 0)
 			{
-				int result = git_lfs_repo_check_oid_exist(mgr, config, repo, oid_hash, error_msg, sizeof(error_msg));
-				if(result < 0)
+				const char *object_error = NULL;
+				int object_ret = parse_batch_object(&reader, request, &object_error);
+				if(object_ret == -2)
 				{
-					struct json_object *error = create_json_error(400, "%s", error_msg);
-					JSON_OBJECT_CHECK(error, error1);
-					json_object_object_add(obj_info, "error", error);
-					continue;
+					*error = "Out of memory.";
+					return 500;
 				}
 				
-				if(!result)
+				if(object_ret < 0)
 				{
-					struct json_object *error = create_json_error(404, "Object (%s) does not exist.", oid_str);
-					JSON_OBJECT_CHECK(error, error1);
-					json_object_object_add(obj_info, "error", error);
-					continue;
+					fatal_error = object_error;
+					goto syntax_error;
 				}
 				
-				char download_url[1024];
-				
-				if(snprintf(download_url, sizeof(download_url), "%s/%s/download/%s", repo->base_url ? repo->base_url : config->base_url, repo->uri, oid_str) >= (long)sizeof(download_url))
+				if(object_ret > 0 && !objects_error)
 				{
-					struct json_object *error = create_json_error(400, "Download URL is too long.");
-					JSON_OBJECT_CHECK(error, error1);
-					json_object_object_add(obj_info, "error", error);
-					continue;
+					objects_error = object_error;
 				}
-				
-				struct json_object *actions = json_object_new_object();
-				JSON_OBJECT_CHECK(actions, error1);
-				json_object_object_add(obj_info, "actions", actions);
+			}
+			if(ret < 0) goto syntax_error;
+		}
+		else if(json_reader_skip(&reader) < 0)
+		{
+			goto syntax_error;
+		}
+	}
+	if(ret < 0) goto syntax_error;
+	
+	if(!has_operation)
+	{
+		*error = "API error. Missing operation.";
+		return 400;
+	}
+	
+	if(transfers_error)
+	{
+		*error = transfers_error;
+		return 400;
+	}
+	
+	if(request->op == git_lfs_operation_unknown)
+	{
+		*error = "Unknown operation.";
+		return 400;
+	}
+	
+	if(!has_objects)
+	{
+		*error = "API error. Missing objects.";
+		return 400;
+	}
+	
+	if(objects_error)
+	{
+		*error = objects_error;
+		return 400;
+	}
+	
+	// downloads resume with ranges, multipart only changes uploads
+	request->multipart = request->op == git_lfs_operation_upload && multipart;
+	
+	return 0;
+syntax_error:
+	*error = fatal_error ? fatal_error : "Error while parsing request.";
+	return 400;
+}
 
-				struct json_object *download = json_object_new_object();
-				JSON_OBJECT_CHECK(download, error1);
-				json_object_object_add(actions, "download", download);
-				
-				struct json_object *download_obj = json_object_new_string(download_url);
-				JSON_OBJECT_CHECK(download_obj, error1);
-				json_object_object_add(download, "href", download_obj);
+struct batch_response
+{
+	const struct git_lfs_config *config;
+	const struct git_lfs_repo *repo;
+	const struct batch_request *request;
+	const int64_t *sizes; // of the stored objects, -1 if missing
+	const char *check_error; // why objects sized CHECK_OIDS_FAILED weren't checked
+	const char *expire_time; // NULL if it could not be formatted
+	time_t expire;
+};
+
+static void json_stream_object_error(struct json_stream *stream, int error_code, const char *format, ...)
+{
+	char message[4096];
+	va_list va;
+	va_start(va, format);
+	vsnprintf(message, sizeof(message), format, va);
+	va_end(va);
+	
+	json_stream_literal(stream, ",\"error\":{\"code\":");
+	json_stream_int64(stream, error_code);
+	json_stream_literal(stream, ",\"message\":");
+	json_stream_string(stream, message);
+	json_stream_raw(stream, "}", 1);
+}
+
+static void json_stream_action(struct json_stream *stream, const char *name, const char *href, const char *expires_at, int64_t part_size)
+{
+	json_stream_raw(stream, "\"", 1);
+	json_stream_literal(stream, name);
+	json_stream_literal(stream, "\":{\"href\":");
+	json_stream_string(stream, href);
+	json_stream_literal(stream, ",\"expires_at\":");
+	json_stream_string(stream, expires_at);
+	if(part_size > 0)
+	{
+		json_stream_literal(stream, ",\"part_size\":");
+		json_stream_int64(stream, part_size);
+	}
+	json_stream_raw(stream, "}", 1);
+}
+
+static void write_batch_object(struct json_stream *stream, const struct batch_response *response, const struct batch_object *object)
+{
+	const struct batch_request *request = response->request;
+	const char *base_url = response->repo->base_url ? response->repo->base_url : response->config->base_url;
+	
+	char oid_str[65];
+	if(object->oid_index >= 0)
+	{
+		oid_to_string(request->oid_hashes[object->oid_index], oid_str);
+	}
+	
+	json_stream_literal(stream, "{\"oid\":");
+	json_stream_string(stream, object->oid_index >= 0 ? oid_str : request->invalid_oids + object->invalid_oid);
+	json_stream_literal(stream, ",\"size\":");
+	json_stream_int64(stream, object->size);
+	
+	if(object->oid_index < 0)
+	{
+		json_stream_object_error(stream, 400, "OID (%s) is invalid.", request->invalid_oids + object->invalid_oid);
+		goto done;
+	}
+	
+	if(!response->expire_time)
+	{
+		json_stream_object_error(stream, 400, "Unable to format time string for timestamp %ld.", response->expire);
+		goto done;
+	}
+	
+	int64_t stored_size = response->sizes[object->oid_index];
+	if(stored_size == CHECK_OIDS_FAILED)
+	{
+		json_stream_object_error(stream, 400, "%s", response->check_error);
+		goto done;
+	}
+	
+	// the oid is a hash of the content, so the same oid with another size
+	// is a broken client or object
+	int exists = stored_size >= 0;
+	if(exists && stored_size != object->size)
+	{
+		json_stream_object_error(stream, 422, "Object (%s) is %lld bytes, not %lld.", oid_str, (long long)stored_size, (long long)object->size);
+		goto done;
+	}
+	
+	switch(request->op) {
+		case git_lfs_operation_upload:
+		{
+			if(exists) // only add upload entry if file doesn't exist
+			{
+				break;
+			}
+			
+			// add upload url, multipart parts are PUT to <url>/parts
+			char url[1024];
+			if(snprintf(url, sizeof(url), "%s/%s/upload/%s%s", base_url, response->repo->uri, oid_str, request->multipart ? "/parts" : "") >= (long)sizeof(url))
+			{
+				json_stream_object_error(stream, 400, "Upload URL is too long.");
+				break;
+			}
+			
+			// the parts are assembled and verified by a POST to the verify href
+			char verify_url[1024];
+			if(request->multipart &&
+			   snprintf(verify_url, sizeof(verify_url), "%s/%s/upload/%s/commit", base_url, response->repo->uri, oid_str) >= (long)sizeof(verify_url))
+			{
+				json_stream_object_error(stream, 400, "Verify URL is too long.");
+				break;
+			}
+			
+			json_stream_literal(stream, ",\"actions\":{");
+			json_stream_action(stream, "upload", url, response->expire_time, request->multipart ? MULTIPART_PART_SIZE : 0);
+			if(request->multipart)
+			{
+				json_stream_raw(stream, ",", 1);
+				json_stream_action(stream, "verify", verify_url, response->expire_time, 0);
+			}
+			json_stream_raw(stream, "}", 1);
+			break;
+		}
+		
+		case git_lfs_operation_download:
+		{
+			if(!exists)
+			{
+				json_stream_object_error(stream, 404, "Object (%s) does not exist.", oid_str);
+				break;
+			}
+			
+			char download_url[1024];
+			if(snprintf(download_url, sizeof(download_url), "%s/%s/download/%s", base_url, response->repo->uri, oid_str) >= (long)sizeof(download_url))
+			{
+				json_stream_object_error(stream, 400, "Download URL is too long.");
+				break;
+			}
+			
+			json_stream_literal(stream, ",\"actions\":{");
+			json_stream_action(stream, "download", download_url, response->expire_time, 0);
+			json_stream_raw(stream, "}", 1);
+			break;
+		}
+		
+		default:
+			break;
+	}
+	
+done:
+	json_stream_raw(stream, "}", 1);
+}
+
+static void write_batch_body(struct json_stream *stream, void *context)
+{
+	const struct batch_response *response = context;
+	
+	json_stream_literal(stream, "{\"objects\":[");
+	for(int i = 0; i < response->request->num_objects; i++)
+	{
+		if(i > 0) json_stream_raw(stream, ",", 1);
+		write_batch_object(stream, response, &response->request->objects[i]);
+	}
+	json_stream_raw(stream, "]", 1);
+	
+	if(response->request->multipart)
+	{
+		json_stream_literal(stream, ",\"transfer\":\"multipart\"");
+	}
+	
+	json_stream_raw(stream, "}", 1);
+}
+
+static void git_lfs_server_handle_batch(struct repo_manager *mgr,
+										const struct git_lfs_config *config,
+										const struct git_lfs_repo *repo,
+										struct socket_io *io,
+										struct arena *arena)
+{
+	struct batch_request request;
+	memset(&request, 0, sizeof(request));
+	request.arena = arena;
+	
+	const char *parse_error;
+	int error_code = parse_batch_request(io, &request, &parse_error);
+	if(error_code)
+	{
+		git_lfs_write_error(io, error_code, "%s", parse_error);
+		return;
+	}
+	
+	// check the existence and size of all objects with as few requests to
+	// the repo manager as it takes
+	int64_t *sizes = arena_alloc(arena, (request.num_oids + 1) * sizeof(int64_t));
+	if(!sizes)
+	{
+		git_lfs_write_error(io, 500, "Out of memory.");
+		return;
+	}
+	
+	char error_msg[128] = "";
+	git_lfs_repo_check_oids_exist(mgr, repo, (const uint8_t (*)[32])request.oid_hashes, request.num_oids, sizes, error_msg, sizeof(error_msg));
+	
+	char expire_time[32];
+	int has_expire_time = strftime(expire_time, sizeof(expire_time), "%FT%TZ", gmtime(&mgr->access_token_expire)) > 0;
+	
+	struct batch_response response;
+	response.config = config;
+	response.repo = repo;
+	response.request = &request;
+	response.sizes = sizes;
+	response.check_error = error_msg;
+	response.expire_time = has_expire_time ? expire_time : NULL;
+	response.expire = mgr->access_token_expire;
+	
+	write_response_json_stream(config, io, 200, "Ok", write_batch_body, &response);
+}
+
+// parses a single "bytes=first-last" range. returns 1 and the inclusive
+// range if it is satisfiable, 0 if the header should be ignored and the
+// whole object sent, or -1 if the range cannot be satisfied.
+static int parse_range(const char *range, long filesize, long *first, long *last)
+{
+	if(strncmp(range, "bytes=", 6) != 0) return 0;
+	range += 6;
+	
+	// multiple ranges would need a multipart/byteranges response, clients
+	// are happy to get the whole object instead
+	if(strchr(range, ',')) return 0;
+	
+	char *end;
+	if(*range == '-')
+	{
+		// suffix range, the last n bytes
+		if(!isdigit((unsigned char)range[1])) return 0;
+		errno = 0;
+		long long n = strtoll(range + 1, &end, 10);
+		if(*end || errno == ERANGE) return 0;
+		if(n == 0 || filesize == 0) return -1;
+		*first = n < filesize ? filesize - n : 0;
+		*last = filesize - 1;
+		return 1;
+	}
+	
+	if(!isdigit((unsigned char)*range)) return 0;
+	errno = 0;
+	long long a = strtoll(range, &end, 10);
+	if(*end != '-' || errno == ERANGE) return 0;
+	
+	long long b = filesize - 1;
+	if(end[1])
+	{
+		if(!isdigit((unsigned char)end[1])) return 0;
+		errno = 0;
+		b = strtoll(end + 1, &end, 10);
+		if(*end || errno == ERANGE || b < a) return 0;
+		if(b > filesize - 1) b = filesize - 1;
+	}
+	
+	if(a >= filesize) return -1;
+	
+	*first = a;
+	*last = b;
+	return 1;
+}
+
+static void git_lfs_download(struct repo_manager *mgr,
+							 const struct git_lfs_config *config,
+							 const struct git_lfs_repo *repo,
+							 const struct socket_io *io,
+							 const char *oid)
+{
+	uint8_t oid_bytes[SHA256_DIGEST_LENGTH];
+	if(oid_from_string(oid, oid_bytes) < 0)
+	{
+		git_lfs_write_error(io, 400, "Invalid object id.");
+		return;
+	}
+
+	int fd;
+	long filesize;
+	char error_msg[128];
+	if(git_lfs_repo_get_read_oid_fd(mgr, config, repo, oid_bytes, &fd, &filesize, error_msg, sizeof(error_msg)) < 0) {
+		git_lfs_write_error(io, 400, "%s", error_msg);
+		return;
+	}
+	
+	// objects are addressed by their content, so the oid is a strong etag
+	char oid_str[SHA256_DIGEST_LENGTH * 2 + 1];
+	oid_to_string(oid_bytes, oid_str);
+	char etag[6 + SHA256_DIGEST_LENGTH * 2 + 3];
+	snprintf(etag, sizeof(etag), "ETag: \"%s\"", oid_str);
+	
+	long first = 0, last = filesize - 1;
+	int ranged = 0;
+	
+	const char *range = io->get_header ? io->get_header(io->context, "Range") : NULL;
+	if(range)
+	{
+		// If-Range only accepts a strong etag match, a date never matches
+		// since we don't send Last-Modified
+		const char *if_range = io->get_header(io->context, "If-Range");
+		if(!if_range || 0 == strcmp(if_range, etag + 6))
+		{
+			ranged = parse_range(range, filesize, &first, &last);
+		}
+	}
+	
+	if(ranged < 0)
+	{
+		char content_range[64];
+		snprintf(content_range, sizeof(content_range), "Content-Range: bytes */%ld", filesize);
+		const char *headers[] = {
+			"Content-Length: 0",
+			content_range,
+			"Accept-Ranges: bytes",
+			etag
+		};
+		
+		io->write_http_status(io->context, 416, "Range Not Satisfiable");
+		io->write_headers(io->context, headers, sizeof(headers) / sizeof(headers[0]));
+		io->flush(io->context);
+		os_close(fd);
+		return;
+	}
+	
+	long length = filesize > 0 ? last - first + 1 : 0;
+
+	char content_length[64];
+	snprintf(content_length, sizeof(content_length), "Content-Length: %ld", length);
+	char content_range[96];
+	snprintf(content_range, sizeof(content_range), "Content-Range: bytes %ld-%ld/%ld", first, last, filesize);
+	const char *headers[] = {
+		"Content-Type: application/octet-stream",
+		content_length,
+		"Accept-Ranges: bytes",
+		etag,
+		content_range
+	};
+	
+	if(ranged)
+	{
+		io->write_http_status(io->context, 206, "Partial Content");
+		io->write_headers(io->context, headers, sizeof(headers) / sizeof(headers[0]));
+	}
+	else
+	{
+		io->write_http_status(io->context, 200, "OK");
+		io->write_headers(io->context, headers, sizeof(headers) / sizeof(headers[0]) - 1);
+	}
+
+	if(!io->send_file || io->send_file(io->context, fd, first, length) < 0)
+	{
+		char buffer[4096];
+		int n;
+		
+		if(first > 0 && os_seek(fd, first) != first) length = 0;
+
+		while(length > 0 &&
+			  (n = os_read(fd, buffer, sizeof(buffer) < length ? sizeof(buffer) : length)) > 0) {
+			io->write(io->context, buffer, n);
+			length -= n;
+		}
+	}
+	io->flush(io->context);
+
+	os_close(fd);
+}
+
+static void write_upload_io_error(const struct socket_io *io)
+{
+	switch(errno)
+	{
+		case EDQUOT:
+		case EFBIG:
+			git_lfs_write_error(io, 425, "Insufficient space on storage.");
+			break;
+		default:
+			git_lfs_write_error(io, 500, "Write IO error.");
+			break;
+	}
+}
+
+static void git_lfs_upload(struct repo_manager *mgr,
+						   const struct git_lfs_config *config,
+						   const struct git_lfs_repo *repo,
+						   const struct socket_io *io,
+						   const char *oid)
+{
+	uint8_t oid_bytes[SHA256_DIGEST_LENGTH];
+	if(oid_from_string(oid, oid_bytes) < 0)
+	{
+		git_lfs_write_error(io, 400, "Invalid object id.");
+		return;
+	}
+	
+	char *buffer = malloc(UPLOAD_CHUNK_SIZE);
+	if(!buffer)
+	{
+		git_lfs_write_error(io, 500, "Out of memory.");
+		return;
+	}
+	
+	uint32_t ticket;
+	int fd;
+	char error_msg[128];
+	if(git_lfs_repo_get_write_oid_fd(mgr, config, repo, oid_bytes, &fd, &ticket, error_msg, sizeof(error_msg)) < 0) {
+		git_lfs_write_error(io, 400, "%s", error_msg);
+		goto done;
+	}
+	
+	// hash the data as it arrives, the repo manager checks it against the oid
+	struct sha256_ctx ctx;
+	sha256_init(&ctx);
+	
+	int n;
+	int64_t size = 0;
+	while((n = io->read(io->context, buffer, UPLOAD_CHUNK_SIZE)) > 0) {
+		sha256_update(&ctx, buffer, n);
+		size += n;
+		if(os_write(fd, buffer, n) != n)
+		{
+			write_upload_io_error(io);
+			os_close(fd);
+			goto done;
+		}
+	}
+
+	os_close(fd);
+	
+	uint8_t sha256[SHA256_DIGEST_LENGTH];
+	sha256_final(&ctx, sha256);
+	
+	// commit
+	if(git_lfs_repo_commit(mgr, ticket, size, sha256, error_msg, sizeof(error_msg)) < 0) {
+		git_lfs_write_error(io, 400, "%s", error_msg);
+		goto done;
+	}
+
+	io->write_http_status(io->context, 200, "OK");
+	io->write_headers(io->context, NULL, 0);
+	io->flush(io->context);
+done:
+	free(buffer);
+}
+
+// PUT <oid>/parts with "Content-Range: bytes first-last/size" stores one
+// part of a multipart upload. an empty object is sent as "bytes */0".
+static void git_lfs_upload_part(struct repo_manager *mgr,
+								const struct git_lfs_config *config,
+								const struct git_lfs_repo *repo,
+								const struct socket_io *io,
+								const char *oid)
+{
+	uint8_t oid_bytes[SHA256_DIGEST_LENGTH];
+	if(oid_from_string(oid, oid_bytes) < 0)
+	{
+		git_lfs_write_error(io, 400, "Invalid object id.");
+		return;
+	}
+	
+	const char *content_range = io->get_header ? io->get_header(io->context, "Content-Range") : NULL;
+	if(!content_range)
+	{
+		git_lfs_write_error(io, 400, "Parts must have a Content-Range.");
+		return;
+	}
+	
+	long long first, last, size;
+	int end = 0;
+	if(0 == strcmp(content_range, "bytes */0"))
+	{
+		first = 0;
+		last = -1;
+		size = 0;
+	}
+	else if(sscanf(content_range, "bytes %lld-%lld/%lld%n", &first, &last, &size, &end) != 3 ||
+			content_range[end] != 0 ||
+			first < 0 || last < first || size <= last)
+	{
+		git_lfs_write_error(io, 400, "Invalid Content-Range.");
+		return;
+	}
+	
+	int64_t length = last - first + 1;
+	
+	const char *content_length = io->get_header(io->context, "Content-Length");
+	if(content_length && strtoll(content_length, NULL, 10) != length)
+	{
+		git_lfs_write_error(io, 400, "Part length does not match its Content-Range.");
+		return;
+	}
+	
+	int fd;
+	char tmp_suffix[MULTIPART_TMP_SUFFIX_SIZE];
+	char error_msg[128];
+	if(git_lfs_repo_get_write_part_fd(mgr, repo, oid_bytes, size, first, length, &fd, tmp_suffix, error_msg, sizeof(error_msg)) < 0) {
+		git_lfs_write_error(io, 400, "%s", error_msg);
+		return;
+	}
+	
+	char buffer[4096];
+	int n;
+	int64_t remaining = length;
+	while(remaining > 0 &&
+		  (n = io->read(io->context, buffer, sizeof(buffer) < remaining ? sizeof(buffer) : remaining)) > 0) {
+		if(os_write(fd, buffer, n) != n)
+		{
+			write_upload_io_error(io);
+			os_close(fd);
+			return;
+		}
+		remaining -= n;
+	}
+	
+	os_close(fd);
+	
+	// the part is only marked as received once all of it is on disk
+	if(remaining > 0)
+	{
+		git_lfs_write_error(io, 400, "Part is incomplete.");
+		return;
+	}
+	
+	if(git_lfs_repo_commit_part(mgr, repo, oid_bytes, size, first, length, tmp_suffix, error_msg, sizeof(error_msg)) < 0) {
+		git_lfs_write_error(io, 400, "%s", error_msg);
+		return;
+	}
+	
+	io->write_http_status(io->context, 200, "OK");
+	io->write_headers(io->context, NULL, 0);
+	io->flush(io->context);
+}
 
-				struct json_object *expire_obj = json_object_new_string(expire_time);
-				JSON_OBJECT_CHECK(expire_obj, error1);
-				json_object_object_add(download, "expires_at", expire_obj);
-				break;
-			}
-			
-			default:
-				break;
+// GET <oid>/parts lists the byte ranges received so far, so an interrupted
+// upload only sends the missing parts
+struct upload_status
+{
+	const char *oid;
+	int64_t size;
+	int64_t part_size;
+	uint32_t num_parts;
+	const uint8_t *received;
+};
+
+static void write_upload_status_body(struct json_stream *stream, void *context)
+{
+	const struct upload_status *status = context;
+	
+	json_stream_literal(stream, "{\"oid\":");
+	json_stream_string(stream, status->oid);
+	json_stream_literal(stream, ",\"size\":");
+	json_stream_int64(stream, status->size);
+	json_stream_literal(stream, ",\"part_size\":");
+	json_stream_int64(stream, status->part_size);
+	json_stream_literal(stream, ",\"received\":[");
+	
+	// merge consecutive parts into inclusive byte ranges
+	int first_range = 1;
+	for(uint32_t i = 0; i < status->num_parts; )
+	{
+		if(!((status->received[i >> 3] >> (i & 7)) & 1))
+		{
+			i++;
+			continue;
 		}
+		
+		uint32_t start = i;
+		while(i < status->num_parts && ((status->received[i >> 3] >> (i & 7)) & 1)) i++;
+		
+		int64_t last = (int64_t)i * status->part_size - 1;
+		if(last > status->size - 1) last = status->size - 1;
+		
+		json_stream_literal(stream, first_range ? "[" : ",[");
+		json_stream_int64(stream, (int64_t)start * status->part_size);
+		json_stream_raw(stream, ",", 1);
+		json_stream_int64(stream, last);
+		json_stream_raw(stream, "]", 1);
+		first_range = 0;
 	}
-
-	write_response_json(config, io, 200, "Ok", response);
-
-error1:
-	json_object_put(response);
-error0:
-	json_object_put(request);
+	
+	json_stream_literal(stream, "]}");
 }
 
-static void git_lfs_download(struct repo_manager *mgr,
-							 const struct git_lfs_config *config,
-							 const struct git_lfs_repo *repo,
-							 const struct socket_io *io,
-							 const char *oid)
+static void git_lfs_upload_status(struct repo_manager *mgr,
+								  const struct git_lfs_config *config,
+								  const struct git_lfs_repo *repo,
+								  struct socket_io *io,
+								  struct arena *arena,
+								  const char *oid)
 {
 	uint8_t oid_bytes[SHA256_DIGEST_LENGTH];
 	if(oid_from_string(oid, oid_bytes) < 0)
@@ -440,43 +1180,96 @@ static void git_lfs_download(struct repo_manager *mgr,
 		git_lfs_write_error(io, 400, "Invalid object id.");
 		return;
 	}
-
-	int fd;
-	long filesize;
+	
+	uint8_t *received = arena_calloc(arena, MULTIPART_MAX_PARTS / 8, 1);
+	if(!received)
+	{
+		git_lfs_write_error(io, 500, "Out of memory.");
+		return;
+	}
+	
+	struct upload_status status;
 	char error_msg[128];
-	if(git_lfs_repo_get_read_oid_fd(mgr, config, repo, oid_bytes, &fd, &filesize, error_msg, sizeof(error_msg)) < 0) {
+	if(git_lfs_repo_get_parts_status(mgr, repo, oid_bytes, &status.size, &status.part_size, &status.num_parts, received, error_msg, sizeof(error_msg)) < 0)
+	{
 		git_lfs_write_error(io, 400, "%s", error_msg);
 		return;
 	}
+	
+	status.oid = oid;
+	status.received = received;
+	write_response_json_stream(config, io, 200, "Ok", write_upload_status_body, &status);
+}
 
-	char content_length[64];
-	snprintf(content_length, sizeof(content_length), "Content-Length: %ld", filesize);
-	const char *headers[] = {
-		"Content-Type: application/octet-stream",
-		content_length
-	};
-
-	io->write_http_status(io->context, 200, "OK");
-	io->write_headers(io->context, headers, sizeof(headers) / sizeof(headers[0]));
-
-	char buffer[4096];
-	int n;
-
-	while(filesize > 0 &&
-		  (n = os_read(fd, buffer, sizeof(buffer) < filesize ? sizeof(buffer) : filesize)) > 0) {
-		io->write(io->context, buffer, n);
-		filesize -= n;
+// copies the parts into fd, hashing them if uploads are verified. parts
+// arrive in any order, so this can only happen once all of them are there.
+// returns 0, -1 on a write error, or the http status of another error
+static int copy_upload_parts(struct repo_manager *mgr,
+							 const struct git_lfs_repo *repo,
+							 const uint8_t oid[SHA256_DIGEST_LENGTH],
+							 int fd,
+							 char *buffer,
+							 uint8_t sha256[SHA256_DIGEST_LENGTH],
+							 int64_t *size,
+							 char *error_msg,
+							 size_t error_msg_buf_len)
+{
+	struct sha256_ctx ctx;
+	sha256_init(&ctx);
+	
+	*size = 0;
+	uint32_t num_parts = 1;
+	for(uint32_t part = 0; part < num_parts; part++)
+	{
+		int part_fd;
+		int64_t length;
+		if(git_lfs_repo_get_read_part_fd(mgr, repo, oid, part, &part_fd, &length, &num_parts, error_msg, error_msg_buf_len) < 0)
+		{
+			return 400;
+		}
+		
+		int n;
+		while(length > 0 &&
+			  (n = os_read(part_fd, buffer, UPLOAD_CHUNK_SIZE < length ? UPLOAD_CHUNK_SIZE : length)) > 0) {
+			if(repo->verify_uploads)
+			{
+				sha256_update(&ctx, buffer, n);
+			}
+			
+			if(os_write(fd, buffer, n) != n)
+			{
+				os_close(part_fd);
+				return -1;
+			}
+			
+			length -= n;
+			*size += n;
+		}
+		
+		os_close(part_fd);
+		
+		if(length > 0)
+		{
+			snprintf(error_msg, error_msg_buf_len, "Read IO error.");
+			return 500;
+		}
 	}
-	io->flush(io->context);
-
-	os_close(fd);
+	
+	// the repo manager only looks at the hash if uploads are verified
+	if(repo->verify_uploads)
+	{
+		sha256_final(&ctx, sha256);
+	}
+	
+	return 0;
 }
 
-static void git_lfs_upload(struct repo_manager *mgr,
-						   const struct git_lfs_config *config,
-						   const struct git_lfs_repo *repo,
-						   const struct socket_io *io,
-						   const char *oid)
+// POST <oid>/commit assembles the parts into an upload and commits it
+static void git_lfs_upload_commit_parts(struct repo_manager *mgr,
+										const struct git_lfs_config *config,
+										const struct git_lfs_repo *repo,
+										const struct socket_io *io,
+										const char *oid)
 {
 	uint8_t oid_bytes[SHA256_DIGEST_LENGTH];
 	if(oid_from_string(oid, oid_bytes) < 0)
@@ -485,46 +1278,76 @@ static void git_lfs_upload(struct repo_manager *mgr,
 		return;
 	}
 	
+	char *buffer = malloc(UPLOAD_CHUNK_SIZE);
+	if(!buffer)
+	{
+		git_lfs_write_error(io, 500, "Out of memory.");
+		return;
+	}
+	
 	uint32_t ticket;
 	int fd;
 	char error_msg[128];
 	if(git_lfs_repo_get_write_oid_fd(mgr, config, repo, oid_bytes, &fd, &ticket, error_msg, sizeof(error_msg)) < 0) {
 		git_lfs_write_error(io, 400, "%s", error_msg);
-		return;
+		goto done;
 	}
 	
-	char buffer[4096];
-	int n;
-	while((n = io->read(io->context, buffer, sizeof(buffer))) > 0) {
-		int actual = os_write(fd, buffer, n);
-		if(actual < 0)
-		{
-			switch(errno)
-			{
-				case EDQUOT:
-				case EFBIG:
-					git_lfs_write_error(io, 425, "Insufficient space on storage.");
-					os_close(fd);
-					return;
-				default:
-					git_lfs_write_error(io, 500, "Write IO error.");
-					os_close(fd);
-					return;
-			}
-		}
+	uint8_t sha256[SHA256_DIGEST_LENGTH];
+	memset(sha256, 0, sizeof(sha256));
+	
+	int64_t size;
+	int status = copy_upload_parts(mgr, repo, oid_bytes, fd, buffer, sha256, &size, error_msg, sizeof(error_msg));
+	if(status < 0)
+	{
+		write_upload_io_error(io);
+		os_close(fd);
+		goto done;
 	}
-
+	
 	os_close(fd);
 	
-	// commit
-	if(git_lfs_repo_commit(mgr, ticket, error_msg, sizeof(error_msg)) < 0) {
+	if(status > 0)
+	{
+		git_lfs_write_error(io, status, "%s", error_msg);
+		goto done;
+	}
+	
+	int ret = git_lfs_repo_commit(mgr, ticket, size, sha256, error_msg, sizeof(error_msg));
+	
+	// there is no telling which part was wrong, so a failed verification
+	// starts the upload over
+	if(ret == 0 || (repo->verify_uploads && memcmp(oid_bytes, sha256, SHA256_DIGEST_LENGTH) != 0))
+	{
+		char remove_error_msg[128];
+		git_lfs_repo_remove_parts(mgr, repo, oid_bytes, remove_error_msg, sizeof(remove_error_msg));
+	}
+	
+	if(ret < 0)
+	{
 		git_lfs_write_error(io, 400, "%s", error_msg);
-		return;
+		goto done;
 	}
-
+	
 	io->write_http_status(io->context, 200, "OK");
 	io->write_headers(io->context, NULL, 0);
 	io->flush(io->context);
+done:
+	free(buffer);
+}
+
+// splits /upload/<oid>/<action>, returns NULL if the end point has no action
+static const char *get_upload_action(const char *end_point, char oid[65])
+{
+	if(strncmp(end_point, "/upload/", 8) != 0) return NULL;
+	
+	const char *action = strchr(end_point + 8, '/');
+	if(!action || action - (end_point + 8) != 64) return NULL;
+	
+	memcpy(oid, end_point + 8, 64);
+	oid[64] = 0;
+	
+	return action + 1;
 }
 
 struct json_object *git_lfs_lock_info_to_json(struct repo_lock_info *lock_info)
@@ -645,55 +1468,127 @@ error0:
 	json_object_put(request);
 }
 
+static void json_stream_lock(struct json_stream *stream, const struct repo_lock *lock)
+{
+	char id_str[32];
+	snprintf(id_str, sizeof(id_str), "%lld", (long long)lock->id);
+	
+	char lockedat_str[64];
+	if(!strftime(lockedat_str, sizeof(lockedat_str), "%FT%TZ", gmtime(&lock->locked_at)))
+	{
+		lockedat_str[0] = 0;
+	}
+	
+	json_stream_literal(stream, "{\"id\":");
+	json_stream_string(stream, id_str);
+	json_stream_literal(stream, ",\"path\":");
+	json_stream_string(stream, lock->path);
+	json_stream_literal(stream, ",\"locked_at\":");
+	json_stream_string(stream, lockedat_str);
+	json_stream_literal(stream, ",\"owner\":{\"name\":");
+	json_stream_string(stream, lock->username);
+	json_stream_literal(stream, "}}");
+}
+
+static void json_stream_next_cursor(struct json_stream *stream, int64_t next_cursor)
+{
+	if(next_cursor > 0)
+	{
+		char next_cursor_str[32];
+		snprintf(next_cursor_str, sizeof(next_cursor_str), "%lld", (long long)next_cursor);
+		json_stream_literal(stream, ",\"next_cursor\":");
+		json_stream_string(stream, next_cursor_str);
+	}
+}
+
+static void write_lock_list_body(struct json_stream *stream, void *context)
+{
+	const struct repo_lock_list *list = context;
+	
+	json_stream_literal(stream, "{\"locks\":[");
+	for(int i = 0; i < list->num_locks; i++)
+	{
+		if(i > 0) json_stream_raw(stream, ",", 1);
+		json_stream_lock(stream, &list->locks[i]);
+	}
+	json_stream_raw(stream, "]", 1);
+	json_stream_next_cursor(stream, list->next_cursor);
+	json_stream_raw(stream, "}", 1);
+}
+
+struct verify_lock_list
+{
+	const struct repo_lock_list *list;
+	const char *username;
+};
+
+static void write_verify_lock_list_half(struct json_stream *stream, const struct verify_lock_list *verify, int ours)
+{
+	int first = 1;
+	for(int i = 0; i < verify->list->num_locks; i++)
+	{
+		const struct repo_lock *lock = &verify->list->locks[i];
+		if((0 == strcmp(lock->username, verify->username)) != ours)
+		{
+			continue;
+		}
+		
+		if(!first) json_stream_raw(stream, ",", 1);
+		json_stream_lock(stream, lock);
+		first = 0;
+	}
+}
+
+static void write_verify_lock_list_body(struct json_stream *stream, void *context)
+{
+	const struct verify_lock_list *verify = context;
+	
+	json_stream_literal(stream, "{\"ours\":[");
+	write_verify_lock_list_half(stream, verify, 1);
+	json_stream_literal(stream, "],\"theirs\":[");
+	write_verify_lock_list_half(stream, verify, 0);
+	json_stream_raw(stream, "]", 1);
+	json_stream_next_cursor(stream, verify->list->next_cursor);
+	json_stream_raw(stream, "}", 1);
+}
+
 static void git_lfs_server_handle_list_locks(struct repo_manager *mgr,
 											 const struct git_lfs_config *config,
 											 const struct git_lfs_repo *repo,
 											 struct socket_io *io,
 											 const char *path,
 											 int64_t *id,
-											 int cursor,
+											 int64_t cursor,
 											 int limit)
 {
-	struct repo_lock_info *lock_list;
-	int next_cursor;
+	struct repo_lock_list *lock_list;
 	char error_msg[128];
-	int num_locks;
 
-	if(git_lfs_repo_list_locks(mgr, repo, cursor, limit, path, id, &lock_list, &num_locks, &next_cursor, error_msg, sizeof(error_msg)) < 0)
+	if(git_lfs_repo_list_locks(mgr, repo, cursor, limit, path, id, &lock_list, error_msg, sizeof(error_msg)) < 0)
 	{
 		git_lfs_write_error(io, 500, "%s", error_msg);
 		return;
 	}
 	
-	struct json_object *response = json_object_new_object();
-	JSON_OBJECT_CHECK(response, error0);
-	
-	struct json_object *locks = json_object_new_array();
-	JSON_OBJECT_CHECK(locks, error1);
-	json_object_object_add(response, "locks", locks);
+	write_response_json_stream(config, io, 200, "Ok", write_lock_list_body, lock_list);
+	repo_lock_list_free(lock_list);
+}
 
-	for(int i = 0; i < num_locks; i++)
+static int64_t parse_lock_cursor(const char *cursor_str)
+{
+	if(!cursor_str || !*cursor_str)
 	{
-		struct json_object *lock_json = git_lfs_lock_info_to_json(&lock_list[i]);
-		JSON_OBJECT_CHECK(lock_json, error1);
-		json_object_array_add(locks, lock_json);
+		return 0;
 	}
 	
-	if(next_cursor > 0)
+	char *end_ptr;
+	long long cursor = strtoll(cursor_str, &end_ptr, 10);
+	if(*end_ptr != 0 || cursor < 0)
 	{
-		char next_cursor_str[32];
-		if(snprintf(next_cursor_str, sizeof(next_cursor_str), "%d", next_cursor) >= sizeof(next_cursor_str)) goto error1;
-		struct json_object *next_cursor_obj = json_object_new_string(next_cursor_str);
-		JSON_OBJECT_CHECK(next_cursor_str, error1);
-		json_object_object_add(response, "next_cursor", next_cursor_obj);
+		return 0;
 	}
-
-	write_response_json(config, io, 200, "Ok", response);
-
-error1:
-	json_object_put(response);
-error0:
-	free(lock_list);
+	
+	return cursor;
 }
 
 static void git_lfs_server_handle_verify_list_locks(struct repo_manager *mgr,
@@ -701,10 +1596,8 @@ static void git_lfs_server_handle_verify_list_locks(struct repo_manager *mgr,
 											 const struct git_lfs_repo *repo,
 											 struct socket_io *io)
 {
-	struct repo_lock_info *lock_list;
-	int next_cursor;
+	struct repo_lock_list *lock_list;
 	char error_msg[128];
-	int num_locks;
 	
 	struct json_object *request = parse_json_request(io);
 	if(!request)
@@ -713,21 +1606,12 @@ static void git_lfs_server_handle_verify_list_locks(struct repo_manager *mgr,
 		return;
 	}
 
-	int cursor = 0;
+	int64_t cursor = 0;
 	int limit = LIST_LOCKS_LIMIT;
 	struct json_object *cursor_obj;
 	if(json_object_object_get_ex(request, "cursor", &cursor_obj))
 	{
-		const char *cursor_str = json_object_get_string(cursor_obj);
-		if(cursor_str && *cursor_str)
-		{
-			char *end_ptr;
-			cursor = strtol(cursor_str, &end_ptr, 10);
-			if(*end_ptr != 0)
-			{
-				cursor = 0;
-			}
-		}
+		cursor = parse_lock_cursor(json_object_get_string(cursor_obj));
 	}
 	
 	struct json_object *limit_obj;
@@ -737,53 +1621,18 @@ static void git_lfs_server_handle_verify_list_locks(struct repo_manager *mgr,
 		limit = json_object_get_int(limit_obj);
 	}
 	
-	if(git_lfs_repo_list_locks(mgr, repo, cursor, limit, NULL, NULL, &lock_list, &num_locks, &next_cursor, error_msg, sizeof(error_msg)) < 0)
+	if(git_lfs_repo_list_locks(mgr, repo, cursor, limit, NULL, NULL, &lock_list, error_msg, sizeof(error_msg)) < 0)
 	{
 		git_lfs_write_error(io, 500, "%s", error_msg);
 		goto error0;
 	}
 	
-	struct json_object *response = json_object_new_object();
-	JSON_OBJECT_CHECK(response, error0);
-
-	struct json_object *ours = json_object_new_array();
-	JSON_OBJECT_CHECK(ours, error1);
-	json_object_object_add(response, "ours", ours);
-	
-	struct json_object *theirs = json_object_new_array();
-	JSON_OBJECT_CHECK(theirs, error1);
-	json_object_object_add(response, "theirs", theirs);
-	
-	for(int i = 0; i < num_locks; i++)
-	{
-		struct json_object *lock_json = git_lfs_lock_info_to_json(&lock_list[i]);
-		JSON_OBJECT_CHECK(lock_json, error1);
-
-		if(0 == strcmp(lock_list[i].username, mgr->username))
-		{
-			json_object_array_add(ours, lock_json);
-		}
-		else
-		{
-			json_object_array_add(theirs, lock_json);
-		}
-	}
-	
-	if(next_cursor > 0)
-	{
-		char next_cursor_str[32];
-		if(snprintf(next_cursor_str, sizeof(next_cursor_str), "%d", next_cursor) >= sizeof(next_cursor_str)) goto error1;
-		struct json_object *next_cursor_obj = json_object_new_string(next_cursor_str);
-		JSON_OBJECT_CHECK(next_cursor_str, error1);
-		json_object_object_add(response, "next_cursor", next_cursor_obj);
-	}
-
-	write_response_json(config, io, 200, "Ok", response);
+	struct verify_lock_list verify = { lock_list, mgr->username };
+	write_response_json_stream(config, io, 200, "Ok", write_verify_lock_list_body, &verify);
+	repo_lock_list_free(lock_list);
 	
-error1:
-	json_object_put(response);
 error0:
-	free(lock_list);
+	json_object_put(request);
 }
 
 static void git_lfs_server_handle_delete_lock(struct repo_manager *mgr,
@@ -842,14 +1691,15 @@ error0:
 }
 
 
-void git_lfs_server_handle_request(struct repo_manager *mgr,
-								   const struct git_lfs_config *config,
-								   const struct git_lfs_repo *repo,
-								   struct socket_io *io,
-								   const char *authorization_header,
-								   const char *method,
-								   const char *end_point,
-								   struct query_param_list *params)
+static void git_lfs_server_handle_repo_request(struct repo_manager *mgr,
+											   const struct git_lfs_config *config,
+											   const struct git_lfs_repo *repo,
+											   struct socket_io *io,
+											   struct arena *arena,
+											   const char *authorization_header,
+											   const char *method,
+											   const char *end_point,
+											   struct query_param_list *params)
 {
 	if(config->verbose >= 1)
 	{
@@ -956,17 +1806,24 @@ void git_lfs_server_handle_request(struct repo_manager *mgr,
 		}
 	}
 
+	char oid[65];
+	const char *upload_action = get_upload_action(end_point, oid);
+	
 	if(strcmp(method, "GET") == 0)
 	{
 		if(strncmp(end_point, "/download/", 10) == 0)
 		{
 			git_lfs_download(mgr, config, repo, io, end_point + 10);
 		}
+		else if(upload_action && strcmp(upload_action, "parts") == 0)
+		{
+			git_lfs_upload_status(mgr, config, repo, io, arena, oid);
+		}
 		else if(strcmp(end_point, "/locks") == 0)
 		{
 			const char *path = NULL;
 			int64_t id = -1;
-			int cursor = 0;
+			int64_t cursor = 0;
 			int limit = LIST_LOCKS_LIMIT;
 			char *end_ptr;
 			const char *str_val;
@@ -980,12 +1837,7 @@ void git_lfs_server_handle_request(struct repo_manager *mgr,
 				if(*end_ptr != 0) id = -1;
 			}
 			
-			str_val = get_query_param(params, "cursor");
-			if(str_val && *str_val)
-			{
-				cursor = strtoll(str_val, &end_ptr, 10);
-				if(*end_ptr != 0) cursor = 0;
-			}
+			cursor = parse_lock_cursor(get_query_param(params, "cursor"));
 			
 			str_val = get_query_param(params, "limit");
 			if(str_val && *str_val)
@@ -1003,7 +1855,9 @@ void git_lfs_server_handle_request(struct repo_manager *mgr,
 		
 	} else if(strcmp(method, "PUT") == 0) {
 		
-		if(strncmp(end_point, "/upload/", 8) == 0) {
+		if(upload_action && strcmp(upload_action, "parts") == 0) {
+			git_lfs_upload_part(mgr, config, repo, io, oid);
+		} else if(strncmp(end_point, "/upload/", 8) == 0) {
 			git_lfs_upload(mgr, config, repo, io, end_point + 8);
 		} else {
 			git_lfs_write_error(io, 501, "End point not supported.");
@@ -1014,7 +1868,11 @@ void git_lfs_server_handle_request(struct repo_manager *mgr,
 		// v1 batch
 		if(strcmp(end_point, "/objects/batch") == 0)
 		{
-			git_lfs_server_handle_batch(mgr, config, repo, io);
+			git_lfs_server_handle_batch(mgr, config, repo, io, arena);
+		}
+		else if(upload_action && strcmp(upload_action, "commit") == 0)
+		{
+			git_lfs_upload_commit_parts(mgr, config, repo, io, oid);
 		}
 		else if(strcmp(end_point, "/locks") == 0)
 		{
@@ -1057,4 +1915,93 @@ error:
 	}
 }
 
+// follows the dispatch of git_lfs_server_handle_repo_request, so requests
+// that fail authentication are counted with their endpoint as well
+static enum metrics_endpoint get_metrics_endpoint(const char *method, const char *end_point)
+{
+	char oid[65];
+	const char *upload_action = get_upload_action(end_point, oid);
+	int is_parts = upload_action && strcmp(upload_action, "parts") == 0;
+	
+	if(strcmp(method, "GET") == 0)
+	{
+		if(strncmp(end_point, "/download/", 10) == 0) return METRICS_ENDPOINT_DOWNLOAD;
+		if(is_parts) return METRICS_ENDPOINT_UPLOAD_STATUS;
+		if(strcmp(end_point, "/locks") == 0) return METRICS_ENDPOINT_LOCK_LIST;
+	}
+	else if(strcmp(method, "PUT") == 0)
+	{
+		if(is_parts) return METRICS_ENDPOINT_UPLOAD_PART;
+		if(strncmp(end_point, "/upload/", 8) == 0) return METRICS_ENDPOINT_UPLOAD;
+	}
+	else if(strcmp(method, "POST") == 0)
+	{
+		if(strcmp(end_point, "/objects/batch") == 0) return METRICS_ENDPOINT_BATCH;
+		if(upload_action && strcmp(upload_action, "commit") == 0) return METRICS_ENDPOINT_UPLOAD_COMMIT;
+		if(strcmp(end_point, "/locks") == 0) return METRICS_ENDPOINT_LOCK_CREATE;
+		if(strcmp(end_point, "/locks/verify") == 0) return METRICS_ENDPOINT_LOCK_VERIFY;
+		if(strncmp(end_point, "/locks/", 7) == 0) return METRICS_ENDPOINT_LOCK_DELETE;
+	}
+	
+	return METRICS_ENDPOINT_OTHER;
+}
+
+void git_lfs_server_handle_request(struct repo_manager *mgr,
+								   const struct git_lfs_config *config,
+								   const struct git_lfs_repo *repo,
+								   struct socket_io *io,
+								   struct arena *arena,
+								   const char *authorization_header,
+								   const char *method,
+								   const char *end_point,
+								   struct query_param_list *params)
+{
+	uint64_t start = os_clock_us();
+	enum metrics_endpoint endpoint = get_metrics_endpoint(method, end_point);
+	
+	struct metrics_io mio;
+	metrics_io_init(&mio, io);
+	
+	// object data isn't worth keeping in the log, only the json bodies are sampled
+	struct access_log_io *lio = NULL;
+	if(endpoint != METRICS_ENDPOINT_DOWNLOAD &&
+	   endpoint != METRICS_ENDPOINT_UPLOAD &&
+	   endpoint != METRICS_ENDPOINT_UPLOAD_PART &&
+	   access_log_sample(config->access_log_sample))
+	{
+		lio = (struct access_log_io *)arena_alloc(arena, sizeof(struct access_log_io));
+		if(lio) access_log_io_init(lio, &mio.wrapper.io);
+	}
+	
+	git_lfs_server_handle_repo_request(mgr, config, repo, lio ? &lio->wrapper.io : &mio.wrapper.io, arena, authorization_header, method, end_point, params);
+	
+	uint64_t elapsed = os_clock_us() - start;
+	metrics_observe_request(endpoint, repo, &mio, elapsed);
+	
+	if(access_log_enabled())
+	{
+		struct access_log_entry entry =
+		{
+			.method = method,
+			.repo = repo->name,
+			.end_point = end_point,
+			.user = mgr->username[0] ? mgr->username : NULL,
+			.status = mio.status,
+			.bytes_in = mio.bytes_in,
+			.bytes_out = mio.bytes_out,
+			.duration_us = elapsed
+		};
+		
+		if(lio)
+		{
+			entry.request_body = lio->request_body;
+			entry.request_body_len = lio->request_len;
+			entry.response_body = lio->response_body;
+			entry.response_body_len = lio->response_len;
+		}
+		
+		access_log_write(&entry);
+	}
+}
+
 #undef JSON_OBJECT_CHECK
@@ -21,11 +21,13 @@ struct options;
 struct git_lfs_config;
 struct git_lfs_repo;
 struct query_param_list;
+struct arena;
 
 void git_lfs_server_handle_request(struct repo_manager *mgr,
 								   const struct git_lfs_config *config,
 								   const struct git_lfs_repo *repo,
 								   struct socket_io *io,
+								   struct arena *arena,
 								   const char *authorization_header,
 								   const char *method,
 								   const char *end_point,
@@ -18,9 +18,53 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
 #include "compat/string.h"
 #include "crypt_blowfish.h"
 
+struct htpasswd *create_htpasswd(void)
+{
+	struct htpasswd *htp = calloc(1, sizeof *htp);
+	if(!htp) return NULL;
+	
+	SLIST_INIT(&htp->users);
+	
+	if(RAND_bytes(htp->cache_key, sizeof(htp->cache_key)) != 1)
+	{
+		free(htp);
+		return NULL;
+	}
+	
+	return htp;
+}
+
+int htpasswd_add_user(struct htpasswd *htpasswd, const char *username, const char *bcrypt_hash)
+{
+	struct password_entry *user = calloc(1, sizeof *user);
+	if(!user) return -1;
+	
+	if(strlcpy(user->username, username, sizeof(user->username)) >= sizeof(user->username))
+	{
+		fprintf(stderr, "htpasswd: Ignored user '%s', username is too long.\n", username);
+		free(user);
+		return 0;
+	}
+
+	if(strlcpy(user->bcrypt_hash, bcrypt_hash, sizeof(user->bcrypt_hash)) >= sizeof(user->bcrypt_hash))
+	{
+		fprintf(stderr, "htpasswd: Ignored user '%s', hash is too long.\n", username);
+		free(user);
+		return 0;
+	}
+	
+	SLIST_INSERT_HEAD(&htpasswd->users, user, entries);
+	
+	return 0;
+}
+
 struct htpasswd *load_htpasswd_file(const char *filename)
 {
 	char line[128];
@@ -28,10 +72,12 @@ struct htpasswd *load_htpasswd_file(const char *filename)
 	FILE *fp = fopen(filename, "r");
 	if(!fp) return NULL;
 	
-	struct htpasswd *htp = calloc(1, sizeof *htp);
-	if(!htp) return NULL;
-	
-	SLIST_INIT(htp);
+	struct htpasswd *htp = create_htpasswd();
+	if(!htp)
+	{
+		fclose(fp);
+		return NULL;
+	}
 
 	while(fgets(line, sizeof(line), fp))
 	{
@@ -85,29 +131,12 @@ struct htpasswd *load_htpasswd_file(const char *filename)
 			continue;
 		}
 
-		struct password_entry *user = calloc(1, sizeof *user);
-		if(!user)
+		if(htpasswd_add_user(htp, username, bcrypt_hash) < 0)
 		{
 			free_htpasswd(htp);
 			fclose(fp);
 			return NULL;
 		}
-
-		if(strlcpy(user->username, username, sizeof(user->username)) >= sizeof(user->username))
-		{
-			fprintf(stderr, "htpasswd: Ignored user '%s', username is too long.\n", username);
-			free(user);
-			continue;
-		}
-
-		if(strlcpy(user->bcrypt_hash, bcrypt_hash, sizeof(user->bcrypt_hash)) >= sizeof(user->bcrypt_hash))
-		{
-			fprintf(stderr, "htpasswd: Ignored user '%s', hash is too long.\n", username);
-			free(user);
-			continue;
-		}
-		
-		SLIST_INSERT_HEAD(htp, user, entries);
 	}
 
 	fclose(fp);
@@ -115,24 +144,79 @@ struct htpasswd *load_htpasswd_file(const char *filename)
 	return htp;
 }
 
+static int htpasswd_cache_mac(const struct htpasswd *htpasswd, const struct password_entry *user, const char *password, unsigned char *mac)
+{
+	// the hash line is part of the MAC so a changed password in the
+	// htpasswd file never matches what was cached for the old one
+	size_t hash_len = strlen(user->bcrypt_hash) + 1;
+	size_t username_len = strlen(user->username) + 1;
+	size_t password_len = strlen(password);
+	size_t message_len = hash_len + username_len + password_len;
+	unsigned char *message = malloc(message_len);
+	if(!message) return -1;
+	
+	memcpy(message, user->bcrypt_hash, hash_len);
+	memcpy(message + hash_len, user->username, username_len);
+	memcpy(message + hash_len + username_len, password, password_len);
+	
+	unsigned int mac_len = 0;
+	int ret = HMAC(EVP_sha256(), htpasswd->cache_key, sizeof(htpasswd->cache_key), message, message_len, mac, &mac_len) &&
+			  mac_len == HTPASSWD_MAC_SIZE ? 0 : -1;
+	
+	explicit_bzero(message, message_len);
+	free(message);
+	return ret;
+}
+
+static struct htpasswd_cache_entry *htpasswd_cache_slot(struct htpasswd *htpasswd, const unsigned char *mac)
+{
+	return &htpasswd->cache[(mac[0] | (mac[1] << 8)) % HTPASSWD_CACHE_SIZE];
+}
+
 int authenticate_user_with_password(struct htpasswd *htpasswd, const char *username, const char *password)
 {
 	struct password_entry *user;
-	SLIST_FOREACH(user, htpasswd, entries)
+	SLIST_FOREACH(user, &htpasswd->users, entries)
 	{
 		if(0 == strcmp(user->username, username))
 		{
 			char hash[61];
+			unsigned char mac[HTPASSWD_MAC_SIZE];
+			int has_mac = htpasswd_cache_mac(htpasswd, user, password, mac) == 0;
+			time_t now = time(NULL);
+
+			if(has_mac)
+			{
+				struct htpasswd_cache_entry *entry = htpasswd_cache_slot(htpasswd, mac);
+				if(entry->expire > now && CRYPTO_memcmp(entry->mac, mac, sizeof(mac)) == 0)
+				{
+					explicit_bzero(mac, sizeof(mac));
+					return 1;
+				}
+			}
 
 			if (_crypt_blowfish_rn(password, user->bcrypt_hash, hash, sizeof(hash)) == NULL)
 			{
+				explicit_bzero(mac, sizeof(mac));
 				return 0;
 			}
 			
 			if(0 == strncmp(user->bcrypt_hash, hash, 31))
 			{
+				// only successful logins are remembered, so a wrong
+				// password always costs a full bcrypt
+				if(has_mac)
+				{
+					struct htpasswd_cache_entry *entry = htpasswd_cache_slot(htpasswd, mac);
+					memcpy(entry->mac, mac, sizeof(mac));
+					entry->expire = now + HTPASSWD_CACHE_TTL;
+					explicit_bzero(mac, sizeof(mac));
+				}
+				
 				return 1;
 			}
+			
+			explicit_bzero(mac, sizeof(mac));
 		}
 	}
 	
@@ -144,12 +228,13 @@ void free_htpasswd(struct htpasswd * htpasswd)
 	if(htpasswd)
 	{
 		struct password_entry *user;
-		while (!SLIST_EMPTY(htpasswd))
+		while (!SLIST_EMPTY(&htpasswd->users))
 		{
-			user = SLIST_FIRST(htpasswd);
-			SLIST_REMOVE_HEAD(htpasswd, entries);
+			user = SLIST_FIRST(&htpasswd->users);
+			SLIST_REMOVE_HEAD(&htpasswd->users, entries);
 			free(user);
 		}
+		explicit_bzero(htpasswd, sizeof(*htpasswd));
 		free(htpasswd);
 	}
 }
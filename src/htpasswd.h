@@ -16,8 +16,16 @@
 #ifndef HTPASSWD_H
 #define HTPASSWD_H
 
+#include <time.h>
 #include "compat/queue.h"
 
+enum htpasswd_cache_config
+{
+	HTPASSWD_CACHE_SIZE = 256,
+	HTPASSWD_CACHE_TTL = 5 * 60, // seconds
+	HTPASSWD_MAC_SIZE = 32
+};
+
 struct password_entry
 {
 	SLIST_ENTRY(password_entry) entries;
@@ -26,8 +34,24 @@ struct password_entry
 	char bcrypt_hash[61];
 };
 
-SLIST_HEAD(htpasswd, password_entry);
+// a password that passed bcrypt, identified by a MAC of the user's hash
+// line, username and password under a key that never leaves the process
+struct htpasswd_cache_entry
+{
+	unsigned char mac[HTPASSWD_MAC_SIZE];
+	time_t expire;
+};
+
+struct htpasswd
+{
+	SLIST_HEAD(, password_entry) users;
+	
+	unsigned char cache_key[HTPASSWD_MAC_SIZE];
+	struct htpasswd_cache_entry cache[HTPASSWD_CACHE_SIZE];
+};
 
+struct htpasswd *create_htpasswd(void);
+int htpasswd_add_user(struct htpasswd *htpasswd, const char *username, const char *bcrypt_hash);
 struct htpasswd *load_htpasswd_file(const char *filename);
 int authenticate_user_with_password(struct htpasswd *htpasswd, const char *username, const char *password);
 void free_htpasswd(struct htpasswd * htpasswd);
@@ -17,7 +17,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <ctype.h>
 #include <fcgiapp.h>
+#include <fastcgi.h>
 #include "mongoose.h"
 #include "compat/queue.h"
 #include "compat/base64.h"
@@ -27,14 +31,26 @@
 #include "os/threads.h"
 #include "os/signal.h"
 #include "os/filesystem.h"
+#include "os/io.h"
+#include "os/socket.h"
+#include "arena.h"
 #include "htpasswd.h"
 #include "git_lfs_server.h"
 #include "repo_manager.h"
 #include "socket_io.h"
+#include "socket_utils.h"
 #include "configuration.h"
+#include "repo_router.h"
+#include "config_reload.h"
+#include "metrics.h"
+#ifdef HAVE_OS_EVENT
+#include "event_httpd.h"
+#endif
+
+// covers the query params and a batch of a couple hundred objects
+#define HTTPD_ARENA_SIZE (16 * 1024)
 
 static os_mutex_t running_mutex;
-static os_mutex_t accept_mutex;
 
 static void term_handler(int sig)
 {
@@ -88,6 +104,19 @@ static void io_mg_flush(void *context)
 {
 }
 
+static const char *io_mg_get_header(void *context, const char *name)
+{
+	return mg_get_header((struct mg_connection *)context, name);
+}
+
+static long io_mg_send_file(void *context, int fd, long offset, long size)
+{
+	int socket = mg_get_socket((struct mg_connection *)context);
+	if(socket < 0) return -1;
+
+	return os_sendfile(socket, fd, offset, size);
+}
+
 static int io_fcgi_read(void *context, void *buffer, int size)
 {
 	FCGX_Request *request = (FCGX_Request *)context;
@@ -134,10 +163,76 @@ static void io_fcgi_flush(void *context)
 	FCGX_FFlush(request->out);
 }
 
+static const char *io_fcgi_get_header(void *context, const char *name)
+{
+	FCGX_Request *request = (FCGX_Request *)context;
+	
+	// the body headers have their own CGI params
+	if(0 == strcasecmp(name, "Content-Length")) return FCGX_GetParam("CONTENT_LENGTH", request->envp);
+	if(0 == strcasecmp(name, "Content-Type")) return FCGX_GetParam("CONTENT_TYPE", request->envp);
+	
+	// other headers are passed as CGI params, e.g. If-Range is HTTP_IF_RANGE
+	char param[128] = "HTTP_";
+	size_t len = strlen(param);
+	for(; *name && len < sizeof(param) - 1; name++, len++) {
+		param[len] = *name == '-' ? '_' : toupper((unsigned char)*name);
+	}
+	if(*name) return NULL;
+	param[len] = 0;
+	
+	return FCGX_GetParam(param, request->envp);
+}
+
+// largest FCGI_STDOUT record that needs no padding
+#define FCGI_SEND_FILE_RECORD_SIZE 65528
+
+static long io_fcgi_send_file(void *context, int fd, long offset, long size)
+{
+	FCGX_Request *request = (FCGX_Request *)context;
+
+	// anything libfcgi has buffered must go out before our own records
+	if(FCGX_FFlush(request->out) < 0) return -1;
+	if(size == 0) return 0;
+
+	// write the stdout records directly to the connection so the record
+	// content can be sent from the file by the kernel
+	long sent = 0;
+	while(sent < size)
+	{
+		long n = size - sent;
+		if(n > FCGI_SEND_FILE_RECORD_SIZE) n = FCGI_SEND_FILE_RECORD_SIZE;
+
+		FCGI_Header header;
+		memset(&header, 0, sizeof(header));
+		header.version = FCGI_VERSION_1;
+		header.type = FCGI_STDOUT;
+		header.requestIdB1 = (request->requestId >> 8) & 0xff;
+		header.requestIdB0 = request->requestId & 0xff;
+		header.contentLengthB1 = (n >> 8) & 0xff;
+		header.contentLengthB0 = n & 0xff;
+
+		// a partial record cannot be recovered from. libfcgi would append
+		// the end of the request to it, so the connection is shut down
+		// rather than kept for the next request
+		if(socket_write_fully(request->ipcFd, &header, sizeof(header)) != sizeof(header)) goto error;
+		
+		long written = os_sendfile(request->ipcFd, fd, offset + sent, n);
+		if(written > 0) sent += written;
+		if(written != n) goto error;
+	}
+
+	return sent;
+	
+error:
+	request->keepConnection = 0;
+	os_shutdown(request->ipcFd);
+	return sent;
+}
+
 struct thread_info
 {
-	const struct git_lfs_config *config;
 	int listening_socket; // for fastcgi
+	os_mutex_t accept_mutex; // for fastcgi, NULL if no other thread accepts on the socket
 	struct repo_manager *repo_mgr;
 };
 
@@ -155,7 +250,7 @@ const char *get_query_param(struct query_param_list *params, const char *key)
 	return NULL;
 }
 
-static void handle_request(struct thread_info *info,
+static void handle_request(struct repo_manager *mgr,
 						   struct socket_io *io,
 						   const char *authentication,
 						   const char *request_method,
@@ -187,28 +282,34 @@ static void handle_request(struct thread_info *info,
 		return;
 	}
 
-	const struct git_lfs_repo *repo = NULL, *r;
-	const char *end_point = NULL;
-	SLIST_FOREACH(r, &info->config->repos, entries) {
-		size_t repo_uri_len = strlen(r->uri);
-		
-		// found a match
-		if(strncmp(r->uri, uri, repo_uri_len) == 0) {
-			end_point = uri + repo_uri_len;
-			repo = r;
-			break;
-		}
+	// a reload leaves the config alone until the request is done with it
+	struct git_lfs_config *config = config_reload_acquire();
+	
+	if(config->metrics && 0 == strcmp(uri, "/metrics") && 0 == strcmp(request_method, "GET"))
+	{
+		metrics_write(io, config, mgr);
+		config_reload_release(config);
+		return;
 	}
 	
+	size_t repo_uri_len;
+	const struct git_lfs_repo *repo = repo_router_lookup(config->router, uri, &repo_uri_len);
+	const char *end_point = uri + repo_uri_len;
+	
+	// scratch memory for the rest of the request
+	uint64_t arena_buffer[HTTPD_ARENA_SIZE / sizeof(uint64_t)];
+	struct arena arena;
+	arena_init(&arena, arena_buffer, sizeof(arena_buffer));
+	
 	struct query_param_list query_params;
 	SLIST_INIT(&query_params);
 	
 	// query params parsing
-	char *query_copy = strndup(query_string, 2048);
+	char *query_copy = arena_strndup(&arena, query_string, 2048);
 	if(!query_copy)
 	{
 		fprintf(stderr, "Unable to allocate memory for query params.");
-		return;
+		goto error0;
 	}
 
 	char *iter = query_copy;
@@ -222,57 +323,35 @@ static void handle_request(struct thread_info *info,
 		char *value = strsep(&kviter, "\r\n");
 		if(!value) continue; // ignore keys without values, this is applicable to this app as we don't care about those
 		
-		struct query_param *param = calloc(1, sizeof *param);
-		if(!param)
-		{
-			fprintf(stderr, "Unable to allocate memory for query params.");
-			goto error0;
-		}
-		
 		int key_len = strlen(key);
 		int value_len = strlen(value);
-
-		param->key = malloc(key_len + 1);
-		if(!param->key)
-		{
-			fprintf(stderr, "Unable to allocate memory for query params.");
-			goto error1;
-		}
 		
-		if(mg_url_decode(key, key_len, param->key, key_len + 1, 0) < 0)
+		struct query_param *param = arena_alloc(&arena, sizeof *param);
+		if(param)
 		{
-			fprintf(stderr, "URL decode failed.");
-			goto error2;
+			param->key = arena_alloc(&arena, key_len + 1);
+			param->value = arena_alloc(&arena, value_len + 1);
 		}
-
-		param->value = malloc(value_len + 1);
-		if(!param->value)
+		
+		if(!param || !param->key || !param->value)
 		{
 			fprintf(stderr, "Unable to allocate memory for query params.");
-			goto error2;
+			goto error0;
 		}
 		
-		if(mg_url_decode(value, value_len, param->value, value_len + 1, 0) < 0)
+		if(mg_url_decode(key, key_len, param->key, key_len + 1, 0) < 0 ||
+		   mg_url_decode(value, value_len, param->value, value_len + 1, 0) < 0)
 		{
 			fprintf(stderr, "URL decode failed.");
-			goto error3;
+			goto error0;
 		}
 		
 		SLIST_INSERT_HEAD(&query_params, param, entry);
-		
-		continue;
-error3:
-		free(param->value);
-error2:
-		free(param->key);
-error1:
-		free(param);
-		goto error0;
 	}
 	
 	if(repo)
 	{
-		git_lfs_server_handle_request(info->repo_mgr, info->config, repo, io, authentication, request_method, end_point, &query_params);
+		git_lfs_server_handle_request(mgr, config, repo, io, &arena, authentication, request_method, end_point, &query_params);
 	}
 	else
 	{
@@ -280,16 +359,8 @@ error1:
 	}
 	
 error0:
-	free(query_copy);
-
-	while(!SLIST_EMPTY(&query_params))
-	{
-		struct query_param *param = SLIST_FIRST(&query_params);
-		SLIST_REMOVE_HEAD(&query_params, entry);
-		free(param->value);
-		free(param->key);
-		free(param);
-	}
+	arena_reset(&arena);
+	config_reload_release(config);
 }
 
 static int httpd_handle_request(struct mg_connection *conn)
@@ -307,14 +378,60 @@ static int httpd_handle_request(struct mg_connection *conn)
 	io.write_headers = io_mg_write_headers;
 	io.printf = io_mg_printf;
 	io.flush = io_mg_flush;
+	io.get_header = io_mg_get_header;
+	io.send_file = io_mg_send_file;
 	
 	const char *authentication = mg_get_header(conn, "Authorization");
 
-	handle_request(info, &io, authentication, req->request_method, req->uri, req->query_string ? req->query_string : "");
+	// per-request state, shares the repo manager channel
+	struct repo_manager mgr;
+	repo_manager_init_session(&mgr, info->repo_mgr);
+
+	handle_request(&mgr, &io, authentication, req->request_method, req->uri, req->query_string ? req->query_string : "");
 	
 	return 1;
 }
 
+#ifdef HAVE_OS_EVENT
+// the urls we hand out join base_url and the repo uri with a slash, mongoose
+// collapses the resulting // so do the same here
+static void collapse_slashes(char *path)
+{
+	char *out = path;
+	for(char *in = path; *in; in++)
+	{
+		if(*in == '/' && out > path && out[-1] == '/') continue;
+		*out++ = *in;
+	}
+	*out = 0;
+}
+
+static void event_httpd_handle_request(void *user_data,
+									   struct socket_io *io,
+									   const char *request_method,
+									   const char *uri,
+									   const char *query_string)
+{
+	struct thread_info *info = (struct thread_info *)user_data;
+	
+	// handlers expect the decoded path, as mongoose passes it
+	char decoded_uri[8192];
+	if(mg_url_decode(uri, strlen(uri), decoded_uri, sizeof(decoded_uri), 0) < 0)
+	{
+		git_lfs_write_error(io, 414, "URI is too long.");
+		return;
+	}
+	collapse_slashes(decoded_uri);
+	
+	const char *authentication = io->get_header(io->context, "Authorization");
+	
+	struct repo_manager mgr;
+	repo_manager_init_session(&mgr, info->repo_mgr);
+	
+	handle_request(&mgr, io, authentication, request_method, decoded_uri, query_string);
+}
+#endif
+
 static void *fastcgi_handler_thread(void *data)
 {
 	FCGX_Request request;
@@ -324,9 +441,9 @@ static void *fastcgi_handler_thread(void *data)
 	
 	for (;;) {
 		
-		os_mutex_lock(accept_mutex);
+		if(info->accept_mutex) os_mutex_lock(info->accept_mutex);
 		int rc = FCGX_Accept_r(&request);
-		os_mutex_unlock(accept_mutex);
+		if(info->accept_mutex) os_mutex_unlock(info->accept_mutex);
 		
 		if(rc < 0) break;
 		
@@ -340,6 +457,8 @@ static void *fastcgi_handler_thread(void *data)
 		io.write_headers = io_fcgi_write_headers;
 		io.printf = io_fcgi_printf;
 		io.flush = io_fcgi_flush;
+		io.get_header = io_fcgi_get_header;
+		io.send_file = io_fcgi_send_file;
 		
 		const char *request_method = FCGX_GetParam("REQUEST_METHOD", request.envp);
 		const char *script_name = FCGX_GetParam("SCRIPT_NAME", request.envp);
@@ -352,7 +471,9 @@ static void *fastcgi_handler_thread(void *data)
 		}
 		else
 		{
-			handle_request(info, &io, authentication, request_method, script_name, query_string);
+			struct repo_manager mgr;
+			repo_manager_init_session(&mgr, info->repo_mgr);
+			handle_request(&mgr, &io, authentication, request_method, script_name, query_string);
 		}
 
 		FCGX_Finish_r(&request);
@@ -364,6 +485,8 @@ static void *fastcgi_handler_thread(void *data)
 
 int git_lfs_start_httpd(struct repo_manager *mgr, const struct git_lfs_config *config)
 {
+	int ret = 0;
+	
 	if(!config->fastcgi_server) {
 		running_mutex = os_mutex_create();
 
@@ -383,7 +506,6 @@ int git_lfs_start_httpd(struct repo_manager *mgr, const struct git_lfs_config *c
 		callbacks.begin_request = httpd_handle_request;
 		
 		struct thread_info info;
-		info.config = config;
 		info.repo_mgr = mgr;
 		
 		if(os_sandbox(SANDBOX_INET_SOCKET) < 0)
@@ -392,10 +514,25 @@ int git_lfs_start_httpd(struct repo_manager *mgr, const struct git_lfs_config *c
 			return -1;
 		}
 
-		struct mg_context *context = mg_start(&callbacks, &info, mg_options);
-		if(!context) {
-			fprintf(stderr, "Failed to start web server.\n");
-			return -1;
+		struct mg_context *context = NULL;
+#ifdef HAVE_OS_EVENT
+		struct event_httpd *event_httpd = NULL;
+		if(config->event_server)
+		{
+			event_httpd = event_httpd_start(config->port, config->num_threads, event_httpd_handle_request, &info);
+			if(!event_httpd) {
+				fprintf(stderr, "Failed to start web server.\n");
+				return -1;
+			}
+		}
+		else
+#endif
+		{
+			context = mg_start(&callbacks, &info, mg_options);
+			if(!context) {
+				fprintf(stderr, "Failed to start web server.\n");
+				return -1;
+			}
 		}
 		
 		os_signal(SIGINT, term_handler);
@@ -406,62 +543,142 @@ int git_lfs_start_httpd(struct repo_manager *mgr, const struct git_lfs_config *c
 
 		os_signal(SIGINT, SIG_DFL);
 		os_signal(SIGTERM, SIG_DFL);
-		mg_stop(context);
+#ifdef HAVE_OS_EVENT
+		if(event_httpd) event_httpd_stop(event_httpd);
+#endif
+		if(context) mg_stop(context);
 		
 		os_mutex_destroy(running_mutex);
 	} else {
-		accept_mutex = os_mutex_create();
+		if(config->num_threads < 1 || config->num_threads > 256) {
+			fprintf(stderr, "Invalid number of threads (%d) specified. Must be >= 1 and < 256.\n", config->num_threads);
+			return -1;
+		}
+		
+		int num_listeners = config->fastcgi_listeners;
+		if(num_listeners < 1 || num_listeners > config->num_threads) {
+			fprintf(stderr, "Invalid number of FastCGI listeners (%d) specified. Must be >= 1 and <= num_threads.\n", num_listeners);
+			return -1;
+		}
+		
+		ret = -1;
 		
 		FCGX_Init();
 		
-		int saved_umask = os_umask(0);
-		int listening_socket = FCGX_OpenSocket(config->fastcgi_socket, 400);
-		if(listening_socket < 0) {
-			fprintf(stderr, "Failed to create FastCGI socket '%s'.", config->fastcgi_socket);
+		int *listening_sockets = (int *)calloc(num_listeners, sizeof(int));
+		os_mutex_t *accept_mutexes = (os_mutex_t *)calloc(num_listeners, sizeof(os_mutex_t));
+		struct thread_info *thread_infos = (struct thread_info *)calloc(config->num_threads, sizeof(struct thread_info));
+		if(!listening_sockets || !accept_mutexes || !thread_infos)
+		{
+			fprintf(stderr, "Cannot allocate memory for threads.");
+			free(listening_sockets);
+			free(accept_mutexes);
+			free(thread_infos);
 			return -1;
 		}
+		
+		// like FCGX_OpenSocket, any ':' in the value means [host]:port,
+		// otherwise it is the path of a unix socket
+		const char *port_sep = strrchr(config->fastcgi_socket, ':');
+		char host[256] = "";
+		int port = 0;
+		if(port_sep) {
+			const char *host_start = config->fastcgi_socket;
+			size_t host_len = port_sep - host_start;
+			if(host_len >= 2 && host_start[0] == '[' && host_start[host_len - 1] == ']') {
+				host_start++;
+				host_len -= 2;
+			}
+			char *end;
+			long value = strtol(port_sep + 1, &end, 10);
+			if(host_len >= sizeof(host) || end == port_sep + 1 || *end || value <= 0 || value > 65535) {
+				fprintf(stderr, "Invalid FastCGI socket address '%s'.\n", config->fastcgi_socket);
+				free(listening_sockets);
+				free(accept_mutexes);
+				free(thread_infos);
+				return -1;
+			}
+			memcpy(host, host_start, host_len);
+			host[host_len] = 0;
+			port = (int)value;
+		}
+		
+		// with several listeners, TCP sockets share the port through
+		// SO_REUSEPORT and unix sockets get a .N suffix each
+		int saved_umask = os_umask(0);
+		int num_open = 0;
+		for(; num_open < num_listeners; num_open++) {
+			int listening_socket = -1;
+			char path[PATH_MAX];
+			const char *name = config->fastcgi_socket;
+			if(num_listeners == 1) {
+				listening_socket = FCGX_OpenSocket(config->fastcgi_socket, 400);
+			} else if(port_sep) {
+				listening_socket = os_socket_listen_tcp(host, port, 400, 1);
+			} else if(snprintf(path, sizeof(path), "%s.%d", config->fastcgi_socket, num_open) < sizeof(path)) {
+				name = path;
+				listening_socket = FCGX_OpenSocket(path, 400);
+			}
+			
+			if(listening_socket < 0) {
+				fprintf(stderr, "Failed to create FastCGI socket '%s' for listener %d: %s\n", name, num_open, strerror(errno));
+				break;
+			}
+			
+			listening_sockets[num_open] = listening_socket;
+		}
 		os_umask(saved_umask);
 		
-		if(config->num_threads < 1 || config->num_threads > 256) {
-			fprintf(stderr, "Invalid number of threads (%d) specified. Must be >= 1 and < 256.\n", config->num_threads);
-			return -1;
+		if(num_open < num_listeners) {
+			goto fcgi_error;
 		}
-
+		
+		// threads are dealt out to the listeners in turn. a listener
+		// only needs a lock when more than one thread accepts on it
+		for(int i = 0; i < num_listeners; i++) {
+			if(config->num_threads / num_listeners + (i < config->num_threads % num_listeners) > 1) {
+				accept_mutexes[i] = os_mutex_create();
+			}
+		}
+		
 		os_signal(SIGINT, fcgi_term_handler);
 		os_signal(SIGTERM, fcgi_term_handler);
 		
 		// only allow internet
-		if(os_sandbox(config->fastcgi_socket[0] != ':' ? SANDBOX_UNIX_SOCKET : SANDBOX_INET_SOCKET) < 0)
+		if(os_sandbox(!port_sep ? SANDBOX_UNIX_SOCKET : SANDBOX_INET_SOCKET) < 0)
 		{
 			fprintf(stderr, "Sandbox failed.\n");
-			return -1;
+			goto fcgi_error;
 		}
-
-		struct thread_info *thread_infos = (struct thread_info *)calloc(config->num_threads, sizeof(struct thread_info));
-		if(!thread_infos)
-		{
-			fprintf(stderr, "Cannot allocate memory for threads.");
-			return -1;
+		
+		for(int i = 0; i < config->num_threads; i++) {
+			thread_infos[i].listening_socket = listening_sockets[i % num_listeners];
+			thread_infos[i].accept_mutex = accept_mutexes[i % num_listeners];
+			thread_infos[i].repo_mgr = mgr;
 		}
 		
 		for(int i = 1; i < config->num_threads; i++) {
-			thread_infos[i].config = config;
-			thread_infos[i].listening_socket = listening_socket;
-			thread_infos[i].repo_mgr = mgr;
 			os_thread_create(fastcgi_handler_thread, &thread_infos[i]);
 		}
 		
-		thread_infos[0].config = config;
-		thread_infos[0].listening_socket = listening_socket;
-		thread_infos[0].repo_mgr = mgr;
 		fastcgi_handler_thread(&thread_infos[0]);
 		
 		os_signal(SIGINT, SIG_DFL);
 		os_signal(SIGTERM, SIG_DFL);
-
-		os_mutex_destroy(accept_mutex);
+		
+		ret = 0;
+fcgi_error:
+		// the sockets are only closed if no thread was started on them
+		for(int i = 0; ret < 0 && i < num_open; i++) {
+			os_close(listening_sockets[i]);
+		}
+		for(int i = 0; i < num_listeners; i++) {
+			if(accept_mutexes[i]) os_mutex_destroy(accept_mutexes[i]);
+		}
+		free(accept_mutexes);
+		free(listening_sockets);
 		free(thread_infos);
 	}
 
-	return 0;
+	return ret;
 }
@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "json_reader.h"
+#include <string.h>
+#include <limits.h>
+#include "socket_io.h"
+
+void json_reader_init(struct json_reader *reader, const struct socket_io *io)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->io = io;
+}
+
+// returns the next byte of input without consuming it, or -1 at the end
+static int reader_peek_char(struct json_reader *reader)
+{
+	if(reader->pos >= reader->len)
+	{
+		int n = reader->io->read(reader->io->context, reader->buffer, sizeof(reader->buffer));
+		if(n <= 0) return -1;
+		
+		reader->pos = 0;
+		reader->len = n;
+	}
+	
+	return (unsigned char)reader->buffer[reader->pos];
+}
+
+static int reader_get_char(struct json_reader *reader)
+{
+	int c = reader_peek_char(reader);
+	if(c >= 0) reader->pos++;
+	return c;
+}
+
+static int reader_skip_whitespace(struct json_reader *reader)
+{
+	for(;;)
+	{
+		int c = reader_peek_char(reader);
+		if(c != ' ' && c != '\t' && c != '\r' && c != '\n') return c;
+		reader->pos++;
+	}
+}
+
+// consumes c if it is the next token
+static int reader_expect(struct json_reader *reader, int c)
+{
+	if(reader_skip_whitespace(reader) != c) return -1;
+	reader->pos++;
+	return 0;
+}
+
+enum json_reader_type json_reader_peek(struct json_reader *reader)
+{
+	int c = reader_skip_whitespace(reader);
+	switch(c)
+	{
+		case '{': return JSON_READER_OBJECT;
+		case '[': return JSON_READER_ARRAY;
+		case '"': return JSON_READER_STRING;
+		case 't': case 'f': return JSON_READER_BOOLEAN;
+		case 'n': return JSON_READER_NULL;
+		default:
+			if(c == '-' || (c >= '0' && c <= '9')) return JSON_READER_NUMBER;
+			return JSON_READER_ERROR;
+	}
+}
+
+static int reader_begin(struct json_reader *reader, int open)
+{
+	if(reader->depth >= JSON_READER_MAX_DEPTH || reader_expect(reader, open) < 0)
+	{
+		return -1;
+	}
+	
+	reader->has_members[reader->depth++] = 0;
+	return 0;
+}
+
+// returns 1 if another member follows, having consumed the comma before it
+static int reader_next(struct json_reader *reader, int close)
+{
+	if(reader->depth <= 0) return -1;
+	
+	int c = reader_skip_whitespace(reader);
+	if(c == close)
+	{
+		reader->pos++;
+		reader->depth--;
+		return 0;
+	}
+	
+	if(reader->has_members[reader->depth - 1])
+	{
+		if(c != ',') return -1;
+		reader->pos++;
+	}
+	
+	reader->has_members[reader->depth - 1] = 1;
+	return 1;
+}
+
+int json_reader_begin_object(struct json_reader *reader)
+{
+	return reader_begin(reader, '{');
+}
+
+int json_reader_next_key(struct json_reader *reader, char *key, size_t key_size)
+{
+	int ret = reader_next(reader, '}');
+	if(ret <= 0) return ret;
+	
+	if(json_reader_string(reader, key, key_size) < 0 ||
+	   reader_expect(reader, ':') < 0)
+	{
+		return -1;
+	}
+	
+	return 1;
+}
+
+int json_reader_begin_array(struct json_reader *reader)
+{
+	return reader_begin(reader, '[');
+}
+
+int json_reader_next_element(struct json_reader *reader)
+{
+	return reader_next(reader, ']');
+}
+
+static int hex_value(int c)
+{
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return 10 + c - 'a';
+	if(c >= 'A' && c <= 'F') return 10 + c - 'A';
+	return -1;
+}
+
+static long reader_unicode_escape(struct json_reader *reader)
+{
+	long code_point = 0;
+	for(int i = 0; i < 4; i++)
+	{
+		int digit = hex_value(reader_get_char(reader));
+		if(digit < 0) return -1;
+		code_point = (code_point << 4) | digit;
+	}
+	
+	return code_point;
+}
+
+static void string_put(char *str, size_t size, size_t *len, int c)
+{
+	if(*len + 1 < size) str[*len] = c;
+	(*len)++;
+}
+
+static void string_put_utf8(char *str, size_t size, size_t *len, long code_point)
+{
+	if(code_point < 0x80)
+	{
+		string_put(str, size, len, code_point);
+	}
+	else if(code_point < 0x800)
+	{
+		string_put(str, size, len, 0xc0 | (code_point >> 6));
+		string_put(str, size, len, 0x80 | (code_point & 0x3f));
+	}
+	else if(code_point < 0x10000)
+	{
+		string_put(str, size, len, 0xe0 | (code_point >> 12));
+		string_put(str, size, len, 0x80 | ((code_point >> 6) & 0x3f));
+		string_put(str, size, len, 0x80 | (code_point & 0x3f));
+	}
+	else
+	{
+		string_put(str, size, len, 0xf0 | (code_point >> 18));
+		string_put(str, size, len, 0x80 | ((code_point >> 12) & 0x3f));
+		string_put(str, size, len, 0x80 | ((code_point >> 6) & 0x3f));
+		string_put(str, size, len, 0x80 | (code_point & 0x3f));
+	}
+}
+
+int json_reader_string(struct json_reader *reader, char *str, size_t size)
+{
+	if(reader_expect(reader, '"') < 0) return -1;
+	
+	size_t len = 0;
+	for(;;)
+	{
+		if(len > INT_MAX / 2) return -1;
+		
+		int c = reader_get_char(reader);
+		if(c < 0x20) return -1; // also the end of input
+		if(c == '"') break;
+		
+		if(c != '\\')
+		{
+			string_put(str, size, &len, c);
+			continue;
+		}
+		
+		c = reader_get_char(reader);
+		switch(c)
+		{
+			case '"': case '\\': case '/': string_put(str, size, &len, c); break;
+			case 'b': string_put(str, size, &len, '\b'); break;
+			case 'f': string_put(str, size, &len, '\f'); break;
+			case 'n': string_put(str, size, &len, '\n'); break;
+			case 'r': string_put(str, size, &len, '\r'); break;
+			case 't': string_put(str, size, &len, '\t'); break;
+			case 'u':
+			{
+				long code_point = reader_unicode_escape(reader);
+				if(code_point < 0 || (code_point >= 0xdc00 && code_point < 0xe000)) return -1;
+				
+				// characters outside the BMP are escaped as surrogate pairs
+				if(code_point >= 0xd800 && code_point < 0xdc00)
+				{
+					if(reader_get_char(reader) != '\\' || reader_get_char(reader) != 'u') return -1;
+					
+					long low = reader_unicode_escape(reader);
+					if(low < 0xdc00 || low >= 0xe000) return -1;
+					
+					code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+				}
+				
+				string_put_utf8(str, size, &len, code_point);
+				break;
+			}
+			default:
+				return -1;
+		}
+	}
+	
+	if(size > 0)
+	{
+		str[len < size ? len : size - 1] = 0;
+	}
+	
+	return len;
+}
+
+int json_reader_int64(struct json_reader *reader, int64_t *value)
+{
+	if(json_reader_peek(reader) != JSON_READER_NUMBER) return -1;
+	
+	int negative = reader_peek_char(reader) == '-';
+	if(negative) reader->pos++;
+	
+	uint64_t magnitude = 0;
+	int num_digits = 0;
+	for(int c; (c = reader_peek_char(reader)) >= '0' && c <= '9'; num_digits++)
+	{
+		if(magnitude > (UINT64_MAX - (c - '0')) / 10) return -1;
+		magnitude = magnitude * 10 + (c - '0');
+		reader->pos++;
+	}
+	
+	// fractions and exponents are not integers
+	int c = reader_peek_char(reader);
+	if(num_digits == 0 || c == '.' || c == 'e' || c == 'E') return -1;
+	
+	if(magnitude > (uint64_t)INT64_MAX + negative) return -1;
+	*value = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+	
+	return 0;
+}
+
+static int reader_skip_literal(struct json_reader *reader, const char *literal)
+{
+	for(const char *p = literal; *p; p++)
+	{
+		if(reader_get_char(reader) != *p) return -1;
+	}
+	
+	return 0;
+}
+
+int json_reader_skip(struct json_reader *reader)
+{
+	int ret;
+	switch(json_reader_peek(reader))
+	{
+		case JSON_READER_OBJECT:
+			if(json_reader_begin_object(reader) < 0) return -1;
+			while((ret = json_reader_next_key(reader, NULL, 0)) > 0)
+			{
+				if(json_reader_skip(reader) < 0) return -1;
+			}
+			return ret;
+		case JSON_READER_ARRAY:
+			if(json_reader_begin_array(reader) < 0) return -1;
+			while((ret = json_reader_next_element(reader)) > 0)
+			{
+				if(json_reader_skip(reader) < 0) return -1;
+			}
+			return ret;
+		case JSON_READER_STRING:
+			return json_reader_string(reader, NULL, 0) < 0 ? -1 : 0;
+		case JSON_READER_NUMBER:
+		{
+			int num_chars = 0;
+			for(int c; (c = reader_peek_char(reader)) > 0 && strchr("+-0123456789.eE", c); num_chars++)
+			{
+				reader->pos++;
+			}
+			return num_chars > 0 ? 0 : -1;
+		}
+		case JSON_READER_BOOLEAN:
+			return reader_skip_literal(reader, reader_peek_char(reader) == 't' ? "true" : "false");
+		case JSON_READER_NULL:
+			return reader_skip_literal(reader, "null");
+		default:
+			return -1;
+	}
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct socket_io;
+
+// Pulls JSON values out of a request body as it is read, without building
+// a tree. The caller walks the document it expects with the functions
+// below, all of which return -1 on a syntax error, a value of the wrong
+// type or a read error. Once an error is returned the reader is unusable.
+
+#define JSON_READER_MAX_DEPTH 32
+
+enum json_reader_type
+{
+	JSON_READER_ERROR = -1,
+	JSON_READER_OBJECT,
+	JSON_READER_ARRAY,
+	JSON_READER_STRING,
+	JSON_READER_NUMBER,
+	JSON_READER_BOOLEAN,
+	JSON_READER_NULL
+};
+
+struct json_reader
+{
+	const struct socket_io *io;
+	int depth;
+	uint8_t has_members[JSON_READER_MAX_DEPTH];
+	int pos;
+	int len;
+	char buffer[4096];
+};
+
+void json_reader_init(struct json_reader *reader, const struct socket_io *io);
+
+// type of the next value, without consuming it
+enum json_reader_type json_reader_peek(struct json_reader *reader);
+
+int json_reader_begin_object(struct json_reader *reader);
+// returns 1 and the key of the next member, which the caller must then read
+// or skip the value of. returns 0 once the object is closed. longer keys are
+// truncated, so key_size must be larger than any key the caller looks for
+int json_reader_next_key(struct json_reader *reader, char *key, size_t key_size);
+
+int json_reader_begin_array(struct json_reader *reader);
+// returns 1 if there is another element to read, 0 once the array is closed
+int json_reader_next_element(struct json_reader *reader);
+
+// returns the length of the string, which is truncated if it is not less
+// than size, the same as snprintf
+int json_reader_string(struct json_reader *reader, char *str, size_t size);
+int json_reader_int64(struct json_reader *reader, int64_t *value);
+int json_reader_skip(struct json_reader *reader);
+
+#endif
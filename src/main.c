@@ -35,6 +35,11 @@
 #include "git_lfs_server.h"
 #include "repo_manager.h"
 #include "htpasswd.h"
+#include "object_index.h"
+#include "config_reload.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "scrubber.h"
 #include "mongoose.h"
 
 int child_pid = -1;
@@ -87,10 +92,22 @@ int main(int argc, char *argv[])
 		{
 			printf("FastCGI enabled.\n");
 			printf("Socket Path: %s\n", config->fastcgi_socket);
+			printf("Listeners: %d\n", config->fastcgi_listeners);
 		}
 		else
 		{
 			printf("HTTP Enabled on port %d\n", config->port);
+			printf("Event server: %s\n", config->event_server ? "yes" : "no");
+		}
+		
+		if(config->access_log)
+		{
+			printf("Access log: %s\n", config->access_log);
+		}
+		
+		if(config->scrub_rate)
+		{
+			printf("Scrub rate: %d bytes/s, every %d seconds\n", config->scrub_rate, config->scrub_interval);
 		}
 
 		printf("Base URL: %s\n", config->base_url);
@@ -99,6 +116,7 @@ int main(int argc, char *argv[])
 		printf("User: %s\n", config->user);
 		printf("Group: %s\n", config->group);
 		printf("Num threads: %d\n", config->num_threads);
+		printf("Num repo managers: %d\n", config->num_repo_managers);
 		printf("\n");
 		
 		struct git_lfs_repo *repo;
@@ -111,67 +129,195 @@ int main(int argc, char *argv[])
 			printf("\tRoot path: %s%s\n", config->chroot_path != NULL ? config->chroot_path : "", repo->root_dir);
 			printf("\tAuthentication: %s\n", repo->enable_authentication ? "yes" : "no");
 			printf("\tUpload verification: %s\n", repo->verify_uploads ? "yes" : "no");
+			printf("\tObject index: %d objects\n", repo->object_index_size);
 			if(repo->auth_realm) printf("\tAuth Realm: %s\n", repo->auth_realm);
 			printf("\n");
 		}
 	}
 	
-	int fd[2];
-	if(os_socketpair(fd) < 0) {
+	// the other processes are chrooted away from the config files, so a
+	// loader that can still read them parses the config again on reload
+	int loader_fd[2];
+	if(os_socketpair(loader_fd) < 0) {
 		fprintf(stderr, "Failed to create internal sockets.\n");
 		goto error1;
 	}
 	
-	child_pid = os_fork();
-	if(child_pid < 0) {
+	int loader_pid = os_fork();
+	if(loader_pid < 0) {
 		fprintf(stderr, "Failed to fork process.\n");
-		os_close(fd[1]);
-		os_close(fd[0]);
+		os_close(loader_fd[1]);
+		os_close(loader_fd[0]);
 		goto error1;
 	}
 	
-	if(child_pid == 0)
+	if(loader_pid == 0)
 	{
-		if(os_droproot(config->chroot_path, config->user, config->group) < 0)
+		os_close(loader_fd[0]);
+		os_signal(SIGHUP, SIG_IGN);
+		
+		if(os_droproot(NULL, config->user, config->group) < 0)
 		{
 			goto error1;
 		}
 		
-		if(os_sandbox(SANDBOX_FILEIO) < 0) {
+		if(os_sandbox(SANDBOX_READ_ONLY) < 0) {
 			fprintf(stderr, "Sandbox failed.\n");
 			goto error1;
 		}
-
-		os_close(fd[0]);
-		struct repo_manager *mgr = repo_manager_create(fd[1]);
-		git_lfs_repo_manager_service(mgr, config);
-		repo_manager_free(mgr);
-		os_close(fd[1]);
+		
+		config_loader_service(loader_fd[1], config_path);
+		os_close(loader_fd[1]);
+		goto error1;
 	}
-	else
+	
+	os_close(loader_fd[1]);
+	
+	// the object indexes are shared by the repo managers, so they are
+	// created before those are forked
+	struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
 	{
-		os_signal(SIGCHLD, child_terminated);
+		if(repo->object_index_size == 0) continue;
 		
-		// free auth info in parent since it doesn't need access to it
-		struct git_lfs_repo *repo;
-		SLIST_FOREACH(repo, &config->repos, entries)
+		repo->object_index = object_index_create(repo->object_index_size);
+		if(!repo->object_index)
 		{
-			free_htpasswd(repo->auth);
-			repo->auth = NULL;
+			fprintf(stderr, "Failed to create the object index of repo '%s'.\n", repo->name);
+			os_close(loader_fd[0]);
+			goto error1;
 		}
-
-		if(os_droproot(config->process_chroot, config->user, config->group) < 0)
+	}
+	
+	// the scrubber counters are shared the same way, the http process
+	// reports them
+	if(scrubber_create(config) < 0)
+	{
+		fprintf(stderr, "Failed to create the scrubber counters.\n");
+		os_close(loader_fd[0]);
+		goto error1;
+	}
+	
+	// start the pool of repo managers, each with its own socket
+	int manager_sockets[64];
+	int num_managers = 0;
+	for(int i = 0; i < config->num_repo_managers; i++)
+	{
+		int fd[2];
+		if(os_socketpair(fd) < 0) {
+			fprintf(stderr, "Failed to create internal sockets.\n");
+			goto error2;
+		}
+		
+		child_pid = os_fork();
+		if(child_pid < 0) {
+			fprintf(stderr, "Failed to fork process.\n");
+			os_close(fd[1]);
+			os_close(fd[0]);
+			goto error2;
+		}
+		
+		if(child_pid == 0)
 		{
+			// only keep the socket to this manager
+			for(int j = 0; j < num_managers; j++)
+			{
+				os_close(manager_sockets[j]);
+			}
+			os_close(fd[0]);
+			os_close(loader_fd[0]);
+			os_signal(SIGHUP, SIG_IGN);
+
+			if(os_droproot(config->chroot_path, config->user, config->group) < 0)
+			{
+				goto error1;
+			}
+			
+			if(os_sandbox(SANDBOX_FILEIO) < 0) {
+				fprintf(stderr, "Sandbox failed.\n");
+				goto error1;
+			}
+
+			struct repo_manager *mgr = repo_manager_create(fd[1]);
+			git_lfs_repo_manager_service(mgr, config);
+			repo_manager_free(mgr);
+			os_close(fd[1]);
 			goto error1;
 		}
-
+		
 		os_close(fd[1]);
-		struct repo_manager *mgr = repo_manager_create(fd[0]);
-		git_lfs_start_httpd(mgr, config);
-		repo_manager_free(mgr);
-		os_close(fd[0]);
+		manager_sockets[num_managers++] = fd[0];
+	}
+	
+	os_signal(SIGCHLD, child_terminated);
+	
+	// free auth info and object indexes in parent since it doesn't need
+	// access to them
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		free_htpasswd(repo->auth);
+		repo->auth = NULL;
+		object_index_free(repo->object_index);
+		repo->object_index = NULL;
+	}
+	
+	if(metrics_attach_repos(config, NULL) < 0)
+	{
+		fprintf(stderr, "Failed to allocate metrics.\n");
+		goto error2;
+	}
+
+	// the log directory is usually only writable by root
+	if(access_log_open(config->access_log) < 0)
+	{
+		goto error2;
+	}
+	
+	if(os_droproot(config->process_chroot, config->user, config->group) < 0)
+	{
+		goto error3;
+	}
+	
+	// SIGHUP is only taken by the reload thread, this has to happen before
+	// any other thread is started
+	os_signal_block(SIGHUP);
+	
+	if(access_log_start() < 0)
+	{
+		fprintf(stderr, "Failed to start access log thread.\n");
+		goto error3;
+	}
+
+	struct repo_manager *mgr = repo_manager_create_client(manager_sockets, num_managers);
+	if(!mgr)
+	{
+		fprintf(stderr, "Failed to start repo manager client.\n");
+		goto error3;
+	}
+	
+	if(config_reload_start(config, loader_fd[0], mgr) < 0)
+	{
+		fprintf(stderr, "Failed to start config reload thread.\n");
+		goto error4;
+	}
+	
+	git_lfs_start_httpd(mgr, config);
+	// before the repo managers are told to exit, which ends this process
+	access_log_stop();
+	config_reload_stop();
+error4:
+	repo_manager_free(mgr);
+error3:
+	access_log_stop();
+error2:
+	for(int i = 0; i < num_managers; i++)
+	{
+		os_close(manager_sockets[i]);
 	}
+	os_close(loader_fd[0]);
 error1:
+	scrubber_free();
+	metrics_detach_repos(config);
 	git_lfs_free_config(config);
 error0:
 	return 0;
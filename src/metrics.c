@@ -0,0 +1,568 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include "compat/queue.h"
+#include "configuration.h"
+#include "repo_manager.h"
+#include "git_lfs_server.h"
+#include "scrubber.h"
+
+// Latencies go into log-linear buckets like an HDR histogram with one
+// sub-bucket bit: under 8us, 8-12us, 12-16us, 16-24us, ... up to 2^27us,
+// then everything slower.
+enum metrics_histogram_config
+{
+	METRICS_MIN_SHIFT = 3,
+	METRICS_MAX_SHIFT = 27,
+	METRICS_BUCKETS = 2 * (METRICS_MAX_SHIFT - METRICS_MIN_SHIFT) + 2
+};
+
+struct metrics_histogram
+{
+	uint64_t buckets[METRICS_BUCKETS];
+	uint64_t count;
+	uint64_t sum_us;
+};
+
+// counters of one thread. they are only written by that thread, so
+// updates are plain stores that the scrape may read a moment late
+struct metrics_shard
+{
+	struct metrics_shard *next;
+	struct metrics_histogram requests[METRICS_ENDPOINT_COUNT];
+	uint64_t responses[METRICS_ENDPOINT_COUNT][6]; // by status class, 0 if no status was sent
+	struct metrics_histogram ipc[REPO_CMD_COUNT];
+};
+
+// counters of a repo, shared by all threads but only touched once per
+// request. a reloaded config takes over the counters of the repos it keeps,
+// they are freed with the last config that has the repo.
+struct metrics_repo
+{
+	int refs;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	struct metrics_histogram requests;
+};
+
+struct metrics_buffer
+{
+	char *data;
+	size_t size;
+	size_t capacity;
+	int failed;
+};
+
+static struct metrics_shard *metrics_shards; // shards are never freed
+static __thread struct metrics_shard *metrics_thread_shard;
+
+static const char * const metrics_endpoint_names[METRICS_ENDPOINT_COUNT] =
+{
+	[METRICS_ENDPOINT_BATCH] = "batch",
+	[METRICS_ENDPOINT_DOWNLOAD] = "download",
+	[METRICS_ENDPOINT_UPLOAD] = "upload",
+	[METRICS_ENDPOINT_UPLOAD_PART] = "upload_part",
+	[METRICS_ENDPOINT_UPLOAD_STATUS] = "upload_status",
+	[METRICS_ENDPOINT_UPLOAD_COMMIT] = "upload_commit",
+	[METRICS_ENDPOINT_LOCK_CREATE] = "lock_create",
+	[METRICS_ENDPOINT_LOCK_LIST] = "lock_list",
+	[METRICS_ENDPOINT_LOCK_VERIFY] = "lock_verify",
+	[METRICS_ENDPOINT_LOCK_DELETE] = "lock_delete",
+	[METRICS_ENDPOINT_OTHER] = "other"
+};
+
+static const char * const metrics_ipc_names[REPO_CMD_COUNT] =
+{
+	[REPO_CMD_AUTH] = "auth",
+	[REPO_CMD_GET_ACCESS_TOKEN] = "get_access_token",
+	[REPO_CMD_CHECK_OID_EXIST] = "check_oid_exist",
+	[REPO_CMD_GET_OID] = "get_oid",
+	[REPO_CMD_PUT_OID] = "put_oid",
+	[REPO_CMD_COMMIT] = "commit",
+	[REPO_CMD_TERMINATE] = "terminate",
+	[REPO_CMD_ERROR] = "error",
+	[REPO_CMD_CREATE_LOCK] = "create_lock",
+	[REPO_CMD_LIST_LOCKS] = "list_locks",
+	[REPO_CMD_DELETE_LOCK] = "delete_lock",
+	[REPO_CMD_CHECK_OIDS_EXIST] = "check_oids_exist",
+	[REPO_CMD_PUT_PART] = "put_part",
+	[REPO_CMD_COMMIT_PART] = "commit_part",
+	[REPO_CMD_GET_PARTS_STATUS] = "get_parts_status",
+	[REPO_CMD_GET_PART_FD] = "get_part_fd",
+	[REPO_CMD_REMOVE_PARTS] = "remove_parts",
+	[REPO_CMD_RELOAD_CONFIG] = "reload_config",
+	[REPO_CMD_COMMIT_RELOAD] = "commit_reload",
+	[REPO_CMD_ABORT_RELOAD] = "abort_reload"
+};
+
+static int metrics_io_read(void *context, void *buffer, int n)
+{
+	struct metrics_io *mio = (struct metrics_io *)context;
+	const struct socket_io *inner = mio->wrapper.inner;
+	int ret = inner->read(inner->context, buffer, n);
+	if(ret > 0) mio->bytes_in += ret;
+	return ret;
+}
+
+static int metrics_io_write(void *context, const void *buffer, int n)
+{
+	struct metrics_io *mio = (struct metrics_io *)context;
+	const struct socket_io *inner = mio->wrapper.inner;
+	int ret = inner->write(inner->context, buffer, n);
+	if(ret > 0) mio->bytes_out += ret;
+	return ret;
+}
+
+static void metrics_io_write_http_status(void *context, int code, const char *message)
+{
+	struct metrics_io *mio = (struct metrics_io *)context;
+	const struct socket_io *inner = mio->wrapper.inner;
+	mio->status = code;
+	inner->write_http_status(inner->context, code, message);
+}
+
+static long metrics_io_send_file(void *context, int fd, long offset, long size)
+{
+	struct metrics_io *mio = (struct metrics_io *)context;
+	const struct socket_io *inner = mio->wrapper.inner;
+	long ret = inner->send_file(inner->context, fd, offset, size);
+	if(ret > 0) mio->bytes_out += ret;
+	return ret;
+}
+
+void metrics_io_init(struct metrics_io *mio, const struct socket_io *inner)
+{
+	memset(mio, 0, sizeof(*mio));
+	socket_io_wrapper_init(&mio->wrapper, inner);
+	mio->wrapper.io.read = metrics_io_read;
+	mio->wrapper.io.write = metrics_io_write;
+	mio->wrapper.io.write_http_status = metrics_io_write_http_status;
+	if(inner->send_file) mio->wrapper.io.send_file = metrics_io_send_file;
+}
+
+static struct metrics_shard *metrics_get_shard(void)
+{
+	struct metrics_shard *shard = metrics_thread_shard;
+	if(shard) return shard;
+	
+	shard = calloc(1, sizeof(*shard));
+	if(!shard) return NULL;
+	
+	shard->next = __atomic_load_n(&metrics_shards, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&metrics_shards, &shard->next, shard, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	{
+	}
+	
+	metrics_thread_shard = shard;
+	return shard;
+}
+
+static void metrics_add(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+static int metrics_bucket(uint64_t us)
+{
+	if(us < (1 << METRICS_MIN_SHIFT))
+	{
+		return 0;
+	}
+	
+	int shift = 63 - __builtin_clzll(us);
+	if(shift >= METRICS_MAX_SHIFT)
+	{
+		return METRICS_BUCKETS - 1;
+	}
+	
+	return 1 + (shift - METRICS_MIN_SHIFT) * 2 + ((us >> (shift - 1)) & 1);
+}
+
+// the exclusive upper bound of a bucket other than the last one
+static uint64_t metrics_bucket_limit(int bucket)
+{
+	if(bucket == 0)
+	{
+		return 1 << METRICS_MIN_SHIFT;
+	}
+	
+	int shift = METRICS_MIN_SHIFT + (bucket - 1) / 2;
+	return ((uint64_t)1 << shift) + ((uint64_t)(((bucket - 1) & 1) + 1) << (shift - 1));
+}
+
+static void metrics_histogram_add(struct metrics_histogram *histogram, uint64_t us)
+{
+	metrics_add(&histogram->buckets[metrics_bucket(us)], 1);
+	metrics_add(&histogram->count, 1);
+	metrics_add(&histogram->sum_us, us);
+}
+
+// for counters written by several threads at once
+static void metrics_histogram_add_shared(struct metrics_histogram *histogram, uint64_t us)
+{
+	__atomic_add_fetch(&histogram->buckets[metrics_bucket(us)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histogram->sum_us, us, __ATOMIC_RELAXED);
+}
+
+int metrics_attach_repos(struct git_lfs_config *config, const struct git_lfs_config *previous)
+{
+	struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		struct metrics_repo *repo_metrics = NULL;
+		
+		const struct git_lfs_repo *previous_repo;
+		if(previous)
+		{
+			SLIST_FOREACH(previous_repo, &previous->repos, entries)
+			{
+				if(previous_repo->id == repo->id && previous_repo->metrics)
+				{
+					repo_metrics = previous_repo->metrics;
+					__atomic_add_fetch(&repo_metrics->refs, 1, __ATOMIC_RELAXED);
+					break;
+				}
+			}
+		}
+		
+		if(!repo_metrics)
+		{
+			repo_metrics = calloc(1, sizeof(*repo_metrics));
+			if(!repo_metrics)
+			{
+				metrics_detach_repos(config);
+				return -1;
+			}
+			repo_metrics->refs = 1;
+		}
+		
+		repo->metrics = repo_metrics;
+	}
+	
+	return 0;
+}
+
+void metrics_detach_repos(struct git_lfs_config *config)
+{
+	struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		if(repo->metrics && __atomic_sub_fetch(&repo->metrics->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		{
+			free(repo->metrics);
+		}
+		repo->metrics = NULL;
+	}
+}
+
+void metrics_observe_request(enum metrics_endpoint endpoint, const struct git_lfs_repo *repo, const struct metrics_io *mio, uint64_t elapsed_us)
+{
+	struct metrics_shard *shard = metrics_get_shard();
+	if(shard)
+	{
+		int status_class = mio->status / 100;
+		if(status_class < 1 || status_class > 5) status_class = 0;
+		
+		metrics_histogram_add(&shard->requests[endpoint], elapsed_us);
+		metrics_add(&shard->responses[endpoint][status_class], 1);
+	}
+	
+	struct metrics_repo *repo_metrics = repo->metrics;
+	if(repo_metrics)
+	{
+		__atomic_add_fetch(&repo_metrics->bytes_in, mio->bytes_in, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&repo_metrics->bytes_out, mio->bytes_out, __ATOMIC_RELAXED);
+		metrics_histogram_add_shared(&repo_metrics->requests, elapsed_us);
+	}
+}
+
+void metrics_observe_ipc(int cmd_type, uint64_t elapsed_us)
+{
+	if(cmd_type < 0 || cmd_type >= REPO_CMD_COUNT)
+	{
+		return;
+	}
+	
+	struct metrics_shard *shard = metrics_get_shard();
+	if(shard)
+	{
+		metrics_histogram_add(&shard->ipc[cmd_type], elapsed_us);
+	}
+}
+
+static void metrics_printf(struct metrics_buffer *buffer, const char *format, ...)
+{
+	if(buffer->failed) return;
+	
+	for(;;)
+	{
+		size_t available = buffer->capacity - buffer->size;
+		
+		va_list va;
+		va_start(va, format);
+		int n = vsnprintf(buffer->data ? buffer->data + buffer->size : NULL, available, format, va);
+		va_end(va);
+		
+		if(n < 0)
+		{
+			buffer->failed = 1;
+			return;
+		}
+		
+		if(n < available)
+		{
+			buffer->size += n;
+			return;
+		}
+		
+		size_t capacity = buffer->capacity ? buffer->capacity * 2 : 16 * 1024;
+		while(capacity <= buffer->size + n)
+		{
+			capacity *= 2;
+		}
+		
+		char *data = realloc(buffer->data, capacity);
+		if(!data)
+		{
+			buffer->failed = 1;
+			return;
+		}
+		
+		buffer->data = data;
+		buffer->capacity = capacity;
+	}
+}
+
+// label values escape \, " and new lines
+static void metrics_print_label(struct metrics_buffer *buffer, const char *value)
+{
+	for(const char *p = value; *p; p++)
+	{
+		switch(*p)
+		{
+			case '\\': metrics_printf(buffer, "\\\\"); break;
+			case '"': metrics_printf(buffer, "\\\""); break;
+			case '\n': metrics_printf(buffer, "\\n"); break;
+			default: metrics_printf(buffer, "%c", *p); break;
+		}
+	}
+}
+
+// name and the one label, the caller closes the braces
+static void metrics_print_series(struct metrics_buffer *buffer, const char *name, const char *suffix,
+								 const char *label, const char *label_value)
+{
+	metrics_printf(buffer, "%s%s{%s=\"", name, suffix, label);
+	metrics_print_label(buffer, label_value);
+	metrics_printf(buffer, "\"");
+}
+
+static void metrics_print_histogram(struct metrics_buffer *buffer,
+									const char *name,
+									const char *label,
+									const char *label_value,
+									const struct metrics_histogram *histogram)
+{
+	uint64_t cumulative = 0;
+	for(int i = 0; i < METRICS_BUCKETS - 1; i++)
+	{
+		cumulative += histogram->buckets[i];
+		metrics_print_series(buffer, name, "_bucket", label, label_value);
+		metrics_printf(buffer, ",le=\"%g\"} %llu\n", metrics_bucket_limit(i) / 1e6, (unsigned long long)cumulative);
+	}
+	
+	metrics_print_series(buffer, name, "_bucket", label, label_value);
+	metrics_printf(buffer, ",le=\"+Inf\"} %llu\n", (unsigned long long)histogram->count);
+	metrics_print_series(buffer, name, "_sum", label, label_value);
+	metrics_printf(buffer, "} %g\n", histogram->sum_us / 1e6);
+	metrics_print_series(buffer, name, "_count", label, label_value);
+	metrics_printf(buffer, "} %llu\n", (unsigned long long)histogram->count);
+}
+
+static void metrics_sum_histogram(struct metrics_histogram *total, const struct metrics_histogram *histogram)
+{
+	for(int i = 0; i < METRICS_BUCKETS; i++)
+	{
+		total->buckets[i] += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+	}
+	
+	total->count += __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+	total->sum_us += __atomic_load_n(&histogram->sum_us, __ATOMIC_RELAXED);
+}
+
+// one of the scrubber counters of each repo, repos added by a config
+// reload aren't scrubbed and are left out
+static void metrics_print_scrubber(struct metrics_buffer *buffer, const struct git_lfs_config *config,
+								   const char *name, const char *type, const char *help, size_t offset)
+{
+	metrics_printf(buffer, "# HELP %s %s\n", name, help);
+	metrics_printf(buffer, "# TYPE %s %s\n", name, type);
+	
+	const struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		struct scrubber_stats stats;
+		if(scrubber_get_stats(repo->id, &stats) < 0) continue;
+		
+		metrics_printf(buffer, "%s{repo=\"", name);
+		metrics_print_label(buffer, repo->name);
+		metrics_printf(buffer, "\"} %llu\n", (unsigned long long)*(const uint64_t *)((const char *)&stats + offset));
+	}
+}
+
+void metrics_write(const struct socket_io *io, const struct git_lfs_config *config, const struct repo_manager *mgr)
+{
+	static const char * const status_classes[6] = { "none", "1xx", "2xx", "3xx", "4xx", "5xx" };
+	
+	struct metrics_buffer buffer;
+	memset(&buffer, 0, sizeof(buffer));
+	
+	struct metrics_shard *total = calloc(1, sizeof(*total));
+	if(!total)
+	{
+		git_lfs_write_error(io, 500, "Out of memory.");
+		return;
+	}
+	
+	for(const struct metrics_shard *shard = __atomic_load_n(&metrics_shards, __ATOMIC_ACQUIRE); shard; shard = shard->next)
+	{
+		for(int i = 0; i < METRICS_ENDPOINT_COUNT; i++)
+		{
+			metrics_sum_histogram(&total->requests[i], &shard->requests[i]);
+			for(int j = 0; j < 6; j++)
+			{
+				total->responses[i][j] += __atomic_load_n(&shard->responses[i][j], __ATOMIC_RELAXED);
+			}
+		}
+		
+		for(int i = 0; i < REPO_CMD_COUNT; i++)
+		{
+			metrics_sum_histogram(&total->ipc[i], &shard->ipc[i]);
+		}
+	}
+	
+	metrics_printf(&buffer, "# HELP git_lfs_request_duration_seconds Time taken to handle a request.\n");
+	metrics_printf(&buffer, "# TYPE git_lfs_request_duration_seconds histogram\n");
+	for(int i = 0; i < METRICS_ENDPOINT_COUNT; i++)
+	{
+		metrics_print_histogram(&buffer, "git_lfs_request_duration_seconds", "endpoint", metrics_endpoint_names[i], &total->requests[i]);
+	}
+	
+	metrics_printf(&buffer, "# HELP git_lfs_requests_total Requests handled, by status class.\n");
+	metrics_printf(&buffer, "# TYPE git_lfs_requests_total counter\n");
+	for(int i = 0; i < METRICS_ENDPOINT_COUNT; i++)
+	{
+		for(int j = 0; j < 6; j++)
+		{
+			if(total->responses[i][j] == 0) continue;
+			metrics_printf(&buffer, "git_lfs_requests_total{endpoint=\"%s\",code=\"%s\"} %llu\n",
+						   metrics_endpoint_names[i], status_classes[j], (unsigned long long)total->responses[i][j]);
+		}
+	}
+	
+	// commands that were never sent are left out
+	metrics_printf(&buffer, "# HELP git_lfs_ipc_duration_seconds Time from sending a command to a repo manager to its response.\n");
+	metrics_printf(&buffer, "# TYPE git_lfs_ipc_duration_seconds histogram\n");
+	for(int i = 0; i < REPO_CMD_COUNT; i++)
+	{
+		if(total->ipc[i].count == 0 || !metrics_ipc_names[i]) continue;
+		metrics_print_histogram(&buffer, "git_lfs_ipc_duration_seconds", "command", metrics_ipc_names[i], &total->ipc[i]);
+	}
+	
+	metrics_printf(&buffer, "# HELP git_lfs_ipc_in_flight Commands waiting for a response, by repo manager.\n");
+	metrics_printf(&buffer, "# TYPE git_lfs_ipc_in_flight gauge\n");
+	for(int i = 0; i < mgr->num_channels; i++)
+	{
+		metrics_printf(&buffer, "git_lfs_ipc_in_flight{manager=\"%d\"} %d\n", i, repo_manager_get_in_flight(mgr, i));
+	}
+	
+	metrics_printf(&buffer, "# HELP git_lfs_repo_received_bytes_total Bytes read from requests, by repo.\n");
+	metrics_printf(&buffer, "# TYPE git_lfs_repo_received_bytes_total counter\n");
+	metrics_printf(&buffer, "# HELP git_lfs_repo_sent_bytes_total Bytes written in responses, by repo.\n");
+	metrics_printf(&buffer, "# TYPE git_lfs_repo_sent_bytes_total counter\n");
+	const struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		const struct metrics_repo *repo_metrics = repo->metrics;
+		if(!repo_metrics) continue;
+		
+		metrics_printf(&buffer, "git_lfs_repo_received_bytes_total{repo=\"");
+		metrics_print_label(&buffer, repo->name);
+		metrics_printf(&buffer, "\"} %llu\n", (unsigned long long)__atomic_load_n(&repo_metrics->bytes_in, __ATOMIC_RELAXED));
+		
+		metrics_printf(&buffer, "git_lfs_repo_sent_bytes_total{repo=\"");
+		metrics_print_label(&buffer, repo->name);
+		metrics_printf(&buffer, "\"} %llu\n", (unsigned long long)__atomic_load_n(&repo_metrics->bytes_out, __ATOMIC_RELAXED));
+	}
+	
+	metrics_printf(&buffer, "# HELP git_lfs_repo_request_duration_seconds Time taken to handle a request, by repo.\n");
+	metrics_printf(&buffer, "# TYPE git_lfs_repo_request_duration_seconds histogram\n");
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		if(!repo->metrics) continue;
+		
+		struct metrics_histogram histogram;
+		memset(&histogram, 0, sizeof(histogram));
+		metrics_sum_histogram(&histogram, &repo->metrics->requests);
+		metrics_print_histogram(&buffer, "git_lfs_repo_request_duration_seconds", "repo", repo->name, &histogram);
+	}
+	
+	if(config->scrub_rate > 0)
+	{
+		metrics_print_scrubber(&buffer, config, "git_lfs_scrub_objects_total", "counter",
+							   "Objects hashed by the scrubber, by repo.", offsetof(struct scrubber_stats, objects));
+		metrics_print_scrubber(&buffer, config, "git_lfs_scrub_read_bytes_total", "counter",
+							   "Bytes read by the scrubber, by repo.", offsetof(struct scrubber_stats, bytes));
+		metrics_print_scrubber(&buffer, config, "git_lfs_scrub_quarantined_total", "counter",
+							   "Objects that did not match their oid and were moved to quarantine, by repo.", offsetof(struct scrubber_stats, quarantined));
+		metrics_print_scrubber(&buffer, config, "git_lfs_scrub_errors_total", "counter",
+							   "Objects the scrubber failed to read or move, by repo.", offsetof(struct scrubber_stats, errors));
+		metrics_print_scrubber(&buffer, config, "git_lfs_scrub_passes_total", "counter",
+							   "Passes over all objects of a repo.", offsetof(struct scrubber_stats, passes));
+		metrics_print_scrubber(&buffer, config, "git_lfs_scrub_last_pass_timestamp_seconds", "gauge",
+							   "When the last pass over a repo finished, 0 if none did.", offsetof(struct scrubber_stats, last_pass));
+	}
+	
+	free(total);
+	
+	if(buffer.failed)
+	{
+		free(buffer.data);
+		git_lfs_write_error(io, 500, "Out of memory.");
+		return;
+	}
+	
+	char content_length[64];
+	snprintf(content_length, sizeof(content_length), "Content-Length: %zu", buffer.size);
+	
+	const char *headers[] =
+	{
+		"Content-Type: text/plain; version=0.0.4",
+		content_length
+	};
+	
+	io->write_http_status(io->context, 200, "OK");
+	io->write_headers(io->context, headers, sizeof(headers) / sizeof(headers[0]));
+	io->write(io->context, buffer.data, buffer.size);
+	
+	free(buffer.data);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include "socket_io.h"
+
+struct git_lfs_config;
+struct git_lfs_repo;
+struct repo_manager;
+
+enum metrics_endpoint
+{
+	METRICS_ENDPOINT_BATCH,
+	METRICS_ENDPOINT_DOWNLOAD,
+	METRICS_ENDPOINT_UPLOAD,
+	METRICS_ENDPOINT_UPLOAD_PART,
+	METRICS_ENDPOINT_UPLOAD_STATUS,
+	METRICS_ENDPOINT_UPLOAD_COMMIT,
+	METRICS_ENDPOINT_LOCK_CREATE,
+	METRICS_ENDPOINT_LOCK_LIST,
+	METRICS_ENDPOINT_LOCK_VERIFY,
+	METRICS_ENDPOINT_LOCK_DELETE,
+	METRICS_ENDPOINT_OTHER,
+	METRICS_ENDPOINT_COUNT
+};
+
+// passes everything on to inner, counting the bytes and keeping the status
+struct metrics_io
+{
+	struct socket_io_wrapper wrapper;
+	int status;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+};
+
+void metrics_io_init(struct metrics_io *mio, const struct socket_io *inner);
+
+// gives each repo of config the counters of the repo with the same id in
+// previous, or new ones if there is none. previous may be NULL. returns -1
+// if out of memory, with nothing attached.
+int metrics_attach_repos(struct git_lfs_config *config, const struct git_lfs_config *previous);
+// before config is freed, the counters go with the last config using them
+void metrics_detach_repos(struct git_lfs_config *config);
+
+// each thread records into counters of its own, so nothing here takes a
+// lock or contends with another thread. only the counters of the repo are
+// shared, they take a few atomic adds.
+void metrics_observe_request(enum metrics_endpoint endpoint, const struct git_lfs_repo *repo, const struct metrics_io *mio, uint64_t elapsed_us);
+void metrics_observe_ipc(int cmd_type, uint64_t elapsed_us);
+
+// sends everything recorded so far in the Prometheus text format
+void metrics_write(const struct socket_io *io, const struct git_lfs_config *config, const struct repo_manager *mgr);
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "object_index.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "os/memory.h"
+#include "os/filesystem.h"
+#include "oid_utils.h"
+
+// ~0.8% false positives while the repo holds no more than num_objects
+#define OBJECT_INDEX_BITS_PER_OBJECT 10
+#define OBJECT_INDEX_NUM_HASHES 7
+
+enum object_index_state
+{
+	OBJECT_INDEX_EMPTY,
+	OBJECT_INDEX_SCANNING,
+	OBJECT_INDEX_READY
+};
+
+struct object_index
+{
+	size_t map_size;
+	int state; // enum object_index_state, shared between processes
+	uint64_t num_bits;
+	uint64_t bits[];
+};
+
+struct object_index *object_index_create(long num_objects)
+{
+	if(num_objects <= 0) return NULL;
+	
+	uint64_t num_words = ((uint64_t)num_objects * OBJECT_INDEX_BITS_PER_OBJECT + 63) / 64;
+	size_t map_size = sizeof(struct object_index) + num_words * sizeof(uint64_t);
+	
+	struct object_index *index = os_map_shared(map_size);
+	if(!index) return NULL;
+	
+	index->map_size = map_size;
+	index->state = OBJECT_INDEX_EMPTY;
+	index->num_bits = num_words * 64;
+	
+	return index;
+}
+
+void object_index_free(struct object_index *index)
+{
+	if(!index) return;
+	os_unmap(index, index->map_size);
+}
+
+// the oid is already a sha256 so its bits are used as the hashes directly,
+// combined as h1 + i * h2
+static void object_index_hashes(const uint8_t oid[32], uint64_t *h1, uint64_t *h2)
+{
+	memcpy(h1, oid, sizeof(*h1));
+	memcpy(h2, oid + sizeof(*h1), sizeof(*h2));
+	*h2 |= 1;
+}
+
+void object_index_add(struct object_index *index, const uint8_t oid[32])
+{
+	if(!index) return;
+	
+	uint64_t h1, h2;
+	object_index_hashes(oid, &h1, &h2);
+	
+	for(int i = 0; i < OBJECT_INDEX_NUM_HASHES; i++)
+	{
+		uint64_t bit = (h1 + i * h2) % index->num_bits;
+		__atomic_fetch_or(&index->bits[bit >> 6], (uint64_t)1 << (bit & 63), __ATOMIC_RELAXED);
+	}
+	
+	// make the bits visible before the object is reported as committed
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+int object_index_may_exist(const struct object_index *index, const uint8_t oid[32])
+{
+	if(!index || __atomic_load_n(&index->state, __ATOMIC_ACQUIRE) != OBJECT_INDEX_READY)
+	{
+		return 1;
+	}
+	
+	uint64_t h1, h2;
+	object_index_hashes(oid, &h1, &h2);
+	
+	for(int i = 0; i < OBJECT_INDEX_NUM_HASHES; i++)
+	{
+		uint64_t bit = (h1 + i * h2) % index->num_bits;
+		uint64_t word = __atomic_load_n(&index->bits[bit >> 6], __ATOMIC_RELAXED);
+		if(!(word & ((uint64_t)1 << (bit & 63))))
+		{
+			return 0;
+		}
+	}
+	
+	return 1;
+}
+
+int object_index_claim_scan(struct object_index *index)
+{
+	if(!index) return 0;
+	
+	int expected = OBJECT_INDEX_EMPTY;
+	return __atomic_compare_exchange_n(&index->state, &expected, OBJECT_INDEX_SCANNING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// objects are stored as <root>/<aa>/<rest of oid>. objects committed while
+// the scan runs are added by the committing repo manager, so nothing is
+// missed as long as the index is only marked ready after the scan
+int object_index_scan(struct object_index *index, const char *root_dir, const volatile int *cancel)
+{
+	char pattern[PATH_MAX];
+	int root_len = snprintf(pattern, sizeof(pattern), "%s/", root_dir);
+	if(root_len < 0 || root_len + 2 + 2 + 1 > sizeof(pattern))
+	{
+		return -1;
+	}
+	
+	for(int dir = 0; dir < 256; dir++)
+	{
+		if(*cancel)
+		{
+			return -1;
+		}
+		
+		snprintf(pattern + root_len, sizeof(pattern) - root_len, "%02x/*", dir);
+		
+		int num_files;
+		const char **files = os_glob(pattern, &num_files);
+		if(!files)
+		{
+			return -1;
+		}
+		
+		for(int i = 0; i < num_files; i++)
+		{
+			// skips anything but <aa>/<62 hex digits>, including the
+			// unmatched pattern of an empty directory
+			if(strlen(files[i]) != root_len + 3 + 62) continue;
+			const char *name = files[i] + root_len + 3;
+			
+			char oid_str[65];
+			memcpy(oid_str, pattern + root_len, 2);
+			memcpy(oid_str + 2, name, 63);
+			
+			uint8_t oid[32];
+			if(oid_from_string(oid_str, oid) == 0)
+			{
+				object_index_add(index, oid);
+			}
+		}
+		
+		free(files);
+	}
+	
+	__atomic_store_n(&index->state, OBJECT_INDEX_READY, __ATOMIC_RELEASE);
+	
+	return 0;
+}
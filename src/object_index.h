@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef OBJECT_INDEX_H
+#define OBJECT_INDEX_H
+
+#include <stdint.h>
+
+// A bloom filter of the objects stored in a repo. It is mapped before the
+// repo managers are forked so that all of them share it, and objects are
+// only ever added. It is filled in by scanning the repo once at startup;
+// until that is done every object is reported as possibly existing.
+
+struct object_index;
+
+struct object_index *object_index_create(long num_objects);
+void object_index_free(struct object_index *index);
+
+// returns 1 if this process should scan the repo. only one caller is told to
+int object_index_claim_scan(struct object_index *index);
+
+// stops early and returns -1 once *cancel is set, the index stays unused
+int object_index_scan(struct object_index *index, const char *root_dir, const volatile int *cancel);
+
+void object_index_add(struct object_index *index, const uint8_t oid[32]);
+
+// returns 0 if the object is definitely not in the repo
+int object_index_may_exist(const struct object_index *index, const uint8_t oid[32]);
+
+#endif
@@ -13,60 +13,224 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
-
 #include "oid_utils.h"
 #include <string.h>
+#include <stdint.h>
+#include "cpu_dispatch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OID_HEX_X86
+#include <immintrin.h>
+#endif
+
+// 0xff for anything that isn't a lowercase hex digit
+static const unsigned char hex_values[256] =
+{
+	[0 ... 255] = 0xff,
+	['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
+	['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+	['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15
+};
+
+static const char hex_digits[16] = "0123456789abcdef";
 
-static unsigned char hex_to_int(char hex)
+static int hex_scalar_supported(void)
 {
-	if(hex >= 'a' && hex <= 'f') {
-		return 10 + hex - 'a';
-	} else if(hex >= 'A' && hex <= 'F') {
-		return 10 + hex - 'A';
-	} else if(hex >= '0' && hex <= '9') {
-		return hex - '0';
+	return 1;
+}
+
+static void hex_scalar_encode(const unsigned char oid[32], char hex[64])
+{
+	for(int i = 0; i < 32; i++) {
+		hex[i << 1] = hex_digits[oid[i] >> 4];
+		hex[(i << 1) + 1] = hex_digits[oid[i] & 0xF];
 	}
-	return 0;
 }
 
-static unsigned char int_to_hex(int nibble)
+// invalid digits are or'ed together and checked once at the end
+static int hex_scalar_decode(const char hex[64], unsigned char oid[32])
 {
-	if(nibble < 0 || nibble > 15) return 0;
-	if(nibble < 10) return '0' + nibble;
-	return 'a' + (nibble - 10);
+	unsigned char invalid = 0;
+	for(int i = 0; i < 32; i++) {
+		unsigned char hi = hex_values[(unsigned char)hex[i << 1]];
+		unsigned char lo = hex_values[(unsigned char)hex[(i << 1) + 1]];
+		invalid |= hi | lo;
+		oid[i] = (hi << 4) | (lo & 0xF);
+	}
+	
+	return invalid & 0x80 ? -1 : 0;
 }
 
-int oid_is_valid(const char *oid)
+#ifdef OID_HEX_X86
+static int hex_sse2_supported(void)
 {
-	if(strnlen(oid, 65) != 64) return 0;
+	return __builtin_cpu_supports("sse2");
+}
+
+// 16 nibbles to lowercase hex digits
+__attribute__((target("sse2")))
+static __m128i hex_sse2_digits(__m128i nibbles)
+{
+	__m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+	return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+__attribute__((target("sse2")))
+static void hex_sse2_encode(const unsigned char oid[32], char hex[64])
+{
+	for(int i = 0; i < 32; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(oid + i));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0xF));
+		__m128i lo = _mm_and_si128(bytes, _mm_set1_epi8(0xF));
+		
+		_mm_storeu_si128((__m128i *)(hex + i * 2), hex_sse2_digits(_mm_unpacklo_epi8(hi, lo)));
+		_mm_storeu_si128((__m128i *)(hex + i * 2 + 16), hex_sse2_digits(_mm_unpackhi_epi8(hi, lo)));
+	}
+}
+
+// 16 digits to nibbles, and a mask of the bytes that weren't lowercase hex.
+// the compares are signed, so bytes over 0x7f fail both ranges.
+__attribute__((target("sse2")))
+static __m128i hex_sse2_nibbles(__m128i digits, __m128i *invalid)
+{
+	__m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(digits, _mm_set1_epi8('0' - 1)),
+									 _mm_cmplt_epi8(digits, _mm_set1_epi8('9' + 1)));
+	__m128i is_letter = _mm_and_si128(_mm_cmpgt_epi8(digits, _mm_set1_epi8('a' - 1)),
+									  _mm_cmplt_epi8(digits, _mm_set1_epi8('f' + 1)));
+	*invalid = _mm_or_si128(*invalid, _mm_andnot_si128(_mm_or_si128(is_digit, is_letter), _mm_set1_epi8(-1)));
 	
-	for(int i = 0; i < 64; i++) {
-		if(!((oid[i] >= '0' && oid[i] <= '9') ||
-			 (oid[i] >='a' && oid[i] <= 'f')))
-		{
-			return 0;
-		}
+	__m128i nibbles = _mm_sub_epi8(digits, _mm_set1_epi8('0'));
+	return _mm_sub_epi8(nibbles, _mm_and_si128(is_letter, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+// joins the nibble pairs of each 16 bit lane, the high nibble comes first
+__attribute__((target("sse2")))
+static __m128i hex_sse2_join(__m128i nibbles)
+{
+	__m128i hi = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0xFF)), 4);
+	return _mm_or_si128(hi, _mm_srli_epi16(nibbles, 8));
+}
+
+__attribute__((target("sse2")))
+static int hex_sse2_decode(const char hex[64], unsigned char oid[32])
+{
+	__m128i invalid = _mm_setzero_si128();
+	for(int i = 0; i < 64; i += 32) {
+		__m128i a = hex_sse2_nibbles(_mm_loadu_si128((const __m128i *)(hex + i)), &invalid);
+		__m128i b = hex_sse2_nibbles(_mm_loadu_si128((const __m128i *)(hex + i + 16)), &invalid);
+		_mm_storeu_si128((__m128i *)(oid + i / 2), _mm_packus_epi16(hex_sse2_join(a), hex_sse2_join(b)));
 	}
 	
-	return 1;
+	return _mm_movemask_epi8(invalid) ? -1 : 0;
+}
+
+static int hex_avx2_supported(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static __m256i hex_avx2_digits(__m256i nibbles)
+{
+	__m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+	return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')), letters);
+}
+
+// unpacking works within each 128 bit lane, so the halves are put back in
+// order before storing
+__attribute__((target("avx2")))
+static void hex_avx2_encode(const unsigned char oid[32], char hex[64])
+{
+	__m256i bytes = _mm256_loadu_si256((const __m256i *)oid);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0xF));
+	__m256i lo = _mm256_and_si256(bytes, _mm256_set1_epi8(0xF));
+	__m256i first = hex_avx2_digits(_mm256_unpacklo_epi8(hi, lo));
+	__m256i second = hex_avx2_digits(_mm256_unpackhi_epi8(hi, lo));
+	
+	_mm256_storeu_si256((__m256i *)hex, _mm256_permute2x128_si256(first, second, 0x20));
+	_mm256_storeu_si256((__m256i *)(hex + 32), _mm256_permute2x128_si256(first, second, 0x31));
+}
+
+__attribute__((target("avx2")))
+static __m256i hex_avx2_nibbles(__m256i digits, __m256i *invalid)
+{
+	__m256i is_digit = _mm256_and_si256(_mm256_cmpgt_epi8(digits, _mm256_set1_epi8('0' - 1)),
+										_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), digits));
+	__m256i is_letter = _mm256_and_si256(_mm256_cmpgt_epi8(digits, _mm256_set1_epi8('a' - 1)),
+										 _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), digits));
+	*invalid = _mm256_or_si256(*invalid, _mm256_andnot_si256(_mm256_or_si256(is_digit, is_letter), _mm256_set1_epi8(-1)));
+	
+	__m256i nibbles = _mm256_sub_epi8(digits, _mm256_set1_epi8('0'));
+	return _mm256_sub_epi8(nibbles, _mm256_and_si256(is_letter, _mm256_set1_epi8('a' - '0' - 10)));
+}
+
+__attribute__((target("avx2")))
+static __m256i hex_avx2_join(__m256i nibbles)
+{
+	__m256i hi = _mm256_slli_epi16(_mm256_and_si256(nibbles, _mm256_set1_epi16(0xFF)), 4);
+	return _mm256_or_si256(hi, _mm256_srli_epi16(nibbles, 8));
+}
+
+__attribute__((target("avx2")))
+static int hex_avx2_decode(const char hex[64], unsigned char oid[32])
+{
+	__m256i invalid = _mm256_setzero_si256();
+	__m256i a = hex_avx2_nibbles(_mm256_loadu_si256((const __m256i *)hex), &invalid);
+	__m256i b = hex_avx2_nibbles(_mm256_loadu_si256((const __m256i *)(hex + 32)), &invalid);
+	
+	// packing is per lane too, giving a0 b0 a1 b1 in 64 bit units
+	__m256i packed = _mm256_packus_epi16(hex_avx2_join(a), hex_avx2_join(b));
+	_mm256_storeu_si256((__m256i *)oid, _mm256_permute4x64_epi64(packed, 0xD8));
+	
+	return _mm256_movemask_epi8(invalid) ? -1 : 0;
+}
+#endif
+
+static const struct oid_hex_impl hex_impls[] =
+{
+#ifdef OID_HEX_X86
+	{ "avx2", hex_avx2_supported, hex_avx2_encode, hex_avx2_decode },
+	{ "sse2", hex_sse2_supported, hex_sse2_encode, hex_sse2_decode },
+#endif
+	{ "scalar", hex_scalar_supported, hex_scalar_encode, hex_scalar_decode }
+};
+
+static const void *hex_impl;
+
+static int hex_impl_usable(const void *impl, int arg)
+{
+	return ((const struct oid_hex_impl *)impl)->supported();
+}
+
+static const struct oid_hex_impl *get_hex_impl(void)
+{
+	return cpu_dispatch_pick(&hex_impl, hex_impls, sizeof(hex_impls) / sizeof(hex_impls[0]),
+							 sizeof(hex_impls[0]), hex_impl_usable, 0);
+}
+
+const struct oid_hex_impl *oid_hex_get_impls(int *count)
+{
+	*count = sizeof(hex_impls) / sizeof(hex_impls[0]);
+	return hex_impls;
+}
+
+int oid_is_valid(const char *oid)
+{
+	if(strnlen(oid, 65) != 64) return 0;
+	
+	unsigned char bytes[32];
+	return get_hex_impl()->decode(oid, bytes) == 0;
 }
 
 void oid_to_string(const unsigned char oid[32], char str[65])
 {
-	for(int i = 0; i < 32; ++i) {
-		str[i << 1] = int_to_hex(oid[i] >> 4);
-		str[(i << 1) + 1] = int_to_hex(oid[i] & 0xF);
-	}
+	get_hex_impl()->encode(oid, str);
 	str[64] = 0;
 }
 
 int oid_from_string(const char str[65], unsigned char oid[32])
 {
-	if(!oid_is_valid(str)) return -1;
-	
-	for(int i = 0; i < 32; i++) {
-		oid[i] = (hex_to_int(str[i << 1]) << 4) | hex_to_int(str[(i << 1) + 1]);
-	}
+	if(strnlen(str, 65) != 64) return -1;
 	
-	return 0;
+	return get_hex_impl()->decode(str, oid);
 }
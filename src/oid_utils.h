@@ -20,4 +20,18 @@ int oid_is_valid(const char *oid);
 void oid_to_string(const unsigned char oid[32], char str[65]);
 int oid_from_string(const char str[65], unsigned char oid[32]);
 
+// the hex conversion has a scalar version and SIMD ones, the fastest one
+// the cpu supports is picked on first use. decode only accepts lowercase
+// hex and fails without a length check of its own.
+struct oid_hex_impl
+{
+	const char *name;
+	int (*supported)(void);
+	void (*encode)(const unsigned char oid[32], char hex[64]);
+	int (*decode)(const char hex[64], unsigned char oid[32]);
+};
+
+// all implementations built in, fastest first, for benchmarks
+const struct oid_hex_impl *oid_hex_get_impls(int *count);
+
 #endif
@@ -34,15 +34,24 @@ extern int yyerror (const char *msg, ...);
 %token ROOT
 %token URI
 %token VERIFY_UPLOADS
+%token OBJECT_INDEX
 %token YES
 %token NO
 %token FASTCGI_SERVER
+%token EVENT_SERVER
 %token NUM_THREADS
+%token NUM_REPO_MANAGERS
 %token CHROOT_PATH
 %token PROCESS_CHROOT
 %token USER
 %token GROUP
 %token FASTCGI_SOCKET
+%token FASTCGI_LISTENERS
+%token METRICS
+%token ACCESS_LOG
+%token ACCESS_LOG_SAMPLE
+%token SCRUB_RATE
+%token SCRUB_INTERVAL
 %token AUTH_REALM
 %token ENABLE_AUTHENTICATION
 %token AUTH_FILE
@@ -109,12 +118,44 @@ global_declaration
 	| NUM_THREADS INTEGER {
 		parse_config->num_threads = $2;
 	}
+	| NUM_REPO_MANAGERS INTEGER {
+		parse_config->num_repo_managers = $2;
+	}
 	| FASTCGI_SERVER YES {
 		parse_config->fastcgi_server = 1;
 	}
 	| FASTCGI_SERVER NO {
 		parse_config->fastcgi_server = 0;
 	}
+	| EVENT_SERVER YES {
+		parse_config->event_server = 1;
+	}
+	| EVENT_SERVER NO {
+		parse_config->event_server = 0;
+	}
+	| METRICS YES {
+		parse_config->metrics = 1;
+	}
+	| METRICS NO {
+		parse_config->metrics = 0;
+	}
+	| ACCESS_LOG STRING {
+		parse_config->access_log = strndup($2, sizeof($2));
+		if(!parse_config->access_log)
+		{
+			yyerror("Parser ran out of memory");
+			YYERROR;
+		}
+	}
+	| ACCESS_LOG_SAMPLE INTEGER {
+		parse_config->access_log_sample = $2;
+	}
+	| SCRUB_RATE INTEGER {
+		parse_config->scrub_rate = $2;
+	}
+	| SCRUB_INTERVAL INTEGER {
+		parse_config->scrub_interval = $2;
+	}
 	| FASTCGI_SOCKET STRING {
 		parse_config->fastcgi_socket = strndup($2, sizeof($2));
 		if(!parse_config->fastcgi_socket)
@@ -123,6 +164,9 @@ global_declaration
 			YYERROR;
 		}
 	}
+	| FASTCGI_LISTENERS INTEGER {
+		parse_config->fastcgi_listeners = $2;
+	}
 	| INCLUDE STRING
 	;
 
@@ -137,6 +181,7 @@ repo_declaration
 		parse_repo->name = strndup($2, sizeof($2));
 		parse_repo->id = s_next_id++;
 		parse_repo->verify_uploads = 1;
+		parse_repo->object_index_size = 1000000;
 	}
 	'{' repo_params_list '}' {
 		SLIST_INSERT_HEAD(&parse_config->repos, parse_repo, entries);
@@ -180,6 +225,9 @@ repo_param
 	| VERIFY_UPLOADS NO {
 		parse_repo->verify_uploads = 0;
 	}
+	| OBJECT_INDEX INTEGER {
+		parse_repo->object_index_size = $2;
+	}
 	| ENABLE_AUTHENTICATION YES {
 		parse_repo->enable_authentication = 1;
 	}
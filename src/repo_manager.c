@@ -16,23 +16,62 @@
 #include "repo_manager.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdarg.h>
 #include <time.h>
+#include <ctype.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
 #include <openssl/sha.h>
 #include "sqlite3.h"
 #include "compat/string.h"
 #include "compat/queue.h"
 #include "os/mutex.h"
+#include "os/threads.h"
 #include "os/io.h"
 #include "os/socket.h"
 #include "os/filesystem.h"
+#include "os/clock.h"
 #include "configuration.h"
 #include "oid_utils.h"
 #include "socket_utils.h"
 #include "htpasswd.h"
+#include "mkdir_recusive.h"
+#include "object_index.h"
+#include "scrubber.h"
+#include "metrics.h"
 
-static os_mutex_t lock = NULL;
+// a request waiting for its response from the repo manager
+struct repo_pending_request
+{
+	LIST_ENTRY(repo_pending_request) entries;
+
+	uint32_t cookie;
+	enum repo_cmd_type type;
+	int done;
+	int status;
+	void *resp_data;
+	size_t resp_size;
+	size_t resp_received;
+	int *fd;
+	char *error_msg;
+	size_t error_msg_buf_size;
+	os_cond_t cond;
+};
+
+// client side of the socket, shared by all threads
+struct repo_channel
+{
+	int socket;
+	os_mutex_t write_lock; // serializes writing a single request
+	os_mutex_t pending_lock; // protects everything below
+	LIST_HEAD(repo_pending_list, repo_pending_request) pending;
+	uint32_t next_cookie;
+	int closed;
+	int in_flight; // number of requests waiting on this channel
+	os_thread_t reader;
+};
 
 struct upload_entry
 {
@@ -41,7 +80,7 @@ struct upload_entry
 	uint32_t id;
 	char tmp_path[PATH_MAX];
 	uint8_t oid[32];
-	const struct git_lfs_repo *repo;
+	uint32_t repo_id;
 	time_t expire;
 };
 
@@ -55,25 +94,209 @@ struct git_lfs_access_token
 	
 	char token[16];
 	time_t expire;
-	const struct git_lfs_repo *repo;
+	uint32_t repo_id; // by id, so the token outlives a config reload
 };
 
-static LIST_HEAD(git_lfs_access_token_list, git_lfs_access_token) access_token_list;
+LIST_HEAD(git_lfs_access_token_list, git_lfs_access_token);
 
-static struct git_lfs_access_token *git_lfs_add_access_token(const struct git_lfs_repo *repo, time_t expires_at)
+// tokens are found through a hash table keyed by the token string and
+// expire in order through a min-heap on the expiry time
+static struct
+{
+	struct git_lfs_access_token_list *buckets;
+	size_t num_buckets; // power of two
+	size_t count;
+	
+	struct git_lfs_access_token **heap;
+	size_t heap_capacity;
+	
+	// newest token of each repo, indexed by repo id
+	struct git_lfs_access_token **newest;
+	size_t num_newest;
+} access_tokens;
+
+enum
+{
+	ACCESS_TOKEN_MIN_BUCKETS = 64
+};
+
+static uint32_t access_token_hash(const char *token)
+{
+	// FNV-1a, tokens are random so nothing stronger is needed
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < sizeof(((struct git_lfs_access_token *)0)->token) && token[i]; i++)
+	{
+		hash = (hash ^ (uint8_t)token[i]) * 16777619u;
+	}
+	
+	return hash;
+}
+
+static int access_tokens_resize(size_t num_buckets)
+{
+	struct git_lfs_access_token_list *buckets = calloc(num_buckets, sizeof(buckets[0]));
+	if(!buckets)
+	{
+		return -1;
+	}
+	
+	for(size_t i = 0; i < num_buckets; i++)
+	{
+		LIST_INIT(&buckets[i]);
+	}
+	
+	for(size_t i = 0; i < access_tokens.num_buckets; i++)
+	{
+		struct git_lfs_access_token *access_token;
+		while((access_token = LIST_FIRST(&access_tokens.buckets[i])) != NULL)
+		{
+			LIST_REMOVE(access_token, entries);
+			LIST_INSERT_HEAD(&buckets[access_token_hash(access_token->token) & (num_buckets - 1)], access_token, entries);
+		}
+	}
+	
+	free(access_tokens.buckets);
+	access_tokens.buckets = buckets;
+	access_tokens.num_buckets = num_buckets;
+	
+	return 0;
+}
+
+static int access_token_heap_push(struct git_lfs_access_token *access_token)
+{
+	if(access_tokens.count == access_tokens.heap_capacity)
+	{
+		size_t capacity = access_tokens.heap_capacity ? access_tokens.heap_capacity * 2 : ACCESS_TOKEN_MIN_BUCKETS;
+		struct git_lfs_access_token **heap = realloc(access_tokens.heap, capacity * sizeof(heap[0]));
+		if(!heap)
+		{
+			return -1;
+		}
+		
+		access_tokens.heap = heap;
+		access_tokens.heap_capacity = capacity;
+	}
+	
+	size_t i = access_tokens.count;
+	while(i > 0)
+	{
+		size_t parent = (i - 1) / 2;
+		if(access_tokens.heap[parent]->expire <= access_token->expire)
+		{
+			break;
+		}
+		
+		access_tokens.heap[i] = access_tokens.heap[parent];
+		i = parent;
+	}
+	
+	access_tokens.heap[i] = access_token;
+	return 0;
+}
+
+static struct git_lfs_access_token *access_token_heap_pop(void)
+{
+	struct git_lfs_access_token **heap = access_tokens.heap;
+	struct git_lfs_access_token *top = heap[0];
+	struct git_lfs_access_token *last = heap[--access_tokens.count];
+	
+	size_t i = 0;
+	for(;;)
+	{
+		size_t child = i * 2 + 1;
+		if(child >= access_tokens.count)
+		{
+			break;
+		}
+		
+		if(child + 1 < access_tokens.count && heap[child + 1]->expire < heap[child]->expire)
+		{
+			child++;
+		}
+		
+		if(last->expire <= heap[child]->expire)
+		{
+			break;
+		}
+		
+		heap[i] = heap[child];
+		i = child;
+	}
+	
+	if(access_tokens.count > 0)
+	{
+		heap[i] = last;
+	}
+	
+	return top;
+}
+
+static int generate_access_token(char *token, size_t size)
 {
 	static const char ch[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+	// largest multiple of the alphabet size that fits in a byte, anything
+	// above it is thrown away so every character is equally likely
+	const unsigned int limit = 256 - 256 % (sizeof(ch) - 1);
+	unsigned char random[64];
+	size_t used = sizeof(random);
+	
+	for(size_t i = 0; i < size - 1; )
+	{
+		if(used == sizeof(random))
+		{
+			if(RAND_bytes(random, sizeof(random)) != 1)
+			{
+				return -1;
+			}
+			used = 0;
+		}
+		
+		unsigned int r = random[used++];
+		if(r < limit)
+		{
+			token[i++] = ch[r % (sizeof(ch) - 1)];
+		}
+	}
+	token[size - 1] = 0;
+	
+	explicit_bzero(random, sizeof(random));
+	return 0;
+}
+
+static struct git_lfs_access_token *git_lfs_add_access_token(const struct git_lfs_repo *repo, time_t expires_at)
+{
 	struct git_lfs_access_token *access_token;
 
-	// find existing access token
-	LIST_FOREACH(access_token, &access_token_list, entries)
+	// reuse the newest token of the repo if it lives long enough
+	if(repo->id < access_tokens.num_newest)
 	{
-		if(access_token->repo == repo &&
-		   expires_at < access_token->expire)
+		access_token = access_tokens.newest[repo->id];
+		if(access_token && expires_at < access_token->expire)
 		{
 			return access_token;
 		}
 	}
+	else
+	{
+		size_t num_newest = repo->id + 1;
+		struct git_lfs_access_token **newest = realloc(access_tokens.newest, num_newest * sizeof(newest[0]));
+		if(!newest)
+		{
+			return NULL;
+		}
+		
+		memset(newest + access_tokens.num_newest, 0, (num_newest - access_tokens.num_newest) * sizeof(newest[0]));
+		access_tokens.newest = newest;
+		access_tokens.num_newest = num_newest;
+	}
+	
+	if(access_tokens.count >= access_tokens.num_buckets)
+	{
+		if(access_tokens_resize(access_tokens.num_buckets ? access_tokens.num_buckets * 2 : ACCESS_TOKEN_MIN_BUCKETS) < 0)
+		{
+			return NULL;
+		}
+	}
 	
 	access_token = calloc(1, sizeof *access_token);
 	if(!access_token)
@@ -82,40 +305,70 @@ static struct git_lfs_access_token *git_lfs_add_access_token(const struct git_lf
 	}
 
 	access_token->expire = expires_at + 60;
-	access_token->repo = repo;
+	access_token->repo_id = repo->id;
 	
-	for(int i = 0; i < sizeof(access_token->token) - 1; ++i)
+	if(generate_access_token(access_token->token, sizeof(access_token->token)) < 0 ||
+	   access_token_heap_push(access_token) < 0)
 	{
-		access_token->token[i] = ch[rand() % (sizeof(ch) - 1)];
+		free(access_token);
+		return NULL;
 	}
-	access_token->token[sizeof(access_token->token) - 1] = 0;
 	
-	LIST_INSERT_HEAD(&access_token_list, access_token, entries);
+	access_tokens.count++;
+	LIST_INSERT_HEAD(&access_tokens.buckets[access_token_hash(access_token->token) & (access_tokens.num_buckets - 1)], access_token, entries);
+	access_tokens.newest[repo->id] = access_token;
 	
 	return access_token;
 }
 
+static void git_lfs_remove_access_token(struct git_lfs_access_token *access_token)
+{
+	LIST_REMOVE(access_token, entries);
+	
+	if(access_tokens.newest[access_token->repo_id] == access_token)
+	{
+		access_tokens.newest[access_token->repo_id] = NULL;
+	}
+	
+	explicit_bzero(access_token, sizeof(*access_token));
+	free(access_token);
+}
+
 static void git_lfs_cleanup_access_tokens()
 {
-	struct git_lfs_access_token *access_token, *tmp;
 	time_t now = time(NULL);
-	LIST_FOREACH_SAFE(access_token, &access_token_list, entries, tmp)
+	while(access_tokens.count > 0 && now > access_tokens.heap[0]->expire)
 	{
-		if(now > access_token->expire) {
-			LIST_REMOVE(access_token, entries);
-			free(access_token);
-		}
+		git_lfs_remove_access_token(access_token_heap_pop());
+	}
+}
+
+static void git_lfs_free_access_tokens()
+{
+	while(access_tokens.count > 0)
+	{
+		git_lfs_remove_access_token(access_token_heap_pop());
 	}
+	
+	free(access_tokens.buckets);
+	free(access_tokens.heap);
+	free(access_tokens.newest);
+	memset(&access_tokens, 0, sizeof(access_tokens));
 }
 
 static int git_lfs_verify_access_token(const char *access_token, int repo_id)
 {
+	if(access_tokens.num_buckets == 0)
+	{
+		return 0;
+	}
+	
 	struct git_lfs_access_token *token;
-	LIST_FOREACH(token, &access_token_list, entries)
+	LIST_FOREACH(token, &access_tokens.buckets[access_token_hash(access_token) & (access_tokens.num_buckets - 1)], entries)
 	{
-		if(token->repo->id == repo_id &&
+		if(token->repo_id == repo_id &&
 		   time(NULL) <= token->expire &&
-		   0 == strncmp(token->token, access_token, sizeof(token->token)))
+		   0 == CRYPTO_memcmp(token->token, access_token, sizeof(token->token)))
 		{
 			return 1;
 		}
@@ -177,143 +430,401 @@ struct repo_manager *repo_manager_create(int socket)
 	return mgr;
 }
 
+static void repo_channel_free(struct repo_channel *channel)
+{
+	if(channel->reader)
+	{
+		// unblocks the reader thread
+		os_shutdown(channel->socket);
+		os_thread_join(channel->reader, NULL);
+	}
+
+	if(channel->pending_lock) os_mutex_destroy(channel->pending_lock);
+	if(channel->write_lock) os_mutex_destroy(channel->write_lock);
+	free(channel);
+}
+
 void repo_manager_free(struct repo_manager *mgr)
 {
+	for(int i = 0; i < mgr->num_channels; i++)
+	{
+		repo_channel_free(mgr->channels[i]);
+	}
+	free(mgr->channels);
 	free(mgr);
 }
 
-static int git_lfs_repo_send_request(struct repo_manager *mgr,
-									 enum repo_cmd_type type,
-									 const char *access_token,
-									 const void *req_data, size_t req_size,
-									 void *resp_data, size_t resp_size,
-									 int *fd,
-									 char *error_msg,
-									 size_t error_msg_buf_size)
+void repo_manager_init_session(struct repo_manager *session, const struct repo_manager *mgr)
 {
-	int ret = -1;
+	static unsigned int next_channel = 0;
 	
-	if(error_msg && error_msg_buf_size > 0) {
-		*error_msg = 0;
-	}
-
-	if(!lock) lock = os_mutex_create();
+	memset(session, 0, sizeof(*session));
+	session->socket = -1;
 	
-	os_mutex_lock(lock);
-
-	struct repo_cmd_header req_cmd;
-	memset(&req_cmd, 0, sizeof(req_cmd));
-	req_cmd.magic = REPO_CMD_MAGIC;
-	req_cmd.cookie = rand();
-	req_cmd.type = type;
-	if(strlcpy(req_cmd.access_token, access_token, sizeof(req_cmd.access_token)) >= sizeof(req_cmd.access_token))
+	if(mgr->num_channels < 1) return;
+	
+	// pick the least busy repo manager, starting round-robin so ties are spread out.
+	// the session stays on this channel so tokens and tickets stay in one process.
+	unsigned int start = __sync_fetch_and_add(&next_channel, 1);
+	struct repo_channel *best = NULL;
+	int best_in_flight = 0;
+	for(int i = 0; i < mgr->num_channels; i++)
 	{
-		goto fail;
+		struct repo_channel *channel = mgr->channels[(start + i) % mgr->num_channels];
+		int in_flight = __atomic_load_n(&channel->in_flight, __ATOMIC_RELAXED);
+		if(!best || in_flight < best_in_flight)
+		{
+			best = channel;
+			best_in_flight = in_flight;
+		}
 	}
 	
-	// sends the request
-	if(socket_write_fully(mgr->socket, &req_cmd, sizeof(req_cmd)) != sizeof(req_cmd)) goto fail;
-	if(req_size > 0 && socket_write_fully(mgr->socket, req_data, req_size) != req_size) goto fail;
-	
-	struct repo_cmd_header resp_cmd;
-	// expect a reply
-	if(socket_read_fully(mgr->socket, &resp_cmd, sizeof(resp_cmd)) != sizeof(resp_cmd)) goto fail;
-	
-	if(resp_cmd.magic != REPO_CMD_MAGIC ||
-	   resp_cmd.cookie != req_cmd.cookie) {
-		goto fail;
+	session->socket = best->socket;
+	session->channel = best;
+	session->channels = mgr->channels;
+	session->num_channels = mgr->num_channels;
+}
+
+int repo_manager_get_in_flight(const struct repo_manager *mgr, int channel)
+{
+	return __atomic_load_n(&mgr->channels[channel]->in_flight, __ATOMIC_RELAXED);
+}
+
+static int repo_channel_discard(struct repo_channel *channel, size_t size)
+{
+	char buffer[256];
+	while(size > 0)
+	{
+		int n = size < sizeof(buffer) ? size : sizeof(buffer);
+		if(socket_read_fully(channel->socket, buffer, n) != n) return -1;
+		size -= n;
 	}
 	
-	if(resp_cmd.type == REPO_CMD_ERROR) {
+	return 0;
+}
+
+// reads the payload of a response into the request that is waiting for it
+static int repo_channel_read_payload(struct repo_channel *channel,
+									 const struct repo_cmd_header *hdr,
+									 struct repo_pending_request *req)
+{
+	if(hdr->type == REPO_CMD_ERROR)
+	{
 		struct repo_cmd_error_response err_resp;
-		if(socket_read_fully(mgr->socket, &err_resp, sizeof(err_resp)) == sizeof(err_resp)) {
-			if(error_msg) {
-				err_resp.message[sizeof(err_resp.message) - 1] = 0;
-				strlcpy(error_msg, err_resp.message, error_msg_buf_size);
-			}
+		memset(&err_resp, 0, sizeof(err_resp));
+		
+		if(hdr->size > sizeof(err_resp)) return -1;
+		if(socket_read_fully(channel->socket, &err_resp, hdr->size) != hdr->size) return -1;
+		
+		if(req && req->error_msg && req->error_msg_buf_size > 0)
+		{
+			err_resp.message[sizeof(err_resp.message) - 1] = 0;
+			strlcpy(req->error_msg, err_resp.message, req->error_msg_buf_size);
 		}
-		goto fail;
+		
+		return 0;
 	}
 	
-	if(resp_size > 0) {
-		if(fd) {
-			if(os_recv_with_file_descriptor(mgr->socket, resp_data, resp_size, fd) != resp_size)
+	// nobody is waiting on this or it is not what was asked for
+	if(!req || hdr->type != req->type || hdr->size > req->resp_size)
+	{
+		return repo_channel_discard(channel, hdr->size);
+	}
+
+	if(hdr->size > 0)
+	{
+		if(req->fd)
+		{
+			if(os_recv_with_file_descriptor(channel->socket, req->resp_data, hdr->size, req->fd) != hdr->size)
 			{
-				goto fail;
+				return -1;
 			}
-		} else {
-			if(socket_read_fully(mgr->socket, resp_data, resp_size) != resp_size) goto fail;
+		}
+		else
+		{
+			if(socket_read_fully(channel->socket, req->resp_data, hdr->size) != hdr->size) return -1;
 		}
 	}
 	
-	ret = 0;
-fail:
-	os_mutex_unlock(lock);
-	return ret;
+	req->resp_received = hdr->size;
+	req->status = 0;
+
+	return 0;
 }
 
-static int git_lfs_repo_send_response(struct repo_manager *mgr,
-									  enum repo_cmd_type type,
-									  uint32_t cookie,
-									  void *resp_data, size_t resp_size,
-									  int *fd)
+static void *repo_channel_reader_thread(void *data)
 {
-	struct repo_cmd_header hdr;
-	memset(&hdr, 0, sizeof(hdr));
-	hdr.magic = REPO_CMD_MAGIC;
-	hdr.cookie = cookie;
-	hdr.type = type;
+	struct repo_channel *channel = (struct repo_channel *)data;
+	struct repo_pending_request *req, *tmp;
 
-	if(socket_write_fully(mgr->socket, &hdr, sizeof(hdr)) != sizeof(hdr)) {
-		return -1;
-	}
-	
-	if(fd) {
-		if(os_send_with_file_descriptor(mgr->socket, resp_data, resp_size, *fd) != resp_size) {
-			return -1;
+	for(;;)
+	{
+		struct repo_cmd_header hdr;
+		if(socket_read_fully(channel->socket, &hdr, sizeof(hdr)) != sizeof(hdr)) break;
+		if(hdr.magic != REPO_CMD_MAGIC) break;
+		
+		os_mutex_lock(channel->pending_lock);
+		LIST_FOREACH(req, &channel->pending, entries)
+		{
+			if(req->cookie == hdr.cookie)
+			{
+				LIST_REMOVE(req, entries);
+				break;
+			}
 		}
-	} else {
-		if(socket_write_fully(mgr->socket, resp_data, resp_size) != resp_size) {
-			return -1;
+		os_mutex_unlock(channel->pending_lock);
+
+		int ret = repo_channel_read_payload(channel, &hdr, req);
+		
+		if(req)
+		{
+			os_mutex_lock(channel->pending_lock);
+			req->done = 1;
+			os_cond_signal(req->cond);
+			os_mutex_unlock(channel->pending_lock);
 		}
+		
+		if(ret < 0) break;
 	}
 	
-	return 0;
+	// fail everything still waiting
+	os_mutex_lock(channel->pending_lock);
+	channel->closed = 1;
+	LIST_FOREACH_SAFE(req, &channel->pending, entries, tmp)
+	{
+		LIST_REMOVE(req, entries);
+		req->done = 1;
+		os_cond_signal(req->cond);
+	}
+	os_mutex_unlock(channel->pending_lock);
+	
+	return NULL;
 }
 
-static int git_lfs_repo_send_error_response(struct repo_manager *mgr, uint32_t cookie, const char *msg, ...)
+static struct repo_channel *repo_channel_create(int socket)
 {
-	struct repo_cmd_error_response err_resp;
+	struct repo_channel *channel = calloc(1, sizeof *channel);
+	if(!channel) return NULL;
 	
-	va_list va;
-	va_start(va, msg);
-	vsnprintf(err_resp.message, sizeof(err_resp.message), msg, va);
-	va_end(va);
+	channel->socket = socket;
+	LIST_INIT(&channel->pending);
 	
-	return git_lfs_repo_send_response(mgr, REPO_CMD_ERROR, cookie, &err_resp, sizeof(err_resp), NULL);
+	channel->write_lock = os_mutex_create();
+	if(!channel->write_lock) goto error;
+	
+	channel->pending_lock = os_mutex_create();
+	if(!channel->pending_lock) goto error;
+
+	channel->reader = os_thread_create(repo_channel_reader_thread, channel);
+	if(!channel->reader) goto error;
+	
+	return channel;
+error:
+	repo_channel_free(channel);
+	return NULL;
 }
 
-static int handle_cmd_auth(struct repo_manager *mgr, uint32_t cookie, const struct git_lfs_config *config)
+struct repo_manager *repo_manager_create_client(const int *sockets, int num_sockets)
 {
-	struct repo_cmd_auth_request request;
-	struct repo_cmd_auth_response response;
+	struct repo_manager *mgr = calloc(1, sizeof *mgr);
+	if(!mgr) return NULL;
 	
-	memset(&request, 0, sizeof(request));
-	memset(&response, 0, sizeof(response));
-
-	if(socket_read_fully(mgr->socket, &request, sizeof(request)) != sizeof(request))
-	{
-		return -1;
-	}
+	mgr->socket = -1;
+	mgr->channels = calloc(num_sockets, sizeof(*mgr->channels));
+	if(!mgr->channels) goto error;
 	
-	// check for unterminated username/password
-	if(request.username[sizeof(request.username) - 1] != 0)
+	for(int i = 0; i < num_sockets; i++)
 	{
-		return -1;
+		mgr->channels[i] = repo_channel_create(sockets[i]);
+		if(!mgr->channels[i]) goto error;
+		mgr->num_channels++;
 	}
-	
-	if(request.password[sizeof(request.password) - 1] != 0)
-	{
+
+	return mgr;
+error:
+	repo_manager_free(mgr);
+	return NULL;
+}
+
+static int git_lfs_repo_transact(struct repo_manager *mgr,
+								 enum repo_cmd_type type,
+								 const char *access_token,
+								 const void *req_data, size_t req_size,
+								 void *resp_data, size_t resp_size,
+								 size_t *resp_received,
+								 int *fd,
+								 char *error_msg,
+								 size_t error_msg_buf_size)
+{
+	struct repo_channel *channel = mgr->channel;
+	uint64_t start = os_clock_us();
+	
+	if(error_msg && error_msg_buf_size > 0) {
+		*error_msg = 0;
+	}
+	
+	struct repo_cmd_header req_cmd;
+	memset(&req_cmd, 0, sizeof(req_cmd));
+	req_cmd.magic = REPO_CMD_MAGIC;
+	req_cmd.type = type;
+	req_cmd.size = req_size;
+	if(strlcpy(req_cmd.access_token, access_token, sizeof(req_cmd.access_token)) >= sizeof(req_cmd.access_token))
+	{
+		return -1;
+	}
+
+	struct repo_pending_request req;
+	memset(&req, 0, sizeof(req));
+	req.type = type;
+	req.status = -1;
+	req.resp_data = resp_data;
+	req.resp_size = resp_size;
+	req.fd = fd;
+	req.error_msg = error_msg;
+	req.error_msg_buf_size = error_msg_buf_size;
+	req.cond = os_cond_create();
+	if(!req.cond)
+	{
+		return -1;
+	}
+	
+	os_mutex_lock(channel->pending_lock);
+	if(channel->closed)
+	{
+		os_mutex_unlock(channel->pending_lock);
+		os_cond_destroy(req.cond);
+		return -1;
+	}
+	req.cookie = req_cmd.cookie = channel->next_cookie++;
+	LIST_INSERT_HEAD(&channel->pending, &req, entries);
+	__atomic_add_fetch(&channel->in_flight, 1, __ATOMIC_RELAXED);
+	os_mutex_unlock(channel->pending_lock);
+	
+	// sends the request
+	int sent = 0;
+	os_mutex_lock(channel->write_lock);
+	if(socket_write_fully(channel->socket, &req_cmd, sizeof(req_cmd)) == sizeof(req_cmd) &&
+	   (req_size == 0 || socket_write_fully(channel->socket, req_data, req_size) == req_size))
+	{
+		sent = 1;
+	}
+	os_mutex_unlock(channel->write_lock);
+	
+	// wait for the reader thread to hand over the response
+	os_mutex_lock(channel->pending_lock);
+	if(!sent && !req.done)
+	{
+		LIST_REMOVE(&req, entries);
+		req.done = 1;
+	}
+	while(!req.done)
+	{
+		os_cond_wait(req.cond, channel->pending_lock);
+	}
+	__atomic_sub_fetch(&channel->in_flight, 1, __ATOMIC_RELAXED);
+	os_mutex_unlock(channel->pending_lock);
+	
+	os_cond_destroy(req.cond);
+	
+	metrics_observe_ipc(type, os_clock_us() - start);
+	
+	if(!sent) return -1;
+	if(resp_received) *resp_received = req.resp_received;
+	
+	return req.status;
+}
+
+static int git_lfs_repo_send_request(struct repo_manager *mgr,
+									 enum repo_cmd_type type,
+									 const char *access_token,
+									 const void *req_data, size_t req_size,
+									 void *resp_data, size_t resp_size,
+									 int *fd,
+									 char *error_msg,
+									 size_t error_msg_buf_size)
+{
+	size_t received;
+	if(git_lfs_repo_transact(mgr, type, access_token,
+							 req_data, req_size,
+							 resp_data, resp_size, &received,
+							 fd, error_msg, error_msg_buf_size) < 0)
+	{
+		return -1;
+	}
+	
+	if(received != resp_size)
+	{
+		if(fd && received > 0) os_close(*fd);
+		return -1;
+	}
+	
+	return 0;
+}
+
+static int git_lfs_repo_send_response(struct repo_manager *mgr,
+									  enum repo_cmd_type type,
+									  uint32_t cookie,
+									  void *resp_data, size_t resp_size,
+									  int *fd)
+{
+	struct repo_cmd_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = REPO_CMD_MAGIC;
+	hdr.cookie = cookie;
+	hdr.type = type;
+	hdr.size = resp_size;
+
+	if(socket_write_fully(mgr->socket, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		return -1;
+	}
+	
+	if(fd) {
+		if(os_send_with_file_descriptor(mgr->socket, resp_data, resp_size, *fd) != resp_size) {
+			return -1;
+		}
+	} else if(resp_size > 0) {
+		if(socket_write_fully(mgr->socket, resp_data, resp_size) != resp_size) {
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+static int git_lfs_repo_send_error_response(struct repo_manager *mgr, uint32_t cookie, const char *msg, ...)
+{
+	struct repo_cmd_error_response err_resp;
+	memset(&err_resp, 0, sizeof(err_resp));
+	
+	va_list va;
+	va_start(va, msg);
+	vsnprintf(err_resp.message, sizeof(err_resp.message), msg, va);
+	va_end(va);
+	
+	return git_lfs_repo_send_response(mgr, REPO_CMD_ERROR, cookie, &err_resp, sizeof(err_resp), NULL);
+}
+
+static int handle_cmd_auth(struct repo_manager *mgr, uint32_t cookie, const struct git_lfs_config *config)
+{
+	struct repo_cmd_auth_request request;
+	struct repo_cmd_auth_response response;
+	
+	memset(&request, 0, sizeof(request));
+	memset(&response, 0, sizeof(response));
+
+	if(socket_read_fully(mgr->socket, &request, sizeof(request)) != sizeof(request))
+	{
+		return -1;
+	}
+	
+	// check for unterminated username/password
+	if(request.username[sizeof(request.username) - 1] != 0)
+	{
+		return -1;
+	}
+	
+	if(request.password[sizeof(request.password) - 1] != 0)
+	{
 		return -1;
 	}
 	
@@ -328,6 +839,11 @@ static int handle_cmd_auth(struct repo_manager *mgr, uint32_t cookie, const stru
 	{
 		git_lfs_cleanup_access_tokens();
 		struct git_lfs_access_token *token = git_lfs_add_access_token(repo, time(NULL) + 60);
+		if(!token)
+		{
+			git_lfs_repo_send_error_response(mgr, cookie, "Unable to create access token.");
+			return 0;
+		}
 		response.expire = token->expire;
 		strlcpy(response.access_token, token->token, sizeof(response.access_token));
 	}
@@ -362,18 +878,23 @@ static int handle_cmd_get_access_token(struct repo_manager *mgr, uint32_t cookie
 	
 	git_lfs_cleanup_access_tokens();
 	struct git_lfs_access_token *token = git_lfs_add_access_token(repo, time(NULL) + 60);
+	if(!token)
+	{
+		git_lfs_repo_send_error_response(mgr, cookie, "Unable to create access token.");
+		return 0;
+	}
 	response.expire = token->expire;
 	strlcpy(response.access_token, token->token, sizeof(response.access_token));
 	
 	return git_lfs_repo_send_response(mgr, REPO_CMD_GET_ACCESS_TOKEN, cookie, &response, sizeof(response), NULL);
 }
 
-static int handle_cmd_check_oid(struct repo_manager *mgr, uint32_t cookie, const char *path)
+static int handle_cmd_check_oid(struct repo_manager *mgr, uint32_t cookie, const struct git_lfs_repo *repo, const uint8_t *oid, const char *path)
 {
 	struct repo_cmd_check_oid_response resp;
 	memset(&resp, 0, sizeof(resp));
 	
-	resp.exist = os_file_exists(path);
+	resp.exist = object_index_may_exist(repo->object_index, oid) && os_file_exists(path);
 	if(git_lfs_repo_send_response(mgr, REPO_CMD_CHECK_OID_EXIST, cookie, &resp, sizeof(resp), NULL) < 0)
 	{
 		return -1;
@@ -382,6 +903,95 @@ static int handle_cmd_check_oid(struct repo_manager *mgr, uint32_t cookie, const
 	return 0;
 }
 
+static int handle_cmd_check_oids(struct repo_manager *mgr, const char *access_token, uint32_t cookie, uint32_t size, const struct git_lfs_config *config)
+{
+	struct repo_cmd_check_oids_request *request;
+	struct repo_cmd_check_oids_response *response = NULL;
+	int ret = -1;
+	
+	if(size < sizeof(*request) ||
+	   size > sizeof(*request) + CHECK_OIDS_LIMIT * sizeof(request->oids[0]))
+	{
+		return -1;
+	}
+	
+	request = malloc(size);
+	if(!request)
+	{
+		return -1;
+	}
+	
+	if(socket_read_fully(mgr->socket, request, size) != size)
+	{
+		goto error;
+	}
+	
+	int n = request->num_oids;
+	if(n < 0 || size != sizeof(*request) + n * sizeof(request->oids[0]))
+	{
+		goto error;
+	}
+	
+	struct git_lfs_repo *repo = find_repo_by_id(config, request->repo_id);
+	if(!repo)
+	{
+		ret = git_lfs_repo_send_error_response(mgr, cookie, "Invalid repo id.");
+		goto error;
+	}
+	
+	if(!git_lfs_verify_access_token(access_token, request->repo_id))
+	{
+		ret = git_lfs_repo_send_error_response(mgr, cookie, "Invalid access token.");
+		goto error;
+	}
+	
+	// <root>/<aa>/<rest of oid>, only the oid part changes per object
+	char path[PATH_MAX];
+	int root_len = snprintf(path, sizeof(path), "%s/", repo->root_dir);
+	if(root_len < 0 || root_len + 2 + 1 + 62 + 1 > sizeof(path))
+	{
+		ret = git_lfs_repo_send_error_response(mgr, cookie, "Unable to check objects. Path is too long.");
+		goto error;
+	}
+	
+	size_t response_size = sizeof(*response) + n * sizeof(response->sizes[0]);
+	response = calloc(1, response_size);
+	if(!response)
+	{
+		goto error;
+	}
+	
+	response->num_oids = n;
+	for(int i = 0; i < n; i++)
+	{
+		char oid_str[65];
+		oid_to_string(request->oids[i], oid_str);
+		
+		memcpy(path + root_len, oid_str, 2);
+		path[root_len + 2] = '/';
+		memcpy(path + root_len + 3, oid_str + 2, 63);
+		
+		// most objects of an upload batch are new, those are answered
+		// without going to the filesystem
+		long file_size;
+		if(object_index_may_exist(repo->object_index, request->oids[i]) &&
+		   os_file_get_size(path, &file_size) == 0)
+		{
+			response->sizes[i] = file_size;
+		}
+		else
+		{
+			response->sizes[i] = -1;
+		}
+	}
+	
+	ret = git_lfs_repo_send_response(mgr, REPO_CMD_CHECK_OIDS_EXIST, cookie, response, response_size, NULL);
+error:
+	free(response);
+	free(request);
+	return ret;
+}
+
 static int handle_cmd_get_oid(struct repo_manager *mgr, uint32_t cookie, const char *path, const char *oid_str)
 {
 	struct repo_cmd_get_oid_response resp;
@@ -427,9 +1037,10 @@ static int handle_cmd_put_oid(struct repo_manager *mgr,
 		return 0;
 	}
 	
+	// another repo manager may create it at the same time
 	if(!os_is_directory(tmp_dir))
 	{
-		if(os_mkdir(tmp_dir, 0700) < 0)
+		if(os_mkdir(tmp_dir, 0700) < 0 && !os_is_directory(tmp_dir))
 		{
 			git_lfs_repo_send_error_response(mgr, cookie, "Fail to create tmp directory. Repository root directory not accessible.");
 			return 0;
@@ -442,7 +1053,7 @@ static int handle_cmd_put_oid(struct repo_manager *mgr,
 		return -1;
 	}
 
-	upload->repo = repo;
+	upload->repo_id = repo->id;
 	upload->id = next_upload_id++;
 	upload->expire = time(NULL) + 7200;
 	memcpy(upload->oid, oid, sizeof(upload->oid));
@@ -475,6 +1086,31 @@ static int handle_cmd_put_oid(struct repo_manager *mgr,
 	return 0;
 }
 
+// builds the final path of an object, creating its directory if needed.
+// returns NULL on success or the reason it failed
+static const char *create_object_path(const struct git_lfs_repo *repo, const char *oid_str, char *path, size_t path_size)
+{
+	if(snprintf(path, path_size, "%s/%.2s/", repo->root_dir, oid_str) >= path_size)
+	{
+		return "Path too long.";
+	}
+	
+	if(!os_is_directory(path))
+	{
+		if(os_mkdir(path, 0700) < 0 && !os_is_directory(path))
+		{
+			return "Invalid path.";
+		}
+	}
+	
+	if(strlcat(path, oid_str + 2, path_size) >= path_size)
+	{
+		return "Path too long.";
+	}
+	
+	return NULL;
+}
+
 static int handle_cmd_commit(struct repo_manager *mgr, const char *access_token, uint32_t cookie, const struct git_lfs_config *config)
 {
 	struct repo_cmd_commit_request request;
@@ -495,97 +1131,708 @@ static int handle_cmd_commit(struct repo_manager *mgr, const char *access_token,
 
 	if(!upload)
 	{
-		git_lfs_repo_send_error_response(mgr, cookie, "Invalid upload ticket.");
-		return 0;
+		git_lfs_repo_send_error_response(mgr, cookie, "Invalid upload ticket.");
+		return 0;
+	}
+	
+	if(!git_lfs_verify_access_token(access_token, upload->repo_id))
+	{
+		git_lfs_repo_send_error_response(mgr, cookie, "Invalid access token.");
+		return 0;
+	}
+	
+	int ret = 0;
+	
+	char oid_str[65];
+	char dest_path[PATH_MAX];
+	
+	oid_to_string(upload->oid, oid_str);
+	
+	// the repo may have been removed by a reload since the upload started
+	const struct git_lfs_repo *repo = find_repo_by_id(config, upload->repo_id);
+	if(!repo)
+	{
+		git_lfs_repo_send_error_response(mgr, cookie, "Object %s could not be created. The repo no longer exists.", oid_str);
+		goto done;
+	}
+	
+	const char *path_error = create_object_path(repo, oid_str, dest_path, sizeof(dest_path));
+	if(path_error)
+	{
+		git_lfs_repo_send_error_response(mgr, cookie, "Object %s could not be created. %s", oid_str, path_error);
+		goto done;
+	}
+	
+	// The data was hashed as it was written, so there is no need to read it
+	// back here. The http process holds a writable descriptor to the tmp file
+	// anyway, so re-hashing would not protect against it either. A write that
+	// fell short still shows in the size though.
+	long tmp_size;
+	if(os_file_get_size(upload->tmp_path, &tmp_size) < 0 || tmp_size != request.size)
+	{
+		git_lfs_repo_send_error_response(mgr, cookie, "Object %s is incomplete. %lld of %lld bytes written.", oid_str, (long long)tmp_size, (long long)request.size);
+		goto done;
+	}
+	
+	if(repo->verify_uploads)
+	{
+		if(memcmp(upload->oid, request.sha256, SHA256_DIGEST_LENGTH) != 0)
+		{
+			char actual_hash_str[65];
+			oid_to_string(request.sha256, actual_hash_str);
+			git_lfs_repo_send_error_response(mgr, cookie, "Object %s failed verification. Unexpected hash %s.", oid_str, actual_hash_str);
+			goto done;
+		}
+	}
+	
+	if(os_rename(upload->tmp_path, dest_path) < 0)
+	{
+		git_lfs_repo_send_error_response(mgr, cookie, "Object %s failed rename.", oid_str);
+		goto done;
+	}
+	
+	object_index_add(repo->object_index, upload->oid);
+	
+	if(git_lfs_repo_send_response(mgr, REPO_CMD_COMMIT, cookie, NULL, 0, NULL) < 0)
+	{
+		ret = -1;
+		goto done;
+	}
+	
+done:
+	LIST_REMOVE(upload, entries);
+	os_unlink(upload->tmp_path);
+	free(upload);
+	
+	return ret;
+}
+
+// Multipart uploads keep their state on disk rather than in an upload_entry,
+// so that the parts can go through any repo manager and an interrupted
+// upload survives a restart.
+//
+//   <root>/tmp/multipart/<oid>.state          struct multipart_state, then one
+//                                             byte per part that is set once
+//                                             it is written
+//   <root>/tmp/multipart/<oid>.<part>.XXXXXX  a part being written, the http
+//                                             process only gets a descriptor
+//                                             to this file
+//   <root>/tmp/multipart/<oid>.<part>         a received part
+//
+// A received part is never replaced, so an uploader can't overwrite parts
+// another one sent. At commit the http process copies the parts into an
+// upload from git_lfs_repo_get_write_oid_fd, hashing them on the way, and
+// commits that like any other upload. The repo manager never reads them.
+
+#define MULTIPART_STATE_MAGIC 0x6d706172
+
+struct multipart_state
+{
+	uint32_t magic;
+	uint32_t num_parts;
+	int64_t size;
+	int64_t part_size;
+	int64_t updated_at;
+};
+
+struct multipart_paths
+{
+	char dir[PATH_MAX];
+	char prefix[PATH_MAX];
+	char state[PATH_MAX];
+};
+
+static int multipart_get_paths(const struct git_lfs_repo *repo, const uint8_t oid[32], struct multipart_paths *paths)
+{
+	char oid_str[65];
+	oid_to_string(oid, oid_str);
+	
+	if(snprintf(paths->dir, sizeof(paths->dir), "%s/tmp/multipart", repo->root_dir) >= sizeof(paths->dir) ||
+	   snprintf(paths->prefix, sizeof(paths->prefix), "%s/%s", paths->dir, oid_str) >= sizeof(paths->prefix) ||
+	   snprintf(paths->state, sizeof(paths->state), "%s.state", paths->prefix) >= sizeof(paths->state))
+	{
+		return -1;
+	}
+	
+	return 0;
+}
+
+// suffix is NULL for a received part, otherwise the end of its tmp file
+static int multipart_get_part_path(const struct multipart_paths *paths, uint32_t part, const char *suffix, char *path, size_t path_size)
+{
+	int len = suffix ? snprintf(path, path_size, "%s.%u.%s", paths->prefix, part, suffix) :
+					   snprintf(path, path_size, "%s.%u", paths->prefix, part);
+	
+	return len < 0 || len >= path_size ? -1 : 0;
+}
+
+// the suffix comes back from the http process, so it may only be what
+// os_mkstemp fills in
+static int multipart_is_valid_suffix(const char *suffix)
+{
+	for(int i = 0; i < MULTIPART_TMP_SUFFIX_SIZE - 1; i++)
+	{
+		if(!isalnum((unsigned char)suffix[i]))
+		{
+			return 0;
+		}
+	}
+	
+	return suffix[MULTIPART_TMP_SUFFIX_SIZE - 1] == 0;
+}
+
+// an empty object is uploaded as a single empty part
+static uint32_t multipart_num_part_files(const struct multipart_state *state)
+{
+	return state->num_parts > 0 ? state->num_parts : 1;
+}
+
+static int64_t multipart_part_length(const struct multipart_state *state, uint32_t part)
+{
+	int64_t remaining = state->size - (int64_t)part * state->part_size;
+	return remaining < state->part_size ? remaining : state->part_size;
+}
+
+// returns the state file descriptor, or -1 if there is no upload in progress
+static int multipart_open_state(const char *state_path, struct multipart_state *state)
+{
+	int fd = os_open_read_write(state_path);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	
+	if(os_pread(fd, state, sizeof(*state), 0) != sizeof(*state) ||
+	   state->magic != MULTIPART_STATE_MAGIC ||
+	   state->size < 0 ||
+	   state->part_size <= 0 ||
+	   state->num_parts != (state->size + state->part_size - 1) / state->part_size)
+	{
+		os_close(fd);
+		return -1;
+	}
+	
+	return fd;
+}
+
+// the state is written to a tmp file and linked into place, so other repo
+// managers never see a partial one. if two start the same upload the first
+// link wins and both continue with that one.
+static int multipart_create_state(const struct multipart_paths *paths, int64_t size, struct multipart_state *state)
+{
+	if(mkdir_recursive(paths->dir, 0700) < 0 && !os_is_directory(paths->dir))
+	{
+		return -1;
+	}
+	
+	char tmp_path[PATH_MAX];
+	if(snprintf(tmp_path, sizeof(tmp_path), "%s/XXXXXX", paths->dir) >= sizeof(tmp_path))
+	{
+		return -1;
+	}
+	
+	int fd = os_mkstemp(tmp_path);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	
+	struct multipart_state new_state;
+	memset(&new_state, 0, sizeof(new_state));
+	new_state.magic = MULTIPART_STATE_MAGIC;
+	new_state.size = size;
+	new_state.part_size = MULTIPART_PART_SIZE;
+	new_state.num_parts = (size + MULTIPART_PART_SIZE - 1) / MULTIPART_PART_SIZE;
+	new_state.updated_at = time(NULL);
+	
+	// the part flags are the zero filled tail of the file
+	int written = os_write(fd, &new_state, sizeof(new_state)) == sizeof(new_state) &&
+				  (new_state.num_parts == 0 ||
+				   os_pwrite(fd, "", 1, sizeof(new_state) + new_state.num_parts - 1) == 1);
+	os_close(fd);
+	
+	if(written)
+	{
+		os_link(tmp_path, paths->state);
+	}
+	os_unlink(tmp_path);
+	
+	return multipart_open_state(paths->state, state);
+}
+
+// removes the state first, so the upload is gone before its parts are
+static void multipart_remove(const char *state_path)
+{
+	char pattern[PATH_MAX];
+	size_t len = strlen(state_path) - (sizeof("state") - 1);
+	if(len + 2 > sizeof(pattern))
+	{
+		return;
+	}
+	memcpy(pattern, state_path, len);
+	memcpy(pattern + len, "*", 2);
+	
+	os_unlink(state_path);
+	
+	int num_files;
+	const char **files = os_glob(pattern, &num_files);
+	if(!files)
+	{
+		return;
+	}
+	
+	for(int i = 0; i < num_files; i++)
+	{
+		os_unlink(files[i]);
+	}
+	
+	free(files);
+}
+
+// returns the number of parts received, or -1 on error
+static int multipart_read_received(int state_fd, const struct multipart_state *state, uint8_t *received_bitmap)
+{
+	uint8_t flags[4096];
+	int num_received = 0;
+	
+	for(uint32_t start = 0; start < state->num_parts; start += sizeof(flags))
+	{
+		int n = state->num_parts - start < sizeof(flags) ? state->num_parts - start : sizeof(flags);
+		if(os_pread(state_fd, flags, n, sizeof(*state) + start) != n)
+		{
+			return -1;
+		}
+		
+		for(int i = 0; i < n; i++)
+		{
+			if(!flags[i]) continue;
+			
+			if(received_bitmap)
+			{
+				received_bitmap[(start + i) >> 3] |= 1 << ((start + i) & 7);
+			}
+			num_received++;
+		}
+	}
+	
+	return num_received;
+}
+
+// parts must be aligned and cover a whole part, except the last one which
+// runs to the end of the object
+static int multipart_get_part_index(const struct multipart_state *state, const struct repo_cmd_part_request *request, uint32_t *part)
+{
+	if(request->size != state->size)
+	{
+		return -1;
+	}
+	
+	if(state->size == 0)
+	{
+		*part = 0;
+		return request->offset == 0 && request->length == 0 ? 0 : -1;
+	}
+	
+	if(request->offset < 0 ||
+	   request->offset >= state->size ||
+	   request->offset % state->part_size != 0)
+	{
+		return -1;
+	}
+	
+	*part = request->offset / state->part_size;
+	return request->length == multipart_part_length(state, *part) ? 0 : -1;
+}
+
+// reads a request that starts with repo_id and oid, and checks them
+static int multipart_read_request(struct repo_manager *mgr,
+								  const char *access_token,
+								  uint32_t cookie,
+								  const struct git_lfs_config *config,
+								  void *request,
+								  size_t request_size,
+								  struct git_lfs_repo **repo,
+								  struct multipart_paths *paths)
+{
+	if(socket_read_fully(mgr->socket, request, request_size) != request_size)
+	{
+		return -1;
+	}
+	
+	const struct repo_oid_cmd_data *data = request;
+	
+	*repo = find_repo_by_id(config, data->repo_id);
+	if(!*repo)
+	{
+		git_lfs_repo_send_error_response(mgr, cookie, "Invalid repo id.");
+		return 0;
+	}
+	
+	if(!git_lfs_verify_access_token(access_token, data->repo_id))
+	{
+		git_lfs_repo_send_error_response(mgr, cookie, "Invalid access token.");
+		return 0;
+	}
+	
+	if(multipart_get_paths(*repo, data->oid, paths) < 0)
+	{
+		git_lfs_repo_send_error_response(mgr, cookie, "Unable to upload object. Path is too long.");
+		return 0;
+	}
+	
+	return 1;
+}
+
+static int handle_cmd_put_part(struct repo_manager *mgr, const char *access_token, uint32_t cookie, const struct git_lfs_config *config)
+{
+	struct repo_cmd_part_request request;
+	struct git_lfs_repo *repo;
+	struct multipart_paths paths;
+	int ret = multipart_read_request(mgr, access_token, cookie, config, &request, sizeof(request), &repo, &paths);
+	if(ret <= 0)
+	{
+		return ret;
+	}
+	
+	if(request.size < 0 || request.size > (int64_t)MULTIPART_PART_SIZE * MULTIPART_MAX_PARTS)
+	{
+		return git_lfs_repo_send_error_response(mgr, cookie, "Object is too large for a multipart upload.");
+	}
+	
+	struct multipart_state state;
+	int state_fd = multipart_open_state(paths.state, &state);
+	
+	// a size that doesn't match is someone's mistake, and only the oid can
+	// tell whose. an upload that is still receiving parts is kept, but a
+	// stale one is replaced rather than holding the oid until it expires.
+	// parts handed out count as activity, so none of its tmp parts are live.
+	if(state_fd >= 0 && state.size != request.size && time(NULL) > state.updated_at + MULTIPART_STALE)
+	{
+		os_close(state_fd);
+		multipart_remove(paths.state);
+		state_fd = -1;
+	}
+	
+	if(state_fd < 0)
+	{
+		state_fd = multipart_create_state(&paths, request.size, &state);
+		if(state_fd < 0)
+		{
+			return git_lfs_repo_send_error_response(mgr, cookie, "Failed to start the upload. Repository root directory not accessible.");
+		}
+	}
+	
+	struct repo_cmd_put_part_response response;
+	memset(&response, 0, sizeof(response));
+	
+	if(state.size != request.size)
+	{
+		os_close(state_fd);
+		return git_lfs_repo_send_error_response(mgr, cookie, "Object size %lld does not match the upload in progress (%lld).", (long long)request.size, (long long)state.size);
+	}
+	
+	if(multipart_get_part_index(&state, &request, &response.part) < 0)
+	{
+		os_close(state_fd);
+		return git_lfs_repo_send_error_response(mgr, cookie, "Invalid part. Parts start at a multiple of %lld bytes and are that long.", (long long)state.part_size);
+	}
+	
+	char tmp_path[PATH_MAX];
+	if(multipart_get_part_path(&paths, response.part, "XXXXXX", tmp_path, sizeof(tmp_path)) < 0)
+	{
+		os_close(state_fd);
+		return git_lfs_repo_send_error_response(mgr, cookie, "Unable to upload object. Path is too long.");
+	}
+	
+	int64_t now = time(NULL);
+	if(os_pwrite(state_fd, &now, sizeof(now), offsetof(struct multipart_state, updated_at)) != sizeof(now))
+	{
+		os_close(state_fd);
+		return git_lfs_repo_send_error_response(mgr, cookie, "Failed to record part %u.", response.part);
+	}
+	os_close(state_fd);
+	
+	int fd = os_mkstemp(tmp_path);
+	if(fd < 0)
+	{
+		return git_lfs_repo_send_error_response(mgr, cookie, "Failed to open the upload.");
+	}
+	
+	memcpy(response.tmp_suffix, tmp_path + strlen(tmp_path) - (MULTIPART_TMP_SUFFIX_SIZE - 1), MULTIPART_TMP_SUFFIX_SIZE - 1);
+	
+	ret = git_lfs_repo_send_response(mgr, REPO_CMD_PUT_PART, cookie, &response, sizeof(response), &fd);
+	os_close(fd);
+	
+	return ret;
+}
+
+static int handle_cmd_commit_part(struct repo_manager *mgr, const char *access_token, uint32_t cookie, const struct git_lfs_config *config)
+{
+	struct repo_cmd_commit_part_request request;
+	struct git_lfs_repo *repo;
+	struct multipart_paths paths;
+	int ret = multipart_read_request(mgr, access_token, cookie, config, &request, sizeof(request), &repo, &paths);
+	if(ret <= 0)
+	{
+		return ret;
+	}
+	
+	struct multipart_state state;
+	int state_fd = multipart_open_state(paths.state, &state);
+	if(state_fd < 0)
+	{
+		return git_lfs_repo_send_error_response(mgr, cookie, "No upload in progress.");
+	}
+	
+	uint32_t part;
+	char tmp_path[PATH_MAX];
+	char part_path[PATH_MAX];
+	if(multipart_get_part_index(&state, &request.part, &part) < 0 ||
+	   !multipart_is_valid_suffix(request.tmp_suffix) ||
+	   multipart_get_part_path(&paths, part, request.tmp_suffix, tmp_path, sizeof(tmp_path)) < 0 ||
+	   multipart_get_part_path(&paths, part, NULL, part_path, sizeof(part_path)) < 0)
+	{
+		os_close(state_fd);
+		return git_lfs_repo_send_error_response(mgr, cookie, "Invalid part.");
+	}
+	
+	long tmp_size;
+	if(os_file_get_size(tmp_path, &tmp_size) < 0 || tmp_size != request.part.length)
+	{
+		os_close(state_fd);
+		os_unlink(tmp_path);
+		return git_lfs_repo_send_error_response(mgr, cookie, "Part %u is incomplete.", part);
+	}
+	
+	// if the part was already received the first one is kept
+	if(os_link(tmp_path, part_path) < 0 && !os_file_exists(part_path))
+	{
+		os_close(state_fd);
+		os_unlink(tmp_path);
+		return git_lfs_repo_send_error_response(mgr, cookie, "Failed to record part %u.", part);
+	}
+	os_unlink(tmp_path);
+	
+	int64_t now = time(NULL);
+	if((state.num_parts > 0 && os_pwrite(state_fd, "\1", 1, sizeof(state) + part) != 1) ||
+	   os_pwrite(state_fd, &now, sizeof(now), offsetof(struct multipart_state, updated_at)) != sizeof(now))
+	{
+		os_close(state_fd);
+		return git_lfs_repo_send_error_response(mgr, cookie, "Failed to record part %u.", part);
+	}
+	os_close(state_fd);
+	
+	return git_lfs_repo_send_response(mgr, REPO_CMD_COMMIT_PART, cookie, NULL, 0, NULL);
+}
+
+static int handle_cmd_get_parts_status(struct repo_manager *mgr, const char *access_token, uint32_t cookie, const struct git_lfs_config *config)
+{
+	struct repo_oid_cmd_data request;
+	struct git_lfs_repo *repo;
+	struct multipart_paths paths;
+	int ret = multipart_read_request(mgr, access_token, cookie, config, &request, sizeof(request), &repo, &paths);
+	if(ret <= 0)
+	{
+		return ret;
+	}
+	
+	struct multipart_state state;
+	int state_fd = multipart_open_state(paths.state, &state);
+	if(state_fd < 0)
+	{
+		// nothing uploaded yet
+		memset(&state, 0, sizeof(state));
+		state.part_size = MULTIPART_PART_SIZE;
+	}
+	
+	struct repo_cmd_parts_status_response *response;
+	size_t response_size = sizeof(*response) + (state.num_parts + 7) / 8;
+	response = calloc(1, response_size);
+	if(!response)
+	{
+		if(state_fd >= 0) os_close(state_fd);
+		return -1;
+	}
+	
+	response->size = state.size;
+	response->part_size = state.part_size;
+	response->num_parts = state.num_parts;
+	
+	if(state_fd >= 0)
+	{
+		int num_received = multipart_read_received(state_fd, &state, response->received);
+		os_close(state_fd);
+		
+		if(num_received < 0)
+		{
+			free(response);
+			return git_lfs_repo_send_error_response(mgr, cookie, "Failed to read the upload state.");
+		}
+	}
+	
+	ret = git_lfs_repo_send_response(mgr, REPO_CMD_GET_PARTS_STATUS, cookie, response, response_size, NULL);
+	free(response);
+	
+	return ret;
+}
+
+static int handle_cmd_get_part_fd(struct repo_manager *mgr, const char *access_token, uint32_t cookie, const struct git_lfs_config *config)
+{
+	struct repo_cmd_get_part_fd_request request;
+	struct git_lfs_repo *repo;
+	struct multipart_paths paths;
+	int ret = multipart_read_request(mgr, access_token, cookie, config, &request, sizeof(request), &repo, &paths);
+	if(ret <= 0)
+	{
+		return ret;
 	}
 	
-	if(!git_lfs_verify_access_token(access_token, upload->repo->id))
+	struct multipart_state state;
+	int state_fd = multipart_open_state(paths.state, &state);
+	if(state_fd < 0)
 	{
-		git_lfs_repo_send_error_response(mgr, cookie, "Invalid access token.");
-		return 0;
+		return git_lfs_repo_send_error_response(mgr, cookie, "No upload in progress.");
 	}
 	
-	int ret = 0;
-	
-	char oid_str[65];
-	char dest_path[PATH_MAX];
+	int num_received = multipart_read_received(state_fd, &state, NULL);
+	os_close(state_fd);
 	
-	oid_to_string(upload->oid, oid_str);
+	if(num_received != state.num_parts)
+	{
+		return git_lfs_repo_send_error_response(mgr, cookie, "Upload is incomplete. %d of %u parts received.", num_received, state.num_parts);
+	}
 	
-	if(snprintf(dest_path, sizeof(dest_path), "%s/%.2s/", upload->repo->root_dir, oid_str) >= sizeof(dest_path))
+	char part_path[PATH_MAX];
+	if(request.part >= multipart_num_part_files(&state) ||
+	   multipart_get_part_path(&paths, request.part, NULL, part_path, sizeof(part_path)) < 0)
 	{
-		git_lfs_repo_send_error_response(mgr, cookie, "Object %s could not be created. Path too long.", oid_str);
-		goto done;
+		return git_lfs_repo_send_error_response(mgr, cookie, "Invalid part.");
 	}
 	
-	if(!os_is_directory(dest_path))
+	struct repo_cmd_get_part_fd_response response;
+	memset(&response, 0, sizeof(response));
+	response.length = multipart_part_length(&state, request.part);
+	response.num_parts = multipart_num_part_files(&state);
+	
+	int fd = os_open_read(part_path);
+	if(fd < 0)
 	{
-		if(os_mkdir(dest_path, 0700) < 0)
-		{
-			git_lfs_repo_send_error_response(mgr, cookie, "Object %s could not be created. Invalid path.", oid_str);
-			goto done;
-		}
+		return git_lfs_repo_send_error_response(mgr, cookie, "Failed to open part %u.", request.part);
 	}
 	
-	if(strlcat(dest_path, oid_str + 2, sizeof(dest_path)) >= sizeof(dest_path))
+	ret = git_lfs_repo_send_response(mgr, REPO_CMD_GET_PART_FD, cookie, &response, sizeof(response), &fd);
+	os_close(fd);
+	
+	return ret;
+}
+
+// the http process assembled the parts into an upload and committed it,
+// or found that they don't hash to the oid
+static int handle_cmd_remove_parts(struct repo_manager *mgr, const char *access_token, uint32_t cookie, const struct git_lfs_config *config)
+{
+	struct repo_oid_cmd_data request;
+	struct git_lfs_repo *repo;
+	struct multipart_paths paths;
+	int ret = multipart_read_request(mgr, access_token, cookie, config, &request, sizeof(request), &repo, &paths);
+	if(ret <= 0)
 	{
-		git_lfs_repo_send_error_response(mgr, cookie, "Object %s could not be created. Path too long.", oid_str);
-		goto done;
+		return ret;
 	}
 	
-	if(upload->repo->verify_uploads)
+	multipart_remove(paths.state);
+	
+	return git_lfs_repo_send_response(mgr, REPO_CMD_REMOVE_PARTS, cookie, NULL, 0, NULL);
+}
+
+// removes multipart uploads that have not received a part for a while
+static void multipart_cleanup(const struct git_lfs_config *config)
+{
+	const struct git_lfs_repo *repo;
+	time_t now = time(NULL);
+	
+	SLIST_FOREACH(repo, &config->repos, entries)
 	{
-		int fd = os_open_read(upload->tmp_path);
-		int n;
-		char buffer[4096];
-		if(fd < 0)
-		{
-			git_lfs_repo_send_error_response(mgr, cookie, "Unable to open written file for object %s.", oid_str);
-			goto done;
-		}
-		
-		SHA256_CTX ctx;
-		SHA256_Init(&ctx);
-		while((n = os_read(fd, buffer, sizeof(buffer))) > 0)
+		char pattern[PATH_MAX];
+		if(snprintf(pattern, sizeof(pattern), "%s/tmp/multipart/*.state", repo->root_dir) >= sizeof(pattern))
 		{
-			SHA256_Update(&ctx, buffer, n);
+			continue;
 		}
-		os_close(fd);
 		
-		unsigned char sha256[SHA256_DIGEST_LENGTH];
-		SHA256_Final(sha256, &ctx);
+		int num_files;
+		const char **files = os_glob(pattern, &num_files);
+		if(!files) continue;
 		
-		if(memcmp(upload->oid, sha256, SHA256_DIGEST_LENGTH) != 0)
+		for(int i = 0; i < num_files; i++)
 		{
-			char actual_hash_str[65];
-			oid_to_string(sha256, actual_hash_str);
-			git_lfs_repo_send_error_response(mgr, cookie, "Object %s failed verification. Unexpected hash %s.", oid_str, actual_hash_str);
-			goto done;
+			struct multipart_state state;
+			int fd = multipart_open_state(files[i], &state);
+			if(fd < 0) continue;
+			os_close(fd);
+			
+			if(now <= state.updated_at + MULTIPART_EXPIRE) continue;
+			
+			multipart_remove(files[i]);
 		}
+		
+		free(files);
 	}
+}
+
+// Each repo manager keeps one connection per repo's lock database open for
+// its lifetime, with the statements prepared once. WAL lets the other repo
+// managers read while one of them writes.
+
+enum locks_stmt
+{
+	LOCKS_STMT_SELECT_BY_PATH,
+	LOCKS_STMT_SELECT_BY_ID,
+	LOCKS_STMT_INSERT,
+	LOCKS_STMT_DELETE,
+	LOCKS_STMT_DELETE_OWNED,
+	LOCKS_STMT_LIST,
+	LOCKS_STMT_LIST_BY_PATH,
+	LOCKS_STMT_LIST_BY_ID,
+	LOCKS_STMT_LIST_BY_PATH_AND_ID,
+	LOCKS_STMT_COUNT
+};
+
+static const char * const locks_stmt_sql[LOCKS_STMT_COUNT] =
+{
+	[LOCKS_STMT_SELECT_BY_PATH] = "SELECT id, path, locked_at, owner FROM locks WHERE path=?",
+	[LOCKS_STMT_SELECT_BY_ID] = "SELECT id, path, locked_at, owner FROM locks WHERE id=?",
+	[LOCKS_STMT_INSERT] = "INSERT INTO locks VALUES(NULL,?,?,?)",
+	[LOCKS_STMT_DELETE] = "DELETE FROM locks WHERE id=?",
+	[LOCKS_STMT_DELETE_OWNED] = "DELETE FROM locks WHERE id=? AND owner=?",
+	// pages continue after the last id of the previous one, which is a
+	// single seek on the primary key however deep into the list it is
+	[LOCKS_STMT_LIST] = "SELECT id, path, locked_at, owner FROM locks WHERE id>? ORDER BY id LIMIT ?",
+	[LOCKS_STMT_LIST_BY_PATH] = "SELECT id, path, locked_at, owner FROM locks WHERE path=? AND id>? ORDER BY id LIMIT ?",
+	[LOCKS_STMT_LIST_BY_ID] = "SELECT id, path, locked_at, owner FROM locks WHERE id=? AND id>? ORDER BY id LIMIT ?",
+	[LOCKS_STMT_LIST_BY_PATH_AND_ID] = "SELECT id, path, locked_at, owner FROM locks WHERE path=? AND id=? AND id>? ORDER BY id LIMIT ?"
+};
+
+struct locks_db
+{
+	LIST_ENTRY(locks_db) entries;
 	
-	if(os_rename(upload->tmp_path, dest_path) < 0)
-	{
-		git_lfs_repo_send_error_response(mgr, cookie, "Object %s failed rename.", oid_str);
-		goto done;
-	}
-	
-	if(git_lfs_repo_send_response(mgr, REPO_CMD_COMMIT, cookie, NULL, 0, NULL) < 0)
+	const struct git_lfs_repo *repo;
+	sqlite3 *db;
+	sqlite3_stmt *stmts[LOCKS_STMT_COUNT];
+};
+
+static LIST_HEAD(locks_db_list, locks_db) locks_db_list;
+
+static struct locks_db *open_or_create_locks_db(const struct git_lfs_repo *repo)
+{
+	struct locks_db *locks_db;
+	LIST_FOREACH(locks_db, &locks_db_list, entries)
 	{
-		ret = -1;
-		goto done;
+		if(locks_db->repo == repo)
+		{
+			return locks_db;
+		}
 	}
 	
-done:
-	LIST_REMOVE(upload, entries);
-	os_unlink(upload->tmp_path);
-	free(upload);
-	
-	return ret;
-}
-
-static sqlite3 *open_or_create_locks_db(struct git_lfs_repo *repo)
-{
 	char locks_path[1024];
 	
 	if(snprintf(locks_path, sizeof(locks_path), "%s/locks/", repo->root_dir) >= sizeof(locks_path))
@@ -595,7 +1842,7 @@ static sqlite3 *open_or_create_locks_db(struct git_lfs_repo *repo)
 	
 	if(!os_is_directory(locks_path))
 	{
-		if(os_mkdir(locks_path, 0700) < 0)
+		if(os_mkdir(locks_path, 0700) < 0 && !os_is_directory(locks_path))
 		{
 			return NULL;
 		}
@@ -606,29 +1853,92 @@ static sqlite3 *open_or_create_locks_db(struct git_lfs_repo *repo)
 		return NULL;
 	}
 	
-	int should_create = !os_file_exists(locks_path);
 	sqlite3 *db;
 	if(SQLITE_OK != sqlite3_open(locks_path, &db))
 	{
 		goto error;
 	}
+	
+	// other repo manager processes may hold the database
+	sqlite3_busy_timeout(db, 5000);
 
-	if(should_create)
+	char *err_msg;
+	if(SQLITE_OK != sqlite3_exec(db,
+								 "PRAGMA journal_mode=WAL;"
+								 "PRAGMA synchronous=NORMAL;"
+								 "PRAGMA temp_store=MEMORY;"
+								 "CREATE TABLE IF NOT EXISTS locks (id INTEGER PRIMARY KEY, path VARCHAR(1024) UNIQUE, locked_at INTEGER, owner VARCHAR(64))",
+								 NULL, NULL, &err_msg))
 	{
-		char *err_msg;
-		if(SQLITE_OK != sqlite3_exec(db, "CREATE TABLE locks (id INTEGER PRIMARY KEY, path VARCHAR(1024) UNIQUE, locked_at INTEGER, owner VARCHAR(64))", NULL, NULL, &err_msg))
-		{
-			fprintf(stderr, "sql create db error: %s\n", err_msg);
-			sqlite3_free(err_msg);
-		}
+		fprintf(stderr, "sql create db error: %s\n", err_msg);
+		sqlite3_free(err_msg);
+		goto error;
+	}
+	
+	locks_db = calloc(1, sizeof *locks_db);
+	if(!locks_db)
+	{
+		goto error;
 	}
+	
+	locks_db->repo = repo;
+	locks_db->db = db;
+	LIST_INSERT_HEAD(&locks_db_list, locks_db, entries);
 
-	return db;
+	return locks_db;
 error:
 	sqlite3_close(db);
 	return NULL;
 }
 
+static void close_locks_dbs()
+{
+	struct locks_db *locks_db, *tmp;
+	LIST_FOREACH_SAFE(locks_db, &locks_db_list, entries, tmp)
+	{
+		LIST_REMOVE(locks_db, entries);
+		for(int i = 0; i < LOCKS_STMT_COUNT; i++)
+		{
+			sqlite3_finalize(locks_db->stmts[i]);
+		}
+		sqlite3_close(locks_db->db);
+		free(locks_db);
+	}
+}
+
+// returns a prepared statement ready to be bound. it must be reset once
+// done with, otherwise it keeps a read transaction open.
+static sqlite3_stmt *locks_db_get_stmt(struct locks_db *locks_db, enum locks_stmt which)
+{
+	if(!locks_db->stmts[which])
+	{
+		if(SQLITE_OK != sqlite3_prepare_v2(locks_db->db, locks_stmt_sql[which], -1, &locks_db->stmts[which], NULL))
+		{
+			fprintf(stderr, "sql prepare error: %s\n", sqlite3_errmsg(locks_db->db));
+			return NULL;
+		}
+	}
+	
+	sqlite3_clear_bindings(locks_db->stmts[which]);
+	return locks_db->stmts[which];
+}
+
+static int locks_db_read_lock(sqlite3_stmt *stmt, struct repo_lock_info *lock)
+{
+	lock->id = sqlite3_column_int64(stmt, 0);
+	if(strlcpy(lock->path, (const char *)sqlite3_column_text(stmt, 1), sizeof(lock->path)) >= sizeof(lock->path))
+	{
+		return -1;
+	}
+	lock->locked_at = sqlite3_column_int(stmt, 2);
+	if(strlcpy(lock->username, (const char *)sqlite3_column_text(stmt, 3), sizeof(lock->username)) >= sizeof(lock->username))
+	{
+		return -1;
+	}
+	
+	return 0;
+}
+
 static int handle_cmd_create_lock(struct repo_manager *mgr, const char *access_token, uint32_t cookie, const struct git_lfs_config *config)
 {
 	struct repo_cmd_create_lock_request request;
@@ -671,17 +1981,16 @@ static int handle_cmd_create_lock(struct repo_manager *mgr, const char *access_t
 		return 0;
 	}
 
-	sqlite3 *db = open_or_create_locks_db(repo);
-	if(!db)
+	struct locks_db *locks_db = open_or_create_locks_db(repo);
+	if(!locks_db)
 	{
 		git_lfs_repo_send_error_response(mgr, cookie, "Unable to open locks database.");
 		return 0;
 	}
 
-	sqlite3_stmt *stmt;
 	// check if lock exists already
-
-	if(SQLITE_OK != sqlite3_prepare_v2(db, "SELECT id, path, locked_at, owner FROM locks WHERE path=?", -1, &stmt, NULL))
+	sqlite3_stmt *stmt = locks_db_get_stmt(locks_db, LOCKS_STMT_SELECT_BY_PATH);
+	if(!stmt)
 	{
 		goto error0;
 	}
@@ -693,13 +2002,7 @@ static int handle_cmd_create_lock(struct repo_manager *mgr, const char *access_t
 		// send lock exists response
 		response.successful = 0;
 		
-		response.lock.id = sqlite3_column_int64(stmt, 0);
-		if(strlcpy(response.lock.path, (const char *)sqlite3_column_text(stmt, 1), sizeof(response.lock.path)) >= sizeof(response.lock.path))
-		{
-			goto error1;
-		}
-		response.lock.locked_at = sqlite3_column_int(stmt, 2);
-		if(strlcpy(response.lock.username, (const char *)sqlite3_column_text(stmt, 3), sizeof(response.lock.username)) >= sizeof(response.lock.username))
+		if(locks_db_read_lock(stmt, &response.lock) < 0)
 		{
 			goto error1;
 		}
@@ -712,11 +2015,12 @@ static int handle_cmd_create_lock(struct repo_manager *mgr, const char *access_t
 		ret = 0;
 		goto error1;
 	}
-	sqlite3_finalize(stmt);
+	sqlite3_reset(stmt);
 	
-	if(SQLITE_OK != sqlite3_prepare_v2(db, "INSERT INTO locks VALUES(NULL,?,?,?)", -1, &stmt, NULL))
+	stmt = locks_db_get_stmt(locks_db, LOCKS_STMT_INSERT);
+	if(!stmt)
 	{
-		goto error1;
+		goto error0;
 	}
 
 	if(strlcpy(response.lock.path, request.path, sizeof(response.lock.path)) >= sizeof(response.lock.path))
@@ -740,9 +2044,9 @@ static int handle_cmd_create_lock(struct repo_manager *mgr, const char *access_t
 		goto error1;
 	}
 
-	response.lock.id = sqlite3_last_insert_rowid(db);
+	response.lock.id = sqlite3_last_insert_rowid(locks_db->db);
 
-	response.successful = sqlite3_changes(db) == 1;
+	response.successful = sqlite3_changes(locks_db->db) == 1;
 	
 	if(git_lfs_repo_send_response(mgr, REPO_CMD_CREATE_LOCK,  cookie, &response, sizeof(response), NULL) < 0)
 	{
@@ -751,10 +2055,8 @@ static int handle_cmd_create_lock(struct repo_manager *mgr, const char *access_t
 
 	ret = 0;
 error1:
-	sqlite3_finalize(stmt);
+	sqlite3_reset(stmt);
 error0:
-	sqlite3_close(db);
-
 	return ret;
 }
 
@@ -803,56 +2105,20 @@ static int handle_list_locks(struct repo_manager *mgr, const char *access_token,
 		return 0;
 	}
 	
-	sqlite3 *db = open_or_create_locks_db(repo);
-	if(!db)
+	struct locks_db *locks_db = open_or_create_locks_db(repo);
+	if(!locks_db)
 	{
 		git_lfs_repo_send_error_response(mgr, cookie, "Unable to open locks database.");
-		goto error0;
+		return 0;
 	}
 
-	char filter_query[512];
-	char query[1024];
-	
-	filter_query[0] = 0;
-	if(request.path[0] || request.id >= 0)
-	{
-		if(strlcpy(filter_query, "WHERE ", sizeof(filter_query)) >= sizeof(filter_query))
-		{
-			goto error0;
-		}
-	}
-	
-	if(request.path[0])
-	{
-		if(strlcat(filter_query, "path=?", sizeof(filter_query)) >= sizeof(filter_query))
-		{
-			goto error0;
-		}
-	}
-	
-	if(request.id >= 0)
-	{
-		if(request.path[0])
-		{
-			if(strlcat(filter_query, " AND ", sizeof(filter_query)) >= sizeof(filter_query))
-			{
-				goto error0;
-			}
-		}
-		if(strlcat(filter_query, "id=?", sizeof(filter_query)) >= sizeof(filter_query))
-		{
-			goto error0;
-		}
-	}
-	
-	if(snprintf(query, sizeof(query), "SELECT id, path, locked_at, owner FROM locks %s LIMIT %d,%d",
-			 filter_query, request.cursor, request.limit) >= sizeof(query))
-	{
-		goto error0;
-	}
+	enum locks_stmt which = LOCKS_STMT_LIST;
+	if(request.path[0] && request.id >= 0) which = LOCKS_STMT_LIST_BY_PATH_AND_ID;
+	else if(request.path[0]) which = LOCKS_STMT_LIST_BY_PATH;
+	else if(request.id >= 0) which = LOCKS_STMT_LIST_BY_ID;
 	
-	sqlite3_stmt *stmt;
-	if(SQLITE_OK != sqlite3_prepare_v2(db, query, -1, &stmt, NULL))
+	sqlite3_stmt *stmt = locks_db_get_stmt(locks_db, which);
+	if(!stmt)
 	{
 		goto error0;
 	}
@@ -874,48 +2140,57 @@ static int handle_list_locks(struct repo_manager *mgr, const char *access_token,
 		}
 	}
 	
-	struct repo_cmd_list_locks_response *response = calloc(1, sizeof *response + LIST_LOCKS_LIMIT * sizeof(response->locks[0]));
+	// one extra row tells whether there is a next page
+	if(SQLITE_OK != sqlite3_bind_int64(stmt, bind_index++, request.cursor) ||
+	   SQLITE_OK != sqlite3_bind_int(stmt, bind_index++, request.limit + 1))
+	{
+		goto error1;
+	}
+	
+	struct repo_cmd_list_locks_response *response = calloc(1, sizeof *response + request.limit * REPO_LOCK_RECORD_MAX_SIZE);
 	if(!response)
 	{
 		goto error1;
 	}
 
+	size_t response_size = sizeof(*response);
 	int row_count = 0;
+	int64_t last_id = 0;
 	while(SQLITE_ROW == sqlite3_step(stmt))
 	{
-		if(row_count >= LIST_LOCKS_LIMIT)
-		{
-			goto error2; // should not happen, in theory
-		}
-
-		struct repo_lock_info *lock = &response->locks[row_count];
-		lock->id = sqlite3_column_int64(stmt, 0);
-		if(strlcpy(lock->path, (const char *)sqlite3_column_text(stmt, 1), sizeof(lock->path)) >= sizeof(lock->path))
+		if(row_count == request.limit)
 		{
-			goto error2;
+			response->next_cursor = last_id;
+			break;
 		}
-		lock->locked_at = sqlite3_column_int(stmt, 2);
-		if(strlcpy(lock->username, (const char *)sqlite3_column_text(stmt, 3), sizeof(lock->username)) >= sizeof(lock->username))
+		
+		const char *path = (const char *)sqlite3_column_text(stmt, 1);
+		const char *username = (const char *)sqlite3_column_text(stmt, 3);
+		size_t path_len = path ? strlen(path) : 0;
+		size_t username_len = username ? strlen(username) : 0;
+		
+		if(path_len >= sizeof(((struct repo_lock_info *)0)->path) ||
+		   username_len >= sizeof(((struct repo_lock_info *)0)->username))
 		{
 			goto error2;
 		}
+		
+		struct repo_lock_record *record = (struct repo_lock_record *)((uint8_t *)response + response_size);
+		record->id = sqlite3_column_int64(stmt, 0);
+		record->locked_at = sqlite3_column_int64(stmt, 2);
+		record->path_len = path_len;
+		record->username_len = username_len;
+		memcpy(record->strings, path, path_len);
+		memcpy(record->strings + path_len + 1, username, username_len);
+		
+		response_size += REPO_LOCK_RECORD_SIZE(path_len, username_len);
+		last_id = record->id;
 		row_count++;
 	}
 	
 	response->num_locks = row_count;
-	response->next_cursor = 0;
-	if(row_count >= request.limit)
-	{
-		response->next_cursor = request.cursor + row_count;
-	}
 
-	if(git_lfs_repo_send_response(mgr, REPO_CMD_LIST_LOCKS, cookie, response, sizeof(*response), NULL) < 0)
-	{
-		goto error2;
-	}
-	
-	int extra_data_size = response->num_locks * sizeof(response->locks[0]);
-	if(socket_write_fully(mgr->socket, response->locks, extra_data_size) != extra_data_size)
+	if(git_lfs_repo_send_response(mgr, REPO_CMD_LIST_LOCKS, cookie, response, response_size, NULL) < 0)
 	{
 		goto error2;
 	}
@@ -924,10 +2199,8 @@ static int handle_list_locks(struct repo_manager *mgr, const char *access_token,
 error2:
 	free(response);
 error1:
-	sqlite3_finalize(stmt);
+	sqlite3_reset(stmt);
 error0:
-	sqlite3_close(db);
-
 	return ret;
 }
 
@@ -959,19 +2232,19 @@ static int handle_delete_lock(struct repo_manager *mgr, const char *access_token
 		return 0;
 	}
 	
-	sqlite3 *db = open_or_create_locks_db(repo);
-	if(!db)
+	struct locks_db *locks_db = open_or_create_locks_db(repo);
+	if(!locks_db)
 	{
 		git_lfs_repo_send_error_response(mgr, cookie, "Unable to open locks database.");
-		goto error0;
+		return 0;
 	}
 	
-	sqlite3_stmt *stmt;
 	struct repo_cmd_delete_lock_response response;
 	memset(&response, 0, sizeof(response));
 
 	// get info about the lock first
-	if(SQLITE_OK != sqlite3_prepare_v2(db, "SELECT id, path, locked_at, owner FROM locks WHERE id=?", -1, &stmt, NULL))
+	sqlite3_stmt *stmt = locks_db_get_stmt(locks_db, LOCKS_STMT_SELECT_BY_ID);
+	if(!stmt)
 	{
 		goto error0;
 	}
@@ -983,28 +2256,23 @@ static int handle_delete_lock(struct repo_manager *mgr, const char *access_token
 	
 	if(SQLITE_ROW != sqlite3_step(stmt))
 	{
-		git_lfs_repo_send_error_response(mgr, cookie, "Lock does not exist.");
+		ret = git_lfs_repo_send_error_response(mgr, cookie, "Lock does not exist.");
 		goto error1;
 	}
 	
-	response.lock.id = sqlite3_column_int64(stmt, 0);
-	if(strlcpy(response.lock.path, (const char *)sqlite3_column_text(stmt, 1), sizeof(response.lock.path)) >= sizeof(response.lock.path))
-	{
-		goto error1;
-	}
-	response.lock.locked_at = sqlite3_column_int(stmt, 2);
-	if(strlcpy(response.lock.username, (const char *)sqlite3_column_text(stmt, 3), sizeof(response.lock.username)) >= sizeof(response.lock.username))
+	if(locks_db_read_lock(stmt, &response.lock) < 0)
 	{
 		goto error1;
 	}
 
-	sqlite3_finalize(stmt);
+	sqlite3_reset(stmt);
 
 	// prepare to delete the lock
 	
 	if(request.force)
 	{
-		if(SQLITE_OK != sqlite3_prepare_v2(db, "DELETE FROM locks WHERE id=?", -1, &stmt, NULL))
+		stmt = locks_db_get_stmt(locks_db, LOCKS_STMT_DELETE);
+		if(!stmt)
 		{
 			goto error0;
 		}
@@ -1016,42 +2284,188 @@ static int handle_delete_lock(struct repo_manager *mgr, const char *access_token
 	}
 	else
 	{
-		if(SQLITE_OK != sqlite3_prepare_v2(db, "DELETE FROM locks WHERE id=? AND owner=?", -1, &stmt, NULL))
-		{
-			goto error0;
-		}
+		stmt = locks_db_get_stmt(locks_db, LOCKS_STMT_DELETE_OWNED);
+		if(!stmt)
+		{
+			goto error0;
+		}
+
+		if(SQLITE_OK != sqlite3_bind_int64(stmt, 1, request.id))
+		{
+			goto error1;
+		}
+		
+		if(SQLITE_OK != sqlite3_bind_text(stmt, 2, request.username, -1, NULL))
+		{
+			goto error1;
+		}
+	}
+
+	response.successful = SQLITE_DONE == sqlite3_step(stmt) && sqlite3_changes(locks_db->db) == 1? 1 : 0;
+	
+	if(git_lfs_repo_send_response(mgr, REPO_CMD_DELETE_LOCK, cookie, &response, sizeof(response), NULL) < 0)
+	{
+		goto error1;
+	}
+
+	ret = 0;
+error1:
+	sqlite3_reset(stmt);
+error0:
+	return ret;
+}
+
+// the object indexes of a reloaded config are borrowed from the one the
+// repo manager started with, since they are shared with the other processes
+static void free_reloaded_config(struct git_lfs_config *config)
+{
+	struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		repo->object_index = NULL;
+	}
+	
+	git_lfs_free_config(config);
+}
+
+// A reload comes in two steps. Every repo manager first reads the config
+// and holds on to it, and it is only swapped in once all of them have it,
+// so a manager that fails leaves every one of them on the old config.
+static int handle_cmd_reload_config(struct repo_manager *mgr,
+									uint32_t cookie,
+									uint32_t size,
+									const struct git_lfs_config *initial_config,
+									struct git_lfs_config **pending_config)
+{
+	if(size > RELOAD_CONFIG_MAX_SIZE)
+	{
+		return -1;
+	}
+	
+	void *data = malloc(size);
+	if(!data)
+	{
+		return -1;
+	}
+	
+	if(socket_read_fully(mgr->socket, data, size) != size)
+	{
+		free(data);
+		return -1;
+	}
+	
+	struct git_lfs_config *config = git_lfs_config_deserialize(data, size);
+	explicit_bzero(data, size);
+	free(data);
+	
+	if(!config)
+	{
+		git_lfs_repo_send_error_response(mgr, cookie, "Unable to read the reloaded config.");
+		return 0;
+	}
+	
+	// the index of a repo whose objects moved elsewhere would be wrong,
+	// such a repo goes without one until a restart
+	struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		const struct git_lfs_repo *initial_repo = find_repo_by_id(initial_config, repo->id);
+		if(initial_repo && repo->object_index_size != 0 &&
+		   0 == strcmp(initial_repo->root_dir, repo->root_dir))
+		{
+			repo->object_index = initial_repo->object_index;
+		}
+	}
+	
+	if(*pending_config)
+	{
+		free_reloaded_config(*pending_config);
+	}
+	*pending_config = config;
+	
+	return git_lfs_repo_send_response(mgr, REPO_CMD_RELOAD_CONFIG, cookie, NULL, 0, NULL);
+}
+
+static int handle_cmd_commit_reload(struct repo_manager *mgr,
+									uint32_t cookie,
+									struct git_lfs_config **pending_config,
+									struct git_lfs_config **reloaded_config)
+{
+	if(!*pending_config)
+	{
+		git_lfs_repo_send_error_response(mgr, cookie, "No config reload in progress.");
+		return 0;
+	}
+	
+	// the lock databases are opened again as needed, in case a repo moved
+	close_locks_dbs();
+	
+	scrubber_set_config(*pending_config);
+	
+	if(*reloaded_config)
+	{
+		free_reloaded_config(*reloaded_config);
+	}
+	*reloaded_config = *pending_config;
+	*pending_config = NULL;
+	
+	return git_lfs_repo_send_response(mgr, REPO_CMD_COMMIT_RELOAD, cookie, NULL, 0, NULL);
+}
 
-		if(SQLITE_OK != sqlite3_bind_int64(stmt, 1, request.id))
-		{
-			goto error1;
-		}
-		
-		if(SQLITE_OK != sqlite3_bind_text(stmt, 2, request.username, -1, NULL))
-		{
-			goto error1;
-		}
+static int handle_cmd_abort_reload(struct repo_manager *mgr,
+								   uint32_t cookie,
+								   struct git_lfs_config **pending_config)
+{
+	if(*pending_config)
+	{
+		free_reloaded_config(*pending_config);
+		*pending_config = NULL;
 	}
+	
+	return git_lfs_repo_send_response(mgr, REPO_CMD_ABORT_RELOAD, cookie, NULL, 0, NULL);
+}
+
+// whichever repo manager gets to a repo's object index first fills it in,
+// while the main thread keeps serving requests
+static volatile int object_index_scan_cancel = 0;
 
-	response.successful = SQLITE_DONE == sqlite3_step(stmt) && sqlite3_changes(db) == 1? 1 : 0;
+static void *object_index_scan_thread(void *data)
+{
+	const struct git_lfs_config *config = (const struct git_lfs_config *)data;
+	const struct git_lfs_repo *repo;
 	
-	if(git_lfs_repo_send_response(mgr, REPO_CMD_DELETE_LOCK, cookie, &response, sizeof(response), NULL) < 0)
+	SLIST_FOREACH(repo, &config->repos, entries)
 	{
-		goto error1;
+		if(!object_index_claim_scan(repo->object_index)) continue;
+		
+		if(object_index_scan(repo->object_index, repo->root_dir, &object_index_scan_cancel) < 0 &&
+		   !object_index_scan_cancel)
+		{
+			fprintf(stderr, "Failed to scan the objects of repo '%s'. Its object index is not used.\n", repo->name);
+		}
 	}
-
-	ret = 0;
-error1:
-	sqlite3_finalize(stmt);
-error0:
-	sqlite3_close(db);
 	
-	return ret;
+	return NULL;
 }
 
-int git_lfs_repo_manager_service(struct repo_manager *mgr, const struct git_lfs_config *config)
+int git_lfs_repo_manager_service(struct repo_manager *mgr, const struct git_lfs_config *initial_config)
 {
 	LIST_INIT(&upload_list);
-	LIST_INIT(&access_token_list);
+	LIST_INIT(&locks_db_list);
+	
+	// the initial config stays around until the service ends, as the scan
+	// thread and the reloaded configs use its object indexes
+	const struct git_lfs_config *config = initial_config;
+	struct git_lfs_config *reloaded_config = NULL;
+	struct git_lfs_config *pending_config = NULL;
+	
+	object_index_scan_cancel = 0;
+	os_thread_t scan_thread = os_thread_create(object_index_scan_thread, (void *)initial_config);
+	
+	if(scrubber_start(initial_config) < 0)
+	{
+		fprintf(stderr, "Failed to start the scrubber.\n");
+	}
 
 	int ret = -1;
 	time_t last_clean = 0;
@@ -1072,6 +2486,8 @@ int git_lfs_repo_manager_service(struct repo_manager *mgr, const struct git_lfs_
 				}
 			}
 			
+			multipart_cleanup(config);
+			
 			last_clean = now;
 		}
 		
@@ -1117,7 +2533,7 @@ int git_lfs_repo_manager_service(struct repo_manager *mgr, const struct git_lfs_
 				
 				struct git_lfs_repo *repo = find_repo_by_id(config, data.repo_id);
 				if(!repo) {
-					git_lfs_repo_send_response(mgr, REPO_CMD_ERROR, hdr.cookie, NULL, 0, NULL);
+					git_lfs_repo_send_error_response(mgr, hdr.cookie, "Invalid repo id.");
 					continue;
 				}
 			
@@ -1132,7 +2548,7 @@ int git_lfs_repo_manager_service(struct repo_manager *mgr, const struct git_lfs_
 				switch(hdr.type) {
 					default: break;
 					case REPO_CMD_CHECK_OID_EXIST:
-						if(handle_cmd_check_oid(mgr, hdr.cookie, path) < 0) goto terminate;
+						if(handle_cmd_check_oid(mgr, hdr.cookie, repo, data.oid, path) < 0) goto terminate;
 						break;
 					case REPO_CMD_GET_OID:
 						if(handle_cmd_get_oid(mgr, hdr.cookie, path, oid_str) < 0) goto terminate;
@@ -1144,6 +2560,9 @@ int git_lfs_repo_manager_service(struct repo_manager *mgr, const struct git_lfs_
 				}
 			}
 				break;
+			case REPO_CMD_CHECK_OIDS_EXIST:
+				if(handle_cmd_check_oids(mgr, hdr.access_token, hdr.cookie, hdr.size, config) < 0) goto terminate;
+				break;
 			case REPO_CMD_COMMIT:
 				if(handle_cmd_commit(mgr, hdr.access_token, hdr.cookie, config) < 0) goto terminate;
 				break;
@@ -1160,6 +2579,31 @@ int git_lfs_repo_manager_service(struct repo_manager *mgr, const struct git_lfs_
 			case REPO_CMD_DELETE_LOCK:
 				if(handle_delete_lock(mgr, hdr.access_token, hdr.cookie, config) < 0) goto terminate;
 				break;
+			case REPO_CMD_PUT_PART:
+				if(handle_cmd_put_part(mgr, hdr.access_token, hdr.cookie, config) < 0) goto terminate;
+				break;
+			case REPO_CMD_COMMIT_PART:
+				if(handle_cmd_commit_part(mgr, hdr.access_token, hdr.cookie, config) < 0) goto terminate;
+				break;
+			case REPO_CMD_GET_PARTS_STATUS:
+				if(handle_cmd_get_parts_status(mgr, hdr.access_token, hdr.cookie, config) < 0) goto terminate;
+				break;
+			case REPO_CMD_GET_PART_FD:
+				if(handle_cmd_get_part_fd(mgr, hdr.access_token, hdr.cookie, config) < 0) goto terminate;
+				break;
+			case REPO_CMD_REMOVE_PARTS:
+				if(handle_cmd_remove_parts(mgr, hdr.access_token, hdr.cookie, config) < 0) goto terminate;
+				break;
+			case REPO_CMD_RELOAD_CONFIG:
+				if(handle_cmd_reload_config(mgr, hdr.cookie, hdr.size, initial_config, &pending_config) < 0) goto terminate;
+				break;
+			case REPO_CMD_COMMIT_RELOAD:
+				if(handle_cmd_commit_reload(mgr, hdr.cookie, &pending_config, &reloaded_config) < 0) goto terminate;
+				if(reloaded_config) config = reloaded_config;
+				break;
+			case REPO_CMD_ABORT_RELOAD:
+				if(handle_cmd_abort_reload(mgr, hdr.cookie, &pending_config) < 0) goto terminate;
+				break;
 			default:
 				goto terminate;
 		}
@@ -1167,6 +2611,14 @@ int git_lfs_repo_manager_service(struct repo_manager *mgr, const struct git_lfs_
 	
 terminate:;
 
+	if(scan_thread)
+	{
+		object_index_scan_cancel = 1;
+		os_thread_join(scan_thread, NULL);
+	}
+	
+	scrubber_stop();
+	
 	// clean up tmp files
 	struct upload_entry *upload, *tmp;
 	LIST_FOREACH_SAFE(upload, &upload_list, entries, tmp)
@@ -1176,6 +2628,18 @@ terminate:;
 		free(upload);
 	}
 	
+	close_locks_dbs();
+	git_lfs_free_access_tokens();
+	
+	if(reloaded_config)
+	{
+		free_reloaded_config(reloaded_config);
+	}
+	
+	if(pending_config)
+	{
+		free_reloaded_config(pending_config);
+	}
 	
 	return ret;
 }
@@ -1298,6 +2762,73 @@ int git_lfs_repo_check_oid_exist(struct repo_manager *mgr,
 	return check_oid_resp.exist;
 }
 
+int git_lfs_repo_check_oids_exist(struct repo_manager *mgr,
+								  const struct git_lfs_repo *repo,
+								  const uint8_t (*oids)[32],
+								  int num_oids,
+								  int64_t *sizes,
+								  char *error_msg,
+								  size_t error_msg_buf_len)
+{
+	struct repo_cmd_check_oids_request *request;
+	struct repo_cmd_check_oids_response *response;
+	int num_failed = 0;
+	
+	request = malloc(sizeof(*request) + CHECK_OIDS_LIMIT * sizeof(request->oids[0]));
+	response = malloc(sizeof(*response) + CHECK_OIDS_LIMIT * sizeof(response->sizes[0]));
+	
+	// split into messages of at most CHECK_OIDS_LIMIT oids. a message that
+	// fails only fails its own oids
+	for(int offset = 0; offset < num_oids; offset += CHECK_OIDS_LIMIT)
+	{
+		int n = num_oids - offset;
+		if(n > CHECK_OIDS_LIMIT) n = CHECK_OIDS_LIMIT;
+		
+		if(!request || !response)
+		{
+			snprintf(error_msg, error_msg_buf_len, "Out of memory.");
+			goto failed;
+		}
+		
+		request->repo_id = repo->id;
+		request->num_oids = n;
+		memcpy(request->oids, oids + offset, n * sizeof(request->oids[0]));
+		
+		size_t request_size = sizeof(*request) + n * sizeof(request->oids[0]);
+		size_t response_size = sizeof(*response) + n * sizeof(response->sizes[0]);
+		
+		if(git_lfs_repo_send_request(mgr,
+									 REPO_CMD_CHECK_OIDS_EXIST,
+									 mgr->access_token,
+									 request, request_size,
+									 response, response_size,
+									 NULL,
+									 error_msg, error_msg_buf_len) < 0)
+		{
+			goto failed;
+		}
+		
+		if(response->num_oids != n)
+		{
+			snprintf(error_msg, error_msg_buf_len, "Invalid response from the repo manager.");
+			goto failed;
+		}
+		
+		memcpy(sizes + offset, response->sizes, n * sizeof(response->sizes[0]));
+		continue;
+	failed:
+		for(int i = 0; i < n; i++)
+		{
+			sizes[offset + i] = CHECK_OIDS_FAILED;
+		}
+		num_failed += n;
+	}
+	
+	free(response);
+	free(request);
+	return num_failed;
+}
+
 int git_lfs_repo_get_read_oid_fd(struct repo_manager *mgr,
 								 const struct git_lfs_config *config,
 								 const struct git_lfs_repo *repo,
@@ -1366,12 +2897,16 @@ int git_lfs_repo_get_write_oid_fd(struct repo_manager *mgr,
 
 int git_lfs_repo_commit(struct repo_manager *mgr,
 						uint32_t ticket,
+						int64_t size,
+						const uint8_t sha256[32],
 						char *error_msg,
 						size_t error_msg_buf_len)
 {
 	struct repo_cmd_commit_request request;
 	memset(&request, 0, sizeof(request));
 	request.ticket = ticket;
+	request.size = size;
+	memcpy(request.sha256, sha256, sizeof(request.sha256));
 	
 	return git_lfs_repo_send_request(mgr,
 									 REPO_CMD_COMMIT,
@@ -1382,11 +2917,246 @@ int git_lfs_repo_commit(struct repo_manager *mgr,
 									 error_msg, error_msg_buf_len);
 }
 
+int git_lfs_repo_get_write_part_fd(struct repo_manager *mgr,
+								   const struct git_lfs_repo *repo,
+								   const uint8_t oid[32],
+								   int64_t size,
+								   int64_t offset,
+								   int64_t length,
+								   int *fd,
+								   char tmp_suffix[MULTIPART_TMP_SUFFIX_SIZE],
+								   char *error_msg,
+								   size_t error_msg_buf_len)
+{
+	struct repo_cmd_part_request request;
+	struct repo_cmd_put_part_response response;
+	
+	memset(&request, 0, sizeof(request));
+	request.repo_id = repo->id;
+	memcpy(request.oid, oid, sizeof(request.oid));
+	request.size = size;
+	request.offset = offset;
+	request.length = length;
+	
+	if(git_lfs_repo_send_request(mgr,
+								 REPO_CMD_PUT_PART,
+								 mgr->access_token,
+								 &request, sizeof(request),
+								 &response, sizeof(response),
+								 fd,
+								 error_msg, error_msg_buf_len) < 0) {
+		return -1;
+	}
+	
+	memcpy(tmp_suffix, response.tmp_suffix, MULTIPART_TMP_SUFFIX_SIZE);
+	
+	return 0;
+}
+
+int git_lfs_repo_commit_part(struct repo_manager *mgr,
+							 const struct git_lfs_repo *repo,
+							 const uint8_t oid[32],
+							 int64_t size,
+							 int64_t offset,
+							 int64_t length,
+							 const char tmp_suffix[MULTIPART_TMP_SUFFIX_SIZE],
+							 char *error_msg,
+							 size_t error_msg_buf_len)
+{
+	struct repo_cmd_commit_part_request request;
+	
+	memset(&request, 0, sizeof(request));
+	request.part.repo_id = repo->id;
+	memcpy(request.part.oid, oid, sizeof(request.part.oid));
+	request.part.size = size;
+	request.part.offset = offset;
+	request.part.length = length;
+	memcpy(request.tmp_suffix, tmp_suffix, sizeof(request.tmp_suffix));
+	
+	return git_lfs_repo_send_request(mgr,
+									 REPO_CMD_COMMIT_PART,
+									 mgr->access_token,
+									 &request, sizeof(request),
+									 NULL, 0,
+									 NULL,
+									 error_msg, error_msg_buf_len);
+}
+
+int git_lfs_repo_get_parts_status(struct repo_manager *mgr,
+								  const struct git_lfs_repo *repo,
+								  const uint8_t oid[32],
+								  int64_t *size,
+								  int64_t *part_size,
+								  uint32_t *num_parts,
+								  uint8_t *received,
+								  char *error_msg,
+								  size_t error_msg_buf_len)
+{
+	int ret = -1;
+	struct repo_oid_cmd_data request;
+	struct repo_cmd_parts_status_response *response;
+	size_t max_response_size = sizeof(*response) + MULTIPART_MAX_PARTS / 8;
+	
+	response = malloc(max_response_size);
+	if(!response)
+	{
+		return -1;
+	}
+	
+	memset(&request, 0, sizeof(request));
+	request.repo_id = repo->id;
+	memcpy(request.oid, oid, sizeof(request.oid));
+	
+	size_t received_size;
+	if(git_lfs_repo_transact(mgr,
+							 REPO_CMD_GET_PARTS_STATUS,
+							 mgr->access_token,
+							 &request, sizeof(request),
+							 response, max_response_size,
+							 &received_size,
+							 NULL,
+							 error_msg, error_msg_buf_len) < 0)
+	{
+		goto error;
+	}
+	
+	if(received_size < sizeof(*response) ||
+	   response->num_parts > MULTIPART_MAX_PARTS ||
+	   received_size != sizeof(*response) + (response->num_parts + 7) / 8)
+	{
+		goto error;
+	}
+	
+	*size = response->size;
+	*part_size = response->part_size;
+	*num_parts = response->num_parts;
+	memcpy(received, response->received, (response->num_parts + 7) / 8);
+	
+	ret = 0;
+error:
+	free(response);
+	return ret;
+}
+
+int git_lfs_repo_get_read_part_fd(struct repo_manager *mgr,
+								  const struct git_lfs_repo *repo,
+								  const uint8_t oid[32],
+								  uint32_t part,
+								  int *fd,
+								  int64_t *length,
+								  uint32_t *num_parts,
+								  char *error_msg,
+								  size_t error_msg_buf_len)
+{
+	struct repo_cmd_get_part_fd_request request;
+	struct repo_cmd_get_part_fd_response response;
+	
+	memset(&request, 0, sizeof(request));
+	request.repo_id = repo->id;
+	memcpy(request.oid, oid, sizeof(request.oid));
+	request.part = part;
+	
+	if(git_lfs_repo_send_request(mgr,
+								 REPO_CMD_GET_PART_FD,
+								 mgr->access_token,
+								 &request, sizeof(request),
+								 &response, sizeof(response),
+								 fd,
+								 error_msg, error_msg_buf_len) < 0) {
+		return -1;
+	}
+	
+	*length = response.length;
+	*num_parts = response.num_parts;
+	
+	return 0;
+}
+
+int git_lfs_repo_remove_parts(struct repo_manager *mgr,
+							  const struct git_lfs_repo *repo,
+							  const uint8_t oid[32],
+							  char *error_msg,
+							  size_t error_msg_buf_len)
+{
+	struct repo_oid_cmd_data request;
+	
+	memset(&request, 0, sizeof(request));
+	request.repo_id = repo->id;
+	memcpy(request.oid, oid, sizeof(request.oid));
+	
+	return git_lfs_repo_send_request(mgr,
+									 REPO_CMD_REMOVE_PARTS,
+									 mgr->access_token,
+									 &request, sizeof(request),
+									 NULL, 0,
+									 NULL,
+									 error_msg, error_msg_buf_len);
+}
+
 int git_lfs_repo_terminate_service(struct repo_manager *mgr)
 {
 	return git_lfs_repo_send_request(mgr, REPO_CMD_TERMINATE, "", NULL, 0, NULL, 0, NULL, NULL, 0);
 }
 
+// sends the same request to the first num_channels repo managers, returns
+// how many of them took it before one failed
+static int git_lfs_repo_broadcast(struct repo_manager *mgr,
+								  int type,
+								  int num_channels,
+								  const void *data,
+								  size_t size,
+								  char *error_msg,
+								  size_t error_msg_buf_len)
+{
+	for(int i = 0; i < num_channels; i++)
+	{
+		struct repo_manager session;
+		memset(&session, 0, sizeof(session));
+		session.socket = mgr->channels[i]->socket;
+		session.channel = mgr->channels[i];
+		
+		if(git_lfs_repo_send_request(&session, type, "",
+									 data, size,
+									 NULL, 0,
+									 NULL,
+									 error_msg, error_msg_buf_len) < 0)
+		{
+			return i;
+		}
+	}
+	
+	return num_channels;
+}
+
+int git_lfs_repo_reload_config(struct repo_manager *mgr,
+							   const void *data,
+							   size_t size,
+							   char *error_msg,
+							   size_t error_msg_buf_len)
+{
+	if(size > RELOAD_CONFIG_MAX_SIZE)
+	{
+		snprintf(error_msg, error_msg_buf_len, "The config is too large.");
+		return -1;
+	}
+	
+	// unlike other requests this goes to every repo manager
+	int prepared = git_lfs_repo_broadcast(mgr, REPO_CMD_RELOAD_CONFIG, mgr->num_channels, data, size, error_msg, error_msg_buf_len);
+	if(prepared < mgr->num_channels)
+	{
+		git_lfs_repo_broadcast(mgr, REPO_CMD_ABORT_RELOAD, prepared, NULL, 0, NULL, 0);
+		return -1;
+	}
+	
+	// this only fails if a repo manager is gone, which ends the server
+	if(git_lfs_repo_broadcast(mgr, REPO_CMD_COMMIT_RELOAD, mgr->num_channels, NULL, 0, error_msg, error_msg_buf_len) < mgr->num_channels)
+	{
+		return -1;
+	}
+	
+	return 0;
+}
+
 int git_lfs_repo_create_lock(struct repo_manager *mgr,
 							 const struct git_lfs_repo *repo,
 							 const char *username,
@@ -1435,17 +3205,14 @@ int git_lfs_repo_create_lock(struct repo_manager *mgr,
 
 int git_lfs_repo_list_locks(struct repo_manager *mgr,
 							const struct git_lfs_repo *repo,
-							int cursor,
+							int64_t cursor,
 							int limit,
 							const char *path,
 							int64_t *id,
-							struct repo_lock_info **out_lock_info,
-							int *out_num_locks,
-							int *out_next_cursor,
+							struct repo_lock_list **out_list,
 							char *error_msg,
 							size_t error_msg_buf_len)
 {
-	int ret = -1;
 	struct repo_cmd_list_locks_request request;
 	memset(&request, 0, sizeof(request));
 	
@@ -1457,63 +3224,109 @@ int git_lfs_repo_list_locks(struct repo_manager *mgr,
 			return -1;
 		}
 	}
+	if(limit < 0 || limit > LIST_LOCKS_LIMIT)
+	{
+		limit = LIST_LOCKS_LIMIT;
+	}
+	
 	request.cursor = cursor;
 	request.limit = limit;
 	request.id = id ? *id :-1;
 	
-	struct repo_cmd_list_locks_response *response = malloc(sizeof *response + LIST_LOCKS_LIMIT * sizeof(response->locks[0]));
+	struct repo_lock_list *list = calloc(1, sizeof(*list));
+	if(!list)
+	{
+		return -1;
+	}
+	
+	size_t response_size = sizeof(struct repo_cmd_list_locks_response) + limit * REPO_LOCK_RECORD_MAX_SIZE;
+	struct repo_cmd_list_locks_response *response = malloc(response_size);
 	if(!response)
 	{
 		goto error;
 	}
 	
-	if(git_lfs_repo_send_request(mgr, REPO_CMD_LIST_LOCKS, mgr->access_token, &request, sizeof(request), response, sizeof *response, NULL, error_msg, error_msg_buf_len) < 0)
+	list->response = response;
+	
+	size_t received;
+	if(git_lfs_repo_transact(mgr, REPO_CMD_LIST_LOCKS, mgr->access_token, &request, sizeof(request), response, response_size, &received, NULL, error_msg, error_msg_buf_len) < 0)
 	{
 		goto error;
 	}
 	
-	int n = response->num_locks;
-	if(n < 0 || n > LIST_LOCKS_LIMIT)
+	if(received < sizeof(*response))
 	{
 		goto error;
 	}
-
-	int extra_data_size = n * sizeof(response->locks[0]);
-	if(socket_read_fully(mgr->socket, &response->locks[0], extra_data_size) != extra_data_size)
+	
+	int n = response->num_locks;
+	if(n < 0 || n > limit || response->next_cursor < 0)
 	{
 		goto error;
 	}
 	
-	*out_next_cursor = response->next_cursor;
-	*out_lock_info = calloc(n, sizeof **out_lock_info);
-	if(!*out_lock_info)
+	list->locks = calloc(n > 0 ? n : 1, sizeof(list->locks[0]));
+	if(!list->locks)
 	{
 		goto error;
 	}
 	
-	*out_num_locks = response->num_locks;
-	for(int i = 0; i < response->num_locks; i++)
+	// walk the packed records, making sure each one fits and its strings
+	// are terminated where their lengths say they are
+	size_t offset = sizeof(*response);
+	for(int i = 0; i < n; i++)
 	{
-		struct repo_lock_info *info = &(*out_lock_info)[i];
-		*info = response->locks[i];
-
-		if(info->path[sizeof(info->path) - 1] != 0)
+		if(received - offset < offsetof(struct repo_lock_record, strings))
+		{
+			goto error;
+		}
+		
+		const struct repo_lock_record *record = (const struct repo_lock_record *)((uint8_t *)response + offset);
+		size_t record_size = REPO_LOCK_RECORD_SIZE(record->path_len, record->username_len);
+		if(received - offset < record_size)
 		{
-			free(*out_lock_info);
 			goto error;
 		}
 		
-		if(info->username[sizeof(info->username) - 1] != 0)
+		const char *record_path = record->strings;
+		const char *record_username = record->strings + record->path_len + 1;
+		if(strnlen(record_path, record->path_len + 1) != record->path_len ||
+		   strnlen(record_username, record->username_len + 1) != record->username_len)
 		{
-			free(*out_lock_info);
 			goto error;
 		}
+		
+		struct repo_lock *lock = &list->locks[i];
+		lock->id = record->id;
+		lock->locked_at = (time_t)record->locked_at;
+		lock->path = record_path;
+		lock->username = record_username;
+		
+		offset += record_size;
 	}
 	
-	ret = 0;
+	if(offset != received)
+	{
+		goto error;
+	}
+	
+	list->num_locks = n;
+	list->next_cursor = response->next_cursor;
+	*out_list = list;
+	return 0;
 error:
-	free(response);
-	return ret;
+	repo_lock_list_free(list);
+	return -1;
+}
+
+void repo_lock_list_free(struct repo_lock_list *list)
+{
+	if(list)
+	{
+		free(list->locks);
+		free(list->response);
+		free(list);
+	}
 }
 
 int git_lfs_repo_delete_lock(struct repo_manager *mgr,
@@ -22,10 +22,14 @@
 
 struct git_lfs_config;
 struct git_lfs_repo;
+struct repo_channel;
 
 struct repo_manager
 {
 	int socket;
+	struct repo_channel **channels; // one channel per repo manager process (client side), shared by sessions
+	int num_channels;
+	struct repo_channel *channel; // channel used by a session
 	
 	char username[33];
 	char access_token[16];
@@ -44,7 +48,17 @@ enum repo_cmd_type
 	REPO_CMD_ERROR,
 	REPO_CMD_CREATE_LOCK,
 	REPO_CMD_LIST_LOCKS,
-	REPO_CMD_DELETE_LOCK
+	REPO_CMD_DELETE_LOCK,
+	REPO_CMD_CHECK_OIDS_EXIST,
+	REPO_CMD_PUT_PART,
+	REPO_CMD_COMMIT_PART,
+	REPO_CMD_GET_PARTS_STATUS,
+	REPO_CMD_GET_PART_FD,
+	REPO_CMD_REMOVE_PARTS,
+	REPO_CMD_RELOAD_CONFIG,
+	REPO_CMD_COMMIT_RELOAD,
+	REPO_CMD_ABORT_RELOAD,
+	REPO_CMD_COUNT
 };
 
 #define REPO_CMD_MAGIC 0xa733f97f
@@ -55,6 +69,7 @@ struct repo_cmd_header
 	uint32_t cookie;
 	char access_token[16];
 	enum repo_cmd_type type;
+	uint32_t size; // size of the payload following the header
 };
 
 struct repo_oid_cmd_data
@@ -94,6 +109,27 @@ struct repo_cmd_check_oid_response
 	int exist;
 };
 
+// check multiple oids
+
+enum check_oids_config
+{
+	CHECK_OIDS_LIMIT = 1024, // per message
+	CHECK_OIDS_FAILED = -2 // size of an oid whose message failed
+};
+
+struct repo_cmd_check_oids_request
+{
+	int repo_id;
+	int num_oids;
+	uint8_t oids[][32];
+};
+
+struct repo_cmd_check_oids_response
+{
+	int num_oids;
+	int64_t sizes[]; // -1 if missing
+};
+
 struct repo_cmd_get_oid_response
 {
 	long content_length;
@@ -107,6 +143,68 @@ struct repo_cmd_put_oid_response
 struct repo_cmd_commit_request
 {
 	uint32_t ticket;
+	int64_t size; // bytes written, and hashed
+	uint8_t sha256[32]; // hash of the uploaded data
+};
+
+// Multipart uploads
+
+enum multipart_config
+{
+	MULTIPART_PART_SIZE = 16 * 1024 * 1024,
+	MULTIPART_MAX_PARTS = 65536,
+	MULTIPART_EXPIRE = 7 * 24 * 60 * 60, // seconds without a new part before an upload is discarded
+	MULTIPART_STALE = 60 * 60, // seconds without a part before a start with another size may replace an upload
+	MULTIPART_TMP_SUFFIX_SIZE = 7
+};
+
+// like every multipart request it starts with the fields of repo_oid_cmd_data
+struct repo_cmd_part_request
+{
+	int repo_id;
+	uint8_t oid[32];
+	int64_t size; // size of the whole object
+	int64_t offset; // must be a multiple of the part size
+	int64_t length;
+};
+
+struct repo_cmd_put_part_response
+{
+	uint32_t part;
+	char tmp_suffix[MULTIPART_TMP_SUFFIX_SIZE]; // names the file the part is written to
+};
+
+struct repo_cmd_commit_part_request
+{
+	struct repo_cmd_part_request part;
+	char tmp_suffix[MULTIPART_TMP_SUFFIX_SIZE]; // from the put part response
+};
+
+struct repo_cmd_parts_status_response
+{
+	int64_t size; // 0 if there is no upload in progress
+	int64_t part_size;
+	uint32_t num_parts;
+	uint8_t received[]; // bitmap of the parts
+};
+
+struct repo_cmd_get_part_fd_request
+{
+	int repo_id;
+	uint8_t oid[32];
+	uint32_t part;
+};
+
+struct repo_cmd_get_part_fd_response
+{
+	int64_t length;
+	uint32_t num_parts; // an empty object still has one empty part
+};
+
+// the payload of a reload is the new config, see git_lfs_config_serialize
+enum reload_config_config
+{
+	RELOAD_CONFIG_MAX_SIZE = 64 * 1024 * 1024
 };
 
 struct repo_cmd_error_response
@@ -148,15 +246,50 @@ struct repo_cmd_list_locks_request
 	int repo_id;
 	char path[1024];
 	int64_t id;
-	int cursor;
+	int64_t cursor; // id of the last lock of the previous page, 0 for the first page
 	int limit;
 };
 
 struct repo_cmd_list_locks_response
 {
 	int num_locks;
-	int next_cursor;
-	struct repo_lock_info locks[];
+	int64_t next_cursor; // 0 on the last page
+	uint8_t records[]; // num_locks packed repo_lock_records
+};
+
+// a lock in a list response. the path and username follow the record,
+// each NULL terminated, and the next record starts on an 8 byte boundary
+struct repo_lock_record
+{
+	int64_t id;
+	int64_t locked_at;
+	uint16_t path_len;
+	uint8_t username_len;
+	char strings[];
+};
+
+#define REPO_LOCK_RECORD_SIZE(path_len, username_len) \
+	((offsetof(struct repo_lock_record, strings) + (path_len) + 1 + (username_len) + 1 + 7) & ~(size_t)7)
+
+#define REPO_LOCK_RECORD_MAX_SIZE \
+	REPO_LOCK_RECORD_SIZE(sizeof(((struct repo_lock_info *)0)->path) - 1, sizeof(((struct repo_lock_info *)0)->username) - 1)
+
+// a page of locks as returned by git_lfs_repo_list_locks, the strings
+// point into the response
+struct repo_lock
+{
+	int64_t id;
+	time_t locked_at;
+	const char *path;
+	const char *username;
+};
+
+struct repo_lock_list
+{
+	int num_locks;
+	int64_t next_cursor;
+	struct repo_lock *locks;
+	struct repo_cmd_list_locks_response *response;
 };
 
 // Delete locks
@@ -178,7 +311,14 @@ struct repo_cmd_delete_lock_response
 struct repo_manager *repo_manager_create(int socket);
 void repo_manager_free(struct repo_manager *mgr);
 
-int git_lfs_repo_manager_service(struct repo_manager *mgr, const struct git_lfs_config *config);
+// client to a pool of repo managers, one socket per manager process
+struct repo_manager *repo_manager_create_client(const int *sockets, int num_sockets);
+// initializes a per-request handle bound to one of the channels of mgr
+void repo_manager_init_session(struct repo_manager *session, const struct repo_manager *mgr);
+// number of requests waiting on a channel of a client
+int repo_manager_get_in_flight(const struct repo_manager *mgr, int channel);
+
+int git_lfs_repo_manager_service(struct repo_manager *mgr, const struct git_lfs_config *initial_config);
 
 int git_lfs_repo_authenticate(struct repo_manager *mgr,
 							  const struct git_lfs_config *config,
@@ -204,6 +344,17 @@ int git_lfs_repo_check_oid_exist(struct repo_manager *mgr,
 								 char *error_msg,
 								 size_t error_msg_buf_len);
 
+// sizes[i] gets the size of oid i, -1 if it does not exist or
+// CHECK_OIDS_FAILED if the message it went in failed. returns the number
+// of oids that could not be checked, error_msg has the last failure.
+int git_lfs_repo_check_oids_exist(struct repo_manager *mgr,
+								  const struct git_lfs_repo *repo,
+								  const uint8_t (*oids)[32],
+								  int num_oids,
+								  int64_t *sizes,
+								  char *error_msg,
+								  size_t error_msg_buf_len);
+
 int git_lfs_repo_get_read_oid_fd(struct repo_manager *mgr,
 								 const struct git_lfs_config *config,
 								 const struct git_lfs_repo *repo,
@@ -224,11 +375,71 @@ int git_lfs_repo_get_write_oid_fd(struct repo_manager *mgr,
 
 int git_lfs_repo_commit(struct repo_manager *mgr,
 						uint32_t ticket,
+						int64_t size,
+						const uint8_t sha256[32],
 						char *error_msg,
 						size_t error_msg_buf_len);
 
+int git_lfs_repo_get_write_part_fd(struct repo_manager *mgr,
+								   const struct git_lfs_repo *repo,
+								   const uint8_t oid[32],
+								   int64_t size,
+								   int64_t offset,
+								   int64_t length,
+								   int *fd,
+								   char tmp_suffix[MULTIPART_TMP_SUFFIX_SIZE],
+								   char *error_msg,
+								   size_t error_msg_buf_len);
+
+int git_lfs_repo_commit_part(struct repo_manager *mgr,
+							 const struct git_lfs_repo *repo,
+							 const uint8_t oid[32],
+							 int64_t size,
+							 int64_t offset,
+							 int64_t length,
+							 const char tmp_suffix[MULTIPART_TMP_SUFFIX_SIZE],
+							 char *error_msg,
+							 size_t error_msg_buf_len);
+
+// received must have room for MULTIPART_MAX_PARTS bits
+int git_lfs_repo_get_parts_status(struct repo_manager *mgr,
+								  const struct git_lfs_repo *repo,
+								  const uint8_t oid[32],
+								  int64_t *size,
+								  int64_t *part_size,
+								  uint32_t *num_parts,
+								  uint8_t *received,
+								  char *error_msg,
+								  size_t error_msg_buf_len);
+
+// fails unless every part was received
+int git_lfs_repo_get_read_part_fd(struct repo_manager *mgr,
+								  const struct git_lfs_repo *repo,
+								  const uint8_t oid[32],
+								  uint32_t part,
+								  int *fd,
+								  int64_t *length,
+								  uint32_t *num_parts,
+								  char *error_msg,
+								  size_t error_msg_buf_len);
+
+// once the parts were committed as an object, or failed verification
+int git_lfs_repo_remove_parts(struct repo_manager *mgr,
+							  const struct git_lfs_repo *repo,
+							  const uint8_t oid[32],
+							  char *error_msg,
+							  size_t error_msg_buf_len);
+
 int git_lfs_repo_terminate_service(struct repo_manager *mgr);
 
+// hands a reloaded config to every repo manager of a client. it is only
+// swapped in once all of them have read it, otherwise none of them switch.
+int git_lfs_repo_reload_config(struct repo_manager *mgr,
+							   const void *data,
+							   size_t size,
+							   char *error_msg,
+							   size_t error_msg_buf_len);
+
 int git_lfs_repo_create_lock(struct repo_manager *mgr,
 							 const struct git_lfs_repo *repo,
 							 const char *username,
@@ -239,15 +450,14 @@ int git_lfs_repo_create_lock(struct repo_manager *mgr,
 
 int git_lfs_repo_list_locks(struct repo_manager *mgr,
 							const struct git_lfs_repo *repo,
-							int cursor,
+							int64_t cursor,
 							int limit,
 							const char *path,
 							int64_t *id,
-							struct repo_lock_info **out_lock_info,
-							int *out_num_locks,
-							int *out_next_cursor,
+							struct repo_lock_list **out_list,
 							char *error_msg,
 							size_t error_msg_buf_len);
+void repo_lock_list_free(struct repo_lock_list *list);
 
 int git_lfs_repo_delete_lock(struct repo_manager *mgr,
 							 const struct git_lfs_repo *repo,
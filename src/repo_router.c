@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "repo_router.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "compat/queue.h"
+#include "configuration.h"
+
+// the children of a node are stored next to each other, sorted by the
+// first byte of their label
+struct repo_router_node
+{
+	const char *label; // points into a repo uri
+	uint32_t label_len;
+	uint32_t first_child;
+	uint32_t num_children;
+	const struct git_lfs_repo *repo; // repo whose uri ends at this node
+};
+
+struct repo_router
+{
+	uint32_t num_nodes;
+	uint32_t max_nodes;
+	struct repo_router_node *nodes;
+};
+
+static int compare_repo_uri(const void *a, const void *b)
+{
+	const struct git_lfs_repo *repo_a = *(const struct git_lfs_repo * const *)a;
+	const struct git_lfs_repo *repo_b = *(const struct git_lfs_repo * const *)b;
+	
+	return strcmp(repo_a->uri, repo_b->uri);
+}
+
+static int64_t repo_router_add_nodes(struct repo_router *router, uint32_t num_nodes)
+{
+	if(router->num_nodes + num_nodes > router->max_nodes)
+	{
+		uint32_t max_nodes = router->max_nodes * 2 + num_nodes;
+		struct repo_router_node *nodes = realloc(router->nodes, max_nodes * sizeof(*nodes));
+		if(!nodes) return -1;
+		
+		router->nodes = nodes;
+		router->max_nodes = max_nodes;
+	}
+	
+	int64_t first = router->num_nodes;
+	memset(&router->nodes[first], 0, num_nodes * sizeof(router->nodes[0]));
+	router->num_nodes += num_nodes;
+	
+	return first;
+}
+
+// fills in the node for repos[lo, hi), sorted uris that all share their
+// first depth bytes
+static int repo_router_build(struct repo_router *router, uint32_t node, const struct git_lfs_repo **repos, int lo, int hi, size_t depth)
+{
+	// the shortest uri sorts first, it may end exactly here
+	if(lo < hi && repos[lo]->uri[depth] == 0)
+	{
+		if(lo + 1 < hi && repos[lo + 1]->uri[depth] == 0)
+		{
+			fprintf(stderr, "error: The repos '%s' and '%s' have the same uri.\n", repos[lo]->name, repos[lo + 1]->name);
+			return -1;
+		}
+		
+		router->nodes[node].repo = repos[lo++];
+	}
+	
+	int num_children = 0;
+	for(int i = lo; i < hi; i++)
+	{
+		if(i == lo || repos[i]->uri[depth] != repos[i - 1]->uri[depth]) num_children++;
+	}
+	
+	if(num_children == 0)
+	{
+		return 0;
+	}
+	
+	int64_t first_child = repo_router_add_nodes(router, num_children);
+	if(first_child < 0)
+	{
+		return -1;
+	}
+	
+	router->nodes[node].first_child = first_child;
+	router->nodes[node].num_children = num_children;
+	
+	uint32_t child = first_child;
+	for(int i = lo; i < hi; child++)
+	{
+		int end = i + 1;
+		while(end < hi && repos[end]->uri[depth] == repos[i]->uri[depth]) end++;
+		
+		// the label runs to where the first and last uri of the group differ
+		const char *first = repos[i]->uri;
+		const char *last = repos[end - 1]->uri;
+		size_t child_depth = depth + 1;
+		while(first[child_depth] && first[child_depth] == last[child_depth]) child_depth++;
+		
+		router->nodes[child].label = first + depth;
+		router->nodes[child].label_len = child_depth - depth;
+		
+		if(repo_router_build(router, child, repos, i, end, child_depth) < 0)
+		{
+			return -1;
+		}
+		
+		i = end;
+	}
+	
+	return 0;
+}
+
+struct repo_router *repo_router_create(const struct git_lfs_config *config)
+{
+	struct repo_router *router = calloc(1, sizeof(*router));
+	if(!router) return NULL;
+	
+	int num_repos = 0;
+	const struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		num_repos++;
+	}
+	
+	const struct git_lfs_repo **repos = calloc(num_repos + 1, sizeof(*repos));
+	if(!repos) goto error0;
+	
+	int n = 0;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		if(repo->uri) repos[n++] = repo;
+	}
+	
+	qsort(repos, n, sizeof(*repos), compare_repo_uri);
+	
+	if(repo_router_add_nodes(router, 1) < 0 ||
+	   repo_router_build(router, 0, repos, 0, n, 0) < 0)
+	{
+		goto error1;
+	}
+	
+	free(repos);
+	return router;
+	
+error1:
+	free(repos);
+error0:
+	repo_router_free(router);
+	return NULL;
+}
+
+void repo_router_free(struct repo_router *router)
+{
+	if(!router) return;
+	
+	free(router->nodes);
+	free(router);
+}
+
+const struct git_lfs_repo *repo_router_lookup(const struct repo_router *router, const char *uri, size_t *prefix_len)
+{
+	const struct repo_router_node *node = &router->nodes[0];
+	const struct git_lfs_repo *repo = node->repo;
+	size_t pos = 0;
+	*prefix_len = 0;
+	
+	while(node->num_children > 0 && uri[pos])
+	{
+		// binary search for the child starting with the next byte
+		const struct repo_router_node *children = &router->nodes[node->first_child];
+		unsigned char c = uri[pos];
+		uint32_t lo = 0, hi = node->num_children;
+		while(lo < hi)
+		{
+			uint32_t mid = (lo + hi) / 2;
+			if((unsigned char)children[mid].label[0] < c) lo = mid + 1;
+			else hi = mid;
+		}
+		
+		if(lo == node->num_children || (unsigned char)children[lo].label[0] != c ||
+		   strncmp(uri + pos, children[lo].label, children[lo].label_len) != 0)
+		{
+			break;
+		}
+		
+		node = &children[lo];
+		pos += node->label_len;
+		
+		if(node->repo)
+		{
+			repo = node->repo;
+			*prefix_len = pos;
+		}
+	}
+	
+	return repo;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef REPO_ROUTER_H
+#define REPO_ROUTER_H
+
+#include <stddef.h>
+
+struct git_lfs_config;
+struct git_lfs_repo;
+
+// Maps request uris to repos by the longest repo uri they start with. The
+// repo uris are compiled into a radix tree when the config is loaded, so a
+// lookup only depends on the length of the request uri.
+
+struct repo_router;
+
+struct repo_router *repo_router_create(const struct git_lfs_config *config);
+void repo_router_free(struct repo_router *router);
+
+// returns NULL if no repo matches, otherwise the repo and the length of its
+// uri, which is where the end point starts
+const struct git_lfs_repo *repo_router_lookup(const struct repo_router *router, const char *uri, size_t *prefix_len);
+
+#endif
@@ -0,0 +1,759 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "scrubber.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include "compat/queue.h"
+#include "compat/string.h"
+#include "os/filesystem.h"
+#include "os/io.h"
+#include "os/clock.h"
+#include "os/memory.h"
+#include "os/mutex.h"
+#include "os/threads.h"
+#include "configuration.h"
+#include "oid_utils.h"
+#include "sha256.h"
+
+// Objects are hashed SHA256_MAX_LANES at a time with sha256_update_multi,
+// a chunk of each per round. Opening an object is charged against the rate
+// like reading a few KB, so that a repo of small objects is throttled too.
+enum scrubber_config
+{
+	SCRUBBER_CHUNK_SIZE = 256 * 1024,
+	SCRUBBER_OBJECT_COST = 4096,
+	SCRUBBER_CHECKPOINT_SECONDS = 60,
+	SCRUBBER_MAX_SLEEP_MS = 3600 * 1000
+};
+
+#define SCRUB_STATE_MAGIC 0x73637262
+
+// <root>/tmp/scrub.state, replaced as a whole each time it is saved
+struct scrub_state
+{
+	uint32_t magic;
+	uint32_t in_progress;
+	int64_t pass_started;
+	int64_t pass_finished;
+	char last_oid[65]; // this pass got through every object up to this one
+};
+
+struct scrubber_shared
+{
+	size_t map_size;
+	int claimed; // set by the repo manager that runs the scrubber
+	int num_repos;
+	struct scrubber_stats repos[];
+};
+
+// what the thread needs of a repo, copied out of the config so that a
+// reload can free it while the repo is being scrubbed
+struct scrubber_repo
+{
+	uint32_t id;
+	char name[256];
+	char root_dir[PATH_MAX];
+};
+
+struct scrubber_lane
+{
+	int fd;
+	int index; // of the object in the directory listing
+	char oid_str[65];
+	uint8_t oid[32];
+	struct sha256_ctx ctx;
+};
+
+static struct scrubber_shared *scrubber_shared;
+
+static struct
+{
+	const struct git_lfs_config *config; // the repo manager's current one, under lock
+	int64_t rate; // of the config the current repo was taken from
+	int64_t interval;
+	os_thread_t thread;
+	os_mutex_t lock;
+	os_cond_t wakeup;
+	int stopping;
+	uint8_t *buffer; // a chunk for each lane
+	uint64_t budget_start_us;
+	uint64_t budget_bytes;
+} scrubber;
+
+int scrubber_create(const struct git_lfs_config *config)
+{
+	if(config->scrub_rate == 0)
+	{
+		return 0;
+	}
+	
+	int num_repos = 0;
+	const struct git_lfs_repo *repo;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		num_repos++;
+	}
+	
+	size_t map_size = sizeof(struct scrubber_shared) + num_repos * sizeof(struct scrubber_stats);
+	scrubber_shared = os_map_shared(map_size);
+	if(!scrubber_shared)
+	{
+		return -1;
+	}
+	
+	scrubber_shared->map_size = map_size;
+	scrubber_shared->num_repos = num_repos;
+	
+	int i = 0;
+	SLIST_FOREACH(repo, &config->repos, entries)
+	{
+		scrubber_shared->repos[i++].repo_id = repo->id;
+	}
+	
+	return 0;
+}
+
+void scrubber_free(void)
+{
+	if(!scrubber_shared) return;
+	
+	os_unmap(scrubber_shared, scrubber_shared->map_size);
+	scrubber_shared = NULL;
+}
+
+static struct scrubber_stats *scrubber_find_stats(uint32_t repo_id)
+{
+	for(int i = 0; i < scrubber_shared->num_repos; i++)
+	{
+		if(scrubber_shared->repos[i].repo_id == repo_id)
+		{
+			return &scrubber_shared->repos[i];
+		}
+	}
+	
+	return NULL;
+}
+
+static void scrubber_count(uint64_t *counter, uint64_t value)
+{
+	__atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+int scrubber_get_stats(uint32_t repo_id, struct scrubber_stats *stats)
+{
+	if(!scrubber_shared) return -1;
+	
+	const struct scrubber_stats *repo_stats = scrubber_find_stats(repo_id);
+	if(!repo_stats) return -1;
+	
+	stats->repo_id = repo_id;
+	stats->objects = __atomic_load_n(&repo_stats->objects, __ATOMIC_RELAXED);
+	stats->bytes = __atomic_load_n(&repo_stats->bytes, __ATOMIC_RELAXED);
+	stats->quarantined = __atomic_load_n(&repo_stats->quarantined, __ATOMIC_RELAXED);
+	stats->errors = __atomic_load_n(&repo_stats->errors, __ATOMIC_RELAXED);
+	stats->passes = __atomic_load_n(&repo_stats->passes, __ATOMIC_RELAXED);
+	stats->last_pass = __atomic_load_n(&repo_stats->last_pass, __ATOMIC_RELAXED);
+	
+	return 0;
+}
+
+// returns -1 once the scrubber is told to stop
+static int scrubber_sleep(uint64_t us)
+{
+	os_mutex_lock(scrubber.lock);
+	if(!scrubber.stopping && us > 0)
+	{
+		uint64_t ms = (us + 999) / 1000;
+		os_cond_timedwait(scrubber.wakeup, scrubber.lock, ms < SCRUBBER_MAX_SLEEP_MS ? ms : SCRUBBER_MAX_SLEEP_MS);
+	}
+	int stopping = scrubber.stopping;
+	os_mutex_unlock(scrubber.lock);
+	
+	return stopping ? -1 : 0;
+}
+
+// sleeps while the reads so far are ahead of scrub_rate. once it falls
+// more than a second behind, the budget starts over rather than letting the
+// scrubber catch up in a burst.
+static int scrubber_throttle(uint64_t bytes)
+{
+	uint64_t rate = scrubber.rate;
+	uint64_t now = os_clock_us();
+	uint64_t elapsed_us = now - scrubber.budget_start_us;
+	
+	scrubber.budget_bytes += bytes;
+	uint64_t due_us = scrubber.budget_bytes * 1000000 / rate;
+	uint64_t sleep_us = due_us > elapsed_us ? due_us - elapsed_us : 0;
+	
+	if(elapsed_us > due_us + 1000000)
+	{
+		scrubber.budget_start_us = now;
+		scrubber.budget_bytes = 0;
+	}
+	else if(scrubber.budget_bytes >= rate * 3600)
+	{
+		// an hour's worth at a time, so the byte count can't overflow
+		scrubber.budget_start_us += due_us;
+		scrubber.budget_bytes = 0;
+	}
+	
+	return scrubber_sleep(sleep_us);
+}
+
+static void scrubber_load_state(const char *path, struct scrub_state *state)
+{
+	int fd = os_open_read(path);
+	if(fd < 0 ||
+	   os_read(fd, state, sizeof(*state)) != sizeof(*state) ||
+	   state->magic != SCRUB_STATE_MAGIC ||
+	   state->last_oid[sizeof(state->last_oid) - 1] != 0)
+	{
+		memset(state, 0, sizeof(*state));
+	}
+	
+	if(fd >= 0)
+	{
+		os_close(fd);
+	}
+}
+
+// written to a tmp file and renamed over the old state, so a crash leaves
+// one or the other
+static void scrubber_save_state(const struct scrubber_repo *repo, const char *path, const struct scrub_state *state)
+{
+	char tmp_path[PATH_MAX];
+	if(snprintf(tmp_path, sizeof(tmp_path), "%s/tmp/XXXXXX", repo->root_dir) >= sizeof(tmp_path))
+	{
+		return;
+	}
+	
+	int fd = os_mkstemp(tmp_path);
+	if(fd < 0)
+	{
+		return;
+	}
+	
+	int written = os_write(fd, state, sizeof(*state)) == sizeof(*state);
+	os_close(fd);
+	
+	if(!written || os_rename(tmp_path, path) < 0)
+	{
+		fprintf(stderr, "Failed to save the scrub progress of repo '%s'.\n", repo->name);
+		os_unlink(tmp_path);
+	}
+}
+
+// a reload may have removed the repo or moved it to another root since it
+// was taken from the config
+static int scrubber_is_current(const struct scrubber_repo *repo)
+{
+	os_mutex_lock(scrubber.lock);
+	const struct git_lfs_repo *config_repo;
+	int current = 0;
+	SLIST_FOREACH(config_repo, &scrubber.config->repos, entries)
+	{
+		if(config_repo->id == repo->id)
+		{
+			current = 0 == strcmp(config_repo->root_dir, repo->root_dir);
+			break;
+		}
+	}
+	os_mutex_unlock(scrubber.lock);
+	
+	return current;
+}
+
+// copies the repo with the lowest id above after_id out of the current
+// config, and the rate and interval with it. returns -1 if there is none.
+static int scrubber_next_repo(int64_t after_id, struct scrubber_repo *repo)
+{
+	os_mutex_lock(scrubber.lock);
+	const struct git_lfs_repo *config_repo, *next = NULL;
+	SLIST_FOREACH(config_repo, &scrubber.config->repos, entries)
+	{
+		if(config_repo->id > after_id && (!next || config_repo->id < next->id))
+		{
+			next = config_repo;
+		}
+	}
+	
+	if(next)
+	{
+		repo->id = next->id;
+		strlcpy(repo->name, next->name, sizeof(repo->name));
+		if(strlcpy(repo->root_dir, next->root_dir, sizeof(repo->root_dir)) >= sizeof(repo->root_dir))
+		{
+			repo->root_dir[0] = 0;
+		}
+		scrubber.rate = scrubber.config->scrub_rate;
+		scrubber.interval = scrubber.config->scrub_interval;
+	}
+	os_mutex_unlock(scrubber.lock);
+	
+	return next ? 0 : -1;
+}
+
+static int scrubber_hash_file(const char *path, uint8_t hash[SHA256_HASH_SIZE])
+{
+	int fd = os_open_read(path);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	
+	struct sha256_ctx ctx;
+	sha256_init(&ctx);
+	
+	int n;
+	while((n = os_read(fd, scrubber.buffer, SCRUBBER_CHUNK_SIZE)) > 0)
+	{
+		sha256_update(&ctx, scrubber.buffer, n);
+	}
+	os_close(fd);
+	
+	if(n < 0)
+	{
+		return -1;
+	}
+	
+	sha256_final(&ctx, hash);
+	return 0;
+}
+
+// the object is moved away before it is hashed again, in case a good copy
+// was committed over it after it was opened. that copy is moved back.
+static void scrubber_quarantine(const struct scrubber_repo *repo, struct scrubber_stats *stats, const struct scrubber_lane *lane, const char *path)
+{
+	// nothing is moved out of a tree that is no longer the repo's
+	if(!scrubber_is_current(repo))
+	{
+		return;
+	}
+	
+	char dest_path[PATH_MAX];
+	if(snprintf(dest_path, sizeof(dest_path), "%s/quarantine", repo->root_dir) >= sizeof(dest_path) ||
+	   (!os_is_directory(dest_path) && os_mkdir(dest_path, 0700) < 0 && !os_is_directory(dest_path)) ||
+	   snprintf(dest_path, sizeof(dest_path), "%s/quarantine/%s", repo->root_dir, lane->oid_str) >= sizeof(dest_path) ||
+	   os_rename(path, dest_path) < 0)
+	{
+		fprintf(stderr, "Object %s of repo '%s' does not match its oid and could not be moved to quarantine.\n", lane->oid_str, repo->name);
+		scrubber_count(&stats->errors, 1);
+		return;
+	}
+	
+	uint8_t hash[SHA256_HASH_SIZE];
+	if(scrubber_hash_file(dest_path, hash) == 0 && memcmp(hash, lane->oid, sizeof(hash)) == 0)
+	{
+		os_rename(dest_path, path);
+		return;
+	}
+	
+	fprintf(stderr, "Object %s of repo '%s' does not match its oid. It was moved to %s.\n", lane->oid_str, repo->name, dest_path);
+	scrubber_count(&stats->quarantined, 1);
+}
+
+static void scrubber_finish_object(const struct scrubber_repo *repo, struct scrubber_stats *stats, struct scrubber_lane *lane, const char *path, int result)
+{
+	os_close(lane->fd);
+	
+	if(result < 0)
+	{
+		fprintf(stderr, "Failed to read object %s of repo '%s'.\n", lane->oid_str, repo->name);
+		scrubber_count(&stats->errors, 1);
+		return;
+	}
+	
+	uint8_t hash[SHA256_HASH_SIZE];
+	sha256_final(&lane->ctx, hash);
+	scrubber_count(&stats->objects, 1);
+	
+	if(memcmp(hash, lane->oid, sizeof(hash)) != 0)
+	{
+		scrubber_quarantine(repo, stats, lane, path);
+	}
+}
+
+// the listing is sorted, so every object before the first one still being
+// hashed is done
+static void scrubber_set_progress(struct scrub_state *state, const char **files, int root_len, int done)
+{
+	for(int i = done; i >= 0; i--)
+	{
+		if(strlen(files[i]) != root_len + 3 + 62) continue;
+		
+		char oid_str[65];
+		memcpy(oid_str, files[i] + root_len, 2);
+		memcpy(oid_str + 2, files[i] + root_len + 3, 63);
+		if(strcmp(oid_str, state->last_oid) > 0)
+		{
+			memcpy(state->last_oid, oid_str, sizeof(oid_str));
+		}
+		return;
+	}
+}
+
+// objects are stored as <root>/<aa>/<rest of oid>. returns -1 once the
+// scrubber is stopping, with the progress so far in the state.
+static int scrubber_scrub_dir(const struct scrubber_repo *repo, struct scrubber_stats *stats,
+							  const char *state_path, struct scrub_state *state, int dir)
+{
+	char pattern[PATH_MAX];
+	int root_len = snprintf(pattern, sizeof(pattern), "%s/", repo->root_dir);
+	if(root_len < 0 || root_len + 2 + 2 + 1 > sizeof(pattern))
+	{
+		return 0;
+	}
+	snprintf(pattern + root_len, sizeof(pattern) - root_len, "%02x/*", dir);
+	
+	int num_files;
+	const char **files = os_glob(pattern, &num_files);
+	if(!files)
+	{
+		return 0;
+	}
+	
+	struct scrubber_lane lanes[SHA256_MAX_LANES];
+	int num_lanes = 0;
+	int next = 0;
+	int ret = 0;
+	time_t last_checkpoint = time(NULL);
+	
+	for(;;)
+	{
+		// refill the lanes from the listing. this skips anything but
+		// <aa>/<62 hex digits>, and the objects of an earlier run.
+		while(num_lanes < SHA256_MAX_LANES && next < num_files)
+		{
+			int index = next++;
+			if(strlen(files[index]) != root_len + 3 + 62) continue;
+			
+			struct scrubber_lane *lane = &lanes[num_lanes];
+			memcpy(lane->oid_str, files[index] + root_len, 2);
+			memcpy(lane->oid_str + 2, files[index] + root_len + 3, 63);
+			if(oid_from_string(lane->oid_str, lane->oid) < 0 ||
+			   strcmp(lane->oid_str, state->last_oid) <= 0)
+			{
+				continue;
+			}
+			
+			lane->fd = os_open_read(files[index]);
+			if(lane->fd < 0)
+			{
+				// unless it was removed since the listing was made
+				if(os_file_exists(files[index]))
+				{
+					fprintf(stderr, "Failed to open object %s of repo '%s'.\n", lane->oid_str, repo->name);
+					scrubber_count(&stats->errors, 1);
+				}
+				continue;
+			}
+			
+			lane->index = index;
+			sha256_init(&lane->ctx);
+			num_lanes++;
+			
+			if(scrubber_throttle(SCRUBBER_OBJECT_COST) < 0)
+			{
+				ret = -1;
+				goto done;
+			}
+		}
+		
+		if(num_lanes == 0)
+		{
+			break;
+		}
+		
+		struct sha256_ctx *ctxs[SHA256_MAX_LANES];
+		const void *data[SHA256_MAX_LANES];
+		size_t sizes[SHA256_MAX_LANES];
+		int results[SHA256_MAX_LANES];
+		uint64_t total = 0;
+		for(int i = 0; i < num_lanes; i++)
+		{
+			uint8_t *chunk = scrubber.buffer + (size_t)i * SCRUBBER_CHUNK_SIZE;
+			results[i] = os_read(lanes[i].fd, chunk, SCRUBBER_CHUNK_SIZE);
+			ctxs[i] = &lanes[i].ctx;
+			data[i] = chunk;
+			sizes[i] = results[i] > 0 ? results[i] : 0;
+			total += sizes[i];
+		}
+		
+		sha256_update_multi(ctxs, data, sizes, num_lanes);
+		scrubber_count(&stats->bytes, total);
+		
+		// the last lane takes the place of a finished one, it was already
+		// looked at as the lanes are walked backwards
+		for(int i = num_lanes - 1; i >= 0; i--)
+		{
+			if(results[i] > 0) continue;
+			
+			scrubber_finish_object(repo, stats, &lanes[i], files[lanes[i].index], results[i]);
+			lanes[i] = lanes[--num_lanes];
+		}
+		
+		if(time(NULL) >= last_checkpoint + SCRUBBER_CHECKPOINT_SECONDS)
+		{
+			int first = next;
+			for(int i = 0; i < num_lanes; i++)
+			{
+				if(lanes[i].index < first) first = lanes[i].index;
+			}
+			
+			scrubber_set_progress(state, files, root_len, first - 1);
+			scrubber_save_state(repo, state_path, state);
+			last_checkpoint = time(NULL);
+		}
+		
+		if(scrubber_throttle(total) < 0)
+		{
+			ret = -1;
+			break;
+		}
+	}
+	
+done:
+	if(ret < 0)
+	{
+		int first = next;
+		for(int i = 0; i < num_lanes; i++)
+		{
+			if(lanes[i].index < first) first = lanes[i].index;
+			os_close(lanes[i].fd);
+		}
+		
+		scrubber_set_progress(state, files, root_len, first - 1);
+	}
+	
+	free(files);
+	return ret;
+}
+
+// returns when the next pass over the repo is due, or -1 once the scrubber
+// is stopping
+static int64_t scrubber_scrub_repo(const struct scrubber_repo *repo, struct scrubber_stats *stats)
+{
+	int64_t interval = scrubber.interval;
+	char tmp_dir[PATH_MAX];
+	char state_path[PATH_MAX];
+	if(snprintf(tmp_dir, sizeof(tmp_dir), "%s/tmp", repo->root_dir) >= sizeof(tmp_dir) ||
+	   snprintf(state_path, sizeof(state_path), "%s/scrub.state", tmp_dir) >= sizeof(state_path))
+	{
+		return time(NULL) + interval;
+	}
+	
+	// another repo manager may create it at the same time
+	if(!os_is_directory(tmp_dir) && os_mkdir(tmp_dir, 0700) < 0 && !os_is_directory(tmp_dir))
+	{
+		fprintf(stderr, "Failed to scrub repo '%s'. Repository root directory not accessible.\n", repo->name);
+		return time(NULL) + interval;
+	}
+	
+	struct scrub_state state;
+	scrubber_load_state(state_path, &state);
+	if(state.pass_finished > 0)
+	{
+		__atomic_store_n(&stats->last_pass, state.pass_finished, __ATOMIC_RELAXED);
+	}
+	
+	if(!state.in_progress)
+	{
+		int64_t now = time(NULL);
+		if(state.pass_finished > 0 && now < state.pass_started + interval)
+		{
+			return state.pass_started + interval;
+		}
+		
+		memset(&state, 0, sizeof(state));
+		state.magic = SCRUB_STATE_MAGIC;
+		state.in_progress = 1;
+		state.pass_started = now;
+		scrubber_save_state(repo, state_path, &state);
+	}
+	
+	unsigned int first_dir = 0;
+	if(state.last_oid[0])
+	{
+		sscanf(state.last_oid, "%2x", &first_dir);
+	}
+	
+	for(int dir = first_dir; dir < 256; dir++)
+	{
+		// the progress is left as it is, for when the repo comes back
+		if(!scrubber_is_current(repo))
+		{
+			return time(NULL);
+		}
+		
+		if(scrubber_scrub_dir(repo, stats, state_path, &state, dir) < 0)
+		{
+			scrubber_save_state(repo, state_path, &state);
+			return -1;
+		}
+		
+		// past every oid that starts with this directory
+		snprintf(state.last_oid, sizeof(state.last_oid), "%02x", dir);
+		memset(state.last_oid + 2, 'f', 62);
+		state.last_oid[64] = 0;
+		scrubber_save_state(repo, state_path, &state);
+	}
+	
+	state.in_progress = 0;
+	state.pass_finished = time(NULL);
+	memset(state.last_oid, 0, sizeof(state.last_oid));
+	scrubber_save_state(repo, state_path, &state);
+	
+	scrubber_count(&stats->passes, 1);
+	__atomic_store_n(&stats->last_pass, state.pass_finished, __ATOMIC_RELAXED);
+	
+	return state.pass_started + interval;
+}
+
+static void *scrubber_thread(void *data)
+{
+	if(os_thread_set_idle_priority() < 0)
+	{
+		fprintf(stderr, "warning: The scrubber runs at normal priority, only its rate is limited.\n");
+	}
+	
+	for(;;)
+	{
+		scrubber.budget_start_us = os_clock_us();
+		scrubber.budget_bytes = 0;
+		
+		int64_t next_pass = INT64_MAX;
+		struct scrubber_repo repo;
+		for(int64_t id = -1; scrubber_next_repo(id, &repo) == 0; id = repo.id)
+		{
+			// a reload may have turned it off
+			struct scrubber_stats *stats = scrubber_find_stats(repo.id);
+			if(!stats || scrubber.rate <= 0 || !repo.root_dir[0]) continue;
+			
+			int64_t due = scrubber_scrub_repo(&repo, stats);
+			if(due < 0)
+			{
+				return NULL;
+			}
+			
+			if(due < next_pass) next_pass = due;
+		}
+		
+		// at least a second, so that a zero interval doesn't spin on empty
+		// repos. long waits are cut short by the sleep and start over here.
+		int64_t wait = next_pass - time(NULL);
+		if(wait < 1) wait = 1;
+		if(wait > SCRUBBER_MAX_SLEEP_MS / 1000) wait = SCRUBBER_MAX_SLEEP_MS / 1000;
+		
+		if(scrubber_sleep(wait * 1000000) < 0)
+		{
+			return NULL;
+		}
+	}
+}
+
+int scrubber_start(const struct git_lfs_config *config)
+{
+	if(!scrubber_shared)
+	{
+		return 0;
+	}
+	
+	int expected = 0;
+	if(!__atomic_compare_exchange_n(&scrubber_shared->claimed, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		return 0;
+	}
+	
+	scrubber.buffer = malloc((size_t)SHA256_MAX_LANES * SCRUBBER_CHUNK_SIZE);
+	if(!scrubber.buffer)
+	{
+		goto error0;
+	}
+	
+	scrubber.lock = os_mutex_create();
+	if(!scrubber.lock)
+	{
+		goto error1;
+	}
+	
+	scrubber.wakeup = os_cond_create();
+	if(!scrubber.wakeup)
+	{
+		goto error2;
+	}
+	
+	scrubber.config = config;
+	scrubber.stopping = 0;
+	scrubber.thread = os_thread_create(scrubber_thread, NULL);
+	if(!scrubber.thread)
+	{
+		goto error3;
+	}
+	
+	return 0;
+	
+error3:
+	os_cond_destroy(scrubber.wakeup);
+	scrubber.wakeup = NULL;
+error2:
+	os_mutex_destroy(scrubber.lock);
+	scrubber.lock = NULL;
+error1:
+	free(scrubber.buffer);
+	scrubber.buffer = NULL;
+error0:
+	// leaves it to another repo manager
+	__atomic_store_n(&scrubber_shared->claimed, 0, __ATOMIC_RELEASE);
+	return -1;
+}
+
+void scrubber_set_config(const struct git_lfs_config *config)
+{
+	if(!scrubber.thread)
+	{
+		return;
+	}
+	
+	os_mutex_lock(scrubber.lock);
+	scrubber.config = config;
+	os_mutex_unlock(scrubber.lock);
+}
+
+void scrubber_stop(void)
+{
+	if(!scrubber.thread)
+	{
+		return;
+	}
+	
+	os_mutex_lock(scrubber.lock);
+	scrubber.stopping = 1;
+	os_cond_signal(scrubber.wakeup);
+	os_mutex_unlock(scrubber.lock);
+	
+	os_thread_join(scrubber.thread, NULL);
+	scrubber.thread = NULL;
+	
+	os_cond_destroy(scrubber.wakeup);
+	scrubber.wakeup = NULL;
+	os_mutex_destroy(scrubber.lock);
+	scrubber.lock = NULL;
+	free(scrubber.buffer);
+	scrubber.buffer = NULL;
+}
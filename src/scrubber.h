@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SCRUBBER_H
+#define SCRUBBER_H
+
+#include <stdint.h>
+
+// Re-hashes the stored objects of every repo in the background and moves
+// the ones that no longer match their oid to <root>/quarantine. It reads no
+// more than scrub_rate bytes per second at idle priority, and keeps its
+// progress in <root>/tmp/scrub.state so that a restart carries on with the
+// pass it was in.
+//
+// The counters are mapped before the repo managers are forked. The first
+// repo manager to start the scrubber runs it, and the http process reports
+// the counters in /metrics.
+
+struct git_lfs_config;
+
+struct scrubber_stats
+{
+	uint32_t repo_id;
+	uint64_t objects; // objects hashed
+	uint64_t bytes; // bytes read
+	uint64_t quarantined; // objects moved to quarantine
+	uint64_t errors; // objects that could not be read or moved
+	uint64_t passes; // passes over all objects of the repo
+	uint64_t last_pass; // unix time the last pass finished, 0 if none did
+};
+
+// does nothing unless scrub_rate is set
+int scrubber_create(const struct git_lfs_config *config);
+void scrubber_free(void);
+
+int scrubber_start(const struct git_lfs_config *config);
+void scrubber_stop(void);
+
+// switches to a reloaded config before the old one is freed. repos it
+// removed or moved are no longer scrubbed, the ones it added are scrubbed
+// after the next restart.
+void scrubber_set_config(const struct git_lfs_config *config);
+
+// returns -1 if the repo isn't scrubbed
+int scrubber_get_stats(uint32_t repo_id, struct scrubber_stats *stats);
+
+#endif
@@ -0,0 +1,502 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "sha256.h"
+#include <string.h>
+#include "cpu_dispatch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_X86
+#include <immintrin.h>
+#endif
+
+static const uint32_t sha256_initial_state[8] =
+{
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint32_t sha256_k[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#ifdef SHA256_X86
+static int sha256_shani_supported(void)
+{
+	return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+}
+
+// the state is kept as ABEF and CDGH, the order sha256rnds2 works on
+__attribute__((target("sha,sse4.1")))
+static void sha256_shani_compress(uint32_t *states[], const uint8_t *data[], size_t num_blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	const uint8_t *p = data[0];
+	
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&states[0][0]), 0xB1);
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&states[0][4]), 0x1B);
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+	
+	for(; num_blocks > 0; num_blocks--, p += SHA256_BLOCK_SIZE) {
+		__m128i abef = state0;
+		__m128i cdgh = state1;
+		__m128i w[4];
+		
+		for(int i = 0; i < 4; i++) {
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + i * 16)), bswap);
+		}
+		
+		// four rounds at a time, w[i & 3] is replaced by the next four words
+#pragma GCC unroll 16
+		for(int i = 0; i < 16; i++) {
+			if(i >= 4) {
+				__m128i x = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+				x = _mm_add_epi32(x, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+				w[i & 3] = _mm_sha256msg2_epu32(x, w[(i + 3) & 3]);
+			}
+			
+			__m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&sha256_k[i * 4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+		}
+		
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+	
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *)&states[0][0], state0);
+	_mm_storeu_si128((__m128i *)&states[0][4], state1);
+}
+
+static int sha256_avx2_supported(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+#define AVX2_ROR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+// w[i] gets word i of the 8 lanes, the data is 8 words of each lane
+__attribute__((target("avx2")))
+static void sha256_avx2_load_words(const uint8_t *data[], size_t offset, __m256i w[8])
+{
+	const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+										   3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i r[8], t[8];
+	for(int i = 0; i < 8; i++) {
+		r[i] = _mm256_loadu_si256((const __m256i *)(data[i] + offset));
+	}
+	
+	for(int i = 0; i < 8; i += 4) {
+		__m256i lo01 = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		__m256i hi01 = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+		__m256i lo23 = _mm256_unpacklo_epi32(r[i + 2], r[i + 3]);
+		__m256i hi23 = _mm256_unpackhi_epi32(r[i + 2], r[i + 3]);
+		t[i] = _mm256_unpacklo_epi64(lo01, lo23);
+		t[i + 1] = _mm256_unpackhi_epi64(lo01, lo23);
+		t[i + 2] = _mm256_unpacklo_epi64(hi01, hi23);
+		t[i + 3] = _mm256_unpackhi_epi64(hi01, hi23);
+	}
+	
+	for(int i = 0; i < 4; i++) {
+		w[i] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(t[i], t[i + 4], 0x20), bswap);
+		w[i + 4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(t[i], t[i + 4], 0x31), bswap);
+	}
+}
+
+// eight streams at once, each 32 bit lane of a register belongs to one
+__attribute__((target("avx2")))
+static void sha256_avx2_compress(uint32_t *states[], const uint8_t *data[], size_t num_blocks)
+{
+	__m256i s[8];
+	for(int j = 0; j < 8; j++) {
+		s[j] = _mm256_setr_epi32(states[0][j], states[1][j], states[2][j], states[3][j],
+								 states[4][j], states[5][j], states[6][j], states[7][j]);
+	}
+	
+	for(size_t n = 0; n < num_blocks; n++) {
+		__m256i w[16];
+		sha256_avx2_load_words(data, n * SHA256_BLOCK_SIZE, w);
+		sha256_avx2_load_words(data, n * SHA256_BLOCK_SIZE + 32, w + 8);
+		
+		__m256i a = s[0], b = s[1], c = s[2], d = s[3];
+		__m256i e = s[4], f = s[5], g = s[6], h = s[7];
+		
+		// unrolled so that the indexes into w are constants
+#pragma GCC unroll 16
+		for(int t = 0; t < 64; t++) {
+			if(t >= 16) {
+				__m256i w15 = w[(t - 15) & 15];
+				__m256i w2 = w[(t - 2) & 15];
+				__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(w15, 7), AVX2_ROR(w15, 18)), _mm256_srli_epi32(w15, 3));
+				__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(w2, 17), AVX2_ROR(w2, 19)), _mm256_srli_epi32(w2, 10));
+				w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+			}
+			
+			__m256i sum1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(e, 6), AVX2_ROR(e, 11)), AVX2_ROR(e, 25));
+			__m256i ch = _mm256_xor_si256(_mm256_and_si256(_mm256_xor_si256(f, g), e), g);
+			__m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sum1), _mm256_add_epi32(ch, w[t & 15]));
+			t1 = _mm256_add_epi32(t1, _mm256_set1_epi32(sha256_k[t]));
+			
+			__m256i sum0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROR(a, 2), AVX2_ROR(a, 13)), AVX2_ROR(a, 22));
+			__m256i maj = _mm256_xor_si256(_mm256_and_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(b, c)), b);
+			
+			h = g;
+			g = f;
+			f = e;
+			e = _mm256_add_epi32(d, t1);
+			d = c;
+			c = b;
+			b = a;
+			a = _mm256_add_epi32(t1, _mm256_add_epi32(sum0, maj));
+		}
+		
+		s[0] = _mm256_add_epi32(s[0], a);
+		s[1] = _mm256_add_epi32(s[1], b);
+		s[2] = _mm256_add_epi32(s[2], c);
+		s[3] = _mm256_add_epi32(s[3], d);
+		s[4] = _mm256_add_epi32(s[4], e);
+		s[5] = _mm256_add_epi32(s[5], f);
+		s[6] = _mm256_add_epi32(s[6], g);
+		s[7] = _mm256_add_epi32(s[7], h);
+	}
+	
+	for(int j = 0; j < 8; j++) {
+		uint32_t lanes[8];
+		_mm256_storeu_si256((__m256i *)lanes, s[j]);
+		for(int i = 0; i < 8; i++) {
+			states[i][j] = lanes[i];
+		}
+	}
+}
+
+static int sha256_avx_bmi2_supported(void)
+{
+	return __builtin_cpu_supports("avx") && __builtin_cpu_supports("bmi2");
+}
+
+#define SSE_ROR(x, n) _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+#define SSE_SIGMA0(x) _mm_xor_si128(_mm_xor_si128(SSE_ROR(x, 7), SSE_ROR(x, 18)), _mm_srli_epi32(x, 3))
+#define SSE_SIGMA1(x) _mm_xor_si128(_mm_xor_si128(SSE_ROR(x, 17), SSE_ROR(x, 19)), _mm_srli_epi32(x, 10))
+#define BMI2_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// one stream, for cpus without sha-ni. the message schedule is computed four
+// words at a time alongside the rounds, which stay scalar but compile to
+// rorx and andn.
+__attribute__((target("avx,bmi2")))
+static void sha256_avx_bmi2_compress(uint32_t *states[], const uint8_t *data[], size_t num_blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	const __m128i low = _mm_set_epi32(0, 0, -1, -1);
+	uint32_t *state = states[0];
+	const uint8_t *p = data[0];
+	
+	for(; num_blocks > 0; num_blocks--, p += SHA256_BLOCK_SIZE) {
+		uint32_t wk[64];
+		__m128i w[4];
+		
+		for(int i = 0; i < 4; i++) {
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + i * 16)), bswap);
+			_mm_storeu_si128((__m128i *)&wk[i * 4], _mm_add_epi32(w[i], _mm_loadu_si128((const __m128i *)&sha256_k[i * 4])));
+		}
+		
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+		
+		// unrolled so the variables rotate by renaming instead of moves
+#pragma GCC unroll 64
+		for(int i = 0; i < 64; i++) {
+			// w[j & 3] is replaced by the next four words. the last two of
+			// them depend on the first two, so sigma1 is added in two halves.
+			int j = i / 4 + 4;
+			if((i & 3) == 0 && j < 16) {
+				__m128i w0 = w[j & 3], w1 = w[(j + 1) & 3], w2 = w[(j + 2) & 3], w3 = w[(j + 3) & 3];
+				__m128i x = _mm_add_epi32(_mm_add_epi32(w0, SSE_SIGMA0(_mm_alignr_epi8(w1, w0, 4))), _mm_alignr_epi8(w3, w2, 4));
+				x = _mm_add_epi32(x, _mm_and_si128(SSE_SIGMA1(_mm_shuffle_epi32(w3, 0xEE)), low));
+				x = _mm_add_epi32(x, _mm_andnot_si128(low, SSE_SIGMA1(_mm_shuffle_epi32(x, 0x44))));
+				w[j & 3] = x;
+				_mm_storeu_si128((__m128i *)&wk[j * 4], _mm_add_epi32(x, _mm_loadu_si128((const __m128i *)&sha256_k[j * 4])));
+			}
+			
+			uint32_t t1 = h + (BMI2_ROR(e, 6) ^ BMI2_ROR(e, 11) ^ BMI2_ROR(e, 25)) + ((e & f) ^ (~e & g)) + wk[i];
+			uint32_t t2 = (BMI2_ROR(a, 2) ^ BMI2_ROR(a, 13) ^ BMI2_ROR(a, 22)) + (((a ^ b) & (b ^ c)) ^ b);
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+#endif
+
+// plain C, runs everywhere and is the reference for the others
+static int sha256_scalar_supported(void)
+{
+	return 1;
+}
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_scalar_compress(uint32_t *states[], const uint8_t *data[], size_t num_blocks)
+{
+	uint32_t *state = states[0];
+	const uint8_t *p = data[0];
+	
+	for(; num_blocks > 0; num_blocks--, p += SHA256_BLOCK_SIZE) {
+		uint32_t w[64];
+		for(int i = 0; i < 16; i++) {
+			w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) |
+				   ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+		}
+		for(int i = 16; i < 64; i++) {
+			uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+		
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+		
+		for(int i = 0; i < 64; i++) {
+			uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+static const struct sha256_engine sha256_engines[] =
+{
+#ifdef SHA256_X86
+	{ "sha-ni", sha256_shani_supported, 1, sha256_shani_compress },
+	{ "avx2", sha256_avx2_supported, 8, sha256_avx2_compress },
+	{ "avx-bmi2", sha256_avx_bmi2_supported, 1, sha256_avx_bmi2_compress },
+#endif
+	{ "scalar", sha256_scalar_supported, 1, sha256_scalar_compress }
+};
+
+static const void *single_engine;
+static const void *multi_engine;
+
+static int engine_usable(const void *impl, int max_lanes)
+{
+	const struct sha256_engine *engine = impl;
+	return engine->lanes <= max_lanes && engine->supported();
+}
+
+static const struct sha256_engine *pick_engine(const void **engine, int max_lanes)
+{
+	return cpu_dispatch_pick(engine, sha256_engines, sizeof(sha256_engines) / sizeof(sha256_engines[0]),
+							 sizeof(sha256_engines[0]), engine_usable, max_lanes);
+}
+
+const struct sha256_engine *sha256_get_engines(int *count)
+{
+	*count = sizeof(sha256_engines) / sizeof(sha256_engines[0]);
+	return sha256_engines;
+}
+
+const struct sha256_engine *sha256_get_engine(void)
+{
+	return pick_engine(&single_engine, 1);
+}
+
+const struct sha256_engine *sha256_get_multi_engine(void)
+{
+	return pick_engine(&multi_engine, SHA256_MAX_LANES);
+}
+
+static void sha256_compress(uint32_t state[8], const uint8_t *data, size_t num_blocks)
+{
+	uint32_t *states[1] = { state };
+	const uint8_t *blocks[1] = { data };
+	sha256_get_engine()->compress(states, blocks, num_blocks);
+}
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+	memcpy(ctx->state, sha256_initial_state, sizeof(ctx->state));
+	ctx->length = 0;
+}
+
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	size_t used = ctx->length % SHA256_BLOCK_SIZE;
+	ctx->length += size;
+	
+	if(used > 0) {
+		size_t n = SHA256_BLOCK_SIZE - used < size ? SHA256_BLOCK_SIZE - used : size;
+		memcpy(ctx->block + used, p, n);
+		p += n;
+		size -= n;
+		
+		if(used + n < SHA256_BLOCK_SIZE) return;
+		sha256_compress(ctx->state, ctx->block, 1);
+	}
+	
+	size_t num_blocks = size / SHA256_BLOCK_SIZE;
+	if(num_blocks > 0) {
+		sha256_compress(ctx->state, p, num_blocks);
+		p += num_blocks * SHA256_BLOCK_SIZE;
+		size -= num_blocks * SHA256_BLOCK_SIZE;
+	}
+	
+	memcpy(ctx->block, p, size);
+}
+
+void sha256_final(struct sha256_ctx *ctx, uint8_t hash[SHA256_HASH_SIZE])
+{
+	size_t used = ctx->length % SHA256_BLOCK_SIZE;
+	uint64_t bits = ctx->length * 8;
+	
+	ctx->block[used++] = 0x80;
+	if(used > SHA256_BLOCK_SIZE - 8) {
+		memset(ctx->block + used, 0, SHA256_BLOCK_SIZE - used);
+		sha256_compress(ctx->state, ctx->block, 1);
+		used = 0;
+	}
+	memset(ctx->block + used, 0, SHA256_BLOCK_SIZE - 8 - used);
+	
+	for(int i = 0; i < 8; i++) {
+		ctx->block[SHA256_BLOCK_SIZE - 1 - i] = bits >> (i * 8);
+	}
+	sha256_compress(ctx->state, ctx->block, 1);
+	
+	for(int i = 0; i < 8; i++) {
+		hash[i * 4] = ctx->state[i] >> 24;
+		hash[i * 4 + 1] = ctx->state[i] >> 16;
+		hash[i * 4 + 2] = ctx->state[i] >> 8;
+		hash[i * 4 + 3] = ctx->state[i];
+	}
+}
+
+void sha256_update_multi(struct sha256_ctx *ctxs[], const void *data[], const size_t sizes[], int count)
+{
+	const struct sha256_engine *engine = sha256_get_multi_engine();
+	if(engine->lanes == 1) {
+		for(int i = 0; i < count; i++) {
+			sha256_update(ctxs[i], data[i], sizes[i]);
+		}
+		return;
+	}
+	
+	// finish the partial blocks first so that every stream continues on a
+	// block boundary, the whole blocks are then all compressed in place
+	const uint8_t *p[SHA256_MAX_LANES];
+	size_t num_blocks[SHA256_MAX_LANES];
+	size_t tail[SHA256_MAX_LANES];
+	for(int i = 0; i < count; i++) {
+		size_t used = ctxs[i]->length % SHA256_BLOCK_SIZE;
+		size_t head = 0;
+		if(used > 0) {
+			head = SHA256_BLOCK_SIZE - used < sizes[i] ? SHA256_BLOCK_SIZE - used : sizes[i];
+			sha256_update(ctxs[i], data[i], head);
+		}
+		
+		p[i] = (const uint8_t *)data[i] + head;
+		num_blocks[i] = (sizes[i] - head) / SHA256_BLOCK_SIZE;
+		tail[i] = (sizes[i] - head) % SHA256_BLOCK_SIZE;
+		ctxs[i]->length += num_blocks[i] * SHA256_BLOCK_SIZE;
+	}
+	
+	// streams share the lanes until they run out of blocks, lanes without a
+	// stream hash a copy of another one into a scratch state. below half the
+	// lanes a single buffer engine is faster.
+	for(;;) {
+		uint32_t scratch[SHA256_MAX_LANES][8];
+		uint32_t *states[SHA256_MAX_LANES];
+		const uint8_t *blocks[SHA256_MAX_LANES];
+		int active[SHA256_MAX_LANES];
+		int num_active = 0;
+		size_t n = 0;
+		
+		for(int i = 0; i < count && num_active < engine->lanes; i++) {
+			if(num_blocks[i] == 0) continue;
+			if(num_active == 0 || num_blocks[i] < n) n = num_blocks[i];
+			active[num_active++] = i;
+		}
+		
+		if(num_active * 2 < engine->lanes) break;
+		
+		for(int lane = 0; lane < engine->lanes; lane++) {
+			if(lane < num_active) {
+				states[lane] = ctxs[active[lane]]->state;
+				blocks[lane] = p[active[lane]];
+			} else {
+				memcpy(scratch[lane], states[0], sizeof(scratch[lane]));
+				states[lane] = scratch[lane];
+				blocks[lane] = p[active[0]];
+			}
+		}
+		
+		engine->compress(states, blocks, n);
+		
+		for(int lane = 0; lane < num_active; lane++) {
+			p[active[lane]] += n * SHA256_BLOCK_SIZE;
+			num_blocks[active[lane]] -= n;
+		}
+	}
+	
+	for(int i = 0; i < count; i++) {
+		if(num_blocks[i] > 0) {
+			sha256_compress(ctxs[i]->state, p[i], num_blocks[i]);
+			p[i] += num_blocks[i] * SHA256_BLOCK_SIZE;
+		}
+		memcpy(ctxs[i]->block, p[i], tail[i]);
+		ctxs[i]->length += tail[i];
+	}
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_HASH_SIZE 32
+#define SHA256_MAX_LANES 8
+
+struct sha256_ctx
+{
+	uint32_t state[8];
+	uint64_t length;
+	uint8_t block[SHA256_BLOCK_SIZE];
+};
+
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t size);
+void sha256_final(struct sha256_ctx *ctx, uint8_t hash[SHA256_HASH_SIZE]);
+
+// adds data to up to SHA256_MAX_LANES independent streams. with a
+// multi-buffer engine their blocks are compressed side by side, one stream
+// per lane, otherwise this is the same as calling sha256_update on each.
+void sha256_update_multi(struct sha256_ctx *ctxs[], const void *data[], const size_t sizes[], int count);
+
+// an engine compresses num_blocks consecutive blocks of each of its lanes.
+// single buffer engines have one lane.
+struct sha256_engine
+{
+	const char *name;
+	int (*supported)(void);
+	int lanes;
+	void (*compress)(uint32_t *states[], const uint8_t *data[], size_t num_blocks);
+};
+
+// all engines built in, fastest first, for benchmarks
+const struct sha256_engine *sha256_get_engines(int *count);
+
+// the engines picked on first use for sha256_update and sha256_update_multi
+const struct sha256_engine *sha256_get_engine(void);
+const struct sha256_engine *sha256_get_multi_engine(void);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2017 Sound <sound@sagaforce.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "socket_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static int socket_io_wrapper_read(void *context, void *buffer, int n)
+{
+	struct socket_io_wrapper *wrapper = (struct socket_io_wrapper *)context;
+	return wrapper->inner->read(wrapper->inner->context, buffer, n);
+}
+
+static int socket_io_wrapper_write(void *context, const void *buffer, int n)
+{
+	struct socket_io_wrapper *wrapper = (struct socket_io_wrapper *)context;
+	return wrapper->inner->write(wrapper->inner->context, buffer, n);
+}
+
+static void socket_io_wrapper_write_http_status(void *context, int code, const char *message)
+{
+	struct socket_io_wrapper *wrapper = (struct socket_io_wrapper *)context;
+	wrapper->inner->write_http_status(wrapper->inner->context, code, message);
+}
+
+static void socket_io_wrapper_write_headers(void *context, const char * const *headers, int num_headers)
+{
+	struct socket_io_wrapper *wrapper = (struct socket_io_wrapper *)context;
+	wrapper->inner->write_headers(wrapper->inner->context, headers, num_headers);
+}
+
+// the format can't be handed on, so it is formatted here and written
+static int socket_io_wrapper_printf(void *context, const char *format, ...)
+{
+	struct socket_io_wrapper *wrapper = (struct socket_io_wrapper *)context;
+	char buffer[1024];
+	char *str = buffer;
+	va_list va;
+	
+	va_start(va, format);
+	int n = vsnprintf(buffer, sizeof(buffer), format, va);
+	va_end(va);
+	
+	if(n < 0) return n;
+	
+	if(n >= sizeof(buffer))
+	{
+		str = malloc(n + 1);
+		if(!str) return -1;
+		
+		va_start(va, format);
+		vsnprintf(str, n + 1, format, va);
+		va_end(va);
+	}
+	
+	int ret = wrapper->io.write(context, str, n);
+	
+	if(str != buffer) free(str);
+	return ret;
+}
+
+static void socket_io_wrapper_flush(void *context)
+{
+	struct socket_io_wrapper *wrapper = (struct socket_io_wrapper *)context;
+	wrapper->inner->flush(wrapper->inner->context);
+}
+
+static const char *socket_io_wrapper_get_header(void *context, const char *name)
+{
+	struct socket_io_wrapper *wrapper = (struct socket_io_wrapper *)context;
+	return wrapper->inner->get_header(wrapper->inner->context, name);
+}
+
+static long socket_io_wrapper_send_file(void *context, int fd, long offset, long size)
+{
+	struct socket_io_wrapper *wrapper = (struct socket_io_wrapper *)context;
+	return wrapper->inner->send_file(wrapper->inner->context, fd, offset, size);
+}
+
+void socket_io_wrapper_init(struct socket_io_wrapper *wrapper, const struct socket_io *inner)
+{
+	wrapper->inner = inner;
+	wrapper->io.context = wrapper;
+	wrapper->io.read = socket_io_wrapper_read;
+	wrapper->io.write = socket_io_wrapper_write;
+	wrapper->io.write_http_status = socket_io_wrapper_write_http_status;
+	wrapper->io.write_headers = socket_io_wrapper_write_headers;
+	wrapper->io.printf = socket_io_wrapper_printf;
+	wrapper->io.flush = socket_io_wrapper_flush;
+	wrapper->io.get_header = socket_io_wrapper_get_header;
+	wrapper->io.send_file = inner->send_file ? socket_io_wrapper_send_file : NULL;
+}
@@ -28,6 +28,23 @@ struct socket_io
 	void (*write_headers)(void *context, const char * const *headers, int num_headers);
 	int (*printf)(void *context, const char *format, ...);
 	void (*flush)(void *context);
+	// returns the value of a request header, or NULL if it was not sent
+	const char *(*get_header)(void *context, const char *name);
+	// optional, sends size bytes of fd starting at offset without copying
+	// through a buffer. returns the number of bytes sent, or -1 if nothing
+	// could be sent and the caller should fall back to write()
+	long (*send_file)(void *context, int fd, long offset, long size);
 };
 
+// passes every call on to inner. a layer puts this first in its own struct
+// and replaces the hooks it wants to see, the context is the layer itself.
+// printf formats and goes through io.write, so it sees what write sees.
+struct socket_io_wrapper
+{
+	struct socket_io io;
+	const struct socket_io *inner;
+};
+
+void socket_io_wrapper_init(struct socket_io_wrapper *wrapper, const struct socket_io *inner);
+
 #endif